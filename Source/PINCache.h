@@ -4,15 +4,46 @@
 
 #import <Foundation/Foundation.h>
 
+#import <PINOperation/PINOperationTypes.h>
+
 #import <PINCache/PINCacheMacros.h>
+#import <PINCache/PINCacheCancellationToken.h>
 #import <PINCache/PINCaching.h>
 #import <PINCache/PINDiskCache.h>
 #import <PINCache/PINMemoryCache.h>
+#import <PINCache/PINMemoryPressureMonitor.h>
+#import <PINCache/PINCacheStatistics.h>
+#import <PINCache/PINTieredCache.h>
+#import <PINCache/PINCacheBinaryCoding.h>
 
 NS_ASSUME_NONNULL_BEGIN
 
 @class PINCache;
 
+/**
+ A callback block used by <[PINCache prefetchObjectsForKeys:priority:completion:]>.
+ 
+ @param cache The cache that performed the prefetch.
+ @param objects The objects that were found, in memory or on disk, keyed by their keys. Keys that were not found are absent.
+ */
+typedef void (^PINCachePrefetchBlock)(PINCache *cache, NSDictionary<NSString *, id> *objects);
+
+/**
+ Passed to a <PINCacheLoaderBlock>, which must call it exactly once, from any thread.
+
+ @param object The loaded object, or nil if it couldn't be loaded.
+ */
+typedef void (^PINCacheLoaderCompletionBlock)(id _Nullable object);
+
+/**
+ A block used by <[PINCache objectForKeyAsync:loader:completion:]> to produce an object the cache doesn't have, for
+ example by fetching it from the network. It is called from the cache's operation queue and should not block it; long
+ work belongs on another queue, calling completion when done.
+
+ @param key The key of the object to load.
+ @param completion The block to call with the loaded object.
+ */
+typedef void (^PINCacheLoaderBlock)(NSString *key, PINCacheLoaderCompletionBlock completion);
 
 /**
  `PINCache` is a thread safe key/value store designed for persisting temporary objects that are expensive to
@@ -43,10 +74,117 @@ PIN_SUBCLASSING_RESTRICTED
 @property (readonly) NSUInteger diskByteCount;
 
 /**
- Sets/gets the maximum number of concurrent operations when handling async requests.
+ Sets/gets the maximum number of concurrent disk operations when handling async requests. These run on their own lane,
+ apart from memory work and from maintenance such as trims, so they never wait behind either, and memory hits never
+ wait behind them. While
+ <adaptsConcurrencyToDiskLatency> is on, fewer may run when disk latency shows the device is saturated. Defaults to `10`.
  */
 @property (nonatomic) NSUInteger maxConcurrentOperations;
 
+/**
+ Whether the number of concurrent async requests follows disk read latency, between `2` and <maxConcurrentOperations>.
+ It drops by a quarter when reads take twice as long as recently seen at best, and grows back by one while they stay
+ close to it. Defaults to `YES`.
+ */
+@property (assign) BOOL adaptsConcurrencyToDiskLatency;
+
+/**
+ The number of concurrent async requests currently allowed. See <adaptsConcurrencyToDiskLatency>.
+ */
+@property (readonly) NSUInteger concurrentOperations;
+
+/**
+ The maximum number of concurrent asynchronous memory operations: those of the <memoryCache>, and the memory halves
+ and memory hit callbacks of the cache's own async requests, which are CPU bound. Defaults to the number of active
+ processors.
+ */
+@property (assign) NSUInteger maxConcurrentMemoryOperations;
+
+/**
+ The maximum number of concurrent maintenance operations: trims, scrubbing, write-back flushes, and the file date and
+ access count updates that follow disk reads. Defaults to `2`.
+ */
+@property (assign) NSUInteger maxConcurrentMaintenanceOperations;
+
+/**
+ The maximum number of disk reads a single call to <prefetchObjectsForKeys:priority:completion:> keeps in flight.
+ Reads also count against <maxConcurrentOperations>. Defaults to `4`.
+ */
+@property (assign) NSUInteger prefetchIODepth;
+
+/**
+ The byte budget of an optional tier between the <memoryCache> and the <diskCache> that holds objects in serialized
+ form, LZ4 compressed where that helps. Objects the memory cache evicts to stay within its cost limit are serialized
+ into this tier with the disk cache's <[PINDiskCache serializer]>, asynchronously on the memory lane, so <serializedMemoryByteCount>
+ lags evictions. A hit here costs a decompress and a deserialize but no disk I/O, and moves the object back into the
+ memory cache. Objects evicted from this tier are still on disk.
+ 
+ TTL caches don't support the tier, since the per-object age limits of their memory cache would be lost, and setting a
+ limit on one asserts. Defaults to `0`, which disables the tier.
+ */
+@property (assign) NSUInteger serializedMemoryByteLimit;
+
+/**
+ Whether the serialized tier compresses objects. See <serializedMemoryByteLimit>. Defaults to `YES`.
+ */
+@property (assign) BOOL compressesSerializedMemory;
+
+/**
+ The number of bytes held by the serialized tier. See <serializedMemoryByteLimit>.
+ */
+@property (readonly) NSUInteger serializedMemoryByteCount;
+
+/**
+ Whether sets complete once the object is in memory, leaving the disk write for later. Pending objects are written to
+ the <diskCache> in batches, at the latest <maxWriteBackDelay> seconds after they were set, as soon as
+ <maxPendingWriteBackObjects> are pending, when the memory cache evicts one of them, on <flush>, when the app enters the
+ background or terminates, and when the cache is deallocated. Pending objects are still found by reads. A crash loses at
+ most the pending objects. Turning it off writes everything pending. Defaults to `NO`.
+ */
+@property (assign) BOOL writesBack;
+
+/**
+ The most objects that may be waiting to be written to disk in write-back mode. A set that reaches it writes the
+ pending objects before returning. Defaults to `1000`.
+ */
+@property (assign) NSUInteger maxPendingWriteBackObjects;
+
+/**
+ The longest, in seconds, an object may wait to be written to disk in write-back mode. Defaults to `1.0`.
+ */
+@property (assign) NSTimeInterval maxWriteBackDelay;
+
+/**
+ The number of objects waiting to be written to disk in write-back mode.
+ */
+@property (readonly) NSUInteger pendingWriteBackCount;
+
+/**
+ How long, in seconds, a key found in no tier is remembered as missing, so that repeated lookups of it are answered
+ without searching the tiers. Only misses and writes made through this cache are seen; objects written directly to the
+ <memoryCache> or <diskCache> may be reported missing until the miss expires. `0` disables it. Defaults to `0`.
+ */
+@property (assign) NSTimeInterval negativeCacheAgeLimit;
+
+/**
+ The most keys remembered as missing. The oldest are forgotten first. See <negativeCacheAgeLimit>. Defaults to `1024`.
+ */
+@property (assign) NSUInteger negativeCacheCountLimit;
+
+/**
+ How old, in seconds, an object read by <objectForKeyAsync:loader:completion:> may be before it is refreshed. A stale
+ object is still returned straight away, and a single background load replaces it. Age is measured from when the object
+ was written to the <diskCache>; objects the disk cache doesn't know about yet are considered fresh. Unlike the hard
+ <[PINDiskCache ageLimit]> of a TTL cache, nothing is removed. `0` disables refreshing. Defaults to `0`.
+ */
+@property (assign) NSTimeInterval softAgeLimit;
+
+/**
+ The most loaders <objectForKeyAsync:loader:completion:> runs at once, across all keys. Further loads wait their turn.
+ `0` means no limit. Defaults to `4`.
+ */
+@property (assign) NSUInteger maxConcurrentLoads;
+
 /**
  The underlying disk cache, see <PINDiskCache> for additional configuration and trimming options.
  */
@@ -93,14 +231,14 @@ PIN_SUBCLASSING_RESTRICTED
 /**
  Multiple instances with the same name are *not* allowed and can *not* safely
  access the same data on disk.. Also used to create the <diskCache>.
- Initializer allows you to override default NSKeyedArchiver/NSKeyedUnarchiver serialization for <diskCache>.
+ Initializer allows you to override the default serialization for <diskCache>.
  You must provide both serializer and deserializer, or opt-out to default implementation providing nil values.
  
  @see name
  @param name The name of the cache.
  @param rootPath The path of the cache on disk.
- @param serializer   A block used to serialize object before writing to disk. If nil provided, default NSKeyedArchiver serialized will be used.
- @param deserializer A block used to deserialize object read from disk. If nil provided, default NSKeyedUnarchiver serialized will be used.
+ @param serializer   A block used to serialize object before writing to disk. If nil provided, the default serializer will be used.
+ @param deserializer A block used to deserialize object read from disk. If nil provided, the default deserializer will be used.
  @result A new cache with the specified name.
  */
 - (instancetype)initWithName:(NSString *)name
@@ -111,14 +249,14 @@ PIN_SUBCLASSING_RESTRICTED
 /**
  Multiple instances with the same name are *not* allowed and can *not* safely
  access the same data on disk. Also used to create the <diskCache>.
- Initializer allows you to override default NSKeyedArchiver/NSKeyedUnarchiver serialization for <diskCache>.
+ Initializer allows you to override the default serialization for <diskCache>.
  You must provide both serializer and deserializer, or opt-out to default implementation providing nil values.
 
  @see name
  @param name The name of the cache.
  @param rootPath The path of the cache on disk.
- @param serializer   A block used to serialize object before writing to disk. If nil provided, default NSKeyedArchiver serialized will be used.
- @param deserializer A block used to deserialize object read from disk. If nil provided, default NSKeyedUnarchiver serialized will be used.
+ @param serializer   A block used to serialize object before writing to disk. If nil provided, the default serializer will be used.
+ @param deserializer A block used to deserialize object read from disk. If nil provided, the default deserializer will be used.
  @param keyEncoder A block used to encode key(filename). If nil provided, default url encoder will be used
  @param keyDecoder A block used to decode key(filename). If nil provided, default url decoder will be used
  @result A new cache with the specified name.
@@ -133,14 +271,14 @@ PIN_SUBCLASSING_RESTRICTED
 /**
  Multiple instances with the same name are *not* allowed and can *not* safely
  access the same data on disk. Also used to create the <diskCache>.
- Initializer allows you to override default NSKeyedArchiver/NSKeyedUnarchiver serialization for <diskCache>.
+ Initializer allows you to override the default serialization for <diskCache>.
  You must provide both serializer and deserializer, or opt-out to default implementation providing nil values.
  
  @see name
  @param name The name of the cache.
  @param rootPath The path of the cache on disk.
- @param serializer   A block used to serialize object before writing to disk. If nil provided, default NSKeyedArchiver serialized will be used.
- @param deserializer A block used to deserialize object read from disk. If nil provided, default NSKeyedUnarchiver serialized will be used.
+ @param serializer   A block used to serialize object before writing to disk. If nil provided, the default serializer will be used.
+ @param deserializer A block used to deserialize object read from disk. If nil provided, the default deserializer will be used.
  @param keyEncoder A block used to encode key(filename). If nil provided, default url encoder will be used
  @param keyDecoder A block used to decode key(filename). If nil provided, default url decoder will be used
  @param ttlCache Whether or not the cache should behave as a TTL cache.
@@ -157,14 +295,14 @@ PIN_SUBCLASSING_RESTRICTED
 /**
  Multiple instances with the same name are *not* allowed and can *not* safely
  access the same data on disk. Also used to create the <diskCache>.
- Initializer allows you to override default NSKeyedArchiver/NSKeyedUnarchiver serialization for <diskCache>.
+ Initializer allows you to override the default serialization for <diskCache>.
  You must provide both serializer and deserializer, or opt-out to default implementation providing nil values.
  
  @see name
  @param name The name of the cache.
  @param rootPath The path of the cache on disk.
- @param serializer   A block used to serialize object before writing to disk. If nil provided, default NSKeyedArchiver serialized will be used.
- @param deserializer A block used to deserialize object read from disk. If nil provided, default NSKeyedUnarchiver serialized will be used.
+ @param serializer   A block used to serialize object before writing to disk. If nil provided, the default serializer will be used.
+ @param deserializer A block used to deserialize object read from disk. If nil provided, the default deserializer will be used.
  @param keyEncoder A block used to encode key(filename). If nil provided, default url encoder will be used
  @param keyDecoder A block used to decode key(filename). If nil provided, default url decoder will be used
  @param ttlCache Whether or not the cache should behave as a TTL cache.
@@ -180,6 +318,270 @@ PIN_SUBCLASSING_RESTRICTED
                     ttlCache:(BOOL)ttlCache 
             evictionStrategy:(PINCacheEvictionStrategy)evictionStrategy NS_DESIGNATED_INITIALIZER;
 
+#pragma mark - Asynchronous Methods
+/// @name Asynchronous Methods
+
+/**
+ Retrieves the object for the specified key. The memory cache is searched on the calling thread, so a memory hit costs
+ a single dispatch of the block. A miss takes one operation, which searches the lower tiers and, when no queue is
+ given, also executes the block. This method returns immediately.
+ 
+ @param key The key associated with the requested object.
+ @param callbackQueue The queue to execute the block on, or nil for the cache's own operation queue.
+ @param block A block to be executed when the object is available.
+ */
+- (void)objectForKeyAsync:(NSString *)key callbackQueue:(nullable dispatch_queue_t)callbackQueue completion:(PINCacheObjectBlock)block;
+
+#pragma mark - Cancellation
+/// @name Cancellation
+
+/**
+ Retrieves the object for the specified key, unless called off first. A memory hit is answered right away, as with
+ <objectForKeyAsync:callbackQueue:completion:>. A miss that's called off before it reaches the disk cache doesn't read
+ it, and one called off while reading doesn't deserialize the object. Lookups called off aren't remembered as misses.
+ This method returns immediately.
+
+ @see PINCacheCancellationToken
+ @param key The key associated with the requested object.
+ @param deadline When the object stops being wanted, or nil.
+ @param block A block to be executed concurrently when the object is available.
+ @result A token to call the lookup off with.
+ */
+- (PINCacheCancellationToken *)objectForKeyAsync:(NSString *)key deadline:(nullable NSDate *)deadline completion:(PINCacheObjectBlock)block;
+
+/**
+ Stores an object in the memory and disk caches, unless called off before the operation storing it starts. This
+ method returns immediately and executes the passed block after the object has been stored.
+
+ @see PINCacheCancellationToken
+ @param object An object to store in the cache.
+ @param key A key to associate with the object. This string will be copied.
+ @param cost An amount to add to the memory cache's total cost.
+ @param ageLimit The age limit (in seconds) to associate with the object, or 0 for the caches' own.
+ @param deadline When the set stops being wanted, or nil.
+ @param block A block to be executed concurrently after the object has been stored, or nil.
+ @result A token to call the set off with.
+ */
+- (PINCacheCancellationToken *)setObjectAsync:(id <NSCoding>)object forKey:(NSString *)key withCost:(NSUInteger)cost ageLimit:(NSTimeInterval)ageLimit deadline:(nullable NSDate *)deadline completion:(nullable PINCacheObjectBlock)block;
+
+/**
+ Removes objects older than a date from every tier, unless called off before the operation trimming them starts. This
+ method returns immediately and executes the passed block after the caches have been trimmed.
+
+ @see PINCacheCancellationToken
+ @param date Objects that haven't been accessed since this date are removed.
+ @param deadline When the trim stops being wanted, or nil.
+ @param block A block to be executed concurrently after the caches have been trimmed, or nil.
+ @result A token to call the trim off with.
+ */
+- (PINCacheCancellationToken *)trimToDateAsync:(NSDate *)date deadline:(nullable NSDate *)deadline completion:(nullable PINCacheBlock)block;
+
+#pragma mark - Read-Through
+/// @name Read-Through
+
+/**
+ Retrieves the object for the specified key, loading it with the given loader if no tier has it. However many callers
+ miss the same key at the same time, its loader runs once: the first caller's loader is used and everyone gets its
+ result. A loaded object is stored in the memory and disk caches before any block is executed. A nil result is not
+ stored and is passed on as is. Objects older than <softAgeLimit> are returned and refreshed in the background.
+ This method returns immediately.
+
+ @param key The key associated with the requested object.
+ @param loader A block producing the object if the cache doesn't have it.
+ @param block A block to be executed concurrently when the object is available.
+ */
+- (void)objectForKeyAsync:(NSString *)key loader:(PINCacheLoaderBlock)loader completion:(PINCacheObjectBlock)block;
+
+#pragma mark - Write-Back
+/// @name Write-Back
+
+/**
+ Writes every object waiting in write-back mode to disk. See <writesBack>. This method blocks the calling thread until
+ they have been written.
+ */
+- (void)flush;
+
+/**
+ Writes every object waiting in write-back mode to disk. See <writesBack>. This method returns immediately and executes
+ the passed block once they have been written.
+ 
+ @param block A block to be executed concurrently after the objects have been written, or nil.
+ */
+- (void)flushAsync:(nullable PINCacheBlock)block;
+
+#pragma mark - Batches
+/// @name Batches
+
+/**
+ Retrieves several objects at once. The memory cache is searched first, then the serialized memory tier, and the
+ remaining keys are read from the disk cache as one batch, in parallel. Objects found below the memory cache are added
+ to it in a single batch. This method returns immediately and executes the passed block once, with every object found.
+ 
+ @see objectsForKeys:
+ @param keys The keys of the objects to retrieve.
+ @param block A block to be executed concurrently when the objects are available.
+ */
+- (void)objectsForKeysAsync:(NSArray<NSString *> *)keys completion:(PINCacheObjectsBlock)block;
+
+/**
+ Stores several objects at once in both the memory and disk caches, each taking its locks once for the whole batch.
+ This method returns immediately and executes the passed block once every object has been stored.
+ 
+ @see setObjects:forKeys:
+ @param objects The objects to store.
+ @param keys The keys to associate with the objects, in the same order. Must have the same count as objects.
+ @param block A block to be executed concurrently after the objects have been stored, or nil.
+ */
+- (void)setObjectsAsync:(NSArray<id <NSCoding>> *)objects forKeys:(NSArray<NSString *> *)keys completion:(nullable PINCacheBlock)block;
+
+/**
+ Retrieves several objects at once. See <objectsForKeysAsync:completion:>. This method blocks the calling thread until
+ the objects are available.
+ 
+ @param keys The keys of the objects to retrieve. Duplicates are looked up once.
+ @result The objects found, keyed by their keys. Keys that were not found are absent.
+ */
+- (NSDictionary<NSString *, id> *)objectsForKeys:(NSArray<NSString *> *)keys;
+
+/**
+ Stores several objects at once. See <setObjectsAsync:forKeys:completion:>. This method blocks the calling thread until
+ the objects have been stored.
+ 
+ @param objects The objects to store.
+ @param keys The keys to associate with the objects, in the same order. Must have the same count as objects.
+ */
+- (void)setObjects:(NSArray<id <NSCoding>> *)objects forKeys:(NSArray<NSString *> *)keys;
+
+#pragma mark - Tags and Prefixes
+/// @name Tags and Prefixes
+
+/**
+ Stores an object with tags. This method returns immediately and executes the passed block after the object has been
+ stored.
+ 
+ @see setObject:forKey:withTags:
+ @param object An object to store in the cache.
+ @param key A key to associate with the object. This string will be copied.
+ @param tags The tags to give the object.
+ @param block A block to be executed concurrently after the object has been stored, or nil.
+ */
+- (void)setObjectAsync:(id <NSCoding>)object forKey:(NSString *)key withTags:(NSSet<NSString *> *)tags completion:(nullable PINCacheObjectBlock)block;
+
+/**
+ Removes every object with a tag. This method returns immediately and executes the passed block after the objects
+ have been removed.
+ 
+ @see removeObjectsWithTag:
+ @param tag The tag of the objects to remove.
+ @param block A block to be executed concurrently after the objects have been removed, or nil.
+ */
+- (void)removeObjectsWithTagAsync:(NSString *)tag completion:(nullable PINCacheBlock)block;
+
+/**
+ Removes every object whose key starts with a prefix. This method returns immediately and executes the passed block
+ after the objects have been removed.
+ 
+ @see removeObjectsWithKeyPrefix:
+ @param prefix The prefix of the keys of the objects to remove.
+ @param block A block to be executed concurrently after the objects have been removed, or nil.
+ */
+- (void)removeObjectsWithKeyPrefixAsync:(NSString *)prefix completion:(nullable PINCacheBlock)block;
+
+/**
+ Stores an object with tags in both the memory and disk caches, or in memory and the write-back queue in write-back
+ mode, which <removeObjectsWithTag:> can later remove it by. Setting the key again replaces its tags along with its
+ object. This method blocks the calling thread until the object has been stored.
+ 
+ @param object An object to store in the cache.
+ @param key A key to associate with the object. This string will be copied.
+ @param tags The tags to give the object.
+ */
+- (void)setObject:(id <NSCoding>)object forKey:(NSString *)key withTags:(NSSet<NSString *> *)tags;
+
+/**
+ Removes every object with a tag from every tier: the memory cache, the serialized memory tier, the objects waiting
+ to be written back and the disk cache. Copies that lost their tags on the way up, such as objects read back from
+ disk, are removed along with the originals, and the keys are forgotten as known misses. This method blocks the
+ calling thread until the objects have been removed.
+ 
+ @param tag The tag of the objects to remove.
+ */
+- (void)removeObjectsWithTag:(NSString *)tag;
+
+/**
+ Removes every object whose key starts with a prefix from every tier, e.g. everything cached for one user, and
+ forgets those keys as known misses. This method blocks the calling thread until the objects have been removed.
+ 
+ @param prefix The prefix of the keys of the objects to remove.
+ */
+- (void)removeObjectsWithKeyPrefix:(NSString *)prefix;
+
+#pragma mark - Prefetching
+/// @name Prefetching
+
+/**
+ Warms the memory cache with objects that are about to be needed. Keys already in the <memoryCache> are not read
+ again; the rest are read from the <diskCache> in parallel, up to <prefetchIODepth> reads at a time, and the objects
+ found are added to the memory cache in a single batch. This method returns immediately.
+ 
+ Cancelling the returned progress stops any reads that haven't started yet. The completion block is still
+ executed, with the objects found up to that point, and nothing found after cancellation is added to memory.
+ 
+ @param keys The keys to prefetch. Duplicates are ignored.
+ @param priority The priority of the disk reads on the cache's operation queue.
+ @param completion A block to be executed concurrently once every key has been looked up, or nil.
+ @result A progress whose `totalUnitCount` is the number of distinct keys and which can be cancelled.
+ */
+- (NSProgress *)prefetchObjectsForKeys:(NSArray<NSString *> *)keys
+                              priority:(PINOperationQueuePriority)priority
+                            completion:(nullable PINCachePrefetchBlock)completion;
+
+#pragma mark - Snapshots
+/// @name Snapshots
+
+/**
+ Writes a consistent snapshot of the cache to a single packed archive. See
+ <[PINDiskCache exportSnapshotToURL:error:]>. This method blocks the calling thread until the archive is written.
+ 
+ @param archiveURL Where to write the archive. An existing file is replaced.
+ @param error Set if the archive could not be written.
+ @result YES if the archive was written.
+ */
+- (BOOL)exportSnapshotToURL:(NSURL *)archiveURL error:(NSError **)error;
+
+/**
+ Imports an archive written by <exportSnapshotToURL:error:> into the disk cache, and puts the most recently used
+ objects straight into the memory cache. See <[PINDiskCache importSnapshotFromURL:error:]>. This method blocks the
+ calling thread until the archive has been imported.
+ 
+ @param archiveURL The archive to import.
+ @param memoryObjectCount How many of the most recently used objects to also add to the memory cache.
+ @param error Set if the archive could not be read or is corrupt. Objects imported before that point remain.
+ @result YES if the whole archive was imported.
+ */
+- (BOOL)importSnapshotFromURL:(NSURL *)archiveURL memoryObjectCount:(NSUInteger)memoryObjectCount error:(NSError **)error;
+
+#pragma mark - Statistics
+/// @name Statistics
+
+/**
+ Whether the cache counts what it does and measures how long it takes, see <statistics>. Recording is cheap but not
+ free, so it's off by default. Setting it also turns the <memoryCache> and <diskCache> statistics on or off, so that
+ each tier can be looked at alone.
+ */
+@property (assign) BOOL statisticsEnabled;
+
+/**
+ A snapshot of what the cache as a whole has done since <statisticsEnabled> was turned on or <resetStatistics> was
+ called.
+ */
+@property (readonly) PINCacheStatistics *statistics;
+
+/**
+ Zeroes <statistics>, and the <memoryCache> and <diskCache> statistics.
+ */
+- (void)resetStatistics;
+
 @end
 
 @interface PINCache (Deprecated)
@@ -6,18 +6,58 @@
 
 #import <PINOperation/PINOperation.h>
 
+#import "PINDiskCache+Private.h"
+#import "PINMemoryCache+Private.h"
+#import "PINCacheCancellationToken+Private.h"
+#import "PINCacheConcurrencyController.h"
+#import "PINCacheLoadQueue.h"
+#import "PINCacheNegativeCache.h"
+#import "PINCacheStatistics+Private.h"
+#import "PINCacheWorkStealingQueue.h"
+#import "PINCacheWriteBackQueue.h"
+#import "PINSerializedMemoryCache.h"
+
+#import <pthread.h>
+#import <stdatomic.h>
+
 static NSString * const PINCachePrefix = @"com.pinterest.PINCache";
 static NSString * const PINCacheSharedName = @"PINCacheShared";
+static const NSUInteger PINCacheDefaultPrefetchIODepth = 4;
+static const NSUInteger PINCacheDefaultNegativeCacheCountLimit = 1024;
+static const NSUInteger PINCacheDefaultMaxConcurrentLoads = 4;
+static const NSUInteger PINCacheDefaultMinConcurrentIOOperations = 2;
+static const NSUInteger PINCacheDefaultMaxConcurrentIOOperations = 10;
+static const NSUInteger PINCacheDefaultMaxConcurrentMaintenanceOperations = 2;
 
 @interface PINCache ()
 @property (copy, nonatomic) NSString *name;
 @property (strong, nonatomic) PINOperationQueue *operationQueue;
+@property (strong, nonatomic) PINCacheWorkStealingQueue *memoryOperationQueue;
+@property (strong, nonatomic) PINOperationQueue *maintenanceOperationQueue;
+@property (strong, nonatomic) PINCacheConcurrencyController *concurrencyController;
+@property (strong, nonatomic) PINSerializedMemoryCache *serializedMemoryCache;
+@property (strong, nonatomic) PINCacheWriteBackQueue *writeBackQueue;
+@property (strong, nonatomic) PINCacheNegativeCache *negativeCache;
+@property (strong, nonatomic) PINCacheLoadQueue *loadQueue;
+@property (strong, nonatomic) PINCacheStatisticsRecorder *statisticsRecorder;
 @end
 
-@implementation PINCache
+@implementation PINCache {
+    atomic_bool _writesBack;
+    _Atomic(NSTimeInterval) _softAgeLimit;
+    // Guards objects evicted from memory that are waiting to be serialized into the serialized tier.
+    pthread_mutex_t _demotionMutex;
+    NSMutableDictionary<NSString *, id> *_pendingDemotions;
+}
 
 #pragma mark - Initialization -
 
+- (void)dealloc
+{
+    __unused int result = pthread_mutex_destroy(&_demotionMutex);
+    NSCAssert(result == 0, @"Failed to destroy demotion lock in PINCache %p. Code: %d", (void *)self, result);
+}
+
 - (instancetype)init
 {
     @throw [NSException exceptionWithName:@"Must initialize with a name" reason:@"PINCache must be initialized with a name. Call initWithName: instead." userInfo:nil];
@@ -72,10 +112,22 @@ static NSString * const PINCacheSharedName = @"PINCacheShared";
         return nil;
     
     if (self = [super init]) {
+        __unused int result = pthread_mutex_init(&_demotionMutex, NULL);
+        NSAssert(result == 0, @"Failed to init demotion lock in PINCache %@. Code: %d", self, result);
+
         _name = [name copy];
       
-        //10 may actually be a bit high, but currently much of our threads are blocked on empyting the trash. Until we can resolve that, lets bump this up.
-        _operationQueue = [[PINOperationQueue alloc] initWithMaxConcurrentOperations:10];
+        // Work runs on three lanes, so that no kind of work can take the slots another needs. Disk reads and writes
+        // that callers wait on get the operation queue, sized by measured disk latency. The memory cache is CPU bound
+        // and gets one slot per core, on a work stealing queue because its operations are too short to all go through
+        // one lock. Trims, scrubbing and access time updates share a small maintenance lane. Loaders, which may block on
+        // the network, run on a lane of their own inside the load queue.
+        _operationQueue = [[PINOperationQueue alloc] initWithMaxConcurrentOperations:PINCacheDefaultMaxConcurrentIOOperations];
+        _concurrencyController = [[PINCacheConcurrencyController alloc] initWithOperationQueue:_operationQueue
+                                                                       minConcurrentOperations:PINCacheDefaultMinConcurrentIOOperations
+                                                                       maxConcurrentOperations:PINCacheDefaultMaxConcurrentIOOperations];
+        _memoryOperationQueue = [[PINCacheWorkStealingQueue alloc] initWithMaxConcurrentOperations:[[NSProcessInfo processInfo] activeProcessorCount]];
+        _maintenanceOperationQueue = [[PINOperationQueue alloc] initWithMaxConcurrentOperations:PINCacheDefaultMaxConcurrentMaintenanceOperations];
         _diskCache = [[PINDiskCache alloc] initWithName:_name
                                                  prefix:PINDiskCachePrefix
                                                rootPath:rootPath
@@ -88,7 +140,23 @@ static NSString * const PINCacheSharedName = @"PINCacheShared";
                                               byteLimit:PINDiskCacheDefaultByteLimit
                                                ageLimit:PINDiskCacheDefaultAgeLimit
                                        evictionStrategy:evictionStrategy];
-        _memoryCache = [[PINMemoryCache alloc] initWithName:_name operationQueue:_operationQueue ttlCache:ttlCache evictionStrategy:evictionStrategy];
+        _diskCache.maintenanceQueue = _maintenanceOperationQueue;
+        _memoryCache = [[PINMemoryCache alloc] initWithName:_name operationQueue:[PINOperationQueue sharedOperationQueue] ttlCache:ttlCache evictionStrategy:evictionStrategy];
+        _memoryCache.operationQueue = _memoryOperationQueue;
+        _serializedMemoryCache = [[PINSerializedMemoryCache alloc] initWithByteLimit:0];
+        _pendingDemotions = [[NSMutableDictionary alloc] init];
+        _writeBackQueue = [[PINCacheWriteBackQueue alloc] initWithDiskCache:_diskCache operationQueue:_maintenanceOperationQueue];
+        _negativeCache = [[PINCacheNegativeCache alloc] initWithCountLimit:PINCacheDefaultNegativeCacheCountLimit];
+        _loadQueue = [[PINCacheLoadQueue alloc] initWithMaxConcurrentLoads:PINCacheDefaultMaxConcurrentLoads];
+        _prefetchIODepth = PINCacheDefaultPrefetchIODepth;
+        _statisticsRecorder = [[PINCacheStatisticsRecorder alloc] init];
+        
+        __weak PINCache *weakSelf = self;
+        [_memoryCache addEvictionObserver:^(PINMemoryCache *cache, NSString *key, id object, CFAbsoluteTime createdTime) {
+            PINCache *strongSelf = weakSelf;
+            [strongSelf demoteObject:object forKey:key createdTime:createdTime];
+            [strongSelf flushIfObjectIsPendingForKey:key];
+        }];
     }
     return self;
 }
@@ -110,6 +178,200 @@ static NSString * const PINCacheSharedName = @"PINCacheShared";
     return cache;
 }
 
+#pragma mark - Private Methods -
+
+// Serializing is left to the memory lane, so that the trim that evicted the object doesn't wait for it. Until then the
+// object stays pending, where reads still find it, and anything that changes the key drops it.
+- (void)demoteObject:(id)object forKey:(NSString *)key createdTime:(CFAbsoluteTime)createdTime
+{
+    if (_serializedMemoryCache.byteLimit == 0 || _memoryCache.isTTLCache)
+        return;
+
+    pthread_mutex_lock(&_demotionMutex);
+        _pendingDemotions[key] = object;
+    pthread_mutex_unlock(&_demotionMutex);
+
+    [_memoryOperationQueue scheduleOperation:^{
+        NSData *data = self->_serializedMemoryCache.byteLimit > 0 ? self->_diskCache.serializer(object, key) : nil;
+
+        pthread_mutex_lock(&self->_demotionMutex);
+            if (self->_pendingDemotions[key] == object) {
+                [self->_pendingDemotions removeObjectForKey:key];
+                if (data)
+                    [self->_serializedMemoryCache setData:data forKey:key createdTime:createdTime];
+            }
+        pthread_mutex_unlock(&self->_demotionMutex);
+    } withPriority:PINOperationQueuePriorityLow];
+}
+
+- (BOOL)containsSerializedObjectForKey:(NSString *)key
+{
+    pthread_mutex_lock(&_demotionMutex);
+        BOOL pending = _pendingDemotions[key] != nil;
+    pthread_mutex_unlock(&_demotionMutex);
+
+    return pending || [_serializedMemoryCache containsDataForKey:key];
+}
+
+- (void)discardSerializedObjectForKey:(NSString *)key
+{
+    pthread_mutex_lock(&_demotionMutex);
+        [_pendingDemotions removeObjectForKey:key];
+        [_serializedMemoryCache discardDataForKey:key];
+    pthread_mutex_unlock(&_demotionMutex);
+}
+
+// Pending demotions are dropped whatever their age. Their objects are still on disk, or on their way there.
+- (void)discardSerializedObjectsCreatedBefore:(NSDate *)date
+{
+    pthread_mutex_lock(&_demotionMutex);
+        [_pendingDemotions removeAllObjects];
+        [_serializedMemoryCache discardDataCreatedBefore:[date timeIntervalSinceReferenceDate]];
+    pthread_mutex_unlock(&_demotionMutex);
+}
+
+- (void)discardSerializedObjectsWithKeyPrefix:(NSString *)prefix
+{
+    pthread_mutex_lock(&_demotionMutex);
+        NSSet<NSString *> *pendingKeys = [_pendingDemotions keysOfEntriesPassingTest:^BOOL(NSString *key, id object, BOOL *stop) {
+            return [key hasPrefix:prefix];
+        }];
+        [_pendingDemotions removeObjectsForKeys:pendingKeys.allObjects];
+        [_serializedMemoryCache discardDataForKeysWithPrefix:prefix];
+    pthread_mutex_unlock(&_demotionMutex);
+}
+
+- (void)discardAllSerializedObjects
+{
+    pthread_mutex_lock(&_demotionMutex);
+        [_pendingDemotions removeAllObjects];
+        [_serializedMemoryCache discardAllData];
+    pthread_mutex_unlock(&_demotionMutex);
+}
+
+// An object evicted from memory before it was written back has nothing in front of the disk cache to save it.
+- (void)flushIfObjectIsPendingForKey:(NSString *)key
+{
+    if ([_writeBackQueue objectForKey:key] != nil)
+        [_writeBackQueue flushAsync];
+}
+
+- (BOOL)canPromoteObjectForKey:(NSString *)key
+{
+    return [_writeBackQueue objectForKey:key] != nil || [self containsSerializedObjectForKey:key];
+}
+
+/**
+ Runs the memory half of an operation on the memory lane and the disk half on the I/O lane, so that memory work never
+ waits for a disk slot. The completion runs once both are done, off either lane.
+ */
+- (void)performMemoryOperation:(dispatch_block_t)memoryOperation diskOperation:(dispatch_block_t)diskOperation completion:(nullable dispatch_block_t)completion
+{
+    dispatch_group_t group = dispatch_group_create();
+    dispatch_group_enter(group);
+    [_memoryOperationQueue scheduleOperation:^{
+        memoryOperation();
+        dispatch_group_leave(group);
+    }];
+    dispatch_group_enter(group);
+    [_operationQueue scheduleOperation:^{
+        diskOperation();
+        dispatch_group_leave(group);
+    }];
+
+    if (completion)
+        dispatch_group_notify(group, dispatch_get_global_queue(QOS_CLASS_DEFAULT, 0), completion);
+}
+
+// Takes an object waiting to be written back, or out of the serialized tier, and puts it back in the memory cache.
+- (nullable id)promoteObjectForKey:(NSString *)key
+{
+    // A pending object keeps its cost and what's left of its age limit, so promoting it doesn't extend its life.
+    NSUInteger cost = 0;
+    NSTimeInterval ageLimit = 0.0;
+    id object = [_writeBackQueue objectForKey:key cost:&cost ageLimit:&ageLimit] ?: [self removeSerializedObjectForKey:key];
+    if (object) {
+        [_memoryCache setObject:object forKey:key withCost:cost ageLimit:ageLimit];
+        [_statisticsRecorder addCount:1 toCounter:PINCacheStatisticsCounterPromotion];
+    }
+    return object;
+}
+
+- (void)recordLookupOfObject:(nullable id)object startTime:(uint64_t)startTime
+{
+    if (startTime == 0)
+        return;
+    [_statisticsRecorder addCount:1 toCounter:object ? PINCacheStatisticsCounterHit : PINCacheStatisticsCounterMiss];
+    [_statisticsRecorder endOperation:PINCacheStatisticsOperationRead startTime:startTime];
+}
+
+- (void)recordSetWithStartTime:(uint64_t)startTime
+{
+    if (startTime == 0)
+        return;
+    [_statisticsRecorder addCount:1 toCounter:PINCacheStatisticsCounterSet];
+    [_statisticsRecorder endOperation:PINCacheStatisticsOperationWrite startTime:startTime];
+}
+
+// Reads that found something are timed to size the I/O lane. Misses are often answered without touching the disk.
+- (nullable id)readObjectFromDiskForKey:(NSString *)key
+{
+    CFAbsoluteTime startTime = CFAbsoluteTimeGetCurrent();
+    id object = [_diskCache objectForKey:key];
+    if (object)
+        [_concurrencyController recordLatency:CFAbsoluteTimeGetCurrent() - startTime];
+    return object;
+}
+
+- (nullable id)removeSerializedObjectForKey:(NSString *)key
+{
+    pthread_mutex_lock(&_demotionMutex);
+        id pendingObject = _pendingDemotions[key];
+        [_pendingDemotions removeObjectForKey:key];
+    pthread_mutex_unlock(&_demotionMutex);
+
+    if (pendingObject)
+        return pendingObject;
+
+    NSData *data = [_serializedMemoryCache removeDataForKey:key createdTime:NULL];
+    if (data == nil)
+        return nil;
+
+    return _diskCache.deserializer(data, key);
+}
+
+- (void)forgetMissesForKeys:(NSArray<NSString *> *)keys
+{
+    for (NSString *key in keys) {
+        [_negativeCache removeKey:key];
+    }
+}
+
+- (BOOL)objectNeedsRefreshForKey:(NSString *)key
+{
+    NSTimeInterval softAgeLimit = atomic_load(&_softAgeLimit);
+    if (softAgeLimit <= 0.0)
+        return NO;
+
+    // Still waiting to be written back, so it was set moments ago.
+    if ([_writeBackQueue objectForKey:key] != nil)
+        return NO;
+
+    NSDate *createdDate = [_diskCache createdDateForKey:key];
+    return createdDate != nil && [[NSDate date] timeIntervalSinceDate:createdDate] >= softAgeLimit;
+}
+
+- (void)loadObjectForKey:(NSString *)key loader:(PINCacheLoaderBlock)loader refreshing:(BOOL)refreshing completion:(nullable PINCacheLoadQueueCompletionBlock)completion
+{
+    // A refresh replaces the object that is there, only a miss can be answered by what another load stored meanwhile.
+    id (^lookup)(NSString *) = refreshing ? nil : ^id(NSString *lookupKey) {
+        return [self->_memoryCache objectForKey:lookupKey] ?: [self->_writeBackQueue objectForKey:lookupKey];
+    };
+    [_loadQueue loadObjectForKey:key loader:loader lookup:lookup store:^(id object) {
+        [self setObject:object forKey:key];
+    } completion:completion];
+}
+
 #pragma mark - Public Asynchronous Methods -
 
 - (void)containsObjectForKeyAsync:(NSString *)key completion:(PINCacheObjectContainmentBlock)block
@@ -118,43 +380,141 @@ static NSString * const PINCacheSharedName = @"PINCacheShared";
         return;
     }
   
+    // Only an answer that needs the disk takes a slot on the I/O lane.
+    if ([_memoryCache containsObjectForKey:key] || [self canPromoteObjectForKey:key]) {
+        [_memoryOperationQueue scheduleOperation:^{
+            block(YES);
+        }];
+        return;
+    }
+
     [self.operationQueue scheduleOperation:^{
         BOOL containsObject = [self containsObjectForKey:key];
         block(containsObject);
     }];
 }
 
-#pragma clang diagnostic push
-#pragma clang diagnostic ignored "-Wshadow"
-
 - (void)objectForKeyAsync:(NSString *)key completion:(PINCacheObjectBlock)block
+{
+    [self objectForKeyAsync:key callbackQueue:nil completion:block];
+}
+
+- (void)objectForKeyAsync:(NSString *)key callbackQueue:(dispatch_queue_t)callbackQueue completion:(PINCacheObjectBlock)block
+{
+    [self objectForKeyAsync:key callbackQueue:callbackQueue cancellationToken:nil completion:block];
+}
+
+- (PINCacheCancellationToken *)objectForKeyAsync:(NSString *)key deadline:(NSDate *)deadline completion:(PINCacheObjectBlock)block
+{
+    PINCacheCancellationToken *token = [[PINCacheCancellationToken alloc] initWithDeadline:deadline];
+    [self objectForKeyAsync:key callbackQueue:nil cancellationToken:token completion:block];
+    return token;
+}
+
+- (void)objectForKeyAsync:(NSString *)key callbackQueue:(nullable dispatch_queue_t)callbackQueue cancellationToken:(nullable PINCacheCancellationToken *)token completion:(PINCacheObjectBlock)block
 {
     if (!key || !block)
         return;
-    
-    [self.operationQueue scheduleOperation:^{
-        [self->_memoryCache objectForKeyAsync:key completion:^(id<PINCaching> memoryCache, NSString *memoryCacheKey, id memoryCacheObject) {
-            if (memoryCacheObject) {
-                // Update file modification date. TODO: make this a separate method?
-                [self->_diskCache fileURLForKeyAsync:memoryCacheKey completion:^(NSString * _Nonnull key, NSURL * _Nullable fileURL) {}];
-                [self->_operationQueue scheduleOperation:^{
-                    block(self, memoryCacheKey, memoryCacheObject);
-                }];
+
+    // A memory hit, or a miss that's already known, is answered with a single dispatch, the lookup itself is cheaper
+    // than scheduling it.
+    uint64_t startTime = [_statisticsRecorder startOperation];
+    uint64_t generation = 0;
+    BOOL knownMiss = [_negativeCache containsKey:key generation:&generation];
+    id object = knownMiss ? nil : [_memoryCache objectForKey:key];
+    if (object || knownMiss) {
+        if (object)
+            [_diskCache recordAccessToObjectForKeyAsync:key];
+        [self recordLookupOfObject:object startTime:startTime];
+        if (callbackQueue) {
+            dispatch_async(callbackQueue, ^{
+                if (!token.cancelled)
+                    block(self, key, object);
+            });
+        } else {
+            [_memoryOperationQueue scheduleOperation:^{
+                if (!token.cancelled)
+                    block(self, key, object);
+            }];
+        }
+        return;
+    }
+
+    // The block runs on the lane that found the object, unless a queue was given.
+    void (^complete)(id, BOOL) = ^(id foundObject, BOOL dropped) {
+        if (!dropped)
+            [self recordLookupOfObject:foundObject startTime:startTime];
+        if (token.cancelled)
+            return;
+
+        if (callbackQueue) {
+            dispatch_async(callbackQueue, ^{
+                block(self, key, foundObject);
+            });
+        } else {
+            block(self, key, foundObject);
+        }
+    };
+    dispatch_block_t readFromDisk = ^{
+        id foundObject = nil;
+        BOOL dropped = [token shouldDropOperationForRecorder:self->_statisticsRecorder];
+        if (!dropped) {
+            PINCacheCurrentCancellationToken = token;
+            foundObject = [self readObjectFromDiskForKey:key];
+            PINCacheCurrentCancellationToken = nil;
+            if (foundObject) {
+                [self->_memoryCache setObject:foundObject forKey:key];
+                [self->_statisticsRecorder addCount:1 toCounter:PINCacheStatisticsCounterPromotion];
             } else {
-                [self->_diskCache objectForKeyAsync:memoryCacheKey completion:^(PINDiskCache *diskCache, NSString *diskCacheKey, id <NSCoding> diskCacheObject) {
-                    
-                    [self->_memoryCache setObjectAsync:diskCacheObject forKey:diskCacheKey completion:nil];
-                    
-                    [self->_operationQueue scheduleOperation:^{
-                        block(self, diskCacheKey, diskCacheObject);
-                    }];
-                }];
+                // A read the disk cache gave up on says nothing about whether the object is there.
+                dropped = [token shouldDropOperationForRecorder:self->_statisticsRecorder];
+                if (!dropped)
+                    [self->_negativeCache addKey:key generation:generation];
             }
-        }];
+        }
+        complete(foundObject, dropped);
+    };
+
+    if (![self canPromoteObjectForKey:key]) {
+        [self.operationQueue scheduleOperation:readFromDisk];
+        return;
+    }
+
+    // Promoting a pending or serialized object is memory work. The disk is only read if it's gone by then.
+    [_memoryOperationQueue scheduleOperation:^{
+        if ([token shouldDropOperationForRecorder:self->_statisticsRecorder]) {
+            complete(nil, YES);
+            return;
+        }
+        id promotedObject = [self promoteObjectForKey:key];
+        if (promotedObject == nil) {
+            [self.operationQueue scheduleOperation:readFromDisk];
+            return;
+        }
+        [self->_diskCache recordAccessToObjectForKeyAsync:key];
+        complete(promotedObject, NO);
     }];
 }
 
-#pragma clang diagnostic pop
+- (void)objectForKeyAsync:(NSString *)key loader:(PINCacheLoaderBlock)loader completion:(PINCacheObjectBlock)block
+{
+    if (!key || !loader || !block)
+        return;
+
+    [self objectForKeyAsync:key completion:^(PINCache *cache, NSString *objectKey, id _Nullable object) {
+        if (object == nil) {
+            [self loadObjectForKey:key loader:loader refreshing:NO completion:^(id _Nullable loadedObject) {
+                block(self, key, loadedObject);
+            }];
+            return;
+        }
+
+        // Stale objects are served as they are, the refresh joins any load already running for the key.
+        block(self, key, object);
+        if ([self objectNeedsRefreshForKey:key])
+            [self loadObjectForKey:key loader:loader refreshing:YES completion:nil];
+    }];
+}
 
 - (void)setObjectAsync:(id <NSCoding>)object forKey:(NSString *)key completion:(PINCacheObjectBlock)block
 {
@@ -176,22 +536,45 @@ static NSString * const PINCacheSharedName = @"PINCacheShared";
     if (!key || !object)
         return;
   
-    PINOperationGroup *group = [PINOperationGroup asyncOperationGroupWithQueue:_operationQueue];
+    if (self.writesBack) {
+        // Only memory is written now.
+        [_memoryOperationQueue scheduleOperation:^{
+            [self setObject:object forKey:key withCost:cost ageLimit:ageLimit];
+            if (block)
+                block(self, key, object);
+        }];
+        return;
+    }
     
-    [group addOperation:^{
+    uint64_t startTime = [_statisticsRecorder startOperation];
+    [self performMemoryOperation:^{
+        [self discardSerializedObjectForKey:key];
         [self->_memoryCache setObject:object forKey:key withCost:cost ageLimit:ageLimit];
-    }];
-    [group addOperation:^{
+        [self->_negativeCache removeKey:key];
+    } diskOperation:^{
         [self->_diskCache setObject:object forKey:key withAgeLimit:ageLimit];
-    }];
-  
-    if (block) {
-        [group setCompletion:^{
+        [self->_negativeCache removeKey:key];
+    } completion:(block || startTime) ? ^{
+        [self recordSetWithStartTime:startTime];
+        if (block)
             block(self, key, object);
-        }];
-    }
-    
-    [group start];
+    } : nil];
+}
+
+- (PINCacheCancellationToken *)setObjectAsync:(id <NSCoding>)object forKey:(NSString *)key withCost:(NSUInteger)cost ageLimit:(NSTimeInterval)ageLimit deadline:(NSDate *)deadline completion:(PINCacheObjectBlock)block
+{
+    PINCacheCancellationToken *token = [[PINCacheCancellationToken alloc] initWithDeadline:deadline];
+    if (!key || !object)
+        return token;
+
+    // One operation writes every tier, so that whether the set is dropped is decided, and counted, once.
+    [self.operationQueue scheduleOperation:^{
+        if (![token shouldDropOperationForRecorder:self->_statisticsRecorder])
+            [self setObject:object forKey:key withCost:cost ageLimit:ageLimit];
+        if (block && !token.cancelled)
+            block(self, key, object);
+    }];
+    return token;
 }
 
 - (void)removeObjectForKeyAsync:(NSString *)key completion:(PINCacheObjectBlock)block
@@ -199,42 +582,30 @@ static NSString * const PINCacheSharedName = @"PINCacheShared";
     if (!key)
         return;
     
-    PINOperationGroup *group = [PINOperationGroup asyncOperationGroupWithQueue:_operationQueue];
-    
-    [group addOperation:^{
+    [self performMemoryOperation:^{
         [self->_memoryCache removeObjectForKey:key];
-    }];
-    [group addOperation:^{
+        [self discardSerializedObjectForKey:key];
+        [self->_writeBackQueue removeObjectForKey:key];
+        [self->_negativeCache removeKey:key];
+    } diskOperation:^{
         [self->_diskCache removeObjectForKey:key];
-    }];
-
-    if (block) {
-        [group setCompletion:^{
-            block(self, key, nil);
-        }];
-    }
-    
-    [group start];
+    } completion:block ? ^{
+        block(self, key, nil);
+    } : nil];
 }
 
 - (void)removeAllObjectsAsync:(PINCacheBlock)block
 {
-    PINOperationGroup *group = [PINOperationGroup asyncOperationGroupWithQueue:_operationQueue];
-    
-    [group addOperation:^{
+    [self performMemoryOperation:^{
         [self->_memoryCache removeAllObjects];
-    }];
-    [group addOperation:^{
+        [self discardAllSerializedObjects];
+        [self->_writeBackQueue removeAllObjects];
+        [self->_negativeCache removeAllKeys];
+    } diskOperation:^{
         [self->_diskCache removeAllObjects];
-    }];
-
-    if (block) {
-        [group setCompletion:^{
-            block(self);
-        }];
-    }
-    
-    [group start];
+    } completion:block ? ^{
+        block(self);
+    } : nil];
 }
 
 - (void)trimToDateAsync:(NSDate *)date completion:(PINCacheBlock)block
@@ -242,10 +613,12 @@ static NSString * const PINCacheSharedName = @"PINCacheShared";
     if (!date)
         return;
     
-    PINOperationGroup *group = [PINOperationGroup asyncOperationGroupWithQueue:_operationQueue];
+    PINOperationGroup *group = [PINOperationGroup asyncOperationGroupWithQueue:_maintenanceOperationQueue];
     
     [group addOperation:^{
         [self->_memoryCache trimToDate:date];
+        [self discardSerializedObjectsCreatedBefore:date];
+        [self->_writeBackQueue removeObjectsAddedBeforeDate:date];
     }];
     [group addOperation:^{
         [self->_diskCache trimToDate:date];
@@ -260,9 +633,24 @@ static NSString * const PINCacheSharedName = @"PINCacheShared";
     [group start];
 }
 
+- (PINCacheCancellationToken *)trimToDateAsync:(NSDate *)date deadline:(NSDate *)deadline completion:(PINCacheBlock)block
+{
+    PINCacheCancellationToken *token = [[PINCacheCancellationToken alloc] initWithDeadline:deadline];
+    if (!date)
+        return token;
+
+    [_maintenanceOperationQueue scheduleOperation:^{
+        if (![token shouldDropOperationForRecorder:self->_statisticsRecorder])
+            [self trimToDate:date];
+        if (block && !token.cancelled)
+            block(self);
+    }];
+    return token;
+}
+
 - (void)removeExpiredObjectsAsync:(PINCacheBlock)block
 {
-    PINOperationGroup *group = [PINOperationGroup asyncOperationGroupWithQueue:_operationQueue];
+    PINOperationGroup *group = [PINOperationGroup asyncOperationGroupWithQueue:_maintenanceOperationQueue];
 
     [group addOperation:^{
         [self->_memoryCache removeExpiredObjects];
@@ -280,6 +668,81 @@ static NSString * const PINCacheSharedName = @"PINCacheShared";
     [group start];
 }
 
+- (void)objectsForKeysAsync:(NSArray<NSString *> *)keys completion:(PINCacheObjectsBlock)block
+{
+    if (!keys || !block)
+        return;
+
+    [self.operationQueue scheduleOperation:^{
+        NSDictionary<NSString *, id> *objects = [self objectsForKeys:keys];
+        block(self, objects);
+    }];
+}
+
+- (void)setObjectsAsync:(NSArray<id <NSCoding>> *)objects forKeys:(NSArray<NSString *> *)keys completion:(PINCacheBlock)block
+{
+    if (!keys || !objects)
+        return;
+
+    if (self.writesBack) {
+        [_memoryOperationQueue scheduleOperation:^{
+            [self setObjects:objects forKeys:keys];
+            if (block)
+                block(self);
+        }];
+        return;
+    }
+
+    [self performMemoryOperation:^{
+        for (NSString *key in keys) {
+            [self discardSerializedObjectForKey:key];
+        }
+        [self->_memoryCache setObjects:objects forKeys:keys];
+        [self forgetMissesForKeys:keys];
+    } diskOperation:^{
+        [self->_diskCache setObjects:objects forKeys:keys];
+        [self forgetMissesForKeys:keys];
+    } completion:block ? ^{
+        block(self);
+    } : nil];
+}
+
+- (void)setObjectAsync:(id <NSCoding>)object forKey:(NSString *)key withTags:(NSSet<NSString *> *)tags completion:(PINCacheObjectBlock)block
+{
+    if (!key || !object)
+        return;
+
+    [self.operationQueue scheduleOperation:^{
+        [self setObject:object forKey:key withTags:tags];
+        if (block)
+            block(self, key, object);
+    }];
+}
+
+- (void)removeObjectsWithTagAsync:(NSString *)tag completion:(PINCacheBlock)block
+{
+    if (!tag)
+        return;
+
+    [self.operationQueue scheduleOperation:^{
+        [self removeObjectsWithTag:tag];
+        if (block)
+            block(self);
+    }];
+}
+
+- (void)removeObjectsWithKeyPrefixAsync:(NSString *)prefix completion:(PINCacheBlock)block
+{
+    if (!prefix)
+        return;
+
+    [self.operationQueue scheduleOperation:^{
+        [self removeObjectsWithKeyPrefix:prefix];
+        if (block)
+            block(self);
+    }];
+}
+
 #pragma mark - Public Synchronous Accessors -
 
 - (NSUInteger)diskByteCount
@@ -298,7 +761,11 @@ static NSString * const PINCacheSharedName = @"PINCacheShared";
     if (!key)
         return NO;
     
-    return [_memoryCache containsObjectForKey:key] || [_diskCache containsObjectForKey:key];
+    uint64_t generation = 0;
+    if ([_negativeCache containsKey:key generation:&generation])
+        return NO;
+    
+    return [_memoryCache containsObjectForKey:key] || [_writeBackQueue objectForKey:key] != nil || [self containsSerializedObjectForKey:key] || [_diskCache containsObjectForKey:key];
 }
 
 - (nullable id)objectForKey:(NSString *)key
@@ -306,21 +773,129 @@ static NSString * const PINCacheSharedName = @"PINCacheShared";
     if (!key)
         return nil;
     
+    uint64_t startTime = [_statisticsRecorder startOperation];
+    uint64_t generation = 0;
+    if ([_negativeCache containsKey:key generation:&generation]) {
+        [self recordLookupOfObject:nil startTime:startTime];
+        return nil;
+    }
+    
     __block id object = nil;
 
-    object = [_memoryCache objectForKey:key];
+    object = [_memoryCache objectForKey:key] ?: [self promoteObjectForKey:key];
     
     if (object) {
-        // Update file modification date. TODO: make this a separate method?
-        [_diskCache fileURLForKeyAsync:key completion:^(NSString * _Nonnull key, NSURL * _Nullable fileURL) {}];
+        [_diskCache recordAccessToObjectForKeyAsync:key];
     } else {
         object = [_diskCache objectForKey:key];
-        [_memoryCache setObject:object forKey:key];
+        if (object) {
+            [_memoryCache setObject:object forKey:key];
+            [_statisticsRecorder addCount:1 toCounter:PINCacheStatisticsCounterPromotion];
+        } else {
+            [_negativeCache addKey:key generation:generation];
+        }
     }
     
+    [self recordLookupOfObject:object startTime:startTime];
     return object;
 }
 
+- (NSDictionary<NSString *, id> *)objectsForKeys:(NSArray<NSString *> *)keys
+{
+    if (keys.count == 0)
+        return @{};
+
+    // Misses are only remembered if nothing was invalidated since the first lookup.
+    uint64_t generation = 0;
+    NSMutableArray<NSString *> *lookupKeys = [[NSMutableArray alloc] initWithCapacity:keys.count];
+    for (NSString *key in keys) {
+        uint64_t keyGeneration = 0;
+        if (![_negativeCache containsKey:key generation:&keyGeneration])
+            [lookupKeys addObject:key];
+        if (key == keys.firstObject)
+            generation = keyGeneration;
+    }
+
+    NSUInteger knownMissCount = keys.count - lookupKeys.count;
+    NSMutableDictionary<NSString *, id> *objects = [[_memoryCache objectsForKeys:lookupKeys] mutableCopy];
+    NSMutableArray<NSString *> *foundKeys = [[objects allKeys] mutableCopy];
+
+    NSMutableArray<NSString *> *promotedKeys = [[NSMutableArray alloc] init];
+    NSMutableArray *promotedObjects = [[NSMutableArray alloc] init];
+    NSUInteger promotedAloneCount = 0;
+    NSMutableOrderedSet<NSString *> *missingKeys = [[NSMutableOrderedSet alloc] init];
+    for (NSString *key in lookupKeys) {
+        if (objects[key] != nil || [missingKeys containsObject:key])
+            continue;
+
+        NSUInteger cost = 0;
+        NSTimeInterval ageLimit = 0.0;
+        id object = [_writeBackQueue objectForKey:key cost:&cost ageLimit:&ageLimit] ?: [self removeSerializedObjectForKey:key];
+        if (object) {
+            objects[key] = object;
+            [foundKeys addObject:key];
+            if (cost > 0 || ageLimit > 0.0) {
+                // Promoted on its own, so that it keeps its cost and what's left of its age limit.
+                [_memoryCache setObject:object forKey:key withCost:cost ageLimit:ageLimit];
+                promotedAloneCount++;
+            } else {
+                [promotedKeys addObject:key];
+                [promotedObjects addObject:object];
+            }
+        } else {
+            [missingKeys addObject:key];
+        }
+    }
+
+    for (NSString *key in foundKeys) {
+        [_diskCache recordAccessToObjectForKeyAsync:key];
+    }
+
+    NSUInteger missCount = knownMissCount;
+    if (missingKeys.count > 0) {
+        NSDictionary<NSString *, id> *diskObjects = [_diskCache objectsForKeys:missingKeys.array];
+        missCount += missingKeys.count - MIN(diskObjects.count, missingKeys.count);
+        [diskObjects enumerateKeysAndObjectsUsingBlock:^(NSString * _Nonnull key, id  _Nonnull object, BOOL * _Nonnull stop) {
+            [promotedKeys addObject:key];
+            [promotedObjects addObject:object];
+        }];
+        [objects addEntriesFromDictionary:diskObjects];
+        for (NSString *key in missingKeys) {
+            if (diskObjects[key] == nil)
+                [_negativeCache addKey:key generation:generation];
+        }
+    }
+
+    [_memoryCache setObjects:promotedObjects forKeys:promotedKeys];
+
+    [_statisticsRecorder addCount:objects.count toCounter:PINCacheStatisticsCounterHit];
+    [_statisticsRecorder addCount:missCount toCounter:PINCacheStatisticsCounterMiss];
+    [_statisticsRecorder addCount:promotedKeys.count + promotedAloneCount toCounter:PINCacheStatisticsCounterPromotion];
+    return objects;
+}
+
+- (void)setObjects:(NSArray<id <NSCoding>> *)objects forKeys:(NSArray<NSString *> *)keys
+{
+    if (!keys || !objects)
+        return;
+
+    for (NSString *key in keys) {
+        [self discardSerializedObjectForKey:key];
+    }
+    [_memoryCache setObjects:objects forKeys:keys];
+    [self forgetMissesForKeys:keys];
+    if (self.writesBack) {
+        NSUInteger count = MIN(objects.count, keys.count);
+        for (NSUInteger idx = 0; idx < count; idx++) {
+            [_writeBackQueue addObject:objects[idx] forKey:keys[idx] withCost:0 ageLimit:0.0];
+        }
+    } else {
+        [_diskCache setObjects:objects forKeys:keys];
+        [self forgetMissesForKeys:keys];
+    }
+    [_statisticsRecorder addCount:MIN(objects.count, keys.count) toCounter:PINCacheStatisticsCounterSet];
+}
+
 - (void)setObject:(id <NSCoding>)object forKey:(NSString *)key
 {
     [self setObject:object forKey:key withCost:0];
@@ -341,8 +916,17 @@ static NSString * const PINCacheSharedName = @"PINCacheShared";
     if (!key || !object)
         return;
     
+    uint64_t startTime = [_statisticsRecorder startOperation];
+    [self discardSerializedObjectForKey:key];
     [_memoryCache setObject:object forKey:key withCost:cost ageLimit:ageLimit];
-    [_diskCache setObject:object forKey:key withAgeLimit:ageLimit];
+    [_negativeCache removeKey:key];
+    if (self.writesBack) {
+        [_writeBackQueue addObject:object forKey:key withCost:cost ageLimit:ageLimit];
+    } else {
+        [_diskCache setObject:object forKey:key withAgeLimit:ageLimit];
+        [_negativeCache removeKey:key];
+    }
+    [self recordSetWithStartTime:startTime];
 }
 
 - (nullable id)objectForKeyedSubscript:(NSString *)key
@@ -365,15 +949,69 @@ static NSString * const PINCacheSharedName = @"PINCacheShared";
         return;
     
     [_memoryCache removeObjectForKey:key];
+    [self discardSerializedObjectForKey:key];
+    [_writeBackQueue removeObjectForKey:key];
+    [_negativeCache removeKey:key];
     [_diskCache removeObjectForKey:key];
 }
 
+- (void)setObject:(id <NSCoding>)object forKey:(NSString *)key withTags:(NSSet<NSString *> *)tags
+{
+    if (!key || !object)
+        return;
+
+    uint64_t startTime = [_statisticsRecorder startOperation];
+    [self discardSerializedObjectForKey:key];
+    [_memoryCache setObject:object forKey:key withTags:tags];
+    [_negativeCache removeKey:key];
+    if (self.writesBack) {
+        [_writeBackQueue addObject:object forKey:key withTags:tags];
+    } else {
+        [_diskCache setObject:object forKey:key withTags:tags];
+        [_negativeCache removeKey:key];
+    }
+    [self recordSetWithStartTime:startTime];
+}
+
+- (void)removeObjectsWithTag:(NSString *)tag
+{
+    if (!tag)
+        return;
+
+    // Only the memory cache, the write-back queue and the disk cache know tags. An object the memory cache got from
+    // one of the others, or from the serialized tier, came without them, so the keys the others know are removed from
+    // the memory cache one by one. That only ever drops copies: the originals stay wherever they are kept.
+    NSMutableSet<NSString *> *keys = [[NSMutableSet alloc] initWithArray:[_writeBackQueue removeObjectsWithTag:tag]];
+    [keys addObjectsFromArray:[_diskCache keysWithTag:tag]];
+    [_memoryCache removeObjectsWithTag:tag];
+    for (NSString *key in keys) {
+        [_memoryCache removeObjectForKey:key];
+        [self discardSerializedObjectForKey:key];
+        [_negativeCache removeKey:key];
+    }
+    [_diskCache removeObjectsWithTag:tag];
+}
+
+- (void)removeObjectsWithKeyPrefix:(NSString *)prefix
+{
+    if (!prefix)
+        return;
+
+    [_memoryCache removeObjectsWithKeyPrefix:prefix];
+    [self discardSerializedObjectsWithKeyPrefix:prefix];
+    [_writeBackQueue removeObjectsWithKeyPrefix:prefix];
+    [_negativeCache removeKeysWithPrefix:prefix];
+    [_diskCache removeObjectsWithKeyPrefix:prefix];
+}
+
 - (void)trimToDate:(NSDate *)date
 {
     if (!date)
         return;
     
     [_memoryCache trimToDate:date];
+    [self discardSerializedObjectsCreatedBefore:date];
+    [_writeBackQueue removeObjectsAddedBeforeDate:date];
     [_diskCache trimToDate:date];
 }
 
@@ -386,17 +1024,306 @@ static NSString * const PINCacheSharedName = @"PINCacheShared";
 - (void)removeAllObjects
 {
     [_memoryCache removeAllObjects];
+    [self discardAllSerializedObjects];
+    [_writeBackQueue removeAllObjects];
+    [_negativeCache removeAllKeys];
     [_diskCache removeAllObjects];
 }
 
+- (NSUInteger)serializedMemoryByteLimit
+{
+    return _serializedMemoryCache.byteLimit;
+}
+
+- (void)setSerializedMemoryByteLimit:(NSUInteger)serializedMemoryByteLimit
+{
+    NSAssert(serializedMemoryByteLimit == 0 || !_memoryCache.isTTLCache, @"TTL caches don't use the serialized tier, since it would lose their age limits.");
+    _serializedMemoryCache.byteLimit = serializedMemoryByteLimit;
+}
+
+- (BOOL)compressesSerializedMemory
+{
+    return _serializedMemoryCache.compressesData;
+}
+
+- (void)setCompressesSerializedMemory:(BOOL)compressesSerializedMemory
+{
+    _serializedMemoryCache.compressesData = compressesSerializedMemory;
+}
+
+- (NSUInteger)serializedMemoryByteCount
+{
+    return _serializedMemoryCache.byteCount;
+}
+
+- (BOOL)writesBack
+{
+    return atomic_load(&_writesBack);
+}
+
+- (void)setWritesBack:(BOOL)writesBack
+{
+    atomic_store(&_writesBack, writesBack);
+    if (!writesBack)
+        [_writeBackQueue flush];
+}
+
+- (NSUInteger)maxPendingWriteBackObjects
+{
+    return _writeBackQueue.maxPendingObjects;
+}
+
+- (void)setMaxPendingWriteBackObjects:(NSUInteger)maxPendingWriteBackObjects
+{
+    _writeBackQueue.maxPendingObjects = maxPendingWriteBackObjects;
+}
+
+- (NSTimeInterval)maxWriteBackDelay
+{
+    return _writeBackQueue.maxPendingDelay;
+}
+
+- (void)setMaxWriteBackDelay:(NSTimeInterval)maxWriteBackDelay
+{
+    _writeBackQueue.maxPendingDelay = maxWriteBackDelay;
+}
+
+- (NSUInteger)pendingWriteBackCount
+{
+    return _writeBackQueue.pendingObjectCount;
+}
+
+- (NSTimeInterval)negativeCacheAgeLimit
+{
+    return _negativeCache.ageLimit;
+}
+
+- (void)setNegativeCacheAgeLimit:(NSTimeInterval)negativeCacheAgeLimit
+{
+    _negativeCache.ageLimit = negativeCacheAgeLimit;
+}
+
+- (NSUInteger)negativeCacheCountLimit
+{
+    return _negativeCache.countLimit;
+}
+
+- (void)setNegativeCacheCountLimit:(NSUInteger)negativeCacheCountLimit
+{
+    _negativeCache.countLimit = negativeCacheCountLimit;
+}
+
+- (NSTimeInterval)softAgeLimit
+{
+    return atomic_load(&_softAgeLimit);
+}
+
+- (void)setSoftAgeLimit:(NSTimeInterval)softAgeLimit
+{
+    atomic_store(&_softAgeLimit, softAgeLimit);
+}
+
+- (NSUInteger)maxConcurrentLoads
+{
+    return _loadQueue.maxConcurrentLoads;
+}
+
+- (void)setMaxConcurrentLoads:(NSUInteger)maxConcurrentLoads
+{
+    _loadQueue.maxConcurrentLoads = maxConcurrentLoads;
+}
+
+- (void)flush
+{
+    [_writeBackQueue flush];
+}
+
+- (void)flushAsync:(PINCacheBlock)block
+{
+    [self.operationQueue scheduleOperation:^{
+        [self->_writeBackQueue flush];
+        if (block)
+            block(self);
+    }];
+}
+
 - (NSUInteger)maxConcurrentOperations
 {
-    return _operationQueue.maxConcurrentOperations;
+    return _concurrencyController.maxConcurrentOperations;
 }
 
 - (void)setMaxConcurrentOperations:(NSUInteger)maxOperations
 {
-    _operationQueue.maxConcurrentOperations = maxOperations;
+    _concurrencyController.maxConcurrentOperations = maxOperations;
+}
+
+- (BOOL)adaptsConcurrencyToDiskLatency
+{
+    return _concurrencyController.adaptsToLatency;
+}
+
+- (void)setAdaptsConcurrencyToDiskLatency:(BOOL)adaptsConcurrencyToDiskLatency
+{
+    _concurrencyController.adaptsToLatency = adaptsConcurrencyToDiskLatency;
+}
+
+- (NSUInteger)concurrentOperations
+{
+    return _concurrencyController.concurrentOperations;
+}
+
+- (NSUInteger)maxConcurrentMemoryOperations
+{
+    return _memoryOperationQueue.maxConcurrentOperations;
+}
+
+- (void)setMaxConcurrentMemoryOperations:(NSUInteger)maxConcurrentMemoryOperations
+{
+    _memoryOperationQueue.maxConcurrentOperations = maxConcurrentMemoryOperations;
+}
+
+- (NSUInteger)maxConcurrentMaintenanceOperations
+{
+    return _maintenanceOperationQueue.maxConcurrentOperations;
+}
+
+- (void)setMaxConcurrentMaintenanceOperations:(NSUInteger)maxConcurrentMaintenanceOperations
+{
+    _maintenanceOperationQueue.maxConcurrentOperations = maxConcurrentMaintenanceOperations;
+}
+
+- (BOOL)statisticsEnabled
+{
+    return _statisticsRecorder.enabled;
+}
+
+- (void)setStatisticsEnabled:(BOOL)statisticsEnabled
+{
+    _statisticsRecorder.enabled = statisticsEnabled;
+    _memoryCache.statisticsEnabled = statisticsEnabled;
+    _diskCache.statisticsEnabled = statisticsEnabled;
+}
+
+- (PINCacheStatistics *)statistics
+{
+    return [_statisticsRecorder snapshot];
+}
+
+- (void)resetStatistics
+{
+    [_statisticsRecorder reset];
+    [_memoryCache resetStatistics];
+    [_diskCache resetStatistics];
+}
+
+#pragma mark - Public Prefetch Methods -
+
+- (NSProgress *)prefetchObjectsForKeys:(NSArray<NSString *> *)keys priority:(PINOperationQueuePriority)priority completion:(PINCachePrefetchBlock)completion
+{
+    NSArray<NSString *> *uniqueKeys = [[NSOrderedSet orderedSetWithArray:keys ?: @[]] array];
+    NSProgress *progress = [NSProgress discreteProgressWithTotalUnitCount:(int64_t)uniqueKeys.count];
+    NSUInteger ioDepth = MAX(self.prefetchIODepth, (NSUInteger)1);
+    
+    // Memory is checked on the memory lane, only the disk readers take I/O slots.
+    [_memoryOperationQueue scheduleOperation:^{
+        NSMutableDictionary<NSString *, id> *objects = [[NSMutableDictionary alloc] initWithCapacity:uniqueKeys.count];
+        NSMutableArray<NSString *> *diskKeys = [[NSMutableArray alloc] init];
+        for (NSString *key in uniqueKeys) {
+            id object = [self->_memoryCache objectForKey:key] ?: [self promoteObjectForKey:key];
+            if (object) {
+                objects[key] = object;
+                progress.completedUnitCount += 1;
+            } else {
+                [diskKeys addObject:key];
+            }
+        }
+        
+        if (diskKeys.count == 0 || progress.isCancelled) {
+            if (completion)
+                completion(self, objects);
+            return;
+        }
+        
+        // Each reader walks its own stride of the keys and fills its own dictionary and child progress, so readers
+        // never contend with each other; everything is merged and promoted to memory once all of them are done.
+        NSUInteger readerCount = MIN(ioDepth, diskKeys.count);
+        NSMutableArray<NSMutableDictionary<NSString *, id> *> *readerObjects = [[NSMutableArray alloc] initWithCapacity:readerCount];
+        PINOperationGroup *group = [PINOperationGroup asyncOperationGroupWithQueue:self->_operationQueue];
+        for (NSUInteger reader = 0; reader < readerCount; reader++) {
+            NSUInteger readerKeyCount = (diskKeys.count - reader + readerCount - 1) / readerCount;
+            NSProgress *readerProgress = [NSProgress progressWithTotalUnitCount:(int64_t)readerKeyCount
+                                                                         parent:progress
+                                                               pendingUnitCount:(int64_t)readerKeyCount];
+            NSMutableDictionary<NSString *, id> *found = [[NSMutableDictionary alloc] init];
+            [readerObjects addObject:found];
+            [group addOperation:^{
+                for (NSUInteger idx = reader; idx < diskKeys.count; idx += readerCount) {
+                    if (readerProgress.isCancelled)
+                        return;
+                    
+                    NSString *key = diskKeys[idx];
+                    id object = [self readObjectFromDiskForKey:key];
+                    if (object)
+                        found[key] = object;
+                    readerProgress.completedUnitCount += 1;
+                }
+            } withPriority:priority];
+        }
+        
+        [group setCompletion:^{
+            NSMutableArray<NSString *> *promotedKeys = [[NSMutableArray alloc] init];
+            NSMutableArray *promotedObjects = [[NSMutableArray alloc] init];
+            for (NSDictionary<NSString *, id> *found in readerObjects) {
+                [found enumerateKeysAndObjectsUsingBlock:^(NSString *key, id object, BOOL *stop) {
+                    [promotedKeys addObject:key];
+                    [promotedObjects addObject:object];
+                    objects[key] = object;
+                }];
+            }
+            
+            if (progress.isCancelled == NO)
+                [self->_memoryCache setObjects:promotedObjects forKeys:promotedKeys];
+            
+            if (completion)
+                completion(self, objects);
+        }];
+        [group start];
+    } withPriority:priority];
+    
+    return progress;
+}
+
+#pragma mark - Public Snapshot Methods -
+
+- (BOOL)exportSnapshotToURL:(NSURL *)archiveURL error:(NSError **)error
+{
+    // Everything in memory was also written to disk, or is waiting to be written back, so once the pending objects
+    // are written the disk cache has the whole picture.
+    [_writeBackQueue flush];
+    return [_diskCache exportSnapshotToURL:archiveURL error:error];
+}
+
+- (BOOL)importSnapshotFromURL:(NSURL *)archiveURL memoryObjectCount:(NSUInteger)memoryObjectCount error:(NSError **)error
+{
+    // Write pending objects first, so they can't be written later over the objects imported for the same keys.
+    [_writeBackQueue flush];
+
+    NSMutableArray<NSString *> *hottestKeys = [[NSMutableArray alloc] init];
+    NSMutableArray *hottestObjects = [[NSMutableArray alloc] init];
+    BOOL imported = [_diskCache importSnapshotFromURL:archiveURL
+                                   hottestObjectCount:memoryObjectCount
+                                   hottestObjectBlock:^(PINDiskCache *diskCache, NSString *key, id<NSCoding> object) {
+        [hottestKeys addObject:key];
+        [hottestObjects addObject:object];
+    } error:error];
+    [_negativeCache removeAllKeys];
+
+    // Coldest first, so the hottest objects end up most recently used in the memory cache too.
+    for (NSUInteger idx = hottestKeys.count; idx > 0; idx--) {
+        [_memoryCache setObject:hottestObjects[idx - 1] forKey:hottestKeys[idx - 1]];
+    }
+
+    return imported;
 }
 
 @end
@@ -0,0 +1,44 @@
+//
+//  PINCacheBinaryCoding.h
+//  PINCache
+//
+//  Copyright © 2017 Pinterest. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ Encodes a property list in the compact binary format the default serializer of <PINDiskCache> writes.
+
+ Supports `NSString`, `NSNumber`, `NSData`, `NSDate` and `NSNull`, and `NSArray` and `NSDictionary` made of them,
+ mutable or not. Objects come back decoded as the class `NSKeyedArchiver` would have archived them as, so mutable
+ collections stay mutable. Other classes, including subclasses that archive as themselves, aren't supported, nor are
+ strings that aren't valid Unicode or collections nested more than 512 deep.
+
+ The data starts with a four byte magic number and a version byte, so it can be told apart from data written by
+ `NSKeyedArchiver`, see <PINCacheIsBinaryEncodedData>.
+
+ @param object The object to encode.
+ @result The encoded object, or `nil` if it, or anything in it, isn't supported.
+ */
+FOUNDATION_EXTERN NSData * _Nullable PINCacheBinaryEncodedData(id object);
+
+/**
+ Whether the data starts like data returned by <PINCacheBinaryEncodedData>, of any version.
+
+ @param data The data to check.
+ @result `YES` if the data should be decoded with <PINCacheBinaryDecodedObject>.
+ */
+FOUNDATION_EXTERN BOOL PINCacheIsBinaryEncodedData(NSData *data);
+
+/**
+ Decodes data returned by <PINCacheBinaryEncodedData>.
+
+ @param data The data to decode.
+ @result The decoded object, or `nil` if the data is malformed or of a version this build can't read.
+ */
+FOUNDATION_EXTERN id _Nullable PINCacheBinaryDecodedObject(NSData *data);
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,540 @@
+//
+//  PINCacheBinaryCoding.m
+//  PINCache
+//
+//  Copyright © 2017 Pinterest. All rights reserved.
+//
+
+#import "PINCacheBinaryCoding.h"
+
+#import <stdlib.h>
+#import <string.h>
+
+// "PINB", followed by the version byte. NSKeyedArchiver's data starts with "bplist", so the two can't be confused.
+static const uint8_t PINCacheBinaryCodingMagic[4] = { 'P', 'I', 'N', 'B' };
+static const uint8_t PINCacheBinaryCodingVersion = 1;
+static const size_t PINCacheBinaryCodingHeaderLength = sizeof(PINCacheBinaryCodingMagic) + 1;
+
+// Deep enough for any real payload, shallow enough not to run out of stack, and a cycle of mutable collections ends
+// up here instead of recursing forever.
+static const NSUInteger PINCacheBinaryCodingMaximumDepth = 512;
+
+static const size_t PINCacheBinaryCodingInitialCapacity = 256;
+
+// Written before each value. Never renumber these, data written by earlier builds must keep decoding.
+typedef NS_ENUM(uint8_t, PINCacheBinaryCodingTag) {
+    PINCacheBinaryCodingTagNull = 0,
+    PINCacheBinaryCodingTagFalse = 1,
+    PINCacheBinaryCodingTagTrue = 2,
+    // Zigzag encoded varint.
+    PINCacheBinaryCodingTagInteger = 3,
+    // Varint, only for values above INT64_MAX.
+    PINCacheBinaryCodingTagUnsignedInteger = 4,
+    // Little endian IEEE 754.
+    PINCacheBinaryCodingTagFloat = 5,
+    PINCacheBinaryCodingTagDouble = 6,
+    // Varint byte count, then UTF-8.
+    PINCacheBinaryCodingTagString = 7,
+    PINCacheBinaryCodingTagMutableString = 8,
+    // Varint byte count, then the bytes.
+    PINCacheBinaryCodingTagData = 9,
+    PINCacheBinaryCodingTagMutableData = 10,
+    // Little endian double, seconds since the reference date.
+    PINCacheBinaryCodingTagDate = 11,
+    // Varint element count, then the elements.
+    PINCacheBinaryCodingTagArray = 12,
+    PINCacheBinaryCodingTagMutableArray = 13,
+    // Varint entry count, then each key followed by its value.
+    PINCacheBinaryCodingTagDictionary = 14,
+    PINCacheBinaryCodingTagMutableDictionary = 15,
+};
+
+#pragma mark - Encoding
+
+typedef struct {
+    uint8_t *bytes;
+    size_t length;
+    size_t capacity;
+} PINCacheBinaryEncoder;
+
+static BOOL PINCacheBinaryEncoderReserve(PINCacheBinaryEncoder *encoder, size_t extraLength)
+{
+    if (extraLength > SIZE_MAX - encoder->length) {
+        return NO;
+    }
+    size_t requiredCapacity = encoder->length + extraLength;
+    if (requiredCapacity <= encoder->capacity) {
+        return YES;
+    }
+    size_t capacity = encoder->capacity;
+    while (capacity < requiredCapacity) {
+        capacity = capacity > SIZE_MAX / 2 ? requiredCapacity : capacity * 2;
+    }
+    uint8_t *bytes = realloc(encoder->bytes, capacity);
+    if (bytes == NULL) {
+        return NO;
+    }
+    encoder->bytes = bytes;
+    encoder->capacity = capacity;
+    return YES;
+}
+
+static size_t PINCacheBinaryVarintLength(uint64_t value)
+{
+    size_t length = 1;
+    while (value >= 0x80) {
+        value >>= 7;
+        length++;
+    }
+    return length;
+}
+
+// The caller reserves the space.
+static void PINCacheBinaryEncoderWriteVarint(PINCacheBinaryEncoder *encoder, uint64_t value)
+{
+    while (value >= 0x80) {
+        encoder->bytes[encoder->length++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    encoder->bytes[encoder->length++] = (uint8_t)value;
+}
+
+static BOOL PINCacheBinaryEncodeTag(PINCacheBinaryEncoder *encoder, PINCacheBinaryCodingTag tag)
+{
+    if (!PINCacheBinaryEncoderReserve(encoder, 1)) {
+        return NO;
+    }
+    encoder->bytes[encoder->length++] = tag;
+    return YES;
+}
+
+static BOOL PINCacheBinaryEncodeTagAndVarint(PINCacheBinaryEncoder *encoder, PINCacheBinaryCodingTag tag, uint64_t value)
+{
+    if (!PINCacheBinaryEncoderReserve(encoder, 1 + PINCacheBinaryVarintLength(value))) {
+        return NO;
+    }
+    encoder->bytes[encoder->length++] = tag;
+    PINCacheBinaryEncoderWriteVarint(encoder, value);
+    return YES;
+}
+
+static BOOL PINCacheBinaryEncodeTagAndBytes(PINCacheBinaryEncoder *encoder, PINCacheBinaryCodingTag tag, const void *bytes, size_t length)
+{
+    if (!PINCacheBinaryEncodeTagAndVarint(encoder, tag, length) || !PINCacheBinaryEncoderReserve(encoder, length)) {
+        return NO;
+    }
+    if (length > 0) {
+        memcpy(encoder->bytes + encoder->length, bytes, length);
+        encoder->length += length;
+    }
+    return YES;
+}
+
+static BOOL PINCacheBinaryEncodeTagAndDouble(PINCacheBinaryEncoder *encoder, PINCacheBinaryCodingTag tag, double value)
+{
+    if (!PINCacheBinaryEncoderReserve(encoder, 1 + sizeof(uint64_t))) {
+        return NO;
+    }
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    bits = CFSwapInt64HostToLittle(bits);
+    encoder->bytes[encoder->length++] = tag;
+    memcpy(encoder->bytes + encoder->length, &bits, sizeof(bits));
+    encoder->length += sizeof(bits);
+    return YES;
+}
+
+static BOOL PINCacheBinaryEncodeNumber(PINCacheBinaryEncoder *encoder, NSNumber *number)
+{
+    CFNumberRef cfNumber = (__bridge CFNumberRef)number;
+    if (cfNumber == (CFNumberRef)kCFBooleanTrue) {
+        return PINCacheBinaryEncodeTag(encoder, PINCacheBinaryCodingTagTrue);
+    }
+    if (cfNumber == (CFNumberRef)kCFBooleanFalse) {
+        return PINCacheBinaryEncodeTag(encoder, PINCacheBinaryCodingTagFalse);
+    }
+
+    const char *type = [number objCType];
+    if (type[0] == 'f') {
+        if (!PINCacheBinaryEncoderReserve(encoder, 1 + sizeof(uint32_t))) {
+            return NO;
+        }
+        float value = [number floatValue];
+        uint32_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        bits = CFSwapInt32HostToLittle(bits);
+        encoder->bytes[encoder->length++] = PINCacheBinaryCodingTagFloat;
+        memcpy(encoder->bytes + encoder->length, &bits, sizeof(bits));
+        encoder->length += sizeof(bits);
+        return YES;
+    }
+    if (CFNumberIsFloatType(cfNumber)) {
+        return PINCacheBinaryEncodeTagAndDouble(encoder, PINCacheBinaryCodingTagDouble, [number doubleValue]);
+    }
+    if (type[0] == 'Q' || type[0] == 'L' || type[0] == 'I' || type[0] == 'S' || type[0] == 'C') {
+        unsigned long long value = [number unsignedLongLongValue];
+        if (value > INT64_MAX) {
+            return PINCacheBinaryEncodeTagAndVarint(encoder, PINCacheBinaryCodingTagUnsignedInteger, value);
+        }
+    }
+    int64_t value = [number longLongValue];
+    uint64_t zigzag = ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+    return PINCacheBinaryEncodeTagAndVarint(encoder, PINCacheBinaryCodingTagInteger, zigzag);
+}
+
+static BOOL PINCacheBinaryEncodeString(PINCacheBinaryEncoder *encoder, NSString *string, PINCacheBinaryCodingTag tag)
+{
+    CFStringRef cfString = (__bridge CFStringRef)string;
+    CFIndex characterCount = CFStringGetLength(cfString);
+    CFIndex maximumByteCount = CFStringGetMaximumSizeForEncoding(characterCount, kCFStringEncodingUTF8);
+    if (maximumByteCount == kCFNotFound) {
+        return NO;
+    }
+
+    // Convert straight into the buffer, leaving room for the longest the byte count can be, and close the gap if the
+    // actual count turns out shorter.
+    size_t maximumVarintLength = PINCacheBinaryVarintLength((uint64_t)maximumByteCount);
+    if (!PINCacheBinaryEncoderReserve(encoder, 1 + maximumVarintLength + (size_t)maximumByteCount)) {
+        return NO;
+    }
+    uint8_t *stringBytes = encoder->bytes + encoder->length + 1 + maximumVarintLength;
+    CFIndex byteCount = 0;
+    CFIndex convertedCount = CFStringGetBytes(cfString, CFRangeMake(0, characterCount), kCFStringEncodingUTF8, 0, false, stringBytes, maximumByteCount, &byteCount);
+    if (convertedCount != characterCount) {
+        // An unpaired surrogate, which UTF-8 can't hold.
+        return NO;
+    }
+
+    encoder->bytes[encoder->length++] = tag;
+    PINCacheBinaryEncoderWriteVarint(encoder, (uint64_t)byteCount);
+    if (encoder->bytes + encoder->length != stringBytes) {
+        memmove(encoder->bytes + encoder->length, stringBytes, (size_t)byteCount);
+    }
+    encoder->length += (size_t)byteCount;
+    return YES;
+}
+
+static struct {
+    Class string;
+    Class mutableString;
+    Class number;
+    Class data;
+    Class mutableData;
+    Class date;
+    Class array;
+    Class mutableArray;
+    Class dictionary;
+    Class mutableDictionary;
+    Class null;
+} PINCacheBinaryCodingClasses;
+
+static BOOL PINCacheBinaryEncodeObject(PINCacheBinaryEncoder *encoder, id object, NSUInteger depth)
+{
+    if (depth > PINCacheBinaryCodingMaximumDepth || ![object respondsToSelector:@selector(classForKeyedArchiver)]) {
+        return NO;
+    }
+
+    // Go by the class NSKeyedArchiver would archive the object as, so that what it decodes to doesn't change. This
+    // keeps mutable objects mutable, and leaves subclasses with their own archiving to NSKeyedArchiver.
+    Class archivedClass = [object classForKeyedArchiver];
+    if (archivedClass == PINCacheBinaryCodingClasses.string) {
+        return PINCacheBinaryEncodeString(encoder, object, PINCacheBinaryCodingTagString);
+    }
+    if (archivedClass == PINCacheBinaryCodingClasses.mutableString) {
+        return PINCacheBinaryEncodeString(encoder, object, PINCacheBinaryCodingTagMutableString);
+    }
+    if (archivedClass == PINCacheBinaryCodingClasses.number) {
+        return PINCacheBinaryEncodeNumber(encoder, object);
+    }
+    if (archivedClass == PINCacheBinaryCodingClasses.data || archivedClass == PINCacheBinaryCodingClasses.mutableData) {
+        NSData *data = object;
+        PINCacheBinaryCodingTag tag = archivedClass == PINCacheBinaryCodingClasses.data ? PINCacheBinaryCodingTagData : PINCacheBinaryCodingTagMutableData;
+        return PINCacheBinaryEncodeTagAndBytes(encoder, tag, data.bytes, data.length);
+    }
+    if (archivedClass == PINCacheBinaryCodingClasses.date) {
+        return PINCacheBinaryEncodeTagAndDouble(encoder, PINCacheBinaryCodingTagDate, [(NSDate *)object timeIntervalSinceReferenceDate]);
+    }
+    if (archivedClass == PINCacheBinaryCodingClasses.null) {
+        return PINCacheBinaryEncodeTag(encoder, PINCacheBinaryCodingTagNull);
+    }
+    if (archivedClass == PINCacheBinaryCodingClasses.array || archivedClass == PINCacheBinaryCodingClasses.mutableArray) {
+        NSArray *array = object;
+        PINCacheBinaryCodingTag tag = archivedClass == PINCacheBinaryCodingClasses.array ? PINCacheBinaryCodingTagArray : PINCacheBinaryCodingTagMutableArray;
+        if (!PINCacheBinaryEncodeTagAndVarint(encoder, tag, array.count)) {
+            return NO;
+        }
+        for (id element in array) {
+            if (!PINCacheBinaryEncodeObject(encoder, element, depth + 1)) {
+                return NO;
+            }
+        }
+        return YES;
+    }
+    if (archivedClass == PINCacheBinaryCodingClasses.dictionary || archivedClass == PINCacheBinaryCodingClasses.mutableDictionary) {
+        NSDictionary *dictionary = object;
+        PINCacheBinaryCodingTag tag = archivedClass == PINCacheBinaryCodingClasses.dictionary ? PINCacheBinaryCodingTagDictionary : PINCacheBinaryCodingTagMutableDictionary;
+        CFIndex count = CFDictionaryGetCount((__bridge CFDictionaryRef)dictionary);
+        if (!PINCacheBinaryEncodeTagAndVarint(encoder, tag, (uint64_t)count)) {
+            return NO;
+        }
+        if (count == 0) {
+            return YES;
+        }
+        // One pass over the entries rather than a lookup for each key.
+        const void **keysAndValues = malloc(sizeof(void *) * 2 * (size_t)count);
+        if (keysAndValues == NULL) {
+            return NO;
+        }
+        CFDictionaryGetKeysAndValues((__bridge CFDictionaryRef)dictionary, keysAndValues, keysAndValues + count);
+        BOOL encoded = YES;
+        for (CFIndex idx = 0; idx < count && encoded; idx++) {
+            encoded = PINCacheBinaryEncodeObject(encoder, (__bridge id)keysAndValues[idx], depth + 1) &&
+                      PINCacheBinaryEncodeObject(encoder, (__bridge id)keysAndValues[count + idx], depth + 1);
+        }
+        free(keysAndValues);
+        return encoded;
+    }
+    return NO;
+}
+
+static void PINCacheBinaryCodingLoadClasses(void)
+{
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        PINCacheBinaryCodingClasses.string = [NSString class];
+        PINCacheBinaryCodingClasses.mutableString = [NSMutableString class];
+        PINCacheBinaryCodingClasses.number = [NSNumber class];
+        PINCacheBinaryCodingClasses.data = [NSData class];
+        PINCacheBinaryCodingClasses.mutableData = [NSMutableData class];
+        PINCacheBinaryCodingClasses.date = [NSDate class];
+        PINCacheBinaryCodingClasses.array = [NSArray class];
+        PINCacheBinaryCodingClasses.mutableArray = [NSMutableArray class];
+        PINCacheBinaryCodingClasses.dictionary = [NSDictionary class];
+        PINCacheBinaryCodingClasses.mutableDictionary = [NSMutableDictionary class];
+        PINCacheBinaryCodingClasses.null = [NSNull class];
+    });
+}
+
+NSData *PINCacheBinaryEncodedData(id object)
+{
+    PINCacheBinaryCodingLoadClasses();
+
+    PINCacheBinaryEncoder encoder = { NULL, 0, 0 };
+    if (!PINCacheBinaryEncoderReserve(&encoder, PINCacheBinaryCodingInitialCapacity)) {
+        return nil;
+    }
+    memcpy(encoder.bytes, PINCacheBinaryCodingMagic, sizeof(PINCacheBinaryCodingMagic));
+    encoder.bytes[sizeof(PINCacheBinaryCodingMagic)] = PINCacheBinaryCodingVersion;
+    encoder.length = PINCacheBinaryCodingHeaderLength;
+
+    if (!PINCacheBinaryEncodeObject(&encoder, object, 0)) {
+        free(encoder.bytes);
+        return nil;
+    }
+
+    // The data may be kept in memory by the serialized memory tier, so don't hold on to the unused capacity.
+    uint8_t *bytes = realloc(encoder.bytes, encoder.length);
+    if (bytes != NULL) {
+        encoder.bytes = bytes;
+    }
+    return [[NSData alloc] initWithBytesNoCopy:encoder.bytes length:encoder.length freeWhenDone:YES];
+}
+
+#pragma mark - Decoding
+
+typedef struct {
+    const uint8_t *bytes;
+    size_t length;
+    size_t offset;
+} PINCacheBinaryDecoder;
+
+static BOOL PINCacheBinaryDecodeVarint(PINCacheBinaryDecoder *decoder, uint64_t *value)
+{
+    uint64_t result = 0;
+    for (unsigned int shift = 0; shift < 64; shift += 7) {
+        if (decoder->offset >= decoder->length) {
+            return NO;
+        }
+        uint8_t byte = decoder->bytes[decoder->offset++];
+        result |= (uint64_t)(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0) {
+            *value = result;
+            return YES;
+        }
+    }
+    return NO;
+}
+
+// A count of elements or bytes, which can't be more than the bytes left since every element takes at least one. This
+// keeps malformed data from asking for huge allocations.
+static BOOL PINCacheBinaryDecodeCount(PINCacheBinaryDecoder *decoder, size_t *count)
+{
+    uint64_t value;
+    if (!PINCacheBinaryDecodeVarint(decoder, &value) || value > decoder->length - decoder->offset) {
+        return NO;
+    }
+    *count = (size_t)value;
+    return YES;
+}
+
+static BOOL PINCacheBinaryDecodeDouble(PINCacheBinaryDecoder *decoder, double *value)
+{
+    uint64_t bits;
+    if (decoder->length - decoder->offset < sizeof(bits)) {
+        return NO;
+    }
+    memcpy(&bits, decoder->bytes + decoder->offset, sizeof(bits));
+    decoder->offset += sizeof(bits);
+    bits = CFSwapInt64LittleToHost(bits);
+    memcpy(value, &bits, sizeof(bits));
+    return YES;
+}
+
+static id PINCacheBinaryDecodeObject(PINCacheBinaryDecoder *decoder, NSUInteger depth)
+{
+    if (depth > PINCacheBinaryCodingMaximumDepth || decoder->offset >= decoder->length) {
+        return nil;
+    }
+
+    PINCacheBinaryCodingTag tag = decoder->bytes[decoder->offset++];
+    switch (tag) {
+        case PINCacheBinaryCodingTagNull:
+            return [NSNull null];
+        case PINCacheBinaryCodingTagFalse:
+            return @NO;
+        case PINCacheBinaryCodingTagTrue:
+            return @YES;
+        case PINCacheBinaryCodingTagInteger: {
+            uint64_t zigzag;
+            if (!PINCacheBinaryDecodeVarint(decoder, &zigzag)) {
+                return nil;
+            }
+            return @((int64_t)(zigzag >> 1) ^ -(int64_t)(zigzag & 1));
+        }
+        case PINCacheBinaryCodingTagUnsignedInteger: {
+            uint64_t value;
+            if (!PINCacheBinaryDecodeVarint(decoder, &value)) {
+                return nil;
+            }
+            return @((unsigned long long)value);
+        }
+        case PINCacheBinaryCodingTagFloat: {
+            uint32_t bits;
+            if (decoder->length - decoder->offset < sizeof(bits)) {
+                return nil;
+            }
+            memcpy(&bits, decoder->bytes + decoder->offset, sizeof(bits));
+            decoder->offset += sizeof(bits);
+            bits = CFSwapInt32LittleToHost(bits);
+            float value;
+            memcpy(&value, &bits, sizeof(value));
+            return @(value);
+        }
+        case PINCacheBinaryCodingTagDouble: {
+            double value;
+            return PINCacheBinaryDecodeDouble(decoder, &value) ? @(value) : nil;
+        }
+        case PINCacheBinaryCodingTagDate: {
+            double value;
+            return PINCacheBinaryDecodeDouble(decoder, &value) ? [[NSDate alloc] initWithTimeIntervalSinceReferenceDate:value] : nil;
+        }
+        case PINCacheBinaryCodingTagString:
+        case PINCacheBinaryCodingTagMutableString: {
+            size_t length;
+            if (!PINCacheBinaryDecodeCount(decoder, &length)) {
+                return nil;
+            }
+            const uint8_t *bytes = decoder->bytes + decoder->offset;
+            decoder->offset += length;
+            Class stringClass = tag == PINCacheBinaryCodingTagString ? [NSString class] : [NSMutableString class];
+            // Nil if the bytes aren't valid UTF-8.
+            return [[stringClass alloc] initWithBytes:bytes length:length encoding:NSUTF8StringEncoding];
+        }
+        case PINCacheBinaryCodingTagData:
+        case PINCacheBinaryCodingTagMutableData: {
+            size_t length;
+            if (!PINCacheBinaryDecodeCount(decoder, &length)) {
+                return nil;
+            }
+            const uint8_t *bytes = decoder->bytes + decoder->offset;
+            decoder->offset += length;
+            Class dataClass = tag == PINCacheBinaryCodingTagData ? [NSData class] : [NSMutableData class];
+            return [[dataClass alloc] initWithBytes:bytes length:length];
+        }
+        case PINCacheBinaryCodingTagArray:
+        case PINCacheBinaryCodingTagMutableArray:
+        case PINCacheBinaryCodingTagDictionary:
+        case PINCacheBinaryCodingTagMutableDictionary: {
+            BOOL isArray = tag == PINCacheBinaryCodingTagArray || tag == PINCacheBinaryCodingTagMutableArray;
+            size_t count;
+            if (!PINCacheBinaryDecodeCount(decoder, &count)) {
+                return nil;
+            }
+            // Decode into a buffer and create the collection from it in one go, rather than adding to it one by one.
+            size_t objectCount = isArray ? count : count * 2;
+            __strong id *objects = objectCount > 0 ? (__strong id *)calloc(objectCount, sizeof(id)) : NULL;
+            if (objectCount > 0 && objects == NULL) {
+                return nil;
+            }
+            BOOL decoded = YES;
+            for (size_t idx = 0; idx < count && decoded; idx++) {
+                if (isArray) {
+                    objects[idx] = PINCacheBinaryDecodeObject(decoder, depth + 1);
+                    decoded = objects[idx] != nil;
+                } else {
+                    // Keys in the first half, values in the second.
+                    objects[idx] = PINCacheBinaryDecodeObject(decoder, depth + 1);
+                    objects[count + idx] = objects[idx] ? PINCacheBinaryDecodeObject(decoder, depth + 1) : nil;
+                    decoded = objects[count + idx] != nil;
+                }
+            }
+            id collection = nil;
+            if (decoded) {
+                switch (tag) {
+                    case PINCacheBinaryCodingTagArray:
+                        collection = [[NSArray alloc] initWithObjects:objects count:count];
+                        break;
+                    case PINCacheBinaryCodingTagMutableArray:
+                        collection = [[NSMutableArray alloc] initWithObjects:objects count:count];
+                        break;
+                    case PINCacheBinaryCodingTagDictionary:
+                        collection = [[NSDictionary alloc] initWithObjects:objects + count forKeys:objects count:count];
+                        break;
+                    default:
+                        collection = [[NSMutableDictionary alloc] initWithObjects:objects + count forKeys:objects count:count];
+                        break;
+                }
+            }
+            // ARC doesn't release what a malloc'd buffer holds, so clear it before freeing it.
+            for (size_t idx = 0; idx < objectCount; idx++) {
+                objects[idx] = nil;
+            }
+            free(objects);
+            return collection;
+        }
+    }
+    return nil;
+}
+
+BOOL PINCacheIsBinaryEncodedData(NSData *data)
+{
+    return data.length >= PINCacheBinaryCodingHeaderLength && memcmp(data.bytes, PINCacheBinaryCodingMagic, sizeof(PINCacheBinaryCodingMagic)) == 0;
+}
+
+id PINCacheBinaryDecodedObject(NSData *data)
+{
+    if (!PINCacheIsBinaryEncodedData(data)) {
+        return nil;
+    }
+
+    const uint8_t *bytes = data.bytes;
+    if (bytes[sizeof(PINCacheBinaryCodingMagic)] != PINCacheBinaryCodingVersion) {
+        // Written by a newer build.
+        return nil;
+    }
+
+    PINCacheBinaryDecoder decoder = { bytes, data.length, PINCacheBinaryCodingHeaderLength };
+    id object = PINCacheBinaryDecodeObject(&decoder, 0);
+    // Trailing bytes mean the data isn't what it claims to be.
+    return decoder.offset == decoder.length ? object : nil;
+}
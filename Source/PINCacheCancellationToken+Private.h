@@ -0,0 +1,60 @@
+//
+//  PINCacheCancellationToken+Private.h
+//  PINCache
+//
+//  Copyright © 2017 Pinterest. All rights reserved.
+//
+
+#import "PINCacheCancellationToken.h"
+
+#import <PINOperation/PINOperation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+@class PINCacheStatisticsRecorder;
+
+/**
+ The token of the operation running on this thread, if it has one, so that the synchronous methods it calls can give
+ up early. Set and cleared by the operation, which keeps the token alive in between.
+ */
+FOUNDATION_EXTERN _Thread_local __unsafe_unretained PINCacheCancellationToken * _Nullable PINCacheCurrentCancellationToken;
+
+@interface PINCacheCancellationToken ()
+
+- (instancetype)initWithDeadline:(nullable NSDate *)deadline NS_DESIGNATED_INITIALIZER;
+
+/**
+ Whether the operation should be dropped, because the token was cancelled or its deadline passed. Counts the drop in
+ the recorder when it should.
+ */
+- (BOOL)shouldDropOperationForRecorder:(PINCacheStatisticsRecorder *)recorder;
+
+@end
+
+/**
+ The coalescing data of an operation that several requests may be coalesced into, each with its own data and its own
+ token or none. The requests are kept apart until the operation runs, so that only the data of the requests that
+ weren't dropped by then is merged: a cancelled request can't change what the others get.
+ */
+@interface PINCacheCancellableOperationData : NSObject
+
+- (instancetype)initWithData:(id)data
+           cancellationToken:(nullable PINCacheCancellationToken *)cancellationToken
+         dataCoalescingBlock:(PINOperationDataCoalescingBlock)dataCoalescingBlock NS_DESIGNATED_INITIALIZER;
+- (instancetype)init NS_UNAVAILABLE;
+
+/**
+ Coalesces instances of this class into the existing one. The data of requests without a token is merged with the
+ data coalescing block right away, requests with one are kept until the operation runs.
+ */
++ (PINOperationDataCoalescingBlock)coalescingBlock;
+
+/**
+ The data of the requests that weren't dropped, merged with the data coalescing block, or `nil` if every request was
+ dropped. Counts each dropped request in the recorder. Call once, when the operation runs.
+ */
+- (nullable id)dataOfRemainingRequestsForRecorder:(PINCacheStatisticsRecorder *)recorder;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,51 @@
+//
+//  PINCacheCancellationToken.h
+//  PINCache
+//
+//  Copyright © 2017 Pinterest. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+#import <PINCache/PINCacheMacros.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ Returned by the asynchronous methods that take a deadline, to call the operation off.
+
+ An operation that hasn't started when its token is cancelled or its deadline passes is dropped, and a disk read that
+ has started doesn't deserialize what it read. Once an operation is under way, the rest of it runs. A cancelled
+ operation's completion block isn't called, whether or not the work was done, since whoever asked no longer wants an
+ answer. An expired operation's block is still called as if the cache had nothing: reads get a `nil` object, and
+ other operations report back without having done their work. Dropped operations are counted in the cache's
+ statistics, see <[PINCacheStatistics cancelledCount]> and <[PINCacheStatistics expiredCount]>.
+ */
+PIN_SUBCLASSING_RESTRICTED
+@interface PINCacheCancellationToken : NSObject
+
+/**
+ When the operation stops being wanted, or `nil` if it's wanted until it's cancelled.
+ */
+@property (nullable, readonly) NSDate *deadline;
+
+/**
+ Whether <cancel> was called.
+ */
+@property (readonly, getter=isCancelled) BOOL cancelled;
+
+/**
+ Whether the <deadline> has passed.
+ */
+@property (readonly, getter=isExpired) BOOL expired;
+
+- (instancetype)init NS_UNAVAILABLE;
+
+/**
+ Calls the operation off. Does nothing if it has finished.
+ */
+- (void)cancel;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,144 @@
+//
+//  PINCacheCancellationToken.m
+//  PINCache
+//
+//  Copyright © 2017 Pinterest. All rights reserved.
+//
+
+#import "PINCacheCancellationToken+Private.h"
+#import "PINCacheStatistics+Private.h"
+
+#import <stdatomic.h>
+
+_Thread_local __unsafe_unretained PINCacheCancellationToken *PINCacheCurrentCancellationToken;
+
+@implementation PINCacheCancellationToken {
+    atomic_bool _cancelled;
+    // Checked by every operation before it starts, so kept as a number rather than compared as a date.
+    CFAbsoluteTime _deadlineTime;
+}
+
+- (instancetype)init
+{
+    @throw [NSException exceptionWithName:@"Cancellation tokens are made by the caches" reason:@"PINCacheCancellationToken is returned by the asynchronous methods that take a deadline, and can't be created directly." userInfo:nil];
+    return [self initWithDeadline:nil];
+}
+
+- (instancetype)initWithDeadline:(NSDate *)deadline
+{
+    if (self = [super init]) {
+        _deadline = [deadline copy];
+        _deadlineTime = deadline ? [deadline timeIntervalSinceReferenceDate] : 0.0;
+        atomic_init(&_cancelled, false);
+    }
+    return self;
+}
+
+#pragma mark - Public Methods -
+
+- (void)cancel
+{
+    atomic_store(&_cancelled, true);
+}
+
+#pragma mark - Private Methods -
+
+- (BOOL)shouldDropOperationForRecorder:(PINCacheStatisticsRecorder *)recorder
+{
+    if (self.cancelled) {
+        [recorder addCount:1 toCounter:PINCacheStatisticsCounterCancelled];
+        return YES;
+    }
+    if (self.expired) {
+        [recorder addCount:1 toCounter:PINCacheStatisticsCounterExpired];
+        return YES;
+    }
+    return NO;
+}
+
+#pragma mark - Public Thread Safe Accessors -
+
+- (BOOL)isCancelled
+{
+    return atomic_load(&_cancelled);
+}
+
+- (BOOL)isExpired
+{
+    return _deadlineTime > 0.0 && CFAbsoluteTimeGetCurrent() >= _deadlineTime;
+}
+
+@end
+
+@implementation PINCacheCancellableOperationData {
+    // Requests without a token can't be dropped, so their data is merged as they come in. Requests with one are kept,
+    // data and token at the same index, until the operation runs and knows which of them are still wanted.
+    id _untokenedData;
+    NSMutableArray *_tokenedRequestData;
+    NSMutableArray<PINCacheCancellationToken *> *_tokens;
+    PINOperationDataCoalescingBlock _dataCoalescingBlock;
+}
+
+- (instancetype)init
+{
+    @throw [NSException exceptionWithName:@"Must initialize with data" reason:@"PINCacheCancellableOperationData must be initialized with data. Call initWithData:cancellationToken:dataCoalescingBlock: instead." userInfo:nil];
+    return [self initWithData:[NSNull null] cancellationToken:nil dataCoalescingBlock:^id(id existingData, id newData) { return existingData; }];
+}
+
+- (instancetype)initWithData:(id)data cancellationToken:(PINCacheCancellationToken *)cancellationToken dataCoalescingBlock:(PINOperationDataCoalescingBlock)dataCoalescingBlock
+{
+    if (self = [super init]) {
+        if (cancellationToken) {
+            _tokenedRequestData = [[NSMutableArray alloc] initWithObjects:data, nil];
+            _tokens = [[NSMutableArray alloc] initWithObjects:cancellationToken, nil];
+        } else {
+            _untokenedData = data;
+        }
+        _dataCoalescingBlock = [dataCoalescingBlock copy];
+    }
+    return self;
+}
+
++ (PINOperationDataCoalescingBlock)coalescingBlock
+{
+    static PINOperationDataCoalescingBlock coalescingBlock;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        // The operation queue calls this under its lock, before the operation holding existingData starts, so
+        // existingData can take in newData's requests itself.
+        coalescingBlock = ^id(PINCacheCancellableOperationData *existingData, PINCacheCancellableOperationData *newData) {
+            [existingData addRequestsOfData:newData];
+            return existingData;
+        };
+    });
+    return coalescingBlock;
+}
+
+- (void)addRequestsOfData:(PINCacheCancellableOperationData *)data
+{
+    if (data->_untokenedData) {
+        _untokenedData = _untokenedData ? _dataCoalescingBlock(_untokenedData, data->_untokenedData) : data->_untokenedData;
+    }
+    if (data->_tokens.count > 0) {
+        if (_tokens == nil) {
+            _tokenedRequestData = [[NSMutableArray alloc] init];
+            _tokens = [[NSMutableArray alloc] init];
+        }
+        [_tokenedRequestData addObjectsFromArray:data->_tokenedRequestData];
+        [_tokens addObjectsFromArray:data->_tokens];
+    }
+}
+
+- (id)dataOfRemainingRequestsForRecorder:(PINCacheStatisticsRecorder *)recorder
+{
+    id data = _untokenedData;
+    for (NSUInteger idx = 0; idx < _tokens.count; idx++) {
+        if ([_tokens[idx] shouldDropOperationForRecorder:recorder]) {
+            continue;
+        }
+        data = data ? _dataCoalescingBlock(data, _tokenedRequestData[idx]) : _tokenedRequestData[idx];
+    }
+    return data;
+}
+
+@end
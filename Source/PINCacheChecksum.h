@@ -0,0 +1,20 @@
+//
+//  PINCacheChecksum.h
+//  PINCache
+//
+//  Copyright © 2017 Pinterest. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ Extends a CRC32C (Castagnoli) checksum with the given bytes. Pass `0` as `crc` to start a new checksum, and the
+ previous result to continue one, so data can be checksummed in chunks as it's read.
+ 
+ Uses the CPU's CRC32 instructions where they are available and a table driven implementation otherwise.
+ */
+FOUNDATION_EXTERN uint32_t PINCacheCRC32C(uint32_t crc, const void *bytes, size_t length);
+
+NS_ASSUME_NONNULL_END
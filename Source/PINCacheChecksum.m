@@ -0,0 +1,144 @@
+//
+//  PINCacheChecksum.m
+//  PINCache
+//
+//  Copyright © 2017 Pinterest. All rights reserved.
+//
+
+#import "PINCacheChecksum.h"
+
+#import <string.h>
+#import <sys/sysctl.h>
+
+#if defined(__aarch64__)
+#import <arm_acle.h>
+#elif defined(__x86_64__)
+#import <nmmintrin.h>
+#endif
+
+typedef uint32_t (*PINCacheCRC32CFunction)(uint32_t crc, const uint8_t *bytes, size_t length);
+
+// Reflected Castagnoli polynomial.
+static const uint32_t PINCacheCRC32CPolynomial = 0x82F63B78;
+
+static uint32_t PINCacheCRC32CTable[8][256];
+
+static void PINCacheCRC32CInitializeTable(void)
+{
+    for (uint32_t idx = 0; idx < 256; idx++) {
+        uint32_t crc = idx;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc & 1) ? (crc >> 1) ^ PINCacheCRC32CPolynomial : crc >> 1;
+        }
+        PINCacheCRC32CTable[0][idx] = crc;
+    }
+    for (uint32_t idx = 0; idx < 256; idx++) {
+        for (int slice = 1; slice < 8; slice++) {
+            uint32_t previous = PINCacheCRC32CTable[slice - 1][idx];
+            PINCacheCRC32CTable[slice][idx] = (previous >> 8) ^ PINCacheCRC32CTable[0][previous & 0xFF];
+        }
+    }
+}
+
+// Slicing-by-8, processes eight bytes per iteration with eight table lookups.
+static uint32_t PINCacheCRC32CSoftware(uint32_t crc, const uint8_t *bytes, size_t length)
+{
+    while (length >= 8) {
+        uint64_t word;
+        memcpy(&word, bytes, sizeof(word));
+        word ^= crc;
+        crc = PINCacheCRC32CTable[7][word & 0xFF] ^
+              PINCacheCRC32CTable[6][(word >> 8) & 0xFF] ^
+              PINCacheCRC32CTable[5][(word >> 16) & 0xFF] ^
+              PINCacheCRC32CTable[4][(word >> 24) & 0xFF] ^
+              PINCacheCRC32CTable[3][(word >> 32) & 0xFF] ^
+              PINCacheCRC32CTable[2][(word >> 40) & 0xFF] ^
+              PINCacheCRC32CTable[1][(word >> 48) & 0xFF] ^
+              PINCacheCRC32CTable[0][word >> 56];
+        bytes += 8;
+        length -= 8;
+    }
+    while (length > 0) {
+        crc = (crc >> 8) ^ PINCacheCRC32CTable[0][(crc ^ *bytes) & 0xFF];
+        bytes++;
+        length--;
+    }
+    return crc;
+}
+
+#if defined(__aarch64__)
+
+__attribute__((target("crc")))
+static uint32_t PINCacheCRC32CHardware(uint32_t crc, const uint8_t *bytes, size_t length)
+{
+    while (length >= 8) {
+        uint64_t word;
+        memcpy(&word, bytes, sizeof(word));
+        crc = __crc32cd(crc, word);
+        bytes += 8;
+        length -= 8;
+    }
+    while (length > 0) {
+        crc = __crc32cb(crc, *bytes);
+        bytes++;
+        length--;
+    }
+    return crc;
+}
+
+static BOOL PINCacheCRC32CHardwareAvailable(void)
+{
+    int available = 0;
+    size_t size = sizeof(available);
+    return sysctlbyname("hw.optional.armv8_crc32", &available, &size, NULL, 0) == 0 && available != 0;
+}
+
+#elif defined(__x86_64__)
+
+__attribute__((target("sse4.2")))
+static uint32_t PINCacheCRC32CHardware(uint32_t crc, const uint8_t *bytes, size_t length)
+{
+    uint64_t crc64 = crc;
+    while (length >= 8) {
+        uint64_t word;
+        memcpy(&word, bytes, sizeof(word));
+        crc64 = _mm_crc32_u64(crc64, word);
+        bytes += 8;
+        length -= 8;
+    }
+    crc = (uint32_t)crc64;
+    while (length > 0) {
+        crc = _mm_crc32_u8(crc, *bytes);
+        bytes++;
+        length--;
+    }
+    return crc;
+}
+
+static BOOL PINCacheCRC32CHardwareAvailable(void)
+{
+    return __builtin_cpu_supports("sse4.2");
+}
+
+#endif
+
+uint32_t PINCacheCRC32C(uint32_t crc, const void *bytes, size_t length)
+{
+    static PINCacheCRC32CFunction function;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+#if defined(__aarch64__) || defined(__x86_64__)
+        if (PINCacheCRC32CHardwareAvailable()) {
+            function = PINCacheCRC32CHardware;
+            return;
+        }
+#endif
+        PINCacheCRC32CInitializeTable();
+        function = PINCacheCRC32CSoftware;
+    });
+    
+    if (bytes == NULL || length == 0) {
+        return crc;
+    }
+    return ~function(~crc, (const uint8_t *)bytes, length);
+}
@@ -0,0 +1,56 @@
+//
+//  PINCacheConcurrencyController.h
+//  PINCache
+//
+//  Copyright © 2017 Pinterest. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+@class PINOperationQueue;
+
+/**
+ Sizes an operation queue doing disk I/O by the latency of that I/O. Latencies are averaged over windows of samples and
+ compared to the best window seen recently. When the average climbs well above it, the device is saturated and more
+ concurrency only lengthens its queue, so the limit is cut by a quarter. When the average stays close to it, the limit
+ grows by one. The limit always stays between <minConcurrentOperations> and <maxConcurrentOperations>.
+ */
+@interface PINCacheConcurrencyController : NSObject
+
+/**
+ The lowest the limit goes.
+ */
+@property (assign) NSUInteger minConcurrentOperations;
+
+/**
+ The highest the limit goes. Setting it below the current limit applies it straight away.
+ */
+@property (assign) NSUInteger maxConcurrentOperations;
+
+/**
+ Whether the limit follows latency. When `NO` the queue runs at <maxConcurrentOperations>. Defaults to `YES`.
+ */
+@property (assign) BOOL adaptsToLatency;
+
+/**
+ The limit currently applied to the queue.
+ */
+@property (readonly) NSUInteger concurrentOperations;
+
+- (instancetype)initWithOperationQueue:(PINOperationQueue *)operationQueue
+               minConcurrentOperations:(NSUInteger)minConcurrentOperations
+               maxConcurrentOperations:(NSUInteger)maxConcurrentOperations NS_DESIGNATED_INITIALIZER;
+- (instancetype)init NS_UNAVAILABLE;
+
+/**
+ Records how long one I/O operation on the queue took.
+
+ @param latency The duration, in seconds.
+ */
+- (void)recordLatency:(NSTimeInterval)latency;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,184 @@
+//
+//  PINCacheConcurrencyController.m
+//  PINCache
+//
+//  Copyright © 2017 Pinterest. All rights reserved.
+//
+
+#import "PINCacheConcurrencyController.h"
+
+#import <pthread.h>
+
+#import <PINOperation/PINOperation.h>
+
+// Enough samples to average out a single slow read.
+static const NSUInteger PINCacheConcurrencyControllerWindowSize = 16;
+// The best window is forgotten this often, so that a device that got slower for good is measured against itself.
+static const NSUInteger PINCacheConcurrencyControllerBaselineWindows = 32;
+// Latency above this multiple of the baseline means the device is saturated.
+static const double PINCacheConcurrencyControllerSaturatedRatio = 2.0;
+// Latency below this multiple of the baseline leaves room for more concurrency.
+static const double PINCacheConcurrencyControllerHeadroomRatio = 1.25;
+
+@interface PINCacheConcurrencyController ()
+@property (strong, nonatomic) PINOperationQueue *operationQueue;
+@property (assign, nonatomic) pthread_mutex_t mutex;
+@end
+
+@implementation PINCacheConcurrencyController {
+    NSUInteger _minConcurrentOperations;
+    NSUInteger _maxConcurrentOperations;
+    NSUInteger _concurrentOperations;
+    BOOL _adaptsToLatency;
+    NSUInteger _sampleCount;
+    NSTimeInterval _latencySum;
+    NSUInteger _windowCount;
+    NSTimeInterval _baselineLatency;
+}
+
+- (void)dealloc
+{
+    __unused int result = pthread_mutex_destroy(&_mutex);
+    NSCAssert(result == 0, @"Failed to destroy lock in PINCacheConcurrencyController %p. Code: %d", (void *)self, result);
+}
+
+- (instancetype)initWithOperationQueue:(PINOperationQueue *)operationQueue
+               minConcurrentOperations:(NSUInteger)minConcurrentOperations
+               maxConcurrentOperations:(NSUInteger)maxConcurrentOperations
+{
+    if (self = [super init]) {
+        __unused int result = pthread_mutex_init(&_mutex, NULL);
+        NSAssert(result == 0, @"Failed to init lock in PINCacheConcurrencyController %@. Code: %d", self, result);
+
+        _operationQueue = operationQueue;
+        _minConcurrentOperations = MAX(minConcurrentOperations, 1);
+        _maxConcurrentOperations = MAX(maxConcurrentOperations, _minConcurrentOperations);
+        _concurrentOperations = _maxConcurrentOperations;
+        _adaptsToLatency = YES;
+        _operationQueue.maxConcurrentOperations = _concurrentOperations;
+    }
+    return self;
+}
+
+#pragma mark - Public Methods -
+
+- (void)recordLatency:(NSTimeInterval)latency
+{
+    if (latency < 0.0)
+        return;
+
+    [self lock];
+        if (_adaptsToLatency) {
+            _latencySum += latency;
+            _sampleCount++;
+            if (_sampleCount >= PINCacheConcurrencyControllerWindowSize) {
+                NSTimeInterval averageLatency = _latencySum / _sampleCount;
+                _latencySum = 0.0;
+                _sampleCount = 0;
+
+                _windowCount++;
+                if (_baselineLatency <= 0.0 || averageLatency < _baselineLatency || _windowCount >= PINCacheConcurrencyControllerBaselineWindows) {
+                    _baselineLatency = averageLatency;
+                    _windowCount = 0;
+                }
+
+                NSUInteger limit = _concurrentOperations;
+                if (averageLatency > _baselineLatency * PINCacheConcurrencyControllerSaturatedRatio) {
+                    limit = MAX(_minConcurrentOperations, limit - limit / 4);
+                } else if (averageLatency < _baselineLatency * PINCacheConcurrencyControllerHeadroomRatio) {
+                    limit = MIN(_maxConcurrentOperations, limit + 1);
+                }
+                if (limit != _concurrentOperations) {
+                    _concurrentOperations = limit;
+                    // Under the lock, so that limits reach the queue in the order they were decided.
+                    _operationQueue.maxConcurrentOperations = limit;
+                }
+            }
+        }
+    [self unlock];
+}
+
+#pragma mark - Private Methods -
+
+- (void)_locked_clampConcurrentOperations
+{
+    NSUInteger limit = _adaptsToLatency ? _concurrentOperations : _maxConcurrentOperations;
+    _concurrentOperations = MIN(MAX(limit, _minConcurrentOperations), _maxConcurrentOperations);
+    _operationQueue.maxConcurrentOperations = _concurrentOperations;
+}
+
+#pragma mark - Public Thread Safe Accessors -
+
+- (NSUInteger)minConcurrentOperations
+{
+    [self lock];
+        NSUInteger minConcurrentOperations = _minConcurrentOperations;
+    [self unlock];
+    return minConcurrentOperations;
+}
+
+- (void)setMinConcurrentOperations:(NSUInteger)minConcurrentOperations
+{
+    [self lock];
+        _minConcurrentOperations = MAX(minConcurrentOperations, 1);
+        _maxConcurrentOperations = MAX(_maxConcurrentOperations, _minConcurrentOperations);
+        [self _locked_clampConcurrentOperations];
+    [self unlock];
+}
+
+- (NSUInteger)maxConcurrentOperations
+{
+    [self lock];
+        NSUInteger maxConcurrentOperations = _maxConcurrentOperations;
+    [self unlock];
+    return maxConcurrentOperations;
+}
+
+- (void)setMaxConcurrentOperations:(NSUInteger)maxConcurrentOperations
+{
+    [self lock];
+        _maxConcurrentOperations = MAX(maxConcurrentOperations, 1);
+        _minConcurrentOperations = MIN(_minConcurrentOperations, _maxConcurrentOperations);
+        [self _locked_clampConcurrentOperations];
+    [self unlock];
+}
+
+- (BOOL)adaptsToLatency
+{
+    [self lock];
+        BOOL adaptsToLatency = _adaptsToLatency;
+    [self unlock];
+    return adaptsToLatency;
+}
+
+- (void)setAdaptsToLatency:(BOOL)adaptsToLatency
+{
+    [self lock];
+        _adaptsToLatency = adaptsToLatency;
+        _latencySum = 0.0;
+        _sampleCount = 0;
+        [self _locked_clampConcurrentOperations];
+    [self unlock];
+}
+
+- (NSUInteger)concurrentOperations
+{
+    [self lock];
+        NSUInteger concurrentOperations = _concurrentOperations;
+    [self unlock];
+    return concurrentOperations;
+}
+
+- (void)lock
+{
+    __unused int result = pthread_mutex_lock(&_mutex);
+    NSAssert(result == 0, @"Failed to lock PINCacheConcurrencyController %@. Code: %d", self, result);
+}
+
+- (void)unlock
+{
+    __unused int result = pthread_mutex_unlock(&_mutex);
+    NSAssert(result == 0, @"Failed to unlock PINCacheConcurrencyController %@. Code: %d", self, result);
+}
+
+@end
@@ -0,0 +1,52 @@
+//
+//  PINCacheLinkedList.h
+//  PINCache
+//
+//  Copyright © 2017 Pinterest. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ An entry that can be linked into a <PINCacheLinkedList>. Cache entries subclass it to be kept in order without a
+ separate allocation per link.
+ */
+@interface PINCacheLinkedListNode : NSObject
+
+/**
+ The neighbours in the list the node is in, `nil` at either end or when it isn't in one.
+ */
+@property (nonatomic, readonly, unsafe_unretained, nullable) __kindof PINCacheLinkedListNode *prev;
+@property (nonatomic, readonly, unsafe_unretained, nullable) __kindof PINCacheLinkedListNode *next;
+
+@end
+
+/**
+ An intrusive doubly linked list, oldest node first. The list doesn't retain its nodes, whoever adds them has to keep
+ them alive until they're removed, usually in a dictionary by key. Not thread safe.
+ */
+@interface PINCacheLinkedList<NodeType : PINCacheLinkedListNode *> : NSObject
+
+@property (nonatomic, readonly, unsafe_unretained, nullable) NodeType head;
+@property (nonatomic, readonly, unsafe_unretained, nullable) NodeType tail;
+
+/**
+ Adds a node that isn't in a list at the tail.
+ */
+- (void)appendNode:(NodeType)node;
+
+/**
+ Unlinks a node from the list. Does nothing for `nil`.
+ */
+- (void)removeNode:(nullable NodeType)node;
+
+/**
+ Forgets every node. Nodes still linked aren't unlinked from each other, so they must not be added again.
+ */
+- (void)removeAllNodes;
+
+@end
+
+NS_ASSUME_NONNULL_END
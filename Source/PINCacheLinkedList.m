@@ -0,0 +1,72 @@
+//
+//  PINCacheLinkedList.m
+//  PINCache
+//
+//  Copyright © 2017 Pinterest. All rights reserved.
+//
+
+#import "PINCacheLinkedList.h"
+
+@interface PINCacheLinkedListNode ()
+@property (nonatomic, unsafe_unretained, nullable) __kindof PINCacheLinkedListNode *prev;
+@property (nonatomic, unsafe_unretained, nullable) __kindof PINCacheLinkedListNode *next;
+@end
+
+@implementation PINCacheLinkedListNode
+@end
+
+@implementation PINCacheLinkedList {
+    __unsafe_unretained PINCacheLinkedListNode *_head;
+    __unsafe_unretained PINCacheLinkedListNode *_tail;
+}
+
+- (PINCacheLinkedListNode *)head
+{
+    return _head;
+}
+
+- (PINCacheLinkedListNode *)tail
+{
+    return _tail;
+}
+
+- (void)appendNode:(PINCacheLinkedListNode *)node
+{
+    node.prev = _tail;
+    node.next = nil;
+    if (_tail) {
+        _tail.next = node;
+    } else {
+        _head = node;
+    }
+    _tail = node;
+}
+
+- (void)removeNode:(PINCacheLinkedListNode *)node
+{
+    if (node == nil)
+        return;
+
+    PINCacheLinkedListNode *prev = node.prev;
+    PINCacheLinkedListNode *next = node.next;
+    if (prev) {
+        prev.next = next;
+    } else {
+        _head = next;
+    }
+    if (next) {
+        next.prev = prev;
+    } else {
+        _tail = prev;
+    }
+    node.prev = nil;
+    node.next = nil;
+}
+
+- (void)removeAllNodes
+{
+    _head = nil;
+    _tail = nil;
+}
+
+@end
@@ -0,0 +1,63 @@
+//
+//  PINCacheLoadQueue.h
+//  PINCache
+//
+//  Copyright © 2017 Pinterest. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+#import "PINCache.h"
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ Called once a load has finished, with the loaded object, or `nil` if the loader didn't produce one.
+ */
+typedef void (^PINCacheLoadQueueCompletionBlock)(id _Nullable object);
+
+/**
+ The loads a <PINCache> is running for keys it missed. Callers asking for a key that is already being loaded wait for
+ that load instead of starting their own, so each key is loaded once however many callers miss it at the same time. At
+ most <maxConcurrentLoads> loaders run at once, the rest wait their turn in the order they were asked for.
+ */
+@interface PINCacheLoadQueue : NSObject
+
+/**
+ The most loaders allowed to run at once. `0` means no limit. Raising it starts waiting loads straight away.
+ */
+@property (assign) NSUInteger maxConcurrentLoads;
+
+/**
+ The number of keys being loaded, including those waiting for their turn.
+ */
+@property (readonly) NSUInteger loadCount;
+
+/**
+ Loaders run on a queue of their own, as wide as <maxConcurrentLoads>, so that a loader that blocks never takes a slot
+ from the cache's disk reads and writes.
+ */
+- (instancetype)initWithMaxConcurrentLoads:(NSUInteger)maxConcurrentLoads NS_DESIGNATED_INITIALIZER;
+- (instancetype)init NS_UNAVAILABLE;
+
+/**
+ Loads the object for a key, or joins the load already running for it.
+
+ @param key The key to load.
+ @param loader Called from the load queue to produce the object, unless a load for the key is already running.
+ @param lookup Called under the queue's lock when no load for the key is running, or nil. If it returns an object, one
+ stored by a load that finished after the caller missed, no load is started and the completion is called with it
+ straight away. Must be cheap and must not call back into the queue.
+ @param store Called from the load queue with a loaded object, before any completion runs, unless a load for the key
+ is already running.
+ @param completion Called once the load has finished and its object has been stored, or nil.
+ */
+- (void)loadObjectForKey:(NSString *)key
+                  loader:(PINCacheLoaderBlock)loader
+                  lookup:(nullable id _Nullable (^)(NSString *key))lookup
+                   store:(void (^)(id object))store
+              completion:(nullable PINCacheLoadQueueCompletionBlock)completion;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,225 @@
+//
+//  PINCacheLoadQueue.m
+//  PINCache
+//
+//  Copyright © 2017 Pinterest. All rights reserved.
+//
+
+#import "PINCacheLoadQueue.h"
+
+#import <pthread.h>
+#import <stdatomic.h>
+
+#import <PINOperation/PINOperation.h>
+
+@interface PINCacheLoad : NSObject
+@property (nonatomic, copy) NSString *key;
+@property (nonatomic, copy) PINCacheLoaderBlock loader;
+@property (nonatomic, copy) void (^store)(id object);
+// Everyone waiting for the load, guarded by the queue's lock.
+@property (nonatomic, strong) NSMutableArray<PINCacheLoadQueueCompletionBlock> *completions;
+- (BOOL)markFinished;
+@end
+
+@interface PINCacheLoadQueue ()
+@property (strong, nonatomic) PINOperationQueue *operationQueue;
+@property (strong, nonatomic) NSMutableDictionary<NSString *, PINCacheLoad *> *loads;
+@property (strong, nonatomic) NSMutableArray<PINCacheLoad *> *waitingLoads;
+@property (assign, nonatomic) pthread_mutex_t mutex;
+@end
+
+// How many loaders may be running on the queue at once when the number of loads isn't limited.
+static const NSUInteger PINCacheLoadQueueUnlimitedMaxConcurrentOperations = 16;
+
+static NSUInteger PINCacheLoadQueueMaxConcurrentOperations(NSUInteger maxConcurrentLoads)
+{
+    return maxConcurrentLoads > 0 ? maxConcurrentLoads : PINCacheLoadQueueUnlimitedMaxConcurrentOperations;
+}
+
+@implementation PINCacheLoadQueue {
+    NSUInteger _maxConcurrentLoads;
+    NSUInteger _runningLoadCount;
+}
+
+- (void)dealloc
+{
+    __unused int result = pthread_mutex_destroy(&_mutex);
+    NSCAssert(result == 0, @"Failed to destroy lock in PINCacheLoadQueue %p. Code: %d", (void *)self, result);
+}
+
+- (instancetype)initWithMaxConcurrentLoads:(NSUInteger)maxConcurrentLoads
+{
+    if (self = [super init]) {
+        __unused int result = pthread_mutex_init(&_mutex, NULL);
+        NSAssert(result == 0, @"Failed to init lock in PINCacheLoadQueue %@. Code: %d", self, result);
+
+        _operationQueue = [[PINOperationQueue alloc] initWithMaxConcurrentOperations:PINCacheLoadQueueMaxConcurrentOperations(maxConcurrentLoads)];
+        _loads = [[NSMutableDictionary alloc] init];
+        _waitingLoads = [[NSMutableArray alloc] init];
+        _maxConcurrentLoads = maxConcurrentLoads;
+    }
+    return self;
+}
+
+#pragma mark - Public Methods -
+
+- (void)loadObjectForKey:(NSString *)key
+                  loader:(PINCacheLoaderBlock)loader
+                  lookup:(id _Nullable (^)(NSString *key))lookup
+                   store:(void (^)(id object))store
+              completion:(PINCacheLoadQueueCompletionBlock)completion
+{
+    if (!key || !loader || !store)
+        return;
+
+    BOOL startsLoad = NO;
+    id storedObject = nil;
+    [self lock];
+        PINCacheLoad *load = _loads[key];
+        // A load that finished between the caller's miss and now stored its object before it was dropped from _loads,
+        // so checking again under the lock means the key is never loaded twice.
+        if (load == nil && lookup) {
+            storedObject = lookup(key);
+        }
+        if (load == nil && storedObject == nil) {
+            load = [[PINCacheLoad alloc] init];
+            load.key = key;
+            load.loader = loader;
+            load.store = store;
+            load.completions = [[NSMutableArray alloc] init];
+            _loads[key] = load;
+
+            if (_maxConcurrentLoads == 0 || _runningLoadCount < _maxConcurrentLoads) {
+                _runningLoadCount++;
+                startsLoad = YES;
+            } else {
+                [_waitingLoads addObject:load];
+            }
+        }
+        if (completion && load)
+            [load.completions addObject:completion];
+    [self unlock];
+
+    if (storedObject) {
+        if (completion)
+            completion(storedObject);
+        return;
+    }
+
+    if (startsLoad)
+        [self startLoad:load];
+}
+
+#pragma mark - Private Methods -
+
+- (void)startLoad:(PINCacheLoad *)load
+{
+    [self.operationQueue scheduleOperation:^{
+        load.loader(load.key, ^(id _Nullable object) {
+            // A loader calling back twice would store and complete twice.
+            if (![load markFinished]) {
+                NSCAssert(NO, @"The loader for %@ called its completion more than once.", load.key);
+                return;
+            }
+            [self.operationQueue scheduleOperation:^{
+                [self finishLoad:load object:object];
+            }];
+        });
+    }];
+}
+
+- (void)finishLoad:(PINCacheLoad *)load object:(id)object
+{
+    // Stored before the load is dropped, so that a caller arriving in between either joins it or hits the cache.
+    if (object)
+        load.store(object);
+
+    PINCacheLoad *nextLoad = nil;
+    [self lock];
+        [_loads removeObjectForKey:load.key];
+        NSArray<PINCacheLoadQueueCompletionBlock> *completions = [load.completions copy];
+        if (_waitingLoads.count > 0 && (_maxConcurrentLoads == 0 || _runningLoadCount <= _maxConcurrentLoads)) {
+            // The finished load's slot goes straight to the next one.
+            nextLoad = _waitingLoads.firstObject;
+            [_waitingLoads removeObjectAtIndex:0];
+        } else {
+            _runningLoadCount--;
+        }
+    [self unlock];
+
+    if (nextLoad)
+        [self startLoad:nextLoad];
+
+    for (PINCacheLoadQueueCompletionBlock completion in completions) {
+        completion(object);
+    }
+}
+
+#pragma mark - Public Thread Safe Accessors -
+
+- (NSUInteger)maxConcurrentLoads
+{
+    [self lock];
+        NSUInteger maxConcurrentLoads = _maxConcurrentLoads;
+    [self unlock];
+    return maxConcurrentLoads;
+}
+
+- (void)setMaxConcurrentLoads:(NSUInteger)maxConcurrentLoads
+{
+    NSMutableArray<PINCacheLoad *> *startedLoads = [[NSMutableArray alloc] init];
+    [self lock];
+        _maxConcurrentLoads = maxConcurrentLoads;
+        self.operationQueue.maxConcurrentOperations = PINCacheLoadQueueMaxConcurrentOperations(maxConcurrentLoads);
+        while (_waitingLoads.count > 0 && (_maxConcurrentLoads == 0 || _runningLoadCount < _maxConcurrentLoads)) {
+            [startedLoads addObject:_waitingLoads.firstObject];
+            [_waitingLoads removeObjectAtIndex:0];
+            _runningLoadCount++;
+        }
+    [self unlock];
+
+    for (PINCacheLoad *load in startedLoads) {
+        [self startLoad:load];
+    }
+}
+
+- (NSUInteger)loadCount
+{
+    [self lock];
+        NSUInteger loadCount = _loads.count;
+    [self unlock];
+    return loadCount;
+}
+
+- (void)lock
+{
+    __unused int result = pthread_mutex_lock(&_mutex);
+    NSAssert(result == 0, @"Failed to lock PINCacheLoadQueue %@. Code: %d", self, result);
+}
+
+- (void)unlock
+{
+    __unused int result = pthread_mutex_unlock(&_mutex);
+    NSAssert(result == 0, @"Failed to unlock PINCacheLoadQueue %@. Code: %d", self, result);
+}
+
+@end
+
+@implementation PINCacheLoad {
+    atomic_flag _finished;
+}
+
+- (instancetype)init
+{
+    if (self = [super init]) {
+        atomic_flag_clear(&_finished);
+    }
+    return self;
+}
+
+- (BOOL)markFinished
+{
+    return !atomic_flag_test_and_set(&_finished);
+}
+
+@end
@@ -0,0 +1,71 @@
+//
+//  PINCacheNegativeCache.h
+//  PINCache
+//
+//  Copyright © 2017 Pinterest. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ A bounded set of keys recently confirmed missing from every tier of a <PINCache>, each remembered for <ageLimit>
+ seconds, so that repeated misses are answered without searching the tiers. The oldest keys are forgotten first once
+ <countLimit> is reached.
+
+ Lookups and invalidations race: a miss seen before an object was set must not be remembered after it. Every
+ invalidation bumps a generation, and a miss is only remembered if no invalidation happened since its lookup began.
+ */
+@interface PINCacheNegativeCache : NSObject
+
+/**
+ How long a miss is remembered, in seconds. `0` disables the cache and forgets every key.
+ */
+@property (assign) NSTimeInterval ageLimit;
+
+/**
+ The most keys remembered. Setting it forgets the oldest keys beyond it.
+ */
+@property (assign) NSUInteger countLimit;
+
+/**
+ The number of keys remembered, including any that have expired but haven't been looked up since.
+ */
+@property (readonly) NSUInteger count;
+
+- (instancetype)initWithCountLimit:(NSUInteger)countLimit NS_DESIGNATED_INITIALIZER;
+- (instancetype)init NS_UNAVAILABLE;
+
+/**
+ Whether a key is known to be missing. Must be called before the tiers are searched for it.
+
+ @param key The key being looked up.
+ @param generation Set to the generation to pass to <addKey:generation:> if the lookup misses.
+ @result YES if the key is known to be missing and the tiers don't need to be searched.
+ */
+- (BOOL)containsKey:(NSString *)key generation:(uint64_t *)generation;
+
+/**
+ Remembers that a key is missing, unless the cache was invalidated since <containsKey:generation:> returned generation.
+ */
+- (void)addKey:(NSString *)key generation:(uint64_t)generation;
+
+/**
+ Forgets a key. Must be called after an object is stored in, or removed from, any tier.
+ */
+- (void)removeKey:(NSString *)key;
+
+/**
+ Forgets the keys that start with a prefix. Must be called after objects are removed from the tiers by prefix.
+ */
+- (void)removeKeysWithPrefix:(NSString *)prefix;
+
+/**
+ Forgets every key.
+ */
+- (void)removeAllKeys;
+
+@end
+
+NS_ASSUME_NONNULL_END
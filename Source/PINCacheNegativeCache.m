@@ -0,0 +1,218 @@
+//
+//  PINCacheNegativeCache.m
+//  PINCache
+//
+//  Copyright © 2017 Pinterest. All rights reserved.
+//
+
+#import "PINCacheNegativeCache.h"
+
+#import <pthread.h>
+#import <stdatomic.h>
+
+#import "PINCacheLinkedList.h"
+
+// Goes through +[NSDate date] rather than CFAbsoluteTimeGetCurrent() so that the tests can move time forward.
+static inline CFAbsoluteTime PINCacheNegativeCacheCurrentTime(void)
+{
+    return [[NSDate date] timeIntervalSinceReferenceDate];
+}
+
+// Linked in insertion order, oldest first. Entries are owned by the dictionary.
+@interface PINCacheNegativeCacheEntry : PINCacheLinkedListNode
+@property (nonatomic, copy) NSString *key;
+@property (nonatomic) CFAbsoluteTime expirationTime;
+@end
+
+@interface PINCacheNegativeCache ()
+@property (strong, nonatomic) NSMutableDictionary<NSString *, PINCacheNegativeCacheEntry *> *entries;
+@property (assign, nonatomic) pthread_mutex_t mutex;
+@end
+
+@implementation PINCacheNegativeCache {
+    // Read without the lock so that a disabled cache costs nothing.
+    _Atomic(NSTimeInterval) _ageLimit;
+    NSUInteger _countLimit;
+    // Bumped by every invalidation, even while disabled, so that a lookup that began before it can tell.
+    _Atomic(uint64_t) _generation;
+    PINCacheLinkedList<PINCacheNegativeCacheEntry *> *_insertionList;
+}
+
+- (void)dealloc
+{
+    __unused int result = pthread_mutex_destroy(&_mutex);
+    NSCAssert(result == 0, @"Failed to destroy lock in PINCacheNegativeCache %p. Code: %d", (void *)self, result);
+}
+
+- (instancetype)initWithCountLimit:(NSUInteger)countLimit
+{
+    if (self = [super init]) {
+        __unused int result = pthread_mutex_init(&_mutex, NULL);
+        NSAssert(result == 0, @"Failed to init lock in PINCacheNegativeCache %@. Code: %d", self, result);
+
+        _entries = [[NSMutableDictionary alloc] init];
+        _insertionList = [[PINCacheLinkedList alloc] init];
+        _countLimit = countLimit;
+    }
+    return self;
+}
+
+#pragma mark - Public Methods -
+
+- (BOOL)containsKey:(NSString *)key generation:(uint64_t *)generation
+{
+    *generation = atomic_load_explicit(&_generation, memory_order_acquire);
+    if (atomic_load_explicit(&_ageLimit, memory_order_relaxed) <= 0.0)
+        return NO;
+
+    [self lock];
+        PINCacheNegativeCacheEntry *entry = _entries[key];
+        BOOL containsKey = NO;
+        if (entry) {
+            if (entry.expirationTime > PINCacheNegativeCacheCurrentTime()) {
+                containsKey = YES;
+            } else {
+                [self _locked_removeEntry:entry];
+            }
+        }
+    [self unlock];
+    return containsKey;
+}
+
+- (void)addKey:(NSString *)key generation:(uint64_t)generation
+{
+    NSTimeInterval ageLimit = atomic_load_explicit(&_ageLimit, memory_order_relaxed);
+    if (!key || ageLimit <= 0.0)
+        return;
+
+    CFAbsoluteTime expirationTime = PINCacheNegativeCacheCurrentTime() + ageLimit;
+    [self lock];
+        if (generation == atomic_load_explicit(&_generation, memory_order_relaxed) && _countLimit > 0) {
+            [self _locked_removeEntry:_entries[key]];
+
+            PINCacheNegativeCacheEntry *entry = [[PINCacheNegativeCacheEntry alloc] init];
+            entry.key = key;
+            entry.expirationTime = expirationTime;
+            _entries[entry.key] = entry;
+            [_insertionList appendNode:entry];
+
+            [self _locked_trimToCountLimit:_countLimit];
+        }
+    [self unlock];
+}
+
+- (void)removeKey:(NSString *)key
+{
+    if (!key)
+        return;
+
+    atomic_fetch_add_explicit(&_generation, 1, memory_order_release);
+    if (atomic_load_explicit(&_ageLimit, memory_order_relaxed) <= 0.0)
+        return;
+
+    [self lock];
+        [self _locked_removeEntry:_entries[key]];
+    [self unlock];
+}
+
+- (void)removeKeysWithPrefix:(NSString *)prefix
+{
+    if (!prefix)
+        return;
+
+    [self lock];
+        atomic_fetch_add_explicit(&_generation, 1, memory_order_relaxed);
+        PINCacheNegativeCacheEntry *entry = _insertionList.head;
+        while (entry) {
+            PINCacheNegativeCacheEntry *next = entry.next;
+            if ([entry.key hasPrefix:prefix])
+                [self _locked_removeEntry:entry];
+            entry = next;
+        }
+    [self unlock];
+}
+
+- (void)removeAllKeys
+{
+    [self lock];
+        atomic_fetch_add_explicit(&_generation, 1, memory_order_relaxed);
+        [_entries removeAllObjects];
+        [_insertionList removeAllNodes];
+    [self unlock];
+}
+
+#pragma mark - Private Methods -
+
+- (void)_locked_removeEntry:(PINCacheNegativeCacheEntry *)entry
+{
+    if (entry == nil)
+        return;
+
+    [_insertionList removeNode:entry];
+    [_entries removeObjectForKey:entry.key];
+}
+
+- (void)_locked_trimToCountLimit:(NSUInteger)countLimit
+{
+    while (_entries.count > countLimit && _insertionList.head) {
+        [self _locked_removeEntry:_insertionList.head];
+    }
+}
+
+#pragma mark - Public Thread Safe Accessors -
+
+- (NSTimeInterval)ageLimit
+{
+    return atomic_load_explicit(&_ageLimit, memory_order_relaxed);
+}
+
+- (void)setAgeLimit:(NSTimeInterval)ageLimit
+{
+    [self lock];
+        atomic_store_explicit(&_ageLimit, ageLimit, memory_order_relaxed);
+    [self unlock];
+
+    if (ageLimit <= 0.0)
+        [self removeAllKeys];
+}
+
+- (NSUInteger)countLimit
+{
+    [self lock];
+        NSUInteger countLimit = _countLimit;
+    [self unlock];
+    return countLimit;
+}
+
+- (void)setCountLimit:(NSUInteger)countLimit
+{
+    [self lock];
+        _countLimit = countLimit;
+        [self _locked_trimToCountLimit:countLimit];
+    [self unlock];
+}
+
+- (NSUInteger)count
+{
+    [self lock];
+        NSUInteger count = _entries.count;
+    [self unlock];
+    return count;
+}
+
+- (void)lock
+{
+    __unused int result = pthread_mutex_lock(&_mutex);
+    NSAssert(result == 0, @"Failed to lock PINCacheNegativeCache %@. Code: %d", self, result);
+}
+
+- (void)unlock
+{
+    __unused int result = pthread_mutex_unlock(&_mutex);
+    NSAssert(result == 0, @"Failed to unlock PINCacheNegativeCache %@. Code: %d", self, result);
+}
+
+@end
+
+@implementation PINCacheNegativeCacheEntry
+@end
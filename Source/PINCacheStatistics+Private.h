@@ -0,0 +1,72 @@
+//
+//  PINCacheStatistics+Private.h
+//  PINCache
+//
+//  Copyright © 2017 Pinterest. All rights reserved.
+//
+
+#import "PINCacheStatistics.h"
+
+NS_ASSUME_NONNULL_BEGIN
+
+typedef NS_ENUM(NSUInteger, PINCacheStatisticsCounter) {
+    PINCacheStatisticsCounterHit = 0,
+    PINCacheStatisticsCounterMiss,
+    PINCacheStatisticsCounterSet,
+    PINCacheStatisticsCounterPromotion,
+    PINCacheStatisticsCounterCostEviction,
+    PINCacheStatisticsCounterAgeEviction,
+    PINCacheStatisticsCounterMemoryWarningEviction,
+    PINCacheStatisticsCounterBytesRead,
+    PINCacheStatisticsCounterBytesWritten,
+    PINCacheStatisticsCounterCancelled,
+    PINCacheStatisticsCounterExpired,
+    PINCacheStatisticsCounterCount,
+};
+
+typedef NS_ENUM(NSUInteger, PINCacheStatisticsOperation) {
+    PINCacheStatisticsOperationRead = 0,
+    PINCacheStatisticsOperationWrite,
+    PINCacheStatisticsOperationCount,
+};
+
+/**
+ Collects the statistics of one cache. Every thread adds to its own stripe of counters and histogram buckets with
+ relaxed atomics, so recording never takes a lock or bounces a cache line between cores; stripes are only summed by
+ <snapshot>. While disabled, recording costs one atomic load, and <startOperation> doesn't read the clock.
+ */
+@interface PINCacheStatisticsRecorder : NSObject
+
+/**
+ Whether anything is recorded. Histogram storage is allocated the first time it's turned on. Defaults to `NO`.
+ */
+@property (assign, getter=isEnabled) BOOL enabled;
+
+/**
+ Adds to a counter, if enabled.
+ */
+- (void)addCount:(uint64_t)count toCounter:(PINCacheStatisticsCounter)counter;
+
+/**
+ The time an operation starts, to pass to <endOperation:startTime:>, or `0` if disabled.
+ */
+- (uint64_t)startOperation;
+
+/**
+ Records the latency of an operation started with <startOperation>. Does nothing if startTime is `0`.
+ */
+- (void)endOperation:(PINCacheStatisticsOperation)operation startTime:(uint64_t)startTime;
+
+/**
+ Sums every thread's counters and buckets.
+ */
+- (PINCacheStatistics *)snapshot;
+
+/**
+ Zeroes every counter and bucket. Operations recorded while resetting may survive it.
+ */
+- (void)reset;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,160 @@
+//
+//  PINCacheStatistics.h
+//  PINCache
+//
+//  Copyright © 2017 Pinterest. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+#import <PINCache/PINCacheMacros.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ Why a cache evicted objects. Objects removed by key, or all at once, aren't evictions.
+ */
+typedef NS_ENUM(NSInteger, PINCacheEvictionReason) {
+    /// To get under a cost or byte limit, whether the cache's own or one passed to a trim method.
+    PINCacheEvictionReasonCost = 0,
+    /// Because the object outlived its age limit, or was older than the date passed to a trim method.
+    PINCacheEvictionReasonAge,
+    /// Because the app received a memory warning.
+    PINCacheEvictionReasonMemoryWarning,
+};
+
+/**
+ The distribution of an operation's latencies, kept in logarithmic buckets the way HDR histograms do, so that every
+ reported latency is within about 3% of a latency that was actually recorded, from a nanosecond up to about 18 minutes.
+ */
+PIN_SUBCLASSING_RESTRICTED
+@interface PINCacheLatencyHistogram : NSObject
+
+/**
+ The number of latencies recorded.
+ */
+@property (readonly) uint64_t count;
+
+/**
+ The mean latency, in seconds. `0` if none were recorded.
+ */
+@property (readonly) NSTimeInterval mean;
+
+/**
+ The lowest latency recorded, in seconds. `0` if none were recorded.
+ */
+@property (readonly) NSTimeInterval minimum;
+
+/**
+ The highest latency recorded, in seconds. `0` if none were recorded.
+ */
+@property (readonly) NSTimeInterval maximum;
+
+/**
+ The median latency, in seconds.
+ */
+@property (readonly) NSTimeInterval p50;
+
+/**
+ The latency 99% of operations were at or under, in seconds.
+ */
+@property (readonly) NSTimeInterval p99;
+
+/**
+ The latency 99.9% of operations were at or under, in seconds.
+ */
+@property (readonly) NSTimeInterval p999;
+
+- (instancetype)init NS_UNAVAILABLE;
+
+/**
+ The latency a given share of operations were at or under.
+
+ @param percentile A percentage, between `0` and `100`.
+ @result The latency, in seconds, or `0` if none were recorded.
+ */
+- (NSTimeInterval)latencyAtPercentile:(double)percentile;
+
+@end
+
+/**
+ A snapshot of what a cache has done since statistics were enabled or last reset. Counters are kept per thread and
+ summed when the snapshot is taken, so operations running at the same time may or may not be included. Counters that
+ don't apply to a cache stay at `0`: only a <PINDiskCache> reads and writes bytes, and only a <PINCache> promotes.
+ */
+PIN_SUBCLASSING_RESTRICTED
+@interface PINCacheStatistics : NSObject
+
+/**
+ The number of lookups that found an object. Batch lookups count once per key.
+ */
+@property (readonly) uint64_t hitCount;
+
+/**
+ The number of lookups that found nothing, including objects that had expired.
+ */
+@property (readonly) uint64_t missCount;
+
+/**
+ The share of lookups that found an object, between `0` and `1`. `0` if there were none.
+ */
+@property (readonly) double hitRate;
+
+/**
+ The number of objects set.
+ */
+@property (readonly) uint64_t setCount;
+
+/**
+ The number of objects found below the memory cache and moved back into it.
+ */
+@property (readonly) uint64_t promotionCount;
+
+/**
+ The number of objects evicted, for any reason.
+ */
+@property (readonly) uint64_t evictionCount;
+
+/**
+ The number of bytes read from disk.
+ */
+@property (readonly) uint64_t bytesRead;
+
+/**
+ The number of bytes written to disk.
+ */
+@property (readonly) uint64_t bytesWritten;
+
+/**
+ The number of asynchronous operations dropped because their <PINCacheCancellationToken> was cancelled.
+ */
+@property (readonly) uint64_t cancelledCount;
+
+/**
+ The number of asynchronous operations dropped because the deadline of their <PINCacheCancellationToken> passed. A
+ count that grows means the cache is asked for more than it can answer in time, and callers should shed load.
+ */
+@property (readonly) uint64_t expiredCount;
+
+/**
+ The latencies of single object lookups, hits and misses alike.
+ */
+@property (readonly) PINCacheLatencyHistogram *readLatency;
+
+/**
+ The latencies of single object sets.
+ */
+@property (readonly) PINCacheLatencyHistogram *writeLatency;
+
+- (instancetype)init NS_UNAVAILABLE;
+
+/**
+ The number of objects evicted for a reason.
+
+ @param reason The reason to count.
+ */
+- (uint64_t)evictionCountForReason:(PINCacheEvictionReason)reason;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,410 @@
+//
+//  PINCacheStatistics.m
+//  PINCache
+//
+//  Copyright © 2017 Pinterest. All rights reserved.
+//
+
+#import "PINCacheStatistics+Private.h"
+
+#import <stdatomic.h>
+#import <stdlib.h>
+#import <time.h>
+
+// Latencies are kept in nanoseconds. Below twice the sub-bucket count every nanosecond has its own bucket; above it,
+// each power of two is split into 32 buckets, so a bucket is never wider than 1/32 of the values it holds. These are
+// an enum, rather than constants, because they size the arrays below.
+enum {
+    PINCacheStatisticsSubBucketBits = 5,
+    PINCacheStatisticsSubBucketCount = 1 << PINCacheStatisticsSubBucketBits,
+    PINCacheStatisticsMaxValueBits = 40,
+    // Values of each bit length from SubBucketBits + 1 to MaxValueBits start one row of sub-buckets past the first two.
+    PINCacheStatisticsBucketCount = (PINCacheStatisticsMaxValueBits - PINCacheStatisticsSubBucketBits + 1) * PINCacheStatisticsSubBucketCount,
+};
+
+// Threads are spread over this many stripes. Counters are small, so there are more of them than of histograms.
+static const NSUInteger PINCacheStatisticsCounterStripeCount = 16;
+static const NSUInteger PINCacheStatisticsHistogramStripeCount = 4;
+static const size_t PINCacheStatisticsCacheLineSize = 128;
+
+typedef struct {
+    _Atomic(uint64_t) counters[PINCacheStatisticsCounterCount];
+} PINCacheStatisticsCounterStripe;
+
+typedef struct {
+    _Atomic(uint64_t) buckets[PINCacheStatisticsBucketCount];
+    _Atomic(uint64_t) sum;
+} PINCacheStatisticsHistogram;
+
+typedef struct {
+    PINCacheStatisticsHistogram histograms[PINCacheStatisticsOperationCount];
+} PINCacheStatisticsHistogramStripe;
+
+// Counter stripes are padded apart so that two threads never write the same cache line.
+static inline size_t PINCacheStatisticsCounterStripeSize(void)
+{
+    size_t size = sizeof(PINCacheStatisticsCounterStripe);
+    return (size + PINCacheStatisticsCacheLineSize - 1) / PINCacheStatisticsCacheLineSize * PINCacheStatisticsCacheLineSize;
+}
+
+static _Thread_local NSUInteger PINCacheStatisticsThreadNumber;
+static atomic_uint_fast32_t PINCacheStatisticsNextThreadNumber;
+
+// Threads are numbered in the order they first record, which spreads them over the stripes evenly.
+static inline NSUInteger PINCacheStatisticsCurrentThreadNumber(void)
+{
+    NSUInteger threadNumber = PINCacheStatisticsThreadNumber;
+    if (threadNumber == 0) {
+        threadNumber = (NSUInteger)atomic_fetch_add_explicit(&PINCacheStatisticsNextThreadNumber, 1, memory_order_relaxed) + 1;
+        PINCacheStatisticsThreadNumber = threadNumber;
+    }
+    return threadNumber - 1;
+}
+
+static inline uint64_t PINCacheStatisticsCurrentTime(void)
+{
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (uint64_t)time.tv_sec * NSEC_PER_SEC + (uint64_t)time.tv_nsec;
+}
+
+static inline NSUInteger PINCacheStatisticsBucketIndex(uint64_t value)
+{
+    value = MIN(value, (1ULL << PINCacheStatisticsMaxValueBits) - 1);
+    if (value < 2 * PINCacheStatisticsSubBucketCount)
+        return (NSUInteger)value;
+
+    NSUInteger shift = (NSUInteger)(63 - __builtin_clzll(value)) - PINCacheStatisticsSubBucketBits;
+    return shift * PINCacheStatisticsSubBucketCount + (NSUInteger)(value >> shift);
+}
+
+// The middle of the values a bucket holds, in nanoseconds.
+static inline uint64_t PINCacheStatisticsBucketValue(NSUInteger index)
+{
+    if (index < 2 * PINCacheStatisticsSubBucketCount)
+        return index;
+
+    NSUInteger shift = index / PINCacheStatisticsSubBucketCount - 1;
+    uint64_t lowestValue = (uint64_t)(index - shift * PINCacheStatisticsSubBucketCount) << shift;
+    return lowestValue + ((1ULL << shift) - 1) / 2;
+}
+
+@interface PINCacheLatencyHistogram ()
+@property (strong, nonatomic) NSData *buckets;
+@property (readwrite) uint64_t count;
+@property (readwrite) NSTimeInterval mean;
+- (instancetype)initWithBuckets:(NSData *)buckets sum:(uint64_t)sum NS_DESIGNATED_INITIALIZER;
+@end
+
+@interface PINCacheStatistics ()
+@property (strong, nonatomic) NSData *counters;
+@property (readwrite) PINCacheLatencyHistogram *readLatency;
+@property (readwrite) PINCacheLatencyHistogram *writeLatency;
+- (instancetype)initWithCounters:(NSData *)counters readLatency:(PINCacheLatencyHistogram *)readLatency writeLatency:(PINCacheLatencyHistogram *)writeLatency NS_DESIGNATED_INITIALIZER;
+@end
+
+@implementation PINCacheStatisticsRecorder {
+    atomic_bool _enabled;
+    void *_counterStripes;
+    _Atomic(PINCacheStatisticsHistogramStripe *) _histogramStripes;
+}
+
+- (void)dealloc
+{
+    free(_counterStripes);
+    free(atomic_load(&_histogramStripes));
+}
+
+- (instancetype)init
+{
+    if (self = [super init]) {
+        size_t size = PINCacheStatisticsCounterStripeSize() * PINCacheStatisticsCounterStripeCount;
+        if (posix_memalign(&_counterStripes, PINCacheStatisticsCacheLineSize, size) != 0)
+            return nil;
+        memset(_counterStripes, 0, size);
+    }
+    return self;
+}
+
+#pragma mark - Public Methods -
+
+- (void)addCount:(uint64_t)count toCounter:(PINCacheStatisticsCounter)counter
+{
+    if (!atomic_load_explicit(&_enabled, memory_order_relaxed) || count == 0)
+        return;
+
+    PINCacheStatisticsCounterStripe *stripe = [self counterStripeAtIndex:PINCacheStatisticsCurrentThreadNumber() % PINCacheStatisticsCounterStripeCount];
+    atomic_fetch_add_explicit(&stripe->counters[counter], count, memory_order_relaxed);
+}
+
+- (uint64_t)startOperation
+{
+    if (!atomic_load_explicit(&_enabled, memory_order_relaxed))
+        return 0;
+
+    return PINCacheStatisticsCurrentTime();
+}
+
+- (void)endOperation:(PINCacheStatisticsOperation)operation startTime:(uint64_t)startTime
+{
+    if (startTime == 0)
+        return;
+
+    PINCacheStatisticsHistogramStripe *stripes = atomic_load_explicit(&_histogramStripes, memory_order_acquire);
+    if (stripes == NULL)
+        return;
+
+    uint64_t now = PINCacheStatisticsCurrentTime();
+    uint64_t latency = now > startTime ? now - startTime : 0;
+    PINCacheStatisticsHistogram *histogram = &stripes[PINCacheStatisticsCurrentThreadNumber() % PINCacheStatisticsHistogramStripeCount].histograms[operation];
+    atomic_fetch_add_explicit(&histogram->buckets[PINCacheStatisticsBucketIndex(latency)], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&histogram->sum, latency, memory_order_relaxed);
+}
+
+- (PINCacheStatistics *)snapshot
+{
+    NSMutableData *counters = [[NSMutableData alloc] initWithLength:PINCacheStatisticsCounterCount * sizeof(uint64_t)];
+    uint64_t *counterValues = counters.mutableBytes;
+    for (NSUInteger stripeIndex = 0; stripeIndex < PINCacheStatisticsCounterStripeCount; stripeIndex++) {
+        PINCacheStatisticsCounterStripe *stripe = [self counterStripeAtIndex:stripeIndex];
+        for (NSUInteger counter = 0; counter < PINCacheStatisticsCounterCount; counter++) {
+            counterValues[counter] += atomic_load_explicit(&stripe->counters[counter], memory_order_relaxed);
+        }
+    }
+
+    return [[PINCacheStatistics alloc] initWithCounters:counters
+                                            readLatency:[self histogramForOperation:PINCacheStatisticsOperationRead]
+                                           writeLatency:[self histogramForOperation:PINCacheStatisticsOperationWrite]];
+}
+
+- (void)reset
+{
+    for (NSUInteger stripeIndex = 0; stripeIndex < PINCacheStatisticsCounterStripeCount; stripeIndex++) {
+        PINCacheStatisticsCounterStripe *stripe = [self counterStripeAtIndex:stripeIndex];
+        for (NSUInteger counter = 0; counter < PINCacheStatisticsCounterCount; counter++) {
+            atomic_store_explicit(&stripe->counters[counter], 0, memory_order_relaxed);
+        }
+    }
+
+    PINCacheStatisticsHistogramStripe *stripes = atomic_load_explicit(&_histogramStripes, memory_order_acquire);
+    if (stripes == NULL)
+        return;
+
+    for (NSUInteger stripeIndex = 0; stripeIndex < PINCacheStatisticsHistogramStripeCount; stripeIndex++) {
+        for (NSUInteger operation = 0; operation < PINCacheStatisticsOperationCount; operation++) {
+            PINCacheStatisticsHistogram *histogram = &stripes[stripeIndex].histograms[operation];
+            for (NSUInteger bucket = 0; bucket < PINCacheStatisticsBucketCount; bucket++) {
+                atomic_store_explicit(&histogram->buckets[bucket], 0, memory_order_relaxed);
+            }
+            atomic_store_explicit(&histogram->sum, 0, memory_order_relaxed);
+        }
+    }
+}
+
+#pragma mark - Private Methods -
+
+- (PINCacheStatisticsCounterStripe *)counterStripeAtIndex:(NSUInteger)index
+{
+    return (PINCacheStatisticsCounterStripe *)((char *)_counterStripes + index * PINCacheStatisticsCounterStripeSize());
+}
+
+- (PINCacheLatencyHistogram *)histogramForOperation:(PINCacheStatisticsOperation)operation
+{
+    NSMutableData *buckets = [[NSMutableData alloc] initWithLength:PINCacheStatisticsBucketCount * sizeof(uint64_t)];
+    uint64_t sum = 0;
+    PINCacheStatisticsHistogramStripe *stripes = atomic_load_explicit(&_histogramStripes, memory_order_acquire);
+    if (stripes) {
+        uint64_t *bucketValues = buckets.mutableBytes;
+        for (NSUInteger stripeIndex = 0; stripeIndex < PINCacheStatisticsHistogramStripeCount; stripeIndex++) {
+            PINCacheStatisticsHistogram *histogram = &stripes[stripeIndex].histograms[operation];
+            for (NSUInteger bucket = 0; bucket < PINCacheStatisticsBucketCount; bucket++) {
+                bucketValues[bucket] += atomic_load_explicit(&histogram->buckets[bucket], memory_order_relaxed);
+            }
+            sum += atomic_load_explicit(&histogram->sum, memory_order_relaxed);
+        }
+    }
+    return [[PINCacheLatencyHistogram alloc] initWithBuckets:buckets sum:sum];
+}
+
+#pragma mark - Public Thread Safe Accessors -
+
+- (BOOL)isEnabled
+{
+    return atomic_load_explicit(&_enabled, memory_order_relaxed);
+}
+
+- (void)setEnabled:(BOOL)enabled
+{
+    if (enabled && atomic_load_explicit(&_histogramStripes, memory_order_acquire) == NULL) {
+        PINCacheStatisticsHistogramStripe *stripes = calloc(PINCacheStatisticsHistogramStripeCount, sizeof(PINCacheStatisticsHistogramStripe));
+        PINCacheStatisticsHistogramStripe *expected = NULL;
+        if (stripes && !atomic_compare_exchange_strong_explicit(&_histogramStripes, &expected, stripes, memory_order_acq_rel, memory_order_acquire)) {
+            // Someone else got there first.
+            free(stripes);
+        }
+    }
+    atomic_store_explicit(&_enabled, enabled, memory_order_relaxed);
+}
+
+@end
+
+@implementation PINCacheLatencyHistogram
+
+- (instancetype)initWithBuckets:(NSData *)buckets sum:(uint64_t)sum
+{
+    if (self = [super init]) {
+        _buckets = buckets;
+
+        const uint64_t *bucketValues = buckets.bytes;
+        uint64_t count = 0;
+        for (NSUInteger bucket = 0; bucket < PINCacheStatisticsBucketCount; bucket++) {
+            count += bucketValues[bucket];
+        }
+        _count = count;
+        _mean = count > 0 ? (double)sum / count / NSEC_PER_SEC : 0.0;
+    }
+    return self;
+}
+
+- (NSTimeInterval)latencyAtPercentile:(double)percentile
+{
+    if (_count == 0)
+        return 0.0;
+
+    // The smallest latency with at least the given share of the count at or under it.
+    double share = MIN(MAX(percentile, 0.0), 100.0) / 100.0;
+    uint64_t rank = MAX((uint64_t)ceil(share * _count), (uint64_t)1);
+    const uint64_t *bucketValues = _buckets.bytes;
+    uint64_t seen = 0;
+    for (NSUInteger bucket = 0; bucket < PINCacheStatisticsBucketCount; bucket++) {
+        seen += bucketValues[bucket];
+        if (seen >= rank)
+            return (NSTimeInterval)PINCacheStatisticsBucketValue(bucket) / NSEC_PER_SEC;
+    }
+    return (NSTimeInterval)PINCacheStatisticsBucketValue(PINCacheStatisticsBucketCount - 1) / NSEC_PER_SEC;
+}
+
+- (NSTimeInterval)minimum
+{
+    return [self latencyAtPercentile:0.0];
+}
+
+- (NSTimeInterval)maximum
+{
+    return [self latencyAtPercentile:100.0];
+}
+
+- (NSTimeInterval)p50
+{
+    return [self latencyAtPercentile:50.0];
+}
+
+- (NSTimeInterval)p99
+{
+    return [self latencyAtPercentile:99.0];
+}
+
+- (NSTimeInterval)p999
+{
+    return [self latencyAtPercentile:99.9];
+}
+
+- (NSString *)description
+{
+    return [[NSString alloc] initWithFormat:@"<%@: %p count=%llu p50=%.6fs p99=%.6fs p999=%.6fs max=%.6fs>",
+            [self class], (void *)self, _count, self.p50, self.p99, self.p999, self.maximum];
+}
+
+@end
+
+@implementation PINCacheStatistics
+
+- (instancetype)initWithCounters:(NSData *)counters readLatency:(PINCacheLatencyHistogram *)readLatency writeLatency:(PINCacheLatencyHistogram *)writeLatency
+{
+    if (self = [super init]) {
+        _counters = counters;
+        _readLatency = readLatency;
+        _writeLatency = writeLatency;
+    }
+    return self;
+}
+
+- (uint64_t)valueOfCounter:(PINCacheStatisticsCounter)counter
+{
+    return ((const uint64_t *)_counters.bytes)[counter];
+}
+
+- (uint64_t)hitCount
+{
+    return [self valueOfCounter:PINCacheStatisticsCounterHit];
+}
+
+- (uint64_t)missCount
+{
+    return [self valueOfCounter:PINCacheStatisticsCounterMiss];
+}
+
+- (double)hitRate
+{
+    uint64_t lookupCount = self.hitCount + self.missCount;
+    return lookupCount > 0 ? (double)self.hitCount / lookupCount : 0.0;
+}
+
+- (uint64_t)setCount
+{
+    return [self valueOfCounter:PINCacheStatisticsCounterSet];
+}
+
+- (uint64_t)promotionCount
+{
+    return [self valueOfCounter:PINCacheStatisticsCounterPromotion];
+}
+
+- (uint64_t)evictionCount
+{
+    return [self evictionCountForReason:PINCacheEvictionReasonCost]
+         + [self evictionCountForReason:PINCacheEvictionReasonAge]
+         + [self evictionCountForReason:PINCacheEvictionReasonMemoryWarning];
+}
+
+- (uint64_t)evictionCountForReason:(PINCacheEvictionReason)reason
+{
+    switch (reason) {
+        case PINCacheEvictionReasonCost:
+            return [self valueOfCounter:PINCacheStatisticsCounterCostEviction];
+        case PINCacheEvictionReasonAge:
+            return [self valueOfCounter:PINCacheStatisticsCounterAgeEviction];
+        case PINCacheEvictionReasonMemoryWarning:
+            return [self valueOfCounter:PINCacheStatisticsCounterMemoryWarningEviction];
+    }
+    return 0;
+}
+
+- (uint64_t)bytesRead
+{
+    return [self valueOfCounter:PINCacheStatisticsCounterBytesRead];
+}
+
+- (uint64_t)bytesWritten
+{
+    return [self valueOfCounter:PINCacheStatisticsCounterBytesWritten];
+}
+
+- (uint64_t)cancelledCount
+{
+    return [self valueOfCounter:PINCacheStatisticsCounterCancelled];
+}
+
+- (uint64_t)expiredCount
+{
+    return [self valueOfCounter:PINCacheStatisticsCounterExpired];
+}
+
+- (NSString *)description
+{
+    return [[NSString alloc] initWithFormat:@"<%@: %p hits=%llu misses=%llu sets=%llu promotions=%llu evictions=%llu read=%lluB written=%lluB cancelled=%llu expired=%llu reads=%@ writes=%@>",
+            [self class], (void *)self, self.hitCount, self.missCount, self.setCount, self.promotionCount, self.evictionCount,
+            self.bytesRead, self.bytesWritten, self.cancelledCount, self.expiredCount, self.readLatency, self.writeLatency];
+}
+
+@end
@@ -0,0 +1,111 @@
+//
+//  PINCacheTracing+Private.h
+//  PINCache
+//
+//  Copyright © 2017 Pinterest. All rights reserved.
+//
+
+#import "PINCacheTracing.h"
+
+#import <time.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+enum {
+    PINCacheTracePhaseCount = PINCacheTracePhaseDeserialization + 1,
+    PINCacheTraceMaxIntervals = 32,
+};
+
+typedef struct {
+    PINCacheTracePhase phase;
+    uint64_t startTime;
+    uint64_t endTime;
+} PINCacheTraceInterval;
+
+/**
+ An operation being traced. Lives on the stack of the method being traced, and is found by the code timing its phases
+ through <PINCacheCurrentTrace>. Times are in nanoseconds on the monotonic clock.
+ */
+typedef struct {
+    uint64_t startTime;
+    NSUInteger keyHash;
+    uint64_t phaseDurations[PINCacheTracePhaseCount];
+    NSUInteger intervalCount;
+    PINCacheTraceInterval intervals[PINCacheTraceMaxIntervals];
+} PINCacheTrace;
+
+/**
+ The trace open on this thread, if any.
+ */
+FOUNDATION_EXTERN _Thread_local PINCacheTrace * _Nullable PINCacheCurrentTrace;
+
+/**
+ When the operation about to run on this thread was queued, if it was queued by a traced cache. Taken by the next
+ <PINCacheTraceBegin> on the thread.
+ */
+FOUNDATION_EXTERN _Thread_local uint64_t PINCacheTraceEnqueueTime;
+
+/**
+ Sets <PINCacheTraceEnqueueTime> before running an operation that was queued. Does nothing for operations queued while
+ the cache wasn't traced, whose enqueue time is `0`.
+ */
+static inline void PINCacheTraceWillRunQueuedOperation(uint64_t enqueueTime)
+{
+    if (enqueueTime != 0)
+        PINCacheTraceEnqueueTime = enqueueTime;
+}
+
+/**
+ Clears <PINCacheTraceEnqueueTime> after running an operation that was queued, in case tracing was turned off before it
+ ran and no trace took it.
+ */
+static inline void PINCacheTraceDidRunQueuedOperation(uint64_t enqueueTime)
+{
+    if (enqueueTime != 0)
+        PINCacheTraceEnqueueTime = 0;
+}
+
+static inline uint64_t PINCacheTraceCurrentTime(void)
+{
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (uint64_t)time.tv_sec * NSEC_PER_SEC + (uint64_t)time.tv_nsec;
+}
+
+/**
+ The time a phase starts, to pass to <PINCacheTracePhaseEnd>, or `0` if no trace is open on this thread.
+ */
+static inline uint64_t PINCacheTracePhaseBegin(void)
+{
+    return PINCacheCurrentTrace ? PINCacheTraceCurrentTime() : 0;
+}
+
+/**
+ Adds a phase started with <PINCacheTracePhaseBegin> to the trace open on this thread.
+ */
+static inline void PINCacheTracePhaseEnd(PINCacheTracePhase phase, uint64_t startTime)
+{
+    PINCacheTrace *trace = PINCacheCurrentTrace;
+    if (startTime == 0 || trace == NULL)
+        return;
+
+    uint64_t endTime = PINCacheTraceCurrentTime();
+    trace->phaseDurations[phase] += endTime - startTime;
+    if (trace->intervalCount < PINCacheTraceMaxIntervals) {
+        trace->intervals[trace->intervalCount++] = (PINCacheTraceInterval){ phase, startTime, endTime };
+    }
+}
+
+/**
+ Opens a trace on this thread, queued since <PINCacheTraceEnqueueTime> if that was set.
+
+ @result `NO` if a trace was already open, in which case the phases of this operation count towards that one instead.
+ */
+FOUNDATION_EXTERN BOOL PINCacheTraceBegin(PINCacheTrace *trace, NSString * _Nullable key);
+
+/**
+ Closes the trace opened on this thread by <PINCacheTraceBegin>.
+ */
+FOUNDATION_EXTERN PINCacheTraceSpan *PINCacheTraceEnd(PINCacheTrace *trace, NSString *cacheName, NSString *operation);
+
+NS_ASSUME_NONNULL_END
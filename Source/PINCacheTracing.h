@@ -0,0 +1,148 @@
+//
+//  PINCacheTracing.h
+//  PINCache
+//
+//  Copyright © 2017 Pinterest. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+#import <PINCache/PINCacheMacros.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ Where the time of a traced operation went.
+ */
+typedef NS_ENUM(NSInteger, PINCacheTracePhase) {
+    /// Waiting in the operation queue, for operations started by an asynchronous method.
+    PINCacheTracePhaseQueue = 0,
+    /// Waiting for the cache's lock.
+    PINCacheTracePhaseLockWait,
+    /// Waiting for the cache directory to be created, before the first write.
+    PINCacheTracePhaseDiskWritableWait,
+    /// Reading, writing or removing files.
+    PINCacheTracePhaseIO,
+    /// Running the serializer.
+    PINCacheTracePhaseSerialization,
+    /// Running the deserializer.
+    PINCacheTracePhaseDeserialization,
+};
+
+/**
+ A short name for a phase, e.g. `lock-wait`.
+ */
+FOUNDATION_EXTERN NSString *NSStringFromPINCacheTracePhase(PINCacheTracePhase phase);
+
+/**
+ A block called with each time a phase was entered during a span, in order.
+
+ @param phase The phase.
+ @param startTime When the phase was entered, in seconds on the same clock as <[PINCacheTraceSpan startTime]>.
+ @param duration How long the phase lasted, in seconds.
+ */
+typedef void (^PINCacheTracePhaseBlock)(PINCacheTracePhase phase, NSTimeInterval startTime, NSTimeInterval duration);
+
+/**
+ One traced cache operation, from the moment it was asked for to the moment it returned.
+ */
+PIN_SUBCLASSING_RESTRICTED
+@interface PINCacheTraceSpan : NSObject
+
+/**
+ The name of the cache the operation ran on.
+ */
+@property (readonly) NSString *cacheName;
+
+/**
+ What the operation did: `read`, `write` or `remove`.
+ */
+@property (readonly) NSString *operation;
+
+/**
+ The hash of the key the operation was for. Keys themselves may be private, so they aren't traced.
+ */
+@property (readonly) NSUInteger keyHash;
+
+/**
+ The system identifier of the thread the operation ran on.
+ */
+@property (readonly) uint64_t threadID;
+
+/**
+ When the operation was asked for, in seconds on a monotonic clock that starts at an arbitrary point. Only differences
+ between these times are meaningful.
+ */
+@property (readonly) NSTimeInterval startTime;
+
+/**
+ How long the operation took, in seconds, including any time spent queued.
+ */
+@property (readonly) NSTimeInterval duration;
+
+- (instancetype)init NS_UNAVAILABLE;
+
+/**
+ The total time spent in a phase, in seconds.
+
+ @param phase The phase.
+ */
+- (NSTimeInterval)durationOfPhase:(PINCacheTracePhase)phase;
+
+/**
+ Calls a block with each time a phase was entered, in order. The first 32 are kept, <durationOfPhase:> counts all of
+ them.
+
+ @param block The block to call.
+ */
+- (void)enumeratePhasesUsingBlock:(PIN_NOESCAPE PINCacheTracePhaseBlock)block;
+
+@end
+
+/**
+ Receives the spans of traced operations.
+ */
+@protocol PINCacheTraceSink <NSObject>
+
+/**
+ Called on the thread that ran the operation, as soon as it finishes, and possibly on many threads at once. Anything
+ slow done here slows the cache down, so spans should be handed off rather than processed in place.
+
+ @param span The finished operation.
+ */
+- (void)recordSpan:(PINCacheTraceSpan *)span;
+
+@end
+
+/**
+ A sink that writes spans to a file in the Chrome trace event format, which chrome://tracing and Perfetto can open.
+ Each span is a complete event on its thread, with each phase nested inside it, and the key hash and phase totals
+ as arguments. Events are buffered, and only guaranteed to be on disk after <flush> or <close>.
+ */
+PIN_SUBCLASSING_RESTRICTED
+@interface PINCacheChromeTraceSink : NSObject <PINCacheTraceSink>
+
+/**
+ Creates a sink writing to a file, replacing anything already there.
+
+ @param fileURL Where to write the trace.
+ @param error Set if the file couldn't be created.
+ @result A sink, or `nil` if the file couldn't be created.
+ */
+- (nullable instancetype)initWithFileURL:(NSURL *)fileURL error:(NSError **)error NS_DESIGNATED_INITIALIZER;
+- (instancetype)init NS_UNAVAILABLE;
+
+/**
+ Writes buffered events to the file.
+ */
+- (void)flush;
+
+/**
+ Writes buffered events, ends the trace and closes the file. Spans recorded afterwards are dropped. Also done when the
+ sink is deallocated.
+ */
+- (void)close;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,264 @@
+//
+//  PINCacheTracing.m
+//  PINCache
+//
+//  Copyright © 2017 Pinterest. All rights reserved.
+//
+
+#import "PINCacheTracing+Private.h"
+
+#import <pthread.h>
+#import <stdio.h>
+#import <unistd.h>
+
+_Thread_local PINCacheTrace *PINCacheCurrentTrace;
+_Thread_local uint64_t PINCacheTraceEnqueueTime;
+
+NSString *NSStringFromPINCacheTracePhase(PINCacheTracePhase phase)
+{
+    switch (phase) {
+        case PINCacheTracePhaseQueue:
+            return @"queue";
+        case PINCacheTracePhaseLockWait:
+            return @"lock-wait";
+        case PINCacheTracePhaseDiskWritableWait:
+            return @"disk-writable-wait";
+        case PINCacheTracePhaseIO:
+            return @"io";
+        case PINCacheTracePhaseSerialization:
+            return @"serialize";
+        case PINCacheTracePhaseDeserialization:
+            return @"deserialize";
+    }
+    return @"unknown";
+}
+
+static NSTimeInterval PINCacheTraceSeconds(uint64_t nanoseconds)
+{
+    return (NSTimeInterval)nanoseconds / NSEC_PER_SEC;
+}
+
+@interface PINCacheTraceSpan ()
+@property (assign, nonatomic) uint64_t startNanoseconds;
+@property (assign, nonatomic) uint64_t endNanoseconds;
+@property (strong, nonatomic) NSData *intervals;
+- (instancetype)initWithTrace:(PINCacheTrace *)trace cacheName:(NSString *)cacheName operation:(NSString *)operation NS_DESIGNATED_INITIALIZER;
+@end
+
+BOOL PINCacheTraceBegin(PINCacheTrace *trace, NSString *key)
+{
+    if (PINCacheCurrentTrace != NULL)
+        return NO;
+
+    memset(trace, 0, sizeof(PINCacheTrace));
+    trace->keyHash = key.hash;
+    trace->startTime = PINCacheTraceCurrentTime();
+    PINCacheCurrentTrace = trace;
+
+    uint64_t enqueueTime = PINCacheTraceEnqueueTime;
+    PINCacheTraceEnqueueTime = 0;
+    if (enqueueTime != 0 && enqueueTime < trace->startTime) {
+        PINCacheTracePhaseEnd(PINCacheTracePhaseQueue, enqueueTime);
+        trace->startTime = enqueueTime;
+    }
+    return YES;
+}
+
+PINCacheTraceSpan *PINCacheTraceEnd(PINCacheTrace *trace, NSString *cacheName, NSString *operation)
+{
+    NSCAssert(PINCacheCurrentTrace == trace, @"Ended a trace that isn't open on this thread.");
+    PINCacheCurrentTrace = NULL;
+    return [[PINCacheTraceSpan alloc] initWithTrace:trace cacheName:cacheName operation:operation];
+}
+
+@implementation PINCacheTraceSpan {
+    uint64_t _phaseDurations[PINCacheTracePhaseCount];
+}
+
+- (instancetype)initWithTrace:(PINCacheTrace *)trace cacheName:(NSString *)cacheName operation:(NSString *)operation
+{
+    if (self = [super init]) {
+        _cacheName = [cacheName copy];
+        _operation = [operation copy];
+        _keyHash = trace->keyHash;
+        _startNanoseconds = trace->startTime;
+        _endNanoseconds = PINCacheTraceCurrentTime();
+        _intervals = [[NSData alloc] initWithBytes:trace->intervals length:trace->intervalCount * sizeof(PINCacheTraceInterval)];
+        memcpy(_phaseDurations, trace->phaseDurations, sizeof(_phaseDurations));
+        pthread_threadid_np(NULL, &_threadID);
+    }
+    return self;
+}
+
+- (NSTimeInterval)startTime
+{
+    return PINCacheTraceSeconds(_startNanoseconds);
+}
+
+- (NSTimeInterval)duration
+{
+    return PINCacheTraceSeconds(_endNanoseconds - _startNanoseconds);
+}
+
+- (NSTimeInterval)durationOfPhase:(PINCacheTracePhase)phase
+{
+    if (phase < 0 || phase >= PINCacheTracePhaseCount)
+        return 0.0;
+
+    return PINCacheTraceSeconds(_phaseDurations[phase]);
+}
+
+- (void)enumeratePhasesUsingBlock:(PIN_NOESCAPE PINCacheTracePhaseBlock)block
+{
+    const PINCacheTraceInterval *intervals = _intervals.bytes;
+    NSUInteger intervalCount = _intervals.length / sizeof(PINCacheTraceInterval);
+    for (NSUInteger idx = 0; idx < intervalCount; idx++) {
+        block(intervals[idx].phase, PINCacheTraceSeconds(intervals[idx].startTime), PINCacheTraceSeconds(intervals[idx].endTime - intervals[idx].startTime));
+    }
+}
+
+- (NSString *)description
+{
+    return [[NSString alloc] initWithFormat:@"<%@: %p %@ %@ key=%lx duration=%.6fs>", [self class], (void *)self, _cacheName, _operation, (unsigned long)_keyHash, self.duration];
+}
+
+@end
+
+@interface PINCacheChromeTraceSink ()
+@property (assign, nonatomic) pthread_mutex_t mutex;
+@end
+
+@implementation PINCacheChromeTraceSink {
+    FILE *_file;
+    BOOL _hasEvents;
+    int _processID;
+}
+
+- (void)dealloc
+{
+    [self close];
+    __unused int result = pthread_mutex_destroy(&_mutex);
+    NSCAssert(result == 0, @"Failed to destroy lock in PINCacheChromeTraceSink %p. Code: %d", (void *)self, result);
+}
+
+- (instancetype)initWithFileURL:(NSURL *)fileURL error:(NSError **)error
+{
+    if (self = [super init]) {
+        __unused int result = pthread_mutex_init(&_mutex, NULL);
+        NSAssert(result == 0, @"Failed to init lock in PINCacheChromeTraceSink %@. Code: %d", self, result);
+
+        FILE *file = fopen(fileURL.fileSystemRepresentation, "w");
+        if (file == NULL) {
+            if (error) {
+                *error = [NSError errorWithDomain:NSPOSIXErrorDomain code:errno userInfo:@{ NSURLErrorKey : fileURL }];
+            }
+            return nil;
+        }
+
+        _file = file;
+        _processID = getpid();
+        // The array format, which viewers accept without the closing bracket, so a trace cut short still opens.
+        fputs("[\n", _file);
+    }
+    return self;
+}
+
+#pragma mark - Public Methods -
+
+- (void)recordSpan:(PINCacheTraceSpan *)span
+{
+    NSString *category = [@"PINCache." stringByAppendingString:span.cacheName];
+    NSMutableDictionary<NSString *, id> *arguments = [[NSMutableDictionary alloc] init];
+    arguments[@"key"] = [[NSString alloc] initWithFormat:@"%lx", (unsigned long)span.keyHash];
+    for (NSInteger phase = 0; phase < PINCacheTracePhaseCount; phase++) {
+        NSTimeInterval duration = [span durationOfPhase:phase];
+        if (duration > 0.0) {
+            arguments[[NSStringFromPINCacheTracePhase(phase) stringByAppendingString:@"-us"]] = @(duration * USEC_PER_SEC);
+        }
+    }
+
+    NSMutableArray<NSDictionary *> *events = [[NSMutableArray alloc] init];
+    [events addObject:[self eventNamed:span.operation category:category startTime:span.startTime duration:span.duration threadID:span.threadID arguments:arguments]];
+    [span enumeratePhasesUsingBlock:^(PINCacheTracePhase phase, NSTimeInterval startTime, NSTimeInterval duration) {
+        [events addObject:[self eventNamed:NSStringFromPINCacheTracePhase(phase) category:category startTime:startTime duration:duration threadID:span.threadID arguments:nil]];
+    }];
+
+    // Encoded before taking the lock, so threads only wait on each other for the write.
+    NSMutableData *data = [[NSMutableData alloc] init];
+    for (NSDictionary *event in events) {
+        NSData *eventData = [NSJSONSerialization dataWithJSONObject:event options:0 error:NULL];
+        if (eventData == nil)
+            continue;
+        [data appendBytes:",\n" length:2];
+        [data appendData:eventData];
+    }
+    if (data.length == 0)
+        return;
+
+    [self lock];
+        if (_file) {
+            // The first event isn't preceded by a comma.
+            NSUInteger skip = _hasEvents ? 0 : 2;
+            fwrite((const char *)data.bytes + skip, 1, data.length - skip, _file);
+            _hasEvents = YES;
+        }
+    [self unlock];
+}
+
+- (void)flush
+{
+    [self lock];
+        if (_file) {
+            fflush(_file);
+        }
+    [self unlock];
+}
+
+- (void)close
+{
+    [self lock];
+        if (_file) {
+            fputs("\n]\n", _file);
+            fclose(_file);
+            _file = NULL;
+        }
+    [self unlock];
+}
+
+#pragma mark - Private Methods -
+
+- (NSDictionary *)eventNamed:(NSString *)name
+                    category:(NSString *)category
+                   startTime:(NSTimeInterval)startTime
+                    duration:(NSTimeInterval)duration
+                    threadID:(uint64_t)threadID
+                   arguments:(nullable NSDictionary *)arguments
+{
+    NSMutableDictionary *event = [@{
+        @"name" : name,
+        @"cat" : category,
+        @"ph" : @"X",
+        @"ts" : @(startTime * USEC_PER_SEC),
+        @"dur" : @(duration * USEC_PER_SEC),
+        @"pid" : @(_processID),
+        @"tid" : @(threadID),
+    } mutableCopy];
+    if (arguments) {
+        event[@"args"] = arguments;
+    }
+    return event;
+}
+
+- (void)lock
+{
+    __unused int result = pthread_mutex_lock(&_mutex);
+    NSAssert(result == 0, @"Failed to lock PINCacheChromeTraceSink %@. Code: %d", self, result);
+}
+
+- (void)unlock
+{
+    __unused int result = pthread_mutex_unlock(&_mutex);
+    NSAssert(result == 0, @"Failed to unlock PINCacheChromeTraceSink %@. Code: %d", self, result);
+}
+
+@end
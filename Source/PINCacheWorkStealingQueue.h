@@ -0,0 +1,69 @@
+//
+//  PINCacheWorkStealingQueue.h
+//  PINCache
+//
+//  Copyright © 2017 Pinterest. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+#import <PINOperation/PINOperation.h>
+
+#import <PINCache/PINCacheMacros.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ The part of the `PINOperationQueue` interface the caches schedule their work through, so a cache can run on either a
+ `PINOperationQueue` or a <PINCacheWorkStealingQueue>.
+ */
+@protocol PINCacheOperationScheduling <NSObject>
+
+/**
+ The maximum number of operations that run at the same time.
+ */
+@property (assign) NSUInteger maxConcurrentOperations;
+
+- (id <PINOperationReference>)scheduleOperation:(dispatch_block_t)operation;
+
+- (id <PINOperationReference>)scheduleOperation:(dispatch_block_t)operation withPriority:(PINOperationQueuePriority)priority;
+
+/**
+ Blocks the calling thread until every operation scheduled so far has finished.
+ */
+- (void)waitUntilAllOperationsAreFinished;
+
+@end
+
+@interface PINOperationQueue (PINCacheOperationScheduling) <PINCacheOperationScheduling>
+@end
+
+/**
+ An operation queue for short, CPU bound operations scheduled at a high rate, such as those of a <PINMemoryCache>.
+
+ `PINOperationQueue` keeps every pending operation in one list behind one lock, which every operation takes at least
+ twice, so with many threads scheduling and running short operations most of their time goes to waiting for each other.
+ This queue gives each worker its own list instead. Operations scheduled from a worker of the queue go to that
+ worker's list, others are spread over the lists in turn, and a worker whose list is empty takes operations from the
+ others'. Workers run the highest priority operation they can find, first from their own list, then from the others',
+ and operations of the same priority in the same list run in the order they were scheduled.
+
+ Unlike `PINOperationQueue`, priorities are honored even with one concurrent operation, and operations can't be
+ cancelled once scheduled.
+ */
+PIN_SUBCLASSING_RESTRICTED
+@interface PINCacheWorkStealingQueue : NSObject <PINCacheOperationScheduling>
+
+/**
+ Creates a queue.
+
+ @param maxConcurrentOperations The maximum number of operations to run at the same time, between 1 and 64.
+ @result A new queue.
+ */
+- (instancetype)initWithMaxConcurrentOperations:(NSUInteger)maxConcurrentOperations NS_DESIGNATED_INITIALIZER;
+
+- (instancetype)init NS_UNAVAILABLE;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,332 @@
+//
+//  PINCacheWorkStealingQueue.m
+//  PINCache
+//
+//  Copyright © 2017 Pinterest. All rights reserved.
+//
+
+#import "PINCacheWorkStealingQueue.h"
+
+#import <pthread.h>
+#import <stdatomic.h>
+#import <stdlib.h>
+
+enum {
+    PINCacheWorkStealingPriorityCount = PINOperationQueuePriorityHigh + 1,
+    // Active workers are tracked as bits of one word.
+    PINCacheWorkStealingMaxWorkers = 64,
+    PINCacheWorkStealingInitialListCapacity = 64,
+    PINCacheWorkStealingCacheLineSize = 64,
+};
+
+@implementation PINOperationQueue (PINCacheOperationScheduling)
+@end
+
+@interface PINCacheWorkStealingOperation : NSObject <PINOperationReference>
+@property (copy, nonatomic) dispatch_block_t block;
+@property (assign, nonatomic) PINOperationQueuePriority priority;
+@end
+
+@implementation PINCacheWorkStealingOperation
+@end
+
+// A FIFO ring of retained operations, grown by doubling.
+typedef struct {
+    void **operations;
+    NSUInteger capacity;
+    NSUInteger head;
+    NSUInteger count;
+} PINCacheWorkStealingList;
+
+// One worker's operations, a list per priority. The counts mirror the lists' and are read without the mutex, so thieves
+// skip empty deques without taking it.
+typedef struct {
+    pthread_mutex_t mutex;
+    _Atomic(NSUInteger) counts[PINCacheWorkStealingPriorityCount];
+    PINCacheWorkStealingList lists[PINCacheWorkStealingPriorityCount];
+} PINCacheWorkStealingDeque;
+
+// Deques are padded apart so that workers taking from their own never write the same cache line.
+static inline size_t PINCacheWorkStealingDequeStride(void)
+{
+    size_t size = sizeof(PINCacheWorkStealingDeque);
+    return (size + PINCacheWorkStealingCacheLineSize - 1) / PINCacheWorkStealingCacheLineSize * PINCacheWorkStealingCacheLineSize;
+}
+
+static void PINCacheWorkStealingListPush(PINCacheWorkStealingList *list, void *operation)
+{
+    if (list->count == list->capacity) {
+        NSUInteger capacity = list->capacity ? list->capacity * 2 : PINCacheWorkStealingInitialListCapacity;
+        void **operations = malloc(capacity * sizeof(void *));
+        NSCAssert(operations != NULL, @"Failed to grow work stealing list to %lu operations.", (unsigned long)capacity);
+        for (NSUInteger idx = 0; idx < list->count; idx++) {
+            operations[idx] = list->operations[(list->head + idx) & (list->capacity - 1)];
+        }
+        free(list->operations);
+        list->operations = operations;
+        list->capacity = capacity;
+        list->head = 0;
+    }
+    list->operations[(list->head + list->count) & (list->capacity - 1)] = operation;
+    list->count++;
+}
+
+static void *PINCacheWorkStealingListTake(PINCacheWorkStealingList *list)
+{
+    if (list->count == 0)
+        return NULL;
+
+    void *operation = list->operations[list->head];
+    list->head = (list->head + 1) & (list->capacity - 1);
+    list->count--;
+    return operation;
+}
+
+static void PINCacheWorkStealingDequeLock(PINCacheWorkStealingDeque *deque)
+{
+    __unused int result = pthread_mutex_lock(&deque->mutex);
+    NSCAssert(result == 0, @"Failed to lock work stealing deque %p. Code: %d", (void *)deque, result);
+}
+
+static void PINCacheWorkStealingDequeUnlock(PINCacheWorkStealingDeque *deque)
+{
+    __unused int result = pthread_mutex_unlock(&deque->mutex);
+    NSCAssert(result == 0, @"Failed to unlock work stealing deque %p. Code: %d", (void *)deque, result);
+}
+
+// The queue's pending count is raised with the deque's, under its mutex, so a thief can't take the operation before
+// it's counted and drive the pending count below the operations actually there.
+static void PINCacheWorkStealingDequePush(PINCacheWorkStealingDeque *deque, PINOperationQueuePriority priority, void *operation, _Atomic(NSUInteger) *pendingCount)
+{
+    PINCacheWorkStealingDequeLock(deque);
+        PINCacheWorkStealingListPush(&deque->lists[priority], operation);
+        atomic_fetch_add(&deque->counts[priority], 1);
+        atomic_fetch_add(pendingCount, 1);
+    PINCacheWorkStealingDequeUnlock(deque);
+}
+
+static void *PINCacheWorkStealingDequeTake(PINCacheWorkStealingDeque *deque, PINOperationQueuePriority priority)
+{
+    if (atomic_load_explicit(&deque->counts[priority], memory_order_relaxed) == 0)
+        return NULL;
+
+    PINCacheWorkStealingDequeLock(deque);
+        void *operation = PINCacheWorkStealingListTake(&deque->lists[priority]);
+        if (operation) {
+            atomic_fetch_sub(&deque->counts[priority], 1);
+        }
+    PINCacheWorkStealingDequeUnlock(deque);
+    return operation;
+}
+
+// The queue whose worker is running on this thread, if any, and that worker's deque.
+static _Thread_local void *PINCacheWorkStealingCurrentQueue;
+static _Thread_local NSUInteger PINCacheWorkStealingCurrentDequeIndex;
+
+@implementation PINCacheWorkStealingQueue {
+    void *_deques;
+    NSUInteger _dequeCount;
+    size_t _dequeStride;
+    _Atomic(NSUInteger) _nextDequeIndex;
+    _Atomic(NSUInteger) _maxConcurrentOperations;
+    // Bit n is set while worker n runs. Workers take the lowest free bit.
+    _Atomic(uint64_t) _activeWorkers;
+    // Scheduled operations not yet taken by a worker, by priority, so workers look for the highest one that has any.
+    _Atomic(NSUInteger) _pendingCounts[PINCacheWorkStealingPriorityCount];
+    dispatch_queue_t _workerQueue;
+    dispatch_group_t _group;
+}
+
+- (void)dealloc
+{
+    for (NSUInteger dequeIndex = 0; dequeIndex < _dequeCount; dequeIndex++) {
+        PINCacheWorkStealingDeque *deque = [self dequeAtIndex:dequeIndex];
+        for (NSUInteger priority = 0; priority < PINCacheWorkStealingPriorityCount; priority++) {
+            void *operation;
+            while ((operation = PINCacheWorkStealingListTake(&deque->lists[priority])) != NULL) {
+                CFRelease(operation);
+            }
+            free(deque->lists[priority].operations);
+        }
+        __unused int result = pthread_mutex_destroy(&deque->mutex);
+        NSCAssert(result == 0, @"Failed to destroy deque lock in PINCacheWorkStealingQueue %p. Code: %d", (void *)self, result);
+    }
+    free(_deques);
+}
+
+- (instancetype)init
+{
+    @throw [NSException exceptionWithName:@"Must initialize with a maximum number of concurrent operations" reason:@"PINCacheWorkStealingQueue must be initialized with a maximum number of concurrent operations. Call initWithMaxConcurrentOperations: instead." userInfo:nil];
+    return [self initWithMaxConcurrentOperations:1];
+}
+
+- (instancetype)initWithMaxConcurrentOperations:(NSUInteger)maxConcurrentOperations
+{
+    if (self = [super init]) {
+        maxConcurrentOperations = MIN(MAX(maxConcurrentOperations, 1), PINCacheWorkStealingMaxWorkers);
+        _maxConcurrentOperations = maxConcurrentOperations;
+
+        // Enough deques for every worker to have its own, also after the maximum is raised to the number of cores.
+        NSUInteger dequeCount = MIN(MAX(maxConcurrentOperations, [[NSProcessInfo processInfo] activeProcessorCount]), PINCacheWorkStealingMaxWorkers);
+        _dequeStride = PINCacheWorkStealingDequeStride();
+        if (posix_memalign(&_deques, PINCacheWorkStealingCacheLineSize, _dequeStride * dequeCount) != 0)
+            return nil;
+        memset(_deques, 0, _dequeStride * dequeCount);
+        _dequeCount = dequeCount;
+        for (NSUInteger dequeIndex = 0; dequeIndex < _dequeCount; dequeIndex++) {
+            __unused int result = pthread_mutex_init(&[self dequeAtIndex:dequeIndex]->mutex, NULL);
+            NSAssert(result == 0, @"Failed to init deque lock in PINCacheWorkStealingQueue %@. Code: %d", self, result);
+        }
+
+        _workerQueue = dispatch_queue_create("PINCacheWorkStealingQueue workers", DISPATCH_QUEUE_CONCURRENT);
+        _group = dispatch_group_create();
+    }
+    return self;
+}
+
+#pragma mark - Public Methods -
+
+- (id <PINOperationReference>)scheduleOperation:(dispatch_block_t)operation
+{
+    return [self scheduleOperation:operation withPriority:PINOperationQueuePriorityDefault];
+}
+
+- (id <PINOperationReference>)scheduleOperation:(dispatch_block_t)operation withPriority:(PINOperationQueuePriority)priority
+{
+    PINCacheWorkStealingOperation *workStealingOperation = [[PINCacheWorkStealingOperation alloc] init];
+    workStealingOperation.block = operation;
+    workStealingOperation.priority = MIN(priority, PINOperationQueuePriorityHigh);
+    [self enqueueOperation:workStealingOperation];
+    return workStealingOperation;
+}
+
+- (void)waitUntilAllOperationsAreFinished
+{
+    dispatch_group_wait(_group, DISPATCH_TIME_FOREVER);
+}
+
+#pragma mark - Public Thread Safe Accessors -
+
+- (NSUInteger)maxConcurrentOperations
+{
+    return atomic_load(&_maxConcurrentOperations);
+}
+
+- (void)setMaxConcurrentOperations:(NSUInteger)maxConcurrentOperations
+{
+    atomic_store(&_maxConcurrentOperations, MIN(MAX(maxConcurrentOperations, 1), PINCacheWorkStealingMaxWorkers));
+
+    // Put the new slots to work on what's already waiting. Workers beyond a lowered maximum stop by themselves.
+    while ([self hasPendingOperations] && [self startWorkerIfNeeded]) {}
+}
+
+#pragma mark - Private Methods -
+
+- (PINCacheWorkStealingDeque *)dequeAtIndex:(NSUInteger)dequeIndex
+{
+    return (PINCacheWorkStealingDeque *)((char *)_deques + dequeIndex * _dequeStride);
+}
+
+- (BOOL)hasPendingOperations
+{
+    for (NSUInteger priority = 0; priority < PINCacheWorkStealingPriorityCount; priority++) {
+        if (atomic_load(&_pendingCounts[priority]) > 0)
+            return YES;
+    }
+    return NO;
+}
+
+- (void)enqueueOperation:(PINCacheWorkStealingOperation *)operation
+{
+    dispatch_group_enter(_group);
+
+    // Operations scheduled by an operation of this queue stay with its worker, whose caches are warm with what they
+    // touch. The rest are spread over all deques.
+    NSUInteger dequeIndex;
+    if (PINCacheWorkStealingCurrentQueue == (__bridge void *)self) {
+        dequeIndex = PINCacheWorkStealingCurrentDequeIndex;
+    } else {
+        dequeIndex = atomic_fetch_add_explicit(&_nextDequeIndex, 1, memory_order_relaxed) % _dequeCount;
+    }
+
+    PINOperationQueuePriority priority = operation.priority;
+    PINCacheWorkStealingDequePush([self dequeAtIndex:dequeIndex], priority, (__bridge_retained void *)operation, &_pendingCounts[priority]);
+
+    [self startWorkerIfNeeded];
+}
+
+/**
+ Starts a worker in the lowest free slot, if fewer than the maximum are running.
+
+ @result YES if a worker was started.
+ */
+- (BOOL)startWorkerIfNeeded
+{
+    uint64_t activeWorkers = atomic_load(&_activeWorkers);
+    NSUInteger slot;
+    do {
+        if ((NSUInteger)__builtin_popcountll(activeWorkers) >= atomic_load(&_maxConcurrentOperations))
+            return NO;
+        slot = (NSUInteger)__builtin_ctzll(~activeWorkers);
+    } while (!atomic_compare_exchange_weak(&_activeWorkers, &activeWorkers, activeWorkers | (1ULL << slot)));
+
+    dispatch_async(_workerQueue, ^{
+        [self runWorkerInSlot:slot];
+    });
+    return YES;
+}
+
+- (void)runWorkerInSlot:(NSUInteger)slot
+{
+    NSUInteger dequeIndex = slot % _dequeCount;
+    PINCacheWorkStealingCurrentQueue = (__bridge void *)self;
+    PINCacheWorkStealingCurrentDequeIndex = dequeIndex;
+
+    while (YES) {
+        PINCacheWorkStealingOperation *operation = nil;
+        if (slot < atomic_load(&_maxConcurrentOperations)) {
+            operation = [self takeOperationForDequeAtIndex:dequeIndex];
+        }
+        if (operation == nil)
+            break;
+        [self runOperation:operation];
+    }
+
+    PINCacheWorkStealingCurrentQueue = NULL;
+
+    // The slot is given up before looking for more work, so an operation scheduled in between either is seen here or
+    // sees the free slot and starts a worker itself.
+    atomic_fetch_and(&_activeWorkers, ~(1ULL << slot));
+    if ([self hasPendingOperations]) {
+        [self startWorkerIfNeeded];
+    }
+}
+
+- (nullable PINCacheWorkStealingOperation *)takeOperationForDequeAtIndex:(NSUInteger)dequeIndex
+{
+    for (NSInteger priority = PINCacheWorkStealingPriorityCount - 1; priority >= 0; priority--) {
+        if (atomic_load_explicit(&_pendingCounts[priority], memory_order_relaxed) == 0)
+            continue;
+
+        // The worker's own deque first, then the others in order from the next one, so thieves spread out.
+        for (NSUInteger offset = 0; offset < _dequeCount; offset++) {
+            PINCacheWorkStealingDeque *deque = [self dequeAtIndex:(dequeIndex + offset) % _dequeCount];
+            void *operation = PINCacheWorkStealingDequeTake(deque, (PINOperationQueuePriority)priority);
+            if (operation) {
+                atomic_fetch_sub(&_pendingCounts[priority], 1);
+                return (__bridge_transfer PINCacheWorkStealingOperation *)operation;
+            }
+        }
+    }
+    return nil;
+}
+
+- (void)runOperation:(PINCacheWorkStealingOperation *)operation
+{
+    @autoreleasepool {
+        operation.block();
+    }
+    dispatch_group_leave(_group);
+}
+
+@end
@@ -0,0 +1,104 @@
+//
+//  PINCacheWriteBackQueue.h
+//  PINCache
+//
+//  Copyright © 2017 Pinterest. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+@class PINDiskCache;
+@class PINOperationQueue;
+
+/**
+ Objects set on a <PINCache> in write-back mode that haven't been written to its disk cache yet. Pending objects are
+ written in batches, <maxPendingDelay> after the first one arrives, when <maxPendingObjects> is reached, or on <flush>.
+ Pending objects can be read back until they've been written, so the disk cache is never behind what a reader sees.
+ */
+@interface PINCacheWriteBackQueue : NSObject
+
+/**
+ The most objects that may be pending. A set that reaches it writes the pending objects on the calling thread before
+ returning. Defaults to `1000`.
+ */
+@property (assign) NSUInteger maxPendingObjects;
+
+/**
+ The longest an object may stay pending, in seconds. Defaults to `1.0`.
+ */
+@property (assign) NSTimeInterval maxPendingDelay;
+
+/**
+ The number of objects pending, including those being written.
+ */
+@property (readonly) NSUInteger pendingObjectCount;
+
+- (instancetype)initWithDiskCache:(PINDiskCache *)diskCache operationQueue:(PINOperationQueue *)operationQueue NS_DESIGNATED_INITIALIZER;
+- (instancetype)init NS_UNAVAILABLE;
+
+/**
+ Adds an object to write, replacing any pending object for the key. The cost is kept for when the object is promoted
+ back into memory. An object older than a non-zero age limit is neither read back nor written.
+ */
+- (void)addObject:(id)object forKey:(NSString *)key withCost:(NSUInteger)cost ageLimit:(NSTimeInterval)ageLimit;
+
+/**
+ Adds an object to write with tags, replacing any pending object for the key.
+ */
+- (void)addObject:(id)object forKey:(NSString *)key withTags:(NSSet<NSString *> *)tags;
+
+/**
+ The pending object for a key, if any and it hasn't expired.
+ */
+- (nullable id)objectForKey:(NSString *)key;
+
+/**
+ The pending object for a key, if any and it hasn't expired, with what it was added with.
+
+ @param cost Set to the cost the object was added with.
+ @param ageLimit Set to what's left of the age limit the object was added with, or `0` if it had none.
+ */
+- (nullable id)objectForKey:(NSString *)key cost:(nullable NSUInteger *)cost ageLimit:(nullable NSTimeInterval *)ageLimit;
+
+/**
+ Drops the pending object for a key. If it's being written, it's removed from disk again once the write lands.
+ */
+- (void)removeObjectForKey:(NSString *)key;
+
+/**
+ Drops the pending objects with a tag.
+
+ @result The keys of the objects dropped.
+ */
+- (NSArray<NSString *> *)removeObjectsWithTag:(NSString *)tag;
+
+/**
+ Drops the pending objects whose keys start with a prefix.
+ */
+- (void)removeObjectsWithKeyPrefix:(NSString *)prefix;
+
+/**
+ Drops pending objects added before a date.
+ */
+- (void)removeObjectsAddedBeforeDate:(NSDate *)date;
+
+/**
+ Drops every pending object.
+ */
+- (void)removeAllObjects;
+
+/**
+ Writes every pending object to disk. This method blocks the calling thread until they have been written.
+ */
+- (void)flush;
+
+/**
+ Writes every pending object to disk from the operation queue. Requests made while one is scheduled are coalesced.
+ */
+- (void)flushAsync;
+
+@end
+
+NS_ASSUME_NONNULL_END
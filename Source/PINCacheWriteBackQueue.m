@@ -0,0 +1,400 @@
+//
+//  PINCacheWriteBackQueue.m
+//  PINCache
+//
+//  Copyright © 2017 Pinterest. All rights reserved.
+//
+
+#import "PINCacheWriteBackQueue.h"
+
+#import <pthread.h>
+
+#import <PINOperation/PINOperation.h>
+
+#import "PINDiskCache.h"
+
+#if __IPHONE_OS_VERSION_MIN_REQUIRED >= __IPHONE_4_0
+#import <UIKit/UIKit.h>
+#endif
+
+static const NSUInteger PINCacheWriteBackDefaultMaxPendingObjects = 1000;
+static const NSTimeInterval PINCacheWriteBackDefaultMaxPendingDelay = 1.0;
+
+@interface PINCacheWriteBackEntry : NSObject
+@property (nonatomic, copy) NSString *key;
+@property (nonatomic, strong) id object;
+@property (nonatomic) NSUInteger cost;
+@property (nonatomic) NSTimeInterval ageLimit;
+@property (nonatomic, copy) NSSet<NSString *> *tags;
+@property (nonatomic, strong) NSDate *addedDate;
+// YES if the entry was dropped while being written, so the write has to be undone.
+@property (nonatomic) BOOL removed;
+// What's left of the age limit, `0` if there is none, negative once expired.
+- (NSTimeInterval)remainingAgeLimit;
+@end
+
+@interface PINCacheWriteBackQueue ()
+@property (strong, nonatomic) PINDiskCache *diskCache;
+@property (strong, nonatomic) PINOperationQueue *operationQueue;
+@property (strong, nonatomic) NSMutableDictionary<NSString *, PINCacheWriteBackEntry *> *entries;
+@property (assign, nonatomic) pthread_mutex_t mutex;
+@end
+
+@implementation PINCacheWriteBackQueue {
+    // Held for the whole of a flush, so that flushes land on disk in order.
+    pthread_mutex_t _flushMutex;
+    NSUInteger _maxPendingObjects;
+    NSTimeInterval _maxPendingDelay;
+    BOOL _flushScheduled;
+    BOOL _delayedFlushScheduled;
+}
+
+- (void)dealloc
+{
+    [[NSNotificationCenter defaultCenter] removeObserver:self];
+
+    // Anything still pending is written before the disk cache can go away with us.
+    [self flush];
+
+    __unused int result = pthread_mutex_destroy(&_mutex);
+    NSCAssert(result == 0, @"Failed to destroy lock in PINCacheWriteBackQueue %p. Code: %d", (void *)self, result);
+    result = pthread_mutex_destroy(&_flushMutex);
+    NSCAssert(result == 0, @"Failed to destroy flush lock in PINCacheWriteBackQueue %p. Code: %d", (void *)self, result);
+}
+
+- (instancetype)initWithDiskCache:(PINDiskCache *)diskCache operationQueue:(PINOperationQueue *)operationQueue
+{
+    if (self = [super init]) {
+        __unused int result = pthread_mutex_init(&_mutex, NULL);
+        NSAssert(result == 0, @"Failed to init lock in PINCacheWriteBackQueue %@. Code: %d", self, result);
+        result = pthread_mutex_init(&_flushMutex, NULL);
+        NSAssert(result == 0, @"Failed to init flush lock in PINCacheWriteBackQueue %@. Code: %d", self, result);
+
+        _diskCache = diskCache;
+        _operationQueue = operationQueue;
+        _entries = [[NSMutableDictionary alloc] init];
+        _maxPendingObjects = PINCacheWriteBackDefaultMaxPendingObjects;
+        _maxPendingDelay = PINCacheWriteBackDefaultMaxPendingDelay;
+
+#if __IPHONE_OS_VERSION_MIN_REQUIRED >= __IPHONE_4_0 && !TARGET_OS_WATCH
+        [[NSNotificationCenter defaultCenter] addObserver:self
+                                                 selector:@selector(didReceiveEnterBackgroundNotification:)
+                                                     name:UIApplicationDidEnterBackgroundNotification
+                                                   object:nil];
+        [[NSNotificationCenter defaultCenter] addObserver:self
+                                                 selector:@selector(willTerminateNotification:)
+                                                     name:UIApplicationWillTerminateNotification
+                                                   object:nil];
+#endif
+    }
+    return self;
+}
+
+#pragma mark - Private Methods -
+
+- (void)didReceiveEnterBackgroundNotification:(NSNotification *)notification
+{
+    [self flushAsync];
+}
+
+- (void)willTerminateNotification:(NSNotification *)notification
+{
+    [self flush];
+}
+
+- (void)scheduleDelayedFlushIfNeeded
+{
+    [self lock];
+        BOOL schedule = !_delayedFlushScheduled;
+        _delayedFlushScheduled = YES;
+        NSTimeInterval delay = _maxPendingDelay;
+    [self unlock];
+
+    if (!schedule)
+        return;
+
+    __weak PINCacheWriteBackQueue *weakSelf = self;
+    dispatch_time_t time = dispatch_time(DISPATCH_TIME_NOW, (int64_t)(delay * NSEC_PER_SEC));
+    dispatch_after(time, dispatch_get_global_queue(QOS_CLASS_UTILITY, 0), ^(void) {
+        // If we're gone, dealloc has already flushed.
+        [weakSelf flushAsync];
+    });
+}
+
+#pragma mark - Public Methods -
+
+- (void)addObject:(id)object forKey:(NSString *)key withCost:(NSUInteger)cost ageLimit:(NSTimeInterval)ageLimit
+{
+    [self addObject:object forKey:key cost:cost ageLimit:ageLimit tags:nil];
+}
+
+- (void)addObject:(id)object forKey:(NSString *)key withTags:(NSSet<NSString *> *)tags
+{
+    [self addObject:object forKey:key cost:0 ageLimit:0.0 tags:tags];
+}
+
+- (void)addObject:(id)object forKey:(NSString *)key cost:(NSUInteger)cost ageLimit:(NSTimeInterval)ageLimit tags:(nullable NSSet<NSString *> *)tags
+{
+    if (!object || !key)
+        return;
+
+    PINCacheWriteBackEntry *entry = [[PINCacheWriteBackEntry alloc] init];
+    entry.key = key;
+    entry.object = object;
+    entry.cost = cost;
+    entry.ageLimit = ageLimit;
+    entry.tags = tags;
+    entry.addedDate = [NSDate date];
+
+    [self lock];
+        _entries[key] = entry;
+        BOOL full = _entries.count >= _maxPendingObjects;
+    [self unlock];
+
+    if (full) {
+        // Keeps the amount of unwritten data bounded, at the cost of this caller's latency.
+        [self flush];
+    } else {
+        [self scheduleDelayedFlushIfNeeded];
+    }
+}
+
+- (id)objectForKey:(NSString *)key
+{
+    return [self objectForKey:key cost:NULL ageLimit:NULL];
+}
+
+- (id)objectForKey:(NSString *)key cost:(NSUInteger *)cost ageLimit:(NSTimeInterval *)ageLimit
+{
+    if (!key)
+        return nil;
+
+    [self lock];
+        PINCacheWriteBackEntry *entry = _entries[key];
+    [self unlock];
+
+    NSTimeInterval remainingAgeLimit = [entry remainingAgeLimit];
+    if (entry == nil || remainingAgeLimit < 0.0)
+        return nil;
+
+    if (cost)
+        *cost = entry.cost;
+    if (ageLimit)
+        *ageLimit = remainingAgeLimit;
+    return entry.object;
+}
+
+- (void)removeObjectForKey:(NSString *)key
+{
+    if (!key)
+        return;
+
+    [self lock];
+        _entries[key].removed = YES;
+        [_entries removeObjectForKey:key];
+    [self unlock];
+}
+
+- (NSArray<NSString *> *)removeObjectsWithTag:(NSString *)tag
+{
+    if (!tag)
+        return @[];
+
+    return [self removeObjectsPassingTest:^BOOL(PINCacheWriteBackEntry *entry) {
+        return [entry.tags containsObject:tag];
+    }];
+}
+
+- (void)removeObjectsWithKeyPrefix:(NSString *)prefix
+{
+    if (!prefix)
+        return;
+
+    [self removeObjectsPassingTest:^BOOL(PINCacheWriteBackEntry *entry) {
+        return [entry.key hasPrefix:prefix];
+    }];
+}
+
+- (void)removeObjectsAddedBeforeDate:(NSDate *)date
+{
+    if (!date)
+        return;
+
+    [self removeObjectsPassingTest:^BOOL(PINCacheWriteBackEntry *entry) {
+        return [entry.addedDate compare:date] == NSOrderedAscending;
+    }];
+}
+
+- (NSArray<NSString *> *)removeObjectsPassingTest:(BOOL (^)(PINCacheWriteBackEntry *entry))test
+{
+    NSMutableArray<NSString *> *keys = [[NSMutableArray alloc] init];
+    [self lock];
+        [_entries enumerateKeysAndObjectsUsingBlock:^(NSString * _Nonnull key, PINCacheWriteBackEntry * _Nonnull entry, BOOL * _Nonnull stop) {
+            if (test(entry)) {
+                entry.removed = YES;
+                [keys addObject:key];
+            }
+        }];
+        [_entries removeObjectsForKeys:keys];
+    [self unlock];
+    return keys;
+}
+
+- (void)removeAllObjects
+{
+    [self lock];
+        for (PINCacheWriteBackEntry *entry in [_entries objectEnumerator]) {
+            entry.removed = YES;
+        }
+        [_entries removeAllObjects];
+    [self unlock];
+}
+
+- (void)flush
+{
+    pthread_mutex_lock(&_flushMutex);
+        [self writePendingObjects];
+    pthread_mutex_unlock(&_flushMutex);
+}
+
+// Must be called with the flush lock held.
+- (void)writePendingObjects
+{
+    NSMutableArray<PINCacheWriteBackEntry *> *batch = [[NSMutableArray alloc] init];
+    [self lock];
+        _delayedFlushScheduled = NO;
+        [batch addObjectsFromArray:[_entries allValues]];
+    [self unlock];
+
+    if (batch.count == 0)
+        return;
+
+    // Objects without an age limit or tags go to disk as one batch, the others one at a time to keep them. The disk
+    // cache dates an object from when it's written, so it gets what's left of the age limit, expired ones are dropped.
+    NSMutableArray *objects = [[NSMutableArray alloc] initWithCapacity:batch.count];
+    NSMutableArray<NSString *> *keys = [[NSMutableArray alloc] initWithCapacity:batch.count];
+    for (PINCacheWriteBackEntry *entry in batch) {
+        NSTimeInterval remainingAgeLimit = [entry remainingAgeLimit];
+        if (remainingAgeLimit < 0.0) {
+            continue;
+        } else if (entry.tags.count > 0) {
+            [_diskCache setObject:entry.object forKey:entry.key withTags:entry.tags];
+        } else if (remainingAgeLimit > 0.0) {
+            [_diskCache setObject:entry.object forKey:entry.key withAgeLimit:remainingAgeLimit];
+        } else {
+            [objects addObject:entry.object];
+            [keys addObject:entry.key];
+        }
+    }
+    [_diskCache setObjects:objects forKeys:keys];
+
+    NSMutableArray<NSString *> *removedKeys = [[NSMutableArray alloc] init];
+    [self lock];
+        for (PINCacheWriteBackEntry *entry in batch) {
+            if (_entries[entry.key] == entry) {
+                [_entries removeObjectForKey:entry.key];
+            } else if (entry.removed) {
+                [removedKeys addObject:entry.key];
+            }
+        }
+        BOOL pending = _entries.count > 0;
+    [self unlock];
+
+    // Undo writes of objects that were dropped while they were being written.
+    for (NSString *key in removedKeys) {
+        [_diskCache removeObjectForKey:key];
+    }
+
+    if (pending)
+        [self scheduleDelayedFlushIfNeeded];
+}
+
+- (void)flushAsync
+{
+    [self lock];
+        BOOL schedule = !_flushScheduled;
+        _flushScheduled = YES;
+    [self unlock];
+
+    if (!schedule)
+        return;
+
+    [self.operationQueue scheduleOperation:^{
+        [self lock];
+            self->_flushScheduled = NO;
+        [self unlock];
+        [self flush];
+    } withPriority:PINOperationQueuePriorityLow];
+}
+
+#pragma mark - Public Thread Safe Accessors -
+
+- (NSUInteger)maxPendingObjects
+{
+    [self lock];
+        NSUInteger maxPendingObjects = _maxPendingObjects;
+    [self unlock];
+    return maxPendingObjects;
+}
+
+- (void)setMaxPendingObjects:(NSUInteger)maxPendingObjects
+{
+    [self lock];
+        _maxPendingObjects = MAX(maxPendingObjects, (NSUInteger)1);
+        BOOL full = _entries.count >= _maxPendingObjects;
+    [self unlock];
+
+    if (full)
+        [self flush];
+}
+
+- (NSTimeInterval)maxPendingDelay
+{
+    [self lock];
+        NSTimeInterval maxPendingDelay = _maxPendingDelay;
+    [self unlock];
+    return maxPendingDelay;
+}
+
+- (void)setMaxPendingDelay:(NSTimeInterval)maxPendingDelay
+{
+    [self lock];
+        _maxPendingDelay = maxPendingDelay;
+    [self unlock];
+}
+
+- (NSUInteger)pendingObjectCount
+{
+    [self lock];
+        NSUInteger pendingObjectCount = _entries.count;
+    [self unlock];
+    return pendingObjectCount;
+}
+
+- (void)lock
+{
+    __unused int result = pthread_mutex_lock(&_mutex);
+    NSAssert(result == 0, @"Failed to lock PINCacheWriteBackQueue %@. Code: %d", self, result);
+}
+
+- (void)unlock
+{
+    __unused int result = pthread_mutex_unlock(&_mutex);
+    NSAssert(result == 0, @"Failed to unlock PINCacheWriteBackQueue %@. Code: %d", self, result);
+}
+
+@end
+
+@implementation PINCacheWriteBackEntry
+
+- (NSTimeInterval)remainingAgeLimit
+{
+    if (self.ageLimit <= 0.0)
+        return 0.0;
+
+    NSTimeInterval remainingAgeLimit = self.ageLimit + [self.addedDate timeIntervalSinceNow];
+    // Exactly at the limit counts as expired, rather than as having none.
+    return remainingAgeLimit > 0.0 ? remainingAgeLimit : -1.0;
+}
+
+@end
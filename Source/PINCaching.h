@@ -29,6 +29,12 @@ typedef void (^PINCacheObjectBlock)(__kindof id<PINCaching> cache, NSString *key
  */
 typedef void (^PINCacheObjectEnumerationBlock)(__kindof id<PINCaching> cache, NSString *key, id _Nullable object, BOOL *stop);
 
+/**
+ A callback block which provides the cache and the objects found for a batch of keys as arguments. Keys that were
+ not found are absent from the dictionary.
+ */
+typedef void (^PINCacheObjectsBlock)(__kindof id<PINCaching> cache, NSDictionary<NSString *, id> *objects);
+
 /**
  A callback block which provides a BOOL value as argument
  */
@@ -0,0 +1,49 @@
+//
+//  PINDiskCache+Private.h
+//  PINCache
+//
+//  Copyright © 2017 Pinterest. All rights reserved.
+//
+
+#import "PINDiskCache.h"
+
+NS_ASSUME_NONNULL_BEGIN
+
+@class PINOperationQueue;
+
+@interface PINDiskCache ()
+
+/**
+ The queue for work no caller is waiting on: trims, scrubbing, and the file date and access count updates that follow
+ reads. Keeping it apart from the operation queue stops it from taking the slots foreground reads and writes need.
+ Defaults to the operation queue.
+ */
+@property (strong) PINOperationQueue *maintenanceQueue;
+
+/**
+ Records that the object for a key was read from a cache in front of this one, the way <fileURLForKey:> does, without
+ reading or even checking for the file now. Accesses recorded before the next flush are written together by a single
+ low priority operation. Does nothing for a TTL cache, whose dates aren't refreshed by reads.
+
+ @param key The key of the object that was read.
+ */
+- (void)recordAccessToObjectForKeyAsync:(NSString *)key;
+
+/**
+ When the file for a key was written, as known to the cache, without touching the disk. `nil` if the key isn't known,
+ which includes keys on disk the cache hasn't looked at yet.
+
+ @param key The key of the object.
+ */
+- (nullable NSDate *)createdDateForKey:(NSString *)key;
+
+/**
+ The keys of the objects with a tag, as indexed when the cache last looked at the disk.
+
+ @param tag The tag of the objects.
+ */
+- (NSArray<NSString *> *)keysWithTag:(NSString *)tag;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -5,8 +5,11 @@
 #import <Foundation/Foundation.h>
 
 #import <PINCache/PINCacheMacros.h>
+#import <PINCache/PINCacheCancellationToken.h>
 #import <PINCache/PINCaching.h>
 #import <PINCache/PINCacheObjectSubscripting.h>
+#import <PINCache/PINCacheStatistics.h>
+#import <PINCache/PINCacheTracing.h>
 
 NS_ASSUME_NONNULL_BEGIN
 
@@ -24,6 +27,8 @@ extern NSTimeInterval PINDiskCacheDefaultAgeLimit;
 typedef NS_ENUM(NSInteger, PINDiskCacheError) {
   PINDiskCacheErrorReadFailure = -1000,
   PINDiskCacheErrorWriteFailure = -1001,
+  PINDiskCacheErrorChecksumMismatch = -1002,
+  PINDiskCacheErrorInvalidSnapshot = -1003,
 };
 
 /**
@@ -90,8 +95,9 @@ typedef NSString *_Nonnull(^PINDiskCacheKeyDecoderBlock)(NSString *encodedKey);
  `PINDiskCache` is a thread safe key/value store backed by the file system. It accepts any object conforming
  to the `NSCoding` protocol, which includes the basic Foundation data types and collection classes and also
  many UIKit classes, notably `UIImage`. All work is performed on a serial queue shared by all instances in
- the app, and archiving is handled by `NSKeyedArchiver`. This is a particular advantage for `UIImage` because
- it skips `UIImagePNGRepresentation()` and retains information like scale and orientation.
+ the app. Property lists are written in a compact binary format, see <PINCacheBinaryEncodedData>, and anything else
+ is archived with `NSKeyedArchiver`. This is a particular advantage for `UIImage` because it skips
+ `UIImagePNGRepresentation()` and retains information like scale and orientation.
  
  The designated initializer for `PINDiskCache` is <initWithName:>. The <name> string is used to create a directory
  under Library/Caches that scopes disk access for this instance. Multiple instances with the same name are *not* 
@@ -176,6 +182,46 @@ PIN_SUBCLASSING_RESTRICTED
  */
 @property (atomic, assign) PINCacheEvictionStrategy evictionStrategy;
 
+/**
+ When `YES` the cache coordinates with other processes that open a cache with the same <prefix>, name and root path.
+ A small memory-mapped index file is kept next to <cacheURL>; it holds the shared <byteCount>, a generation counter
+ that is bumped by every write and a journal of the files recently changed. Writes, removals and trims take an
+ advisory file lock, and trims first refresh the metadata of the files another process has changed since, so the
+ <byteLimit> and eviction order are enforced once across all processes. The directory is only rescanned when a
+ process falls further behind than the journal reaches. Reads never take the file lock.
+
+ This should be set once, before the cache is used. Setting it back to `NO` stops coordinating with other processes.
+ Defaults to `NO`.
+ */
+@property (assign) BOOL sharedAcrossProcesses;
+
+/**
+ When `YES` every object written is prefixed with a small header holding its length and a CRC32C checksum, computed
+ with the CPU's CRC instructions where available. Reads verify the checksum as the file is read, and an object that
+ fails verification is moved to <quarantineURL> and reported as a miss instead of being handed to the deserializer.
+ Objects written while this was `NO` are read as before, and objects with a header are always verified, so this can be
+ turned on and off at any time.
+ 
+ @warning Files returned by <fileURLForKey:> include the header when this is `YES`.
+ 
+ Defaults to `NO`.
+ */
+@property (assign) BOOL checksumsEnabled;
+
+/**
+ When greater than `0`, a background scrubber walks the cache verifying the checksums of objects written with
+ <checksumsEnabled>, reading at most this many bytes per second on average. Objects that fail verification are
+ quarantined. Setting it back to `0` stops the scrubber. Defaults to `0`.
+ */
+@property (assign) NSUInteger scrubBytesPerSecond;
+
+/**
+ The directory corrupt objects are moved to, a hidden directory inside <cacheURL>. Quarantined objects no longer count
+ towards <byteCount>, so only the 16 most recently quarantined are kept, and they are deleted by <removeAllObjects>. No
+ removal blocks are called when an object is quarantined.
+ */
+@property (readonly) NSURL *quarantineURL;
+
 /**
  The writing protection option used when writing a file on disk. This value is used every time an object is set.
  NSDataWritingAtomic and NSDataWritingWithoutOverwriting are ignored if set
@@ -204,6 +250,19 @@ PIN_SUBCLASSING_RESTRICTED
  */
 @property (nonatomic, readonly, getter=isTTLCache) BOOL ttlCache;
 
+/**
+ The block used to turn objects into the bytes written to disk: the one passed to the initializer, or the default one,
+ which writes property lists in the compact binary format of <PINCacheBinaryEncodedData> and archives anything else
+ with `NSKeyedArchiver`.
+ */
+@property (readonly) PINDiskCacheSerializerBlock serializer;
+
+/**
+ The block used to turn bytes read from disk back into objects: the one passed to the initializer, or the default one,
+ which reads both the binary format and archives, including those written before the binary format existed.
+ */
+@property (readonly) PINDiskCacheDeserializerBlock deserializer;
+
 #pragma mark - Event Blocks
 /// @name Event Blocks
 
@@ -281,8 +340,8 @@ PIN_SUBCLASSING_RESTRICTED
  @see name
  @param name The name of the cache.
  @param rootPath The path of the cache.
- @param serializer   A block used to serialize object. If nil provided, default NSKeyedArchiver serialized will be used.
- @param deserializer A block used to deserialize object. If nil provided, default NSKeyedUnarchiver serialized will be used.
+ @param serializer   A block used to serialize object. If nil provided, the default serializer will be used.
+ @param deserializer A block used to deserialize object. If nil provided, the default deserializer will be used.
  @result A new cache with the specified name.
  */
 - (instancetype)initWithName:(nonnull NSString *)name rootPath:(nonnull NSString *)rootPath serializer:(nullable PINDiskCacheSerializerBlock)serializer deserializer:(nullable PINDiskCacheDeserializerBlock)deserializer;
@@ -291,8 +350,8 @@ PIN_SUBCLASSING_RESTRICTED
  @see name
  @param name The name of the cache.
  @param rootPath The path of the cache.
- @param serializer   A block used to serialize object. If nil provided, default NSKeyedArchiver serialized will be used.
- @param deserializer A block used to deserialize object. If nil provided, default NSKeyedUnarchiver serialized will be used.
+ @param serializer   A block used to serialize object. If nil provided, the default serializer will be used.
+ @param deserializer A block used to deserialize object. If nil provided, the default deserializer will be used.
  @param operationQueue A PINOperationQueue to run asynchronous operations
  @result A new cache with the specified name.
  */
@@ -303,8 +362,8 @@ PIN_SUBCLASSING_RESTRICTED
  @param name The name of the cache.
  @param prefix The prefix for the cache name. Defaults to com.pinterest.PINDiskCache
  @param rootPath The path of the cache.
- @param serializer   A block used to serialize object. If nil provided, default NSKeyedArchiver serialized will be used.
- @param deserializer A block used to deserialize object. If nil provided, default NSKeyedUnarchiver serialized will be used.
+ @param serializer   A block used to serialize object. If nil provided, the default serializer will be used.
+ @param deserializer A block used to deserialize object. If nil provided, the default deserializer will be used.
  @param keyEncoder A block used to encode key(filename). If nil provided, default url encoder will be used
  @param keyDecoder A block used to decode key(filename). If nil provided, default url decoder will be used
  @param operationQueue A PINOperationQueue to run asynchronous operations
@@ -320,14 +379,14 @@ PIN_SUBCLASSING_RESTRICTED
               operationQueue:(nonnull PINOperationQueue *)operationQueue;
 
 /**
- The designated initializer allowing you to override default NSKeyedArchiver/NSKeyedUnarchiver serialization.
+ The designated initializer allowing you to override the default serialization.
  
  @see name
  @param name The name of the cache.
  @param prefix The prefix for the cache name. Defaults to com.pinterest.PINDiskCache
  @param rootPath The path of the cache.
- @param serializer   A block used to serialize object. If nil provided, default NSKeyedArchiver serialized will be used.
- @param deserializer A block used to deserialize object. If nil provided, default NSKeyedUnarchiver serialized will be used.
+ @param serializer   A block used to serialize object. If nil provided, the default serializer will be used.
+ @param deserializer A block used to deserialize object. If nil provided, the default deserializer will be used.
  @param keyEncoder A block used to encode key(filename). If nil provided, default url encoder will be used
  @param keyDecoder A block used to decode key(filename). If nil provided, default url decoder will be used
  @param operationQueue A PINOperationQueue to run asynchronous operations
@@ -349,8 +408,8 @@ PIN_SUBCLASSING_RESTRICTED
  @param name The name of the cache.
  @param prefix The prefix for the cache name. Defaults to com.pinterest.PINDiskCache
  @param rootPath The path of the cache.
- @param serializer   A block used to serialize object. If nil provided, default NSKeyedArchiver serialized will be used.
- @param deserializer A block used to deserialize object. If nil provided, default NSKeyedUnarchiver serialized will be used.
+ @param serializer   A block used to serialize object. If nil provided, the default serializer will be used.
+ @param deserializer A block used to deserialize object. If nil provided, the default deserializer will be used.
  @param keyEncoder A block used to encode key(filename). If nil provided, default url encoder will be used
  @param keyDecoder A block used to decode key(filename). If nil provided, default url decoder will be used
  @param operationQueue A PINOperationQueue to run asynchronous operations
@@ -372,14 +431,14 @@ PIN_SUBCLASSING_RESTRICTED
                     ageLimit:(NSTimeInterval)ageLimit;
 
 /**
- The designated initializer allowing you to override default NSKeyedArchiver/NSKeyedUnarchiver serialization.
+ The designated initializer allowing you to override the default serialization.
  
  @see name
  @param name The name of the cache.
  @param prefix The prefix for the cache name. Defaults to com.pinterest.PINDiskCache
  @param rootPath The path of the cache.
- @param serializer   A block used to serialize object. If nil provided, default NSKeyedArchiver serialized will be used.
- @param deserializer A block used to deserialize object. If nil provided, default NSKeyedUnarchiver serialized will be used.
+ @param serializer   A block used to serialize object. If nil provided, the default serializer will be used.
+ @param deserializer A block used to deserialize object. If nil provided, the default deserializer will be used.
  @param keyEncoder A block used to encode key(filename). If nil provided, default url encoder will be used
  @param keyDecoder A block used to decode key(filename). If nil provided, default url decoder will be used
  @param operationQueue A PINOperationQueue to run asynchronous operations
@@ -535,6 +594,112 @@ PIN_SUBCLASSING_RESTRICTED
  */
 - (void)enumerateObjectsWithBlockAsync:(PINDiskCacheFileURLEnumerationBlock)block completionBlock:(nullable PINCacheBlock)completionBlock;
 
+/**
+ Retrieves several objects at once. This method returns immediately and executes the passed block once, with every
+ object found.
+ 
+ @see objectsForKeys:
+ @param keys The keys of the objects to retrieve.
+ @param block A block to be executed when the objects are available.
+ */
+- (void)objectsForKeysAsync:(NSArray<NSString *> *)keys completion:(PINCacheObjectsBlock)block;
+
+/**
+ Stores several objects at once. This method returns immediately and executes the passed block once every object
+ has been stored.
+ 
+ @see setObjects:forKeys:
+ @param objects The objects to store.
+ @param keys The keys to associate with the objects, in the same order. Must have the same count as objects.
+ @param block A block to be executed after the objects have been stored, or nil.
+ */
+- (void)setObjectsAsync:(NSArray<id <NSCoding>> *)objects forKeys:(NSArray<NSString *> *)keys completion:(nullable PINCacheBlock)block;
+
+/**
+ Stores an object with tags. This method returns immediately and executes the passed block after the object has been
+ stored.
+
+ @see setObject:forKey:withTags:
+ @param object An object to store in the cache.
+ @param key A key to associate with the object. This string will be copied.
+ @param tags The tags to give the object.
+ @param block A block to be executed after the object has been stored, or nil.
+ */
+- (void)setObjectAsync:(id <NSCoding>)object forKey:(NSString *)key withTags:(NSSet<NSString *> *)tags completion:(nullable PINDiskCacheObjectBlock)block;
+
+/**
+ Removes every object with a tag. This method returns immediately and executes the passed block after the objects
+ have been removed.
+
+ @see removeObjectsWithTag:
+ @param tag The tag of the objects to remove.
+ @param block A block to be executed after the objects have been removed, or nil.
+ */
+- (void)removeObjectsWithTagAsync:(NSString *)tag completion:(nullable PINCacheBlock)block;
+
+/**
+ Removes every object whose key starts with a prefix. This method returns immediately and executes the passed block
+ after the objects have been removed.
+
+ @see removeObjectsWithKeyPrefix:
+ @param prefix The prefix of the keys of the objects to remove.
+ @param block A block to be executed after the objects have been removed, or nil.
+ */
+- (void)removeObjectsWithKeyPrefixAsync:(NSString *)prefix completion:(nullable PINCacheBlock)block;
+
+/**
+ Retrieves the object for the specified key, unless called off first. A read that's under way when it's called off
+ doesn't deserialize the object. This method returns immediately and executes the passed block after the object is
+ available.
+
+ @see PINCacheCancellationToken
+ @param key The key associated with the requested object.
+ @param deadline When the object stops being wanted, or nil.
+ @param block A block to be executed when the object is available.
+ @result A token to call the lookup off with.
+ */
+- (PINCacheCancellationToken *)objectForKeyAsync:(NSString *)key deadline:(nullable NSDate *)deadline completion:(PINDiskCacheObjectBlock)block;
+
+/**
+ Stores an object, unless called off first. This method returns immediately and executes the passed block after the
+ object has been stored.
+
+ @see PINCacheCancellationToken
+ @param object An object to store in the cache.
+ @param key A key to associate with the object. This string will be copied.
+ @param ageLimit The age limit (in seconds) to associate with the object, or 0 for the cache's own.
+ @param deadline When the set stops being wanted, or nil.
+ @param block A block to be executed after the object has been stored, or nil.
+ @result A token to call the set off with.
+ */
+- (PINCacheCancellationToken *)setObjectAsync:(id <NSCoding>)object forKey:(NSString *)key withAgeLimit:(NSTimeInterval)ageLimit deadline:(nullable NSDate *)deadline completion:(nullable PINDiskCacheObjectBlock)block;
+
+/**
+ Removes objects older than a date, unless called off first. Trims waiting to run are coalesced as usual, and the
+ coalesced trim is only dropped if every trim coalesced into it was. This method returns immediately and executes the
+ passed block after the cache has been trimmed.
+
+ @see PINCacheCancellationToken
+ @param date Objects that haven't been accessed since this date are removed from the cache.
+ @param deadline When the trim stops being wanted, or nil.
+ @param block A block to be executed after the cache has been trimmed, or nil.
+ @result A token to call the trim off with.
+ */
+- (PINCacheCancellationToken *)trimToDateAsync:(NSDate *)date deadline:(nullable NSDate *)deadline completion:(nullable PINCacheBlock)block;
+
+/**
+ Removes objects by the <evictionStrategy> until the <byteCount> is below a value, unless called off first. Trims are
+ coalesced as with <trimToDateAsync:deadline:completion:>. This method returns immediately and executes the passed
+ block after the cache has been trimmed.
+
+ @see PINCacheCancellationToken
+ @param byteCount The cache will be trimmed equal to or smaller than this size.
+ @param deadline When the trim stops being wanted, or nil.
+ @param block A block to be executed after the cache has been trimmed, or nil.
+ @result A token to call the trim off with.
+ */
+- (PINCacheCancellationToken *)trimToSizeByEvictionStrategyAsync:(NSUInteger)byteCount deadline:(nullable NSDate *)deadline completion:(nullable PINCacheBlock)block;
+
 #pragma mark - Synchronous Methods
 /// @name Synchronous Methods
 
@@ -591,6 +756,60 @@ PIN_SUBCLASSING_RESTRICTED
  */
 - (void)setObject:(nullable id <NSCoding>)object forKey:(NSString *)key withAgeLimit:(NSTimeInterval)ageLimit;
 
+/**
+ Retrieves several objects at once. The lock is taken once to find the files and once to record the accesses, and the
+ files are read and deserialized in parallel in between. This method blocks the calling thread until the objects are
+ available.
+ 
+ @see objectsForKeysAsync:completion:
+ @param keys The keys of the objects to retrieve. Duplicates are looked up once.
+ @result The objects found, keyed by their keys. Keys that were not found are absent.
+ */
+- (NSDictionary<NSString *, id <NSCoding>> *)objectsForKeys:(NSArray<NSString *> *)keys;
+
+/**
+ Stores several objects at once. The objects are serialized and written to staging files in parallel, then moved into
+ place under a single lock, and the cache is trimmed once afterwards. The <willAddObjectBlock> is called for every
+ object before any is written, and the <didAddObjectBlock> for every object stored once all are in place. Objects
+ too large for the <byteLimit> are skipped. This method blocks the calling thread until the objects have been stored.
+ 
+ @see setObjectsAsync:forKeys:completion:
+ @param objects The objects to store.
+ @param keys The keys to associate with the objects, in the same order. Must have the same count as objects.
+ */
+- (void)setObjects:(NSArray<id <NSCoding>> *)objects forKeys:(NSArray<NSString *> *)keys;
+
+/**
+ Stores an object with tags, which <removeObjectsWithTag:> can later remove it by. Tags are kept in an extended
+ attribute of the object's file, so they last across launches. Setting the key again, including through
+ <setObjects:forKeys:>, replaces its tags along with its object. Tags aren't included in snapshots. This method
+ blocks the calling thread until the object has been stored.
+
+ @param object An object to store in the cache.
+ @param key A key to associate with the object. This string will be copied.
+ @param tags The tags to give the object.
+ */
+- (void)setObject:(id <NSCoding>)object forKey:(NSString *)key withTags:(NSSet<NSString *> *)tags;
+
+/**
+ Removes every object with a tag. Matches are found through an index of the tags kept with the cache's metadata, and
+ their files are removed under a single lock. The event blocks are still executed once per object. This method
+ blocks the calling thread until the objects have been removed.
+
+ @param tag The tag of the objects to remove.
+ */
+- (void)removeObjectsWithTag:(NSString *)tag;
+
+/**
+ Removes every object whose key starts with a prefix, e.g. everything cached for one user. Matches are found through
+ the keys in the cache's metadata, without reading any file, and their files are removed under a single lock. The
+ event blocks are still executed once per object. This method blocks the calling thread until the objects have been
+ removed.
+
+ @param prefix The prefix of the keys of the objects to remove.
+ */
+- (void)removeObjectsWithKeyPrefix:(NSString *)prefix;
+
 /**
  Removes objects from the cache, largest first, until the cache is equal to or smaller than the
  specified byteCount. This method blocks the calling thread until the cache has been trimmed.
@@ -630,6 +849,78 @@ PIN_SUBCLASSING_RESTRICTED
  */
 - (void)enumerateObjectsWithBlock:(PIN_NOESCAPE PINDiskCacheFileURLEnumerationBlock)block;
 
+#pragma mark - Snapshots
+/// @name Snapshots
+
+/**
+ Writes every object in the cache, along with its metadata, to a single packed archive, most recently used first.
+ The lock is only held while the keys and their metadata are read. The files are then hard linked (or copied) aside
+ and the archive is streamed out from those frozen copies, so objects removed meanwhile are left out and objects
+ replaced meanwhile are archived as they are then. This method blocks the calling thread until the archive is written.
+ 
+ @see importSnapshotFromURL:error:
+ @param archiveURL Where to write the archive. An existing file is replaced.
+ @param error Set if a file could not be copied aside or the archive could not be written.
+ @result YES if the archive was written.
+ */
+- (BOOL)exportSnapshotToURL:(NSURL *)archiveURL error:(NSError **)error;
+
+/**
+ Adds the objects in an archive written by <exportSnapshotToURL:error:> to the cache, replacing objects with the same
+ key and restoring their dates, age limits and access counts, so no rescan is needed. The archive is read sequentially
+ and every object is written outside the lock, readers are only held up while each file is moved into place.
+ Event blocks are not called. This method blocks the calling thread until the archive has been imported.
+ 
+ @param archiveURL The archive to import.
+ @param error Set if the archive could not be read or is corrupt. Objects imported before that point remain.
+ @result YES if the whole archive was imported.
+ */
+- (BOOL)importSnapshotFromURL:(NSURL *)archiveURL error:(NSError **)error;
+
+/**
+ Same as <importSnapshotFromURL:error:>, and also hands the hottest objects to a block as they're imported, e.g. to
+ warm up a memory cache.
+ 
+ @param archiveURL The archive to import.
+ @param hottestObjectCount How many of the most recently used objects to pass to `hottestObjectBlock`.
+ @param hottestObjectBlock Called with each of those objects, deserialized, hottest first.
+ @param error Set if the archive could not be read or is corrupt. Objects imported before that point remain.
+ @result YES if the whole archive was imported.
+ */
+- (BOOL)importSnapshotFromURL:(NSURL *)archiveURL
+           hottestObjectCount:(NSUInteger)hottestObjectCount
+           hottestObjectBlock:(nullable PINDiskCacheObjectBlock)hottestObjectBlock
+                        error:(NSError **)error;
+
+#pragma mark - Statistics
+/// @name Statistics
+
+/**
+ Whether the cache counts what it does and measures how long it takes, see <statistics>. Recording is cheap but not
+ free, so it's off by default.
+ */
+@property (assign) BOOL statisticsEnabled;
+
+/**
+ A snapshot of what the disk cache has done since <statisticsEnabled> was turned on or <resetStatistics> was called.
+ */
+@property (readonly) PINCacheStatistics *statistics;
+
+/**
+ Zeroes <statistics>.
+ */
+- (void)resetStatistics;
+
+#pragma mark - Tracing
+/// @name Tracing
+
+/**
+ Receives a span for every single object read, write and removal, with the time spent queued, waiting for the lock,
+ doing I/O and (de)serializing. Batch methods aren't traced. While `nil`, tracing costs one atomic load per operation
+ and per lock. Defaults to `nil`.
+ */
+@property (nullable, strong) id <PINCacheTraceSink> traceSink;
+
 @end
 
 
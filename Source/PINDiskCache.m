@@ -3,16 +3,29 @@
 //  Copyright (c) 2015 Pinterest. All rights reserved.
 
 #import "PINDiskCache.h"
+#import "PINDiskCache+Private.h"
 
 #if __IPHONE_OS_VERSION_MIN_REQUIRED >= __IPHONE_4_0
 #import <UIKit/UIKit.h>
 #endif
 
+#import <fcntl.h>
 #import <pthread.h>
+#import <stdatomic.h>
+#import <sys/file.h>
+#import <sys/mman.h>
+#import <sys/time.h>
 #import <sys/xattr.h>
 
 #import <PINOperation/PINOperation.h>
 
+#import "PINCacheBinaryCoding.h"
+#import "PINCacheCancellationToken+Private.h"
+#import "PINCacheChecksum.h"
+#import "PINCacheStatistics+Private.h"
+#import "PINCacheTracing+Private.h"
+#import "PINDiskCacheKeyFilter.h"
+
 #define PINDiskCacheError(error) if (error) { NSLog(@"%@ (%d) ERROR: %@", \
 [[NSString stringWithUTF8String:__FILE__] lastPathComponent], \
 __LINE__, [error localizedDescription]); }
@@ -21,6 +34,7 @@ __LINE__, [error localizedDescription]); }
 
 const char * PINDiskCacheAgeLimitAttributeName = "com.pinterest.PINDiskCache.ageLimit";
 const char * PINDiskCacheAccessCountAttributeName = "com.pinterest.PINDiskCache.accessCount";
+const char * PINDiskCacheTagsAttributeName = "com.pinterest.PINDiskCache.tags";
 NSString * const PINDiskCacheErrorDomain = @"com.pinterest.PINDiskCache";
 NSErrorUserInfoKey const PINDiskCacheErrorReadFailureCodeKey = @"PINDiskCacheErrorReadFailureCodeKey";
 NSErrorUserInfoKey const PINDiskCacheErrorWriteFailureCodeKey = @"PINDiskCacheErrorWriteFailureCodeKey";
@@ -49,11 +63,267 @@ static PINOperationDataCoalescingBlock PINDiskTrimmingDateCoalescingBlock = ^id(
     return (result == NSOrderedDescending) ? newDate : existingDate;
 };
 
+static NSString * const PINDiskCacheSharedIndexPathExtension = @"index";
+static const uint32_t PINDiskCacheSharedIndexMagic = 0x50494E49; // 'PINI'
+static const uint32_t PINDiskCacheSharedIndexVersion = 2;
+#define PINDiskCacheSharedIndexJournalCapacity 128
+#define PINDiskCacheSharedIndexJournalNameLength 255
+
+// A file changed by the write session that bumped the shared generation to `generation`.
+typedef struct {
+    uint64_t generation;
+    uint8_t nameLength;
+    char name[PINDiskCacheSharedIndexJournalNameLength];
+} PINDiskCacheSharedIndexJournalRecord;
+
+// Layout of the memory-mapped file shared by every process that opens the same cache. The per-entry state
+// (sizes, modification dates, access counts) already lives on disk, so only the totals and the names of the files
+// recently changed need to be shared.
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    // Bumped after every mutation, read without the file lock to detect stale local metadata.
+    _Atomic(uint64_t) generation;
+    _Atomic(uint64_t) byteCount;
+    // The rest is only touched under the file lock.
+    // Set for the length of a write session, still set when the file lock is taken means its holder died mid-write.
+    uint32_t writeInProgress;
+    uint32_t reserved;
+    // The oldest generation whose changes are all still in the journal, processes further behind rescan the directory.
+    uint64_t journalStartGeneration;
+    // Records ever appended, the next one goes in journal[journalRecordCount % PINDiskCacheSharedIndexJournalCapacity].
+    uint64_t journalRecordCount;
+    PINDiskCacheSharedIndexJournalRecord journal[PINDiskCacheSharedIndexJournalCapacity];
+} PINDiskCacheSharedIndexHeader;
+
 const char * PINDiskCacheFileSystemRepresentation(NSURL *url)
 {
     return url.fileSystemRepresentation;
 }
 
+static NSString * const PINDiskCacheQuarantineDirectoryName = @".quarantine";
+static const NSUInteger PINDiskCacheQuarantineMaximumFileCount = 16;
+static NSString * const PINDiskCacheKeyFilterFileName = @".keyfilter";
+static NSString * const PINDiskCacheImportFilePrefix = @".import-";
+static const time_t PINDiskCacheStaleImportFileAge = 60;
+static const NSUInteger PINDiskCacheKeyFilterDefaultCapacity = 16 * 1024;
+static const NSTimeInterval PINDiskCacheKeyFilterPersistDelay = 5.0;
+static const uint64_t PINDiskCacheChecksumHeaderMagic = 0x3143524343494E50; // 'PINCCRC1'
+static const size_t PINDiskCacheReadChunkSize = 64 * 1024;
+static const NSUInteger PINDiskCacheAccessFlushChunkSize = 64;
+
+// Prepended to every file written while checksums are enabled.
+// The time a phase of a traced operation starts, or `0` without any cost beyond a load when the cache isn't traced.
+static inline uint64_t PINDiskCacheTracePhaseBegin(atomic_bool *tracing)
+{
+    return atomic_load_explicit(tracing, memory_order_relaxed) ? PINCacheTracePhaseBegin() : 0;
+}
+
+typedef struct {
+    uint64_t magic;
+    uint32_t checksum;
+    uint32_t reserved;
+    uint64_t length;
+} PINDiskCacheChecksumHeader;
+
+static NSData *PINDiskCacheChecksummedData(NSData *data)
+{
+    PINDiskCacheChecksumHeader header = {
+        .magic = PINDiskCacheChecksumHeaderMagic,
+        .checksum = PINCacheCRC32C(0, data.bytes, data.length),
+        .reserved = 0,
+        .length = data.length,
+    };
+    NSMutableData *checksummedData = [[NSMutableData alloc] initWithCapacity:sizeof(header) + data.length];
+    [checksummedData appendBytes:&header length:sizeof(header)];
+    [checksummedData appendData:data];
+    return checksummedData;
+}
+
+/**
+ * Reads the payload of a cache file. If the file has a checksum header, each chunk is checksummed right after it's
+ * read, while it's still hot in the CPU cache, rather than in a second pass over the payload. Files without a header
+ * are returned unverified.
+ *
+ * @param keepData If NO the payload is only verified, through a small reusable buffer, and nil is returned. Files
+ * without a header aren't read at all in that case.
+ * @param outLength The number of payload bytes read.
+ * @param outCorrupt Set to YES if the file has a header and its payload doesn't match it.
+ */
+static NSData *PINDiskCacheReadChecksummedFile(NSURL *fileURL, BOOL keepData, NSUInteger *outLength, BOOL *outCorrupt)
+{
+    *outCorrupt = NO;
+    if (outLength) {
+        *outLength = 0;
+    }
+
+    int fileDescriptor = open(PINDiskCacheFileSystemRepresentation(fileURL), O_RDONLY | O_CLOEXEC);
+    if (fileDescriptor < 0) {
+        return nil;
+    }
+
+    struct stat fileStat;
+    if (fstat(fileDescriptor, &fileStat) != 0) {
+        close(fileDescriptor);
+        return nil;
+    }
+
+    size_t fileSize = (size_t)fileStat.st_size;
+    PINDiskCacheChecksumHeader header;
+    BOOL hasHeader = fileSize >= sizeof(header)
+        && pread(fileDescriptor, &header, sizeof(header), 0) == (ssize_t)sizeof(header)
+        && header.magic == PINDiskCacheChecksumHeaderMagic;
+    size_t offset = hasHeader ? sizeof(header) : 0;
+    size_t length = fileSize - offset;
+    if (hasHeader && header.length != length) {
+        // Truncated or extended behind our back.
+        close(fileDescriptor);
+        *outCorrupt = YES;
+        return nil;
+    }
+    if (!hasHeader && !keepData) {
+        // Nothing to verify.
+        close(fileDescriptor);
+        return nil;
+    }
+
+    size_t bufferSize = keepData ? length : MIN(length, PINDiskCacheReadChunkSize);
+    uint8_t *buffer = malloc(MAX(bufferSize, (size_t)1));
+    if (buffer == NULL) {
+        close(fileDescriptor);
+        return nil;
+    }
+
+    uint32_t checksum = 0;
+    size_t readLength = 0;
+    while (readLength < length) {
+        size_t chunkSize = MIN(PINDiskCacheReadChunkSize, length - readLength);
+        uint8_t *chunk = keepData ? buffer + readLength : buffer;
+        ssize_t result = pread(fileDescriptor, chunk, chunkSize, (off_t)(offset + readLength));
+        if (result < 0 && errno == EINTR) {
+            continue;
+        }
+        if (result <= 0) {
+            break;
+        }
+        if (hasHeader) {
+            checksum = PINCacheCRC32C(checksum, chunk, (size_t)result);
+        }
+        readLength += (size_t)result;
+    }
+    close(fileDescriptor);
+
+    if (outLength) {
+        *outLength = readLength;
+    }
+    if (readLength != length || (hasHeader && checksum != header.checksum)) {
+        free(buffer);
+        *outCorrupt = hasHeader;
+        return nil;
+    }
+    if (!keepData) {
+        free(buffer);
+        return nil;
+    }
+    return [[NSData alloc] initWithBytesNoCopy:buffer length:length freeWhenDone:YES];
+}
+
+/**
+ * The in-memory equivalent of PINDiskCacheReadChecksummedFile, for file contents that have already been read.
+ */
+static NSData *PINDiskCachePayloadFromData(NSData *data, BOOL *outCorrupt)
+{
+    *outCorrupt = NO;
+
+    PINDiskCacheChecksumHeader header;
+    if (data.length < sizeof(header)) {
+        return data;
+    }
+    memcpy(&header, data.bytes, sizeof(header));
+    if (header.magic != PINDiskCacheChecksumHeaderMagic) {
+        return data;
+    }
+
+    NSData *payload = [data subdataWithRange:NSMakeRange(sizeof(header), data.length - sizeof(header))];
+    if (header.length != payload.length || PINCacheCRC32C(0, payload.bytes, payload.length) != header.checksum) {
+        *outCorrupt = YES;
+        return nil;
+    }
+    return payload;
+}
+
+static const uint32_t PINDiskCacheSnapshotMagic = 0x534E4950; // 'PINS'
+static const uint32_t PINDiskCacheSnapshotVersion = 1;
+static const size_t PINDiskCacheSnapshotBufferSize = 1024 * 1024;
+
+// A snapshot archive is this header, every file's contents back to back, hottest first, and then the index: one
+// PINDiskCacheSnapshotIndexEntry per file, in the same order, each followed by its UTF-8 key. The index goes last so
+// that export can stream every file exactly once, checksumming as it goes.
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t entryCount;
+    uint64_t indexOffset;
+    uint64_t indexLength;
+} PINDiskCacheSnapshotHeader;
+
+typedef struct {
+    uint64_t length;
+    // Seconds since the reference date, 0 if unknown.
+    double createdDate;
+    double lastModifiedDate;
+    double ageLimit;
+    int64_t accessCount;
+    uint32_t checksum;
+    uint32_t keyLength;
+} PINDiskCacheSnapshotIndexEntry;
+
+static NSError *PINDiskCacheSnapshotError(PINDiskCacheError code, int errorNumber)
+{
+    NSDictionary<NSErrorUserInfoKey, id> *userInfo = nil;
+    if (code == PINDiskCacheErrorReadFailure) {
+        userInfo = @{ PINDiskCacheErrorReadFailureCodeKey : @(errorNumber) };
+    } else if (code == PINDiskCacheErrorWriteFailure) {
+        userInfo = @{ PINDiskCacheErrorWriteFailureCodeKey : @(errorNumber) };
+    }
+    return [NSError errorWithDomain:PINDiskCacheErrorDomain code:code userInfo:userInfo];
+}
+
+static BOOL PINDiskCacheWriteFully(int fileDescriptor, const void *bytes, size_t length)
+{
+    const uint8_t *cursor = bytes;
+    while (length > 0) {
+        ssize_t result = write(fileDescriptor, cursor, length);
+        if (result < 0 && errno == EINTR) {
+            continue;
+        }
+        if (result <= 0) {
+            return NO;
+        }
+        cursor += result;
+        length -= (size_t)result;
+    }
+    return YES;
+}
+
+static BOOL PINDiskCacheReadFully(int fileDescriptor, void *bytes, size_t length, off_t offset)
+{
+    uint8_t *cursor = bytes;
+    while (length > 0) {
+        ssize_t result = pread(fileDescriptor, cursor, length, offset);
+        if (result < 0 && errno == EINTR) {
+            continue;
+        }
+        if (result <= 0) {
+            return NO;
+        }
+        cursor += result;
+        offset += result;
+        length -= (size_t)result;
+    }
+    return YES;
+}
+
 @interface PINDiskCacheMetadata : NSObject
 // When the object was added to the disk cache
 @property (nonatomic, strong) NSDate *createdDate;
@@ -64,6 +334,16 @@ const char * PINDiskCacheFileSystemRepresentation(NSURL *url)
 @property (nonatomic) NSTimeInterval ageLimit;
 // Access count is how many times this object has been fetched. Used with the LFU
 @property (nonatomic) NSInteger accessCount;
+// Tags the object was set with, or nil. Must only be changed through _locked_setTags:forKey:, which indexes them.
+@property (nonatomic, copy) NSSet<NSString *> *tags;
+@end
+
+// One file of a snapshot being exported or imported.
+@interface PINDiskCacheSnapshotEntry : NSObject
+@property (nonatomic, copy) NSString *key;
+// The frozen copy of the file while exporting.
+@property (nonatomic, strong) NSURL *fileURL;
+@property (nonatomic) PINDiskCacheSnapshotIndexEntry indexEntry;
 @end
 
 @interface PINDiskCache () {
@@ -72,6 +352,45 @@ const char * PINDiskCacheFileSystemRepresentation(NSURL *url)
     
     PINDiskCacheKeyEncoderBlock _keyEncoder;
     PINDiskCacheKeyDecoderBlock _keyDecoder;
+
+    int _sharedIndexFileDescriptor;
+    PINDiskCacheSharedIndexHeader *_sharedIndexHeader;
+    // The shared generation our metadata was last fully in sync with.
+    uint64_t _sharedIndexGeneration;
+    // Every mapping of the shared index made while the cache is alive, only unmapped in dealloc so that byteCount can
+    // read the header without the lock while sharing is being turned off. Turning it back on reuses the last one.
+    NSMutableArray<NSValue *> *_sharedIndexMappings;
+    dev_t _sharedIndexMappingDevice;
+    ino_t _sharedIndexMappingInode;
+    // Keys changed by the current write session, journaled when it ends. nil outside of one.
+    NSMutableSet<NSString *> *_sharedIndexChangedKeys;
+    // Set when the current write session changed more than can be journaled.
+    BOOL _sharedIndexJournalOverflowed;
+
+    // Keys left to verify in the current scrub pass.
+    NSArray<NSString *> *_scrubKeys;
+    NSUInteger _scrubKeyIndex;
+
+    PINDiskCacheKeyFilter *_keyFilter;
+    // YES once the filter holds every key on disk. Until then it only holds the keys we have metadata for.
+    BOOL _keyFilterCoversDisk;
+    // YES while the filter file matches _keyFilter and is marked clean.
+    BOOL _keyFilterPersisted;
+    BOOL _keyFilterPersistScheduled;
+
+    // Keys read through a cache in front of this one since the last flush. Guarded by their own lock rather than the
+    // cache's, which is held across disk I/O, since they're recorded on the threads serving memory hits.
+    pthread_mutex_t _pendingAccessMutex;
+    NSMutableSet<NSString *> *_pendingAccessKeys;
+    BOOL _pendingAccessFlushScheduled;
+
+    // The keys of the objects with each tag, in step with the tags in _metadata.
+    NSMutableDictionary<NSString *, NSMutableSet<NSString *> *> *_tagIndex;
+
+    PINCacheStatisticsRecorder *_statisticsRecorder;
+
+    atomic_bool _tracing;
+    id <PINCacheTraceSink> _traceSink;
 }
 
 @property (assign, nonatomic) pthread_mutex_t mutex;
@@ -97,9 +416,12 @@ static NSURL *_sharedTrashURL;
 @synthesize didAddObjectBlock = _didAddObjectBlock;
 @synthesize didRemoveObjectBlock = _didRemoveObjectBlock;
 @synthesize didRemoveAllObjectsBlock = _didRemoveAllObjectsBlock;
+@synthesize byteCount = _byteCount;
 @synthesize byteLimit = _byteLimit;
 @synthesize ageLimit = _ageLimit;
 @synthesize ttlCache = _ttlCache;
+@synthesize checksumsEnabled = _checksumsEnabled;
+@synthesize scrubBytesPerSecond = _scrubBytesPerSecond;
 
 #if TARGET_OS_IPHONE
 @synthesize writingProtectionOption = _writingProtectionOption;
@@ -110,10 +432,18 @@ static NSURL *_sharedTrashURL;
 
 - (void)dealloc
 {
+    [self _locked_persistKeyFilter];
+    
     __unused int result = pthread_mutex_destroy(&_mutex);
     NSCAssert(result == 0, @"Failed to destroy lock in PINDiskCache %p. Code: %d", (void *)self, result);
+    result = pthread_mutex_destroy(&_pendingAccessMutex);
+    NSCAssert(result == 0, @"Failed to destroy pending access lock in PINDiskCache %p. Code: %d", (void *)self, result);
     pthread_cond_destroy(&_diskWritableCondition);
     pthread_cond_destroy(&_diskStateKnownCondition);
+    [self _locked_closeSharedIndex];
+    for (NSValue *mapping in _sharedIndexMappings) {
+        munmap([mapping pointerValue], sizeof(PINDiskCacheSharedIndexHeader));
+    }
 }
 
 - (instancetype)init
@@ -250,10 +580,13 @@ static NSURL *_sharedTrashURL;
     if (self = [super init]) {
         __unused int result = pthread_mutex_init(&_mutex, NULL);
         NSAssert(result == 0, @"Failed to init lock in PINDiskCache %@. Code: %d", self, result);
+        result = pthread_mutex_init(&_pendingAccessMutex, NULL);
+        NSAssert(result == 0, @"Failed to init pending access lock in PINDiskCache %@. Code: %d", self, result);
         
         _name = [name copy];
         _prefix = [prefix copy];
         _operationQueue = operationQueue;
+        _maintenanceQueue = operationQueue;
         _ttlCache = ttlCache;
         _willAddObjectBlock = nil;
         _willRemoveObjectBlock = nil;
@@ -263,6 +596,8 @@ static NSURL *_sharedTrashURL;
         _didRemoveAllObjectsBlock = nil;
         
         _byteCount = 0;
+        _sharedIndexFileDescriptor = -1;
+        _sharedIndexHeader = NULL;
         _byteLimit = byteLimit;
         _ageLimit = ageLimit;
         _evictionStrategy = evictionStrategy;
@@ -274,10 +609,21 @@ static NSURL *_sharedTrashURL;
 #endif
         
         _metadata = [[NSMutableDictionary alloc] init];
+        _tagIndex = [[NSMutableDictionary alloc] init];
+        _pendingAccessKeys = [[NSMutableSet alloc] init];
         _diskStateKnown = NO;
+        _statisticsRecorder = [[PINCacheStatisticsRecorder alloc] init];
       
         _cacheURL = [[self class] cacheURLWithRootPath:rootPath prefix:_prefix name:_name];
         
+        // A filter left behind cleanly by the last launch lets us answer misses before the disk has been scanned.
+        _keyFilter = [PINDiskCacheKeyFilter filterWithContentsOfURL:[self keyFilterURL]];
+        _keyFilterCoversDisk = _keyFilter != nil;
+        _keyFilterPersisted = _keyFilter != nil;
+        if (_keyFilter == nil) {
+            _keyFilter = [[PINDiskCacheKeyFilter alloc] initWithCapacity:PINDiskCacheKeyFilterDefaultCapacity];
+        }
+        
         //setup serializers
         if(serializer) {
             _serializer = [serializer copy];
@@ -375,8 +721,13 @@ static NSURL *_sharedTrashURL;
 - (PINDiskCacheSerializerBlock)defaultSerializer
 {
     return ^NSData*(id<NSCoding> object, NSString *key){
+        // Property lists get the compact binary format, anything else is archived as before.
+        NSData *data = PINCacheBinaryEncodedData(object);
+        if (data) {
+            return data;
+        }
         NSError *error = nil;
-        NSData *data = [NSKeyedArchiver archivedDataWithRootObject:object requiringSecureCoding:NO error:&error];
+        data = [NSKeyedArchiver archivedDataWithRootObject:object requiringSecureCoding:NO error:&error];
         PINDiskCacheError(error);
         return data;
     };
@@ -385,6 +736,10 @@ static NSURL *_sharedTrashURL;
 - (PINDiskCacheDeserializerBlock)defaultDeserializer
 {
     return ^id(NSData * data, NSString *key){
+        // Anything without the binary format's header was archived, either as a fallback or by an earlier version.
+        if (PINCacheIsBinaryEncodedData(data)) {
+            return PINCacheBinaryDecodedObject(data);
+        }
         NSError *error = nil;
         NSKeyedUnarchiver *unarchiver = [[NSKeyedUnarchiver alloc] initForReadingFromData:data error:&error];
         NSAssert(!error, @"unarchiver init failed with error");
@@ -507,168 +862,933 @@ static NSURL *_sharedTrashURL;
     });
 }
 
-#pragma mark - Private Queue Methods -
+#pragma mark - Private Shared Index Methods -
 
-- (BOOL)_locked_createCacheDirectory
+- (NSURL *)sharedIndexURL
 {
-    BOOL created = NO;
-    if ([[NSFileManager defaultManager] fileExistsAtPath:[_cacheURL path]] == NO) {
-        NSError *error = nil;
-        created = [[NSFileManager defaultManager] createDirectoryAtURL:_cacheURL
-                                                withIntermediateDirectories:YES
-                                                                 attributes:nil
-                                                                      error:&error];
+    // Lives next to the cache directory rather than in it so that removeAllObjects, which trashes the whole directory,
+    // leaves it in place for the other processes.
+    NSString *indexName = [[_cacheURL lastPathComponent] stringByAppendingPathExtension:PINDiskCacheSharedIndexPathExtension];
+    return [[_cacheURL URLByDeletingLastPathComponent] URLByAppendingPathComponent:indexName isDirectory:NO];
+}
+
+- (BOOL)_locked_openSharedIndex
+{
+    if (_sharedIndexHeader != NULL) {
+        return YES;
+    }
+
+    NSError *error = nil;
+    int fileDescriptor = open(PINDiskCacheFileSystemRepresentation([self sharedIndexURL]), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fileDescriptor < 0) {
+        NSDictionary<NSErrorUserInfoKey, id> *userInfo = @{ PINDiskCacheErrorReadFailureCodeKey : @(errno)};
+        error = [NSError errorWithDomain:PINDiskCacheErrorDomain code:PINDiskCacheErrorReadFailure userInfo:userInfo];
         PINDiskCacheError(error);
+        return NO;
     }
-    
 
-    
-    // while this may not be true if success is false, it's better than deadlocking later.
-    _diskWritable = YES;
-    pthread_cond_broadcast(&_diskWritableCondition);
-    
-    return created;
-}
+    // Hold the file lock while sizing and initializing the file so two processes can't both set it up.
+    flock(fileDescriptor, LOCK_EX);
 
-+ (NSArray *)resourceKeys
-{
-    static NSArray *resourceKeys = nil;
-    static dispatch_once_t predicate;
+    PINDiskCacheSharedIndexHeader *header = MAP_FAILED;
+    struct stat fileStat;
+    if (fstat(fileDescriptor, &fileStat) == 0
+        && (fileStat.st_size >= (off_t)sizeof(PINDiskCacheSharedIndexHeader) || ftruncate(fileDescriptor, sizeof(PINDiskCacheSharedIndexHeader)) == 0)) {
+        NSValue *lastMapping = _sharedIndexMappings.lastObject;
+        if (lastMapping && fileStat.st_dev == _sharedIndexMappingDevice && fileStat.st_ino == _sharedIndexMappingInode) {
+            header = [lastMapping pointerValue];
+        } else {
+            header = mmap(NULL, sizeof(PINDiskCacheSharedIndexHeader), PROT_READ | PROT_WRITE, MAP_SHARED, fileDescriptor, 0);
+            if (header != MAP_FAILED) {
+                if (_sharedIndexMappings == nil) {
+                    _sharedIndexMappings = [[NSMutableArray alloc] init];
+                }
+                [_sharedIndexMappings addObject:[NSValue valueWithPointer:header]];
+                _sharedIndexMappingDevice = fileStat.st_dev;
+                _sharedIndexMappingInode = fileStat.st_ino;
+            }
+        }
+    }
 
-    dispatch_once(&predicate, ^{
-        resourceKeys = @[ NSURLCreationDateKey, NSURLContentModificationDateKey, NSURLTotalFileAllocatedSizeKey ];
-    });
+    if (header == MAP_FAILED) {
+        NSDictionary<NSErrorUserInfoKey, id> *userInfo = @{ PINDiskCacheErrorWriteFailureCodeKey : @(errno)};
+        error = [NSError errorWithDomain:PINDiskCacheErrorDomain code:PINDiskCacheErrorWriteFailure userInfo:userInfo];
+        PINDiskCacheError(error);
+        flock(fileDescriptor, LOCK_UN);
+        close(fileDescriptor);
+        return NO;
+    }
 
-    return resourceKeys;
+    if (header->magic != PINDiskCacheSharedIndexMagic || header->version != PINDiskCacheSharedIndexVersion) {
+        header->magic = PINDiskCacheSharedIndexMagic;
+        header->version = PINDiskCacheSharedIndexVersion;
+        // Generations start at 1 so that a freshly opened index always looks stale and forces a reload.
+        atomic_store_explicit(&header->generation, 1, memory_order_relaxed);
+        atomic_store_explicit(&header->byteCount, 0, memory_order_relaxed);
+        header->writeInProgress = 0;
+        header->journalStartGeneration = 2;
+        header->journalRecordCount = 0;
+    }
+
+    flock(fileDescriptor, LOCK_UN);
+
+    _sharedIndexFileDescriptor = fileDescriptor;
+    _sharedIndexHeader = header;
+    _sharedIndexGeneration = 0;
+
+    return YES;
+}
+
+- (void)_locked_closeSharedIndex
+{
+    // The mapping stays, see _sharedIndexMappings.
+    _sharedIndexHeader = NULL;
+    if (_sharedIndexFileDescriptor >= 0) {
+        close(_sharedIndexFileDescriptor);
+        _sharedIndexFileDescriptor = -1;
+    }
 }
 
 /**
- * @return File size in bytes.
+ * @return YES if another process has mutated the cache since our metadata was last in sync. Does not take the file lock.
  */
-- (NSUInteger)_locked_initializeDiskPropertiesForFile:(NSURL *)fileURL fileKey:(NSString *)fileKey
+- (BOOL)_locked_sharedIndexIsStale
 {
-    NSError *error = nil;
-
-    NSDictionary *dictionary = [fileURL resourceValuesForKeys:[PINDiskCache resourceKeys] error:&error];
-    PINDiskCacheError(error);
-
-    if (_metadata[fileKey] == nil) {
-        _metadata[fileKey] = [[PINDiskCacheMetadata alloc] init];
+    if (_sharedIndexHeader == NULL) {
+        return NO;
     }
+    return atomic_load_explicit(&_sharedIndexHeader->generation, memory_order_acquire) != _sharedIndexGeneration;
+}
 
-    NSDate *createdDate = dictionary[NSURLCreationDateKey];
-    if (createdDate && fileKey)
-        _metadata[fileKey].createdDate = createdDate;
+- (void)_locked_beginSharedIndexWrite
+{
+    if (_sharedIndexHeader == NULL) {
+        return;
+    }
 
-    NSDate *lastModifiedDate = dictionary[NSURLContentModificationDateKey];
-    if (lastModifiedDate && fileKey)
-        _metadata[fileKey].lastModifiedDate = lastModifiedDate;
+    flock(_sharedIndexFileDescriptor, LOCK_EX);
+    [self _locked_recoverFromInterruptedSharedIndexWrite];
+    if ([self _locked_sharedIndexIsStale]) {
+        // Our filter doesn't know about the keys other processes wrote, so removing them could knock out keys it does
+        // hold. Stop trusting it for keys we have no metadata for until the next reload.
+        _keyFilterCoversDisk = NO;
+    }
+    // Pick up writes made by other processes since we last held the file lock.
+    _byteCount = (NSUInteger)atomic_load_explicit(&_sharedIndexHeader->byteCount, memory_order_relaxed);
+    _sharedIndexHeader->writeInProgress = 1;
+    _sharedIndexChangedKeys = [[NSMutableSet alloc] init];
+    _sharedIndexJournalOverflowed = NO;
+}
 
-    NSNumber *fileSize = dictionary[NSURLTotalFileAllocatedSizeKey];
-    if (fileSize) {
-        _metadata[fileKey].size = fileSize;
+- (void)_locked_endSharedIndexWrite
+{
+    if (_sharedIndexHeader == NULL) {
+        return;
     }
 
-    if (_ttlCache) {
-        NSTimeInterval ageLimit;
-        ssize_t res = getxattr(PINDiskCacheFileSystemRepresentation(fileURL), PINDiskCacheAgeLimitAttributeName, &ageLimit, sizeof(NSTimeInterval), 0, 0);
-        if(res > 0) {
-            _metadata[fileKey].ageLimit = ageLimit;
-        } else if (res == -1) {
-            // Ignore if the extended attribute was never recorded for this file.
-            if (errno != ENOATTR) {
-                NSDictionary<NSErrorUserInfoKey, id> *userInfo = @{ PINDiskCacheErrorReadFailureCodeKey : @(errno)};
-                error = [NSError errorWithDomain:PINDiskCacheErrorDomain code:PINDiskCacheErrorReadFailure userInfo:userInfo];
-                PINDiskCacheError(error);
-            }
-        }
+    atomic_store_explicit(&_sharedIndexHeader->byteCount, (uint64_t)_byteCount, memory_order_relaxed);
+    uint64_t generation = atomic_load_explicit(&_sharedIndexHeader->generation, memory_order_relaxed) + 1;
+    [self _locked_appendToSharedIndexJournalForGeneration:generation];
+    _sharedIndexChangedKeys = nil;
+    _sharedIndexHeader->writeInProgress = 0;
+    uint64_t previousGeneration = atomic_fetch_add_explicit(&_sharedIndexHeader->generation, 1, memory_order_release);
+    if (previousGeneration == _sharedIndexGeneration) {
+        // Nobody else wrote in between, so our metadata is still complete.
+        _sharedIndexGeneration = previousGeneration + 1;
     }
-    
-    NSInteger accessCount = 0;
-    ssize_t accessCountResult = getxattr(PINDiskCacheFileSystemRepresentation(fileURL), PINDiskCacheAccessCountAttributeName, &accessCount, sizeof(NSInteger), 0, 0);
-    if(accessCountResult > 0) {
-        _metadata[fileKey].accessCount = accessCount;
-    } else if (accessCountResult == -1) {
-        // Ignore if the extended attribute was never recorded for this file.
-        if (errno != ENOATTR) {
-            NSDictionary<NSErrorUserInfoKey, id> *userInfo = @{ PINDiskCacheErrorReadFailureCodeKey : @(errno)};
-            error = [NSError errorWithDomain:PINDiskCacheErrorDomain code:PINDiskCacheErrorReadFailure userInfo:userInfo];
-            PINDiskCacheError(error);
-        }
+    flock(_sharedIndexFileDescriptor, LOCK_UN);
+}
+
+/**
+ * Records that the file of `key` changed in the current write session, if there is one.
+ */
+- (void)_locked_noteSharedIndexChangeForKey:(NSString *)key
+{
+    if (key) {
+        [_sharedIndexChangedKeys addObject:key];
     }
+}
 
-    return [fileSize unsignedIntegerValue];
+/**
+ * Records that the current write session changed too many files to journal, other processes rescan the directory.
+ */
+- (void)_locked_noteSharedIndexChangeOfAllKeys
+{
+    _sharedIndexJournalOverflowed = YES;
 }
 
-- (void)initializeDiskProperties
+- (void)_locked_appendToSharedIndexJournalForGeneration:(uint64_t)generation
 {
-    NSUInteger byteCount = 0;
+    PINDiskCacheSharedIndexHeader *header = _sharedIndexHeader;
+    BOOL overflowed = _sharedIndexJournalOverflowed || _sharedIndexChangedKeys.count > PINDiskCacheSharedIndexJournalCapacity;
+    if (!overflowed) {
+        for (NSString *key in _sharedIndexChangedKeys) {
+            const char *name = [[self encodedString:key] UTF8String];
+            size_t nameLength = name ? strlen(name) : 0;
+            if (nameLength == 0 || nameLength > PINDiskCacheSharedIndexJournalNameLength) {
+                overflowed = YES;
+                break;
+            }
 
-    NSError *error = nil;
-    
-    [self lock];
-        NSArray *files = [[NSFileManager defaultManager] contentsOfDirectoryAtURL:_cacheURL
-                                                       includingPropertiesForKeys:[PINDiskCache resourceKeys]
-                                                                          options:NSDirectoryEnumerationSkipsHiddenFiles
-                                                                            error:&error];
-    [self unlock];
-    
-    PINDiskCacheError(error);
-    
-    for (NSURL *fileURL in files) {
-        NSString *fileKey = [self keyForEncodedFileURL:fileURL];
-        // Continually grab and release lock while processing files to avoid contention
-        [self lock];
-        if (_metadata[fileKey] == nil) {
-            byteCount += [self _locked_initializeDiskPropertiesForFile:fileURL fileKey:fileKey];
+            PINDiskCacheSharedIndexJournalRecord *record = &header->journal[header->journalRecordCount % PINDiskCacheSharedIndexJournalCapacity];
+            if (header->journalRecordCount >= PINDiskCacheSharedIndexJournalCapacity && record->generation >= header->journalStartGeneration) {
+                // Overwriting part of that session, so it and everything before it is no longer covered.
+                header->journalStartGeneration = record->generation + 1;
+            }
+            record->generation = generation;
+            record->nameLength = (uint8_t)nameLength;
+            memcpy(record->name, name, nameLength);
+            header->journalRecordCount += 1;
         }
-        [self unlock];
     }
-    
-    [self lock];
-        if (byteCount > 0)
-            _byteCount = byteCount;
-    
-        if (self->_byteLimit > 0 && self->_byteCount > self->_byteLimit)
-            [self trimToSizeByEvictionStrategyAsync:self->_byteLimit completion:nil];
 
-        if (self->_ttlCache)
-            [self removeExpiredObjectsAsync:nil];
-    
-        _diskStateKnown = YES;
-        pthread_cond_broadcast(&_diskStateKnownCondition);
-    [self unlock];
+    if (overflowed) {
+        header->journalStartGeneration = generation + 1;
+    }
 }
 
-- (void)asynchronouslySetFileModificationDate:(NSDate *)date forURL:(NSURL *)fileURL
+/**
+ * If the process that last held the file lock died mid-write, its changes never made it into the journal and the
+ * shared byteCount may be off. Bumps the generation past the journal so that every process, us included, rescans.
+ * Must hold the file lock.
+ */
+- (void)_locked_recoverFromInterruptedSharedIndexWrite
 {
-    [self.operationQueue scheduleOperation:^{
-        [self lockForWriting];
-            [self _locked_setFileModificationDate:date forURL:fileURL];
-        [self unlock];
-    } withPriority:PINOperationQueuePriorityLow];
+    if (_sharedIndexHeader->writeInProgress == 0) {
+        return;
+    }
+
+    _sharedIndexHeader->writeInProgress = 0;
+    uint64_t generation = atomic_fetch_add_explicit(&_sharedIndexHeader->generation, 1, memory_order_release) + 1;
+    _sharedIndexHeader->journalStartGeneration = generation + 1;
 }
 
-- (BOOL)_locked_setFileModificationDate:(NSDate *)date forURL:(NSURL *)fileURL
+- (void)_locked_synchronizeSharedIndexIfStale
 {
-    if (!date || !fileURL) {
-        return NO;
+    if ([self _locked_sharedIndexIsStale]) {
+        [self _locked_synchronizeSharedIndex];
     }
-    
-    NSError *error = nil;
-    BOOL success = [[NSFileManager defaultManager] setAttributes:@{ NSFileModificationDate: date }
-                                                    ofItemAtPath:[fileURL path]
-                                                           error:&error];
-    PINDiskCacheError(error);
-    
-    return success;
 }
 
-- (void)asynchronouslySetAgeLimit:(NSTimeInterval)ageLimit forURL:(NSURL *)fileURL
+- (void)_locked_synchronizeSharedIndex
 {
-    [self.operationQueue scheduleOperation:^{
-        [self lockForWriting];
-            [self _locked_setAgeLimit:ageLimit forURL:fileURL];
+    if (_sharedIndexHeader == NULL) {
+        return;
+    }
+
+    flock(_sharedIndexFileDescriptor, LOCK_EX);
+        [self _locked_recoverFromInterruptedSharedIndexWrite];
+        if (![self _locked_applySharedIndexJournal]) {
+            [self _locked_reloadMetadataFromDisk];
+            // The scan is authoritative, this also repairs the shared count if a process died mid-write.
+            atomic_store_explicit(&_sharedIndexHeader->byteCount, (uint64_t)_byteCount, memory_order_relaxed);
+        }
+        _sharedIndexGeneration = atomic_load_explicit(&_sharedIndexHeader->generation, memory_order_acquire);
+    flock(_sharedIndexFileDescriptor, LOCK_UN);
+}
+
+/**
+ * Refreshes the metadata of only the files other processes changed since we were last in sync. Must hold the file lock.
+ *
+ * @return NO if the journal no longer covers every change since, in which case the directory has to be rescanned.
+ */
+- (BOOL)_locked_applySharedIndexJournal
+{
+    PINDiskCacheSharedIndexHeader *header = _sharedIndexHeader;
+    // Before the disk state is known our metadata doesn't hold every key, so there is nothing to apply changes to.
+    if (!_diskStateKnown || _sharedIndexGeneration == 0 || _sharedIndexGeneration + 1 < header->journalStartGeneration) {
+        return NO;
+    }
+
+    NSMutableSet<NSString *> *fileNames = [[NSMutableSet alloc] init];
+    uint64_t recordCount = MIN(header->journalRecordCount, (uint64_t)PINDiskCacheSharedIndexJournalCapacity);
+    for (uint64_t i = 0; i < recordCount; i++) {
+        PINDiskCacheSharedIndexJournalRecord *record = &header->journal[i];
+        if (record->generation <= _sharedIndexGeneration) {
+            continue;
+        }
+        NSString *fileName = [[NSString alloc] initWithBytes:record->name
+                                                      length:MIN(record->nameLength, PINDiskCacheSharedIndexJournalNameLength)
+                                                    encoding:NSUTF8StringEncoding];
+        if (fileName) {
+            [fileNames addObject:fileName];
+        }
+    }
+
+    [self _locked_keyFilterWillChange];
+    NSFileManager *fileManager = [NSFileManager defaultManager];
+    for (NSString *fileName in fileNames) {
+        NSString *key = [self decodedString:fileName];
+        if (!key) {
+            continue;
+        }
+        NSURL *fileURL = [_cacheURL URLByAppendingPathComponent:fileName isDirectory:NO];
+        if ([fileManager fileExistsAtPath:[fileURL path]]) {
+            BOOL keyIsNew = _metadata[key] == nil;
+            [self _locked_initializeDiskPropertiesForFile:fileURL fileKey:key];
+            if (keyIsNew && _keyFilterCoversDisk) {
+                [_keyFilter addKey:key];
+            }
+        } else if (_metadata[key] != nil) {
+            [self _locked_removeMetadataForKey:key];
+        }
+    }
+
+    _byteCount = (NSUInteger)atomic_load_explicit(&header->byteCount, memory_order_relaxed);
+    // The filter holds exactly the keys we have metadata for, which is every key on disk again.
+    _keyFilterCoversDisk = YES;
+    return YES;
+}
+
+- (void)_locked_reloadMetadataFromDisk
+{
+    NSError *error = nil;
+    NSArray *files = [[NSFileManager defaultManager] contentsOfDirectoryAtURL:_cacheURL
+                                                   includingPropertiesForKeys:[PINDiskCache resourceKeys]
+                                                                      options:NSDirectoryEnumerationSkipsHiddenFiles
+                                                                        error:&error];
+    PINDiskCacheError(error);
+    if (files == nil) {
+        return;
+    }
+
+    [self _locked_keyFilterWillChange];
+    [_keyFilter removeAllKeys];
+    _keyFilterCoversDisk = NO;
+
+    _metadata = [[NSMutableDictionary alloc] init];
+    _tagIndex = [[NSMutableDictionary alloc] init];
+    NSUInteger byteCount = 0;
+    for (NSURL *fileURL in files) {
+        NSString *fileKey = [self keyForEncodedFileURL:fileURL];
+        if (fileKey) {
+            byteCount += [self _locked_initializeDiskPropertiesForFile:fileURL fileKey:fileKey];
+        }
+    }
+    _byteCount = byteCount;
+    _keyFilterCoversDisk = YES;
+}
+
+/**
+ * Another process may have written the file without us knowing about it, in which case our metadata can't be trusted
+ * for its size.
+ */
+- (NSNumber *)_locked_allocatedSizeOfFileAtURL:(NSURL *)fileURL
+{
+    NSNumber *fileSize = nil;
+    [fileURL getResourceValue:&fileSize forKey:NSURLTotalFileAllocatedSizeKey error:NULL];
+    // Don't let the cached value leak into reads made after the file is rewritten.
+    [fileURL removeAllCachedResourceValues];
+    return fileSize;
+}
+
+#pragma mark - Private Checksum Methods -
+
+- (NSURL *)quarantineURL
+{
+    return [_cacheURL URLByAppendingPathComponent:PINDiskCacheQuarantineDirectoryName isDirectory:YES];
+}
+
+- (void)_locked_quarantineFileAtURL:(NSURL *)fileURL key:(NSString *)key
+{
+    NSDictionary<NSErrorUserInfoKey, id> *userInfo = @{ NSURLErrorKey : fileURL };
+    NSError *error = [NSError errorWithDomain:PINDiskCacheErrorDomain code:PINDiskCacheErrorChecksumMismatch userInfo:userInfo];
+    PINDiskCacheError(error);
+    error = nil;
+
+    NSFileManager *fileManager = [NSFileManager defaultManager];
+    NSURL *quarantineURL = [self quarantineURL];
+    [fileManager createDirectoryAtURL:quarantineURL withIntermediateDirectories:YES attributes:nil error:&error];
+    PINDiskCacheError(error);
+
+    [self _locked_keyFilterWillChange];
+    [self _locked_beginSharedIndexWrite];
+        NSNumber *byteSize = _sharedIndexHeader ? [self _locked_allocatedSizeOfFileAtURL:fileURL] : _metadata[key].size;
+
+        NSURL *quarantinedFileURL = [quarantineURL URLByAppendingPathComponent:[fileURL lastPathComponent] isDirectory:NO];
+        [fileManager removeItemAtURL:quarantinedFileURL error:nil];
+        error = nil;
+        BOOL moved = [fileManager moveItemAtURL:fileURL toURL:quarantinedFileURL error:&error];
+        PINDiskCacheError(error);
+        if (!moved) {
+            // Don't keep serving a corrupt object just because it couldn't be kept around for inspection.
+            moved = [fileManager removeItemAtURL:fileURL error:nil];
+        }
+
+        if (moved) {
+            if (byteSize)
+                self.byteCount = _byteCount - [byteSize unsignedIntegerValue]; // atomic
+
+            [self _locked_removeMetadataForKey:key];
+        }
+    [self _locked_endSharedIndexWrite];
+
+    // Date the file by when it was quarantined rather than when it was written, so the oldest go first below.
+    [fileManager setAttributes:@{ NSFileModificationDate : [NSDate date] } ofItemAtPath:[quarantinedFileURL path] error:nil];
+    [self _locked_trimQuarantine];
+}
+
+// Quarantined files don't count towards the byte limit, so only the most recent few are kept for inspection.
+- (void)_locked_trimQuarantine
+{
+    NSArray<NSURL *> *quarantinedFileURLs = [[NSFileManager defaultManager] contentsOfDirectoryAtURL:[self quarantineURL]
+                                                                         includingPropertiesForKeys:@[ NSURLContentModificationDateKey ]
+                                                                                            options:0
+                                                                                              error:nil];
+    if (quarantinedFileURLs.count <= PINDiskCacheQuarantineMaximumFileCount)
+        return;
+
+    NSArray<NSURL *> *sortedFileURLs = [quarantinedFileURLs sortedArrayUsingComparator:^NSComparisonResult(NSURL *fileURL1, NSURL *fileURL2) {
+        NSDate *date1 = nil;
+        NSDate *date2 = nil;
+        [fileURL1 getResourceValue:&date1 forKey:NSURLContentModificationDateKey error:nil];
+        [fileURL2 getResourceValue:&date2 forKey:NSURLContentModificationDateKey error:nil];
+        return [(date1 ?: [NSDate distantPast]) compare:(date2 ?: [NSDate distantPast])];
+    }];
+    for (NSUInteger idx = 0; idx < sortedFileURLs.count - PINDiskCacheQuarantineMaximumFileCount; idx++) {
+        [[NSFileManager defaultManager] removeItemAtURL:sortedFileURLs[idx] error:nil];
+    }
+}
+
+- (void)scrubRecursively
+{
+    [self lock];
+        NSUInteger bytesPerSecond = _scrubBytesPerSecond;
+    [self unlock];
+
+    if (bytesPerSecond == 0)
+        return;
+
+    // Verify roughly a second's worth of reads, then wait out however long that budget actually covered.
+    NSUInteger bytesRead = [self scrubUpToByteCount:bytesPerSecond];
+    NSTimeInterval delay = MAX(1.0, (double)bytesRead / (double)bytesPerSecond);
+
+    dispatch_time_t time = dispatch_time(DISPATCH_TIME_NOW, (int64_t)(delay * NSEC_PER_SEC));
+    dispatch_after(time, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_BACKGROUND, 0), ^(void) {
+        // Ensure that the rate is the same as when we were scheduled, otherwise, we've been
+        // rescheduled (another dispatch_after was issued) and should cancel.
+        BOOL shouldReschedule = YES;
+        [self lock];
+            if (bytesPerSecond != self->_scrubBytesPerSecond) {
+                shouldReschedule = NO;
+            }
+        [self unlock];
+
+        if (shouldReschedule) {
+            [self.maintenanceQueue scheduleOperation:^{
+                [self scrubRecursively];
+            } withPriority:PINOperationQueuePriorityLow];
+        }
+    });
+}
+
+- (NSUInteger)scrubUpToByteCount:(NSUInteger)byteBudget
+{
+    NSUInteger bytesRead = 0;
+    BOOL startedNewPass = NO;
+
+    while (bytesRead < byteBudget) {
+        [self lockAndWaitForKnownState];
+            if (_scrubKeyIndex >= _scrubKeys.count) {
+                if (startedNewPass) {
+                    // The whole cache fits in the budget, don't go round again until the next tick.
+                    [self unlock];
+                    break;
+                }
+                _scrubKeys = [_metadata allKeys];
+                _scrubKeyIndex = 0;
+                startedNewPass = YES;
+                if (_scrubKeys.count == 0) {
+                    [self unlock];
+                    break;
+                }
+            }
+
+            NSString *key = _scrubKeys[_scrubKeyIndex++];
+            BOOL known = _metadata[key] != nil;
+        [self unlock];
+
+        if (!known)
+            continue;
+
+        // Verified without the lock so that reads don't wait behind the scrubber.
+        NSURL *fileURL = [self encodedFileURLForKey:key];
+        NSUInteger length = 0;
+        BOOL corrupt = NO;
+        PINDiskCacheReadChecksummedFile(fileURL, NO, &length, &corrupt);
+        bytesRead += length + sizeof(PINDiskCacheChecksumHeader);
+        if (corrupt) {
+            [self lockForWriting];
+                // The file may have been replaced while it was verified, check again before moving it aside.
+                corrupt = NO;
+                if (_metadata[key] != nil)
+                    PINDiskCacheReadChecksummedFile(fileURL, NO, NULL, &corrupt);
+                if (corrupt) {
+                    [self _locked_quarantineFileAtURL:fileURL key:key];
+                }
+            [self unlock];
+        }
+    }
+
+    return bytesRead;
+}
+
+#pragma mark - Private Key Filter Methods -
+
+- (NSURL *)keyFilterURL
+{
+    return [_cacheURL URLByAppendingPathComponent:PINDiskCacheKeyFilterFileName isDirectory:NO];
+}
+
+/**
+ * @return NO if the key is definitely not on disk. Only a filter that covers the whole disk can vouch for keys we don't
+ * have metadata for yet.
+ */
+- (BOOL)_locked_keyFilterMightContainKey:(NSString *)key
+{
+    return !_keyFilterCoversDisk || [_keyFilter mightContainKey:key];
+}
+
+- (BOOL)keyFilterMightContainKey:(NSString *)key
+{
+    [self lock];
+        BOOL mightContainKey = [self _locked_keyFilterMightContainKey:key];
+    [self unlock];
+    return mightContainKey;
+}
+
+/**
+ * Must be called before any change to the files on disk. Marking the file dirty has to land before the change does,
+ * otherwise dying in between would leave a clean filter behind that's missing a key.
+ */
+- (void)_locked_keyFilterWillChange
+{
+    if (_keyFilterPersisted) {
+        NSURL *keyFilterURL = [self keyFilterURL];
+        if (![PINDiskCacheKeyFilter markDirtyAtURL:keyFilterURL]) {
+            [[NSFileManager defaultManager] removeItemAtURL:keyFilterURL error:nil];
+        }
+        _keyFilterPersisted = NO;
+    }
+
+    if (_keyFilterPersistScheduled)
+        return;
+
+    _keyFilterPersistScheduled = YES;
+    __weak PINDiskCache *weakSelf = self;
+    dispatch_time_t time = dispatch_time(DISPATCH_TIME_NOW, (int64_t)(PINDiskCacheKeyFilterPersistDelay * NSEC_PER_SEC));
+    dispatch_after(time, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_BACKGROUND, 0), ^(void) {
+        // If we're gone, dealloc has already written the filter.
+        PINDiskCache *strongSelf = weakSelf;
+        [strongSelf.maintenanceQueue scheduleOperation:^{
+            [strongSelf persistKeyFilter];
+        } withPriority:PINOperationQueuePriorityLow];
+    });
+}
+
+- (void)persistKeyFilter
+{
+    [self lockForWriting];
+        _keyFilterPersistScheduled = NO;
+        [self _locked_persistKeyFilter];
+    [self unlock];
+}
+
+- (void)_locked_persistKeyFilter
+{
+    // A filter that doesn't cover the disk must never be marked clean. When other processes write to the cache they
+    // don't update our filter, so it can't be trusted by the next launch either.
+    if (_keyFilterPersisted || !_keyFilterCoversDisk || _sharedIndexHeader != NULL) {
+        return;
+    }
+
+    if (_diskStateKnown && _keyFilter.count > _keyFilter.capacity) {
+        // Counters can't be split, so grow by rebuilding from the metadata which now has every key.
+        _keyFilter = [[PINDiskCacheKeyFilter alloc] initWithCapacity:_keyFilter.count * 2];
+        for (NSString *key in _metadata) {
+            [_keyFilter addKey:key];
+        }
+    }
+
+    NSError *error = nil;
+    _keyFilterPersisted = [_keyFilter writeToURL:[self keyFilterURL] error:&error];
+    PINDiskCacheError(error);
+}
+
+- (void)_locked_removeMetadataForKey:(NSString *)key
+{
+    // A filter covering the disk already holds keys we haven't loaded metadata for, otherwise it only holds those we have.
+    if (_metadata[key] != nil || _keyFilterCoversDisk) {
+        [_keyFilter removeKey:key];
+    }
+    [self _locked_setTags:nil forKey:key];
+    [_metadata removeObjectForKey:key];
+    [self _locked_noteSharedIndexChangeForKey:key];
+}
+
+// Removes the file of an object the deserializer couldn't read, keeping the byte count, metadata, key filter and shared
+// index in step, the way a regular removal does.
+- (void)_locked_removeUnreadableFileAtURL:(NSURL *)fileURL key:(NSString *)key
+{
+    [self _locked_keyFilterWillChange];
+    [self _locked_beginSharedIndexWrite];
+        NSNumber *byteSize = _sharedIndexHeader ? [self _locked_allocatedSizeOfFileAtURL:fileURL] : _metadata[key].size;
+
+        NSError *error = nil;
+        BOOL removed = [[NSFileManager defaultManager] removeItemAtURL:fileURL error:&error];
+        PINDiskCacheError(error);
+
+        if (removed) {
+            if (byteSize)
+                self.byteCount = _byteCount - [byteSize unsignedIntegerValue]; // atomic
+
+            [self _locked_removeMetadataForKey:key];
+        }
+    [self _locked_endSharedIndexWrite];
+}
+
+#pragma mark - Private Tag Methods -
+
+- (void)_locked_setTags:(NSSet<NSString *> *)tags forKey:(NSString *)key
+{
+    PINDiskCacheMetadata *metadata = _metadata[key];
+    NSSet<NSString *> *oldTags = metadata.tags;
+    if (metadata == nil || (oldTags == nil && tags.count == 0)) {
+        return;
+    }
+
+    for (NSString *tag in oldTags) {
+        NSMutableSet<NSString *> *keys = _tagIndex[tag];
+        [keys removeObject:key];
+        if (keys.count == 0) {
+            [_tagIndex removeObjectForKey:tag];
+        }
+    }
+    for (NSString *tag in tags) {
+        NSMutableSet<NSString *> *keys = _tagIndex[tag];
+        if (keys == nil) {
+            keys = [[NSMutableSet alloc] init];
+            _tagIndex[tag] = keys;
+        }
+        [keys addObject:key];
+    }
+    metadata.tags = tags.count > 0 ? tags : nil;
+}
+
+/**
+ * Tags are kept in an extended attribute of the object's file, as a property list array, so that they survive
+ * relaunches. Writing a file replaces it along with its attributes, so there's nothing to clear for untagged objects.
+ */
+- (BOOL)_locked_setTagsAttribute:(NSSet<NSString *> *)tags forURL:(NSURL *)fileURL
+{
+    NSError *error = nil;
+    NSData *data = [NSPropertyListSerialization dataWithPropertyList:[tags allObjects] format:NSPropertyListBinaryFormat_v1_0 options:0 error:&error];
+    PINDiskCacheError(error);
+    if (data == nil) {
+        return NO;
+    }
+
+    if (setxattr(PINDiskCacheFileSystemRepresentation(fileURL), PINDiskCacheTagsAttributeName, data.bytes, data.length, 0, 0) != 0) {
+        NSDictionary<NSErrorUserInfoKey, id> *userInfo = @{ PINDiskCacheErrorWriteFailureCodeKey : @(errno)};
+        error = [NSError errorWithDomain:PINDiskCacheErrorDomain code:PINDiskCacheErrorWriteFailure userInfo:userInfo];
+        PINDiskCacheError(error);
+        return NO;
+    }
+    return YES;
+}
+
+- (NSSet<NSString *> *)_locked_tagsAttributeForURL:(NSURL *)fileURL
+{
+    const char *path = PINDiskCacheFileSystemRepresentation(fileURL);
+    ssize_t length = getxattr(path, PINDiskCacheTagsAttributeName, NULL, 0, 0, 0);
+    if (length <= 0) {
+        // Ignore if the extended attribute was never recorded for this file.
+        if (length == -1 && errno != ENOATTR) {
+            NSDictionary<NSErrorUserInfoKey, id> *userInfo = @{ PINDiskCacheErrorReadFailureCodeKey : @(errno)};
+            NSError *error = [NSError errorWithDomain:PINDiskCacheErrorDomain code:PINDiskCacheErrorReadFailure userInfo:userInfo];
+            PINDiskCacheError(error);
+        }
+        return nil;
+    }
+
+    NSMutableData *data = [[NSMutableData alloc] initWithLength:(NSUInteger)length];
+    length = getxattr(path, PINDiskCacheTagsAttributeName, data.mutableBytes, data.length, 0, 0);
+    if (length <= 0) {
+        return nil;
+    }
+    data.length = (NSUInteger)length;
+
+    id tags = [NSPropertyListSerialization propertyListWithData:data options:NSPropertyListImmutable format:NULL error:NULL];
+    if (![tags isKindOfClass:[NSArray class]]) {
+        return nil;
+    }
+    for (id tag in tags) {
+        if (![tag isKindOfClass:[NSString class]]) {
+            return nil;
+        }
+    }
+    return [[NSSet alloc] initWithArray:tags];
+}
+
+// The bulk counterpart of removeFileAndExecuteBlocksForKey:, taking the lock once for all the files and emptying the
+// trash once. The keys are matched by the caller before the lock is taken here, so each key is tested again under it,
+// and kept if it no longer matches, e.g. when it was set again without the tag in between.
+- (void)removeFilesAndExecuteBlocksForKeys:(NSArray<NSString *> *)keys passingTest:(BOOL (^)(NSString *key))stillMatches
+{
+    if (keys.count == 0) {
+        return;
+    }
+
+    [self lock];
+        PINDiskCacheObjectBlock willRemoveObjectBlock = _willRemoveObjectBlock;
+        PINDiskCacheObjectBlock didRemoveObjectBlock = _didRemoveObjectBlock;
+    [self unlock];
+
+    if (willRemoveObjectBlock) {
+        for (NSString *key in keys) {
+            willRemoveObjectBlock(self, key, nil);
+        }
+    }
+
+    NSMutableArray<NSString *> *removedKeys = [[NSMutableArray alloc] initWithCapacity:keys.count];
+    [self lockForWriting];
+        // Another process may have changed the tags or removed the keys since, the test should see that.
+        [self _locked_synchronizeSharedIndexIfStale];
+        [self _locked_keyFilterWillChange];
+        [self _locked_beginSharedIndexWrite];
+        for (NSString *key in keys) {
+            NSURL *fileURL = [self encodedFileURLForKey:key];
+            if (!fileURL || !stillMatches(key)) {
+                continue;
+            }
+            NSNumber *byteSize = _sharedIndexHeader ? [self _locked_allocatedSizeOfFileAtURL:fileURL] : _metadata[key].size;
+            if (![PINDiskCache moveItemAtURLToTrashOrRemove:fileURL]) {
+                continue;
+            }
+            if (byteSize)
+                self.byteCount = _byteCount - [byteSize unsignedIntegerValue]; // atomic
+            [self _locked_removeMetadataForKey:key];
+            [removedKeys addObject:key];
+        }
+        [self _locked_endSharedIndexWrite];
+    [self unlock];
+
+    if (removedKeys.count > 0) {
+        [PINDiskCache emptyTrash];
+    }
+
+    if (didRemoveObjectBlock) {
+        for (NSString *key in removedKeys) {
+            didRemoveObjectBlock(self, key, nil);
+        }
+    }
+}
+
+#pragma mark - Private Queue Methods -
+
+- (BOOL)_locked_createCacheDirectory
+{
+    BOOL created = NO;
+    if ([[NSFileManager defaultManager] fileExistsAtPath:[_cacheURL path]] == NO) {
+        NSError *error = nil;
+        created = [[NSFileManager defaultManager] createDirectoryAtURL:_cacheURL
+                                                withIntermediateDirectories:YES
+                                                                 attributes:nil
+                                                                      error:&error];
+        PINDiskCacheError(error);
+    }
+    
+
+    
+    // while this may not be true if success is false, it's better than deadlocking later.
+    _diskWritable = YES;
+    pthread_cond_broadcast(&_diskWritableCondition);
+    
+    return created;
+}
+
++ (NSArray *)resourceKeys
+{
+    static NSArray *resourceKeys = nil;
+    static dispatch_once_t predicate;
+
+    dispatch_once(&predicate, ^{
+        resourceKeys = @[ NSURLCreationDateKey, NSURLContentModificationDateKey, NSURLTotalFileAllocatedSizeKey ];
+    });
+
+    return resourceKeys;
+}
+
+/**
+ * @return File size in bytes.
+ */
+- (NSUInteger)_locked_initializeDiskPropertiesForFile:(NSURL *)fileURL fileKey:(NSString *)fileKey
+{
+    NSError *error = nil;
+
+    NSDictionary *dictionary = [fileURL resourceValuesForKeys:[PINDiskCache resourceKeys] error:&error];
+    PINDiskCacheError(error);
+
+    if (_metadata[fileKey] == nil) {
+        _metadata[fileKey] = [[PINDiskCacheMetadata alloc] init];
+        if (!_keyFilterCoversDisk) {
+            [_keyFilter addKey:fileKey];
+        }
+    }
+
+    NSDate *createdDate = dictionary[NSURLCreationDateKey];
+    if (createdDate && fileKey)
+        _metadata[fileKey].createdDate = createdDate;
+
+    NSDate *lastModifiedDate = dictionary[NSURLContentModificationDateKey];
+    if (lastModifiedDate && fileKey)
+        _metadata[fileKey].lastModifiedDate = lastModifiedDate;
+
+    NSNumber *fileSize = dictionary[NSURLTotalFileAllocatedSizeKey];
+    if (fileSize) {
+        _metadata[fileKey].size = fileSize;
+    }
+
+    if (_ttlCache) {
+        NSTimeInterval ageLimit;
+        ssize_t res = getxattr(PINDiskCacheFileSystemRepresentation(fileURL), PINDiskCacheAgeLimitAttributeName, &ageLimit, sizeof(NSTimeInterval), 0, 0);
+        if(res > 0) {
+            _metadata[fileKey].ageLimit = ageLimit;
+        } else if (res == -1) {
+            // Ignore if the extended attribute was never recorded for this file.
+            if (errno != ENOATTR) {
+                NSDictionary<NSErrorUserInfoKey, id> *userInfo = @{ PINDiskCacheErrorReadFailureCodeKey : @(errno)};
+                error = [NSError errorWithDomain:PINDiskCacheErrorDomain code:PINDiskCacheErrorReadFailure userInfo:userInfo];
+                PINDiskCacheError(error);
+            }
+        }
+    }
+    
+    NSInteger accessCount = 0;
+    ssize_t accessCountResult = getxattr(PINDiskCacheFileSystemRepresentation(fileURL), PINDiskCacheAccessCountAttributeName, &accessCount, sizeof(NSInteger), 0, 0);
+    if(accessCountResult > 0) {
+        _metadata[fileKey].accessCount = accessCount;
+    } else if (accessCountResult == -1) {
+        // Ignore if the extended attribute was never recorded for this file.
+        if (errno != ENOATTR) {
+            NSDictionary<NSErrorUserInfoKey, id> *userInfo = @{ PINDiskCacheErrorReadFailureCodeKey : @(errno)};
+            error = [NSError errorWithDomain:PINDiskCacheErrorDomain code:PINDiskCacheErrorReadFailure userInfo:userInfo];
+            PINDiskCacheError(error);
+        }
+    }
+
+    [self _locked_setTags:[self _locked_tagsAttributeForURL:fileURL] forKey:fileKey];
+
+    return [fileSize unsignedIntegerValue];
+}
+
+/**
+ * Removes files staged by imports and batch sets that a crash left behind. Staged files are renamed into place moments
+ * after they're written, so younger ones are left alone in case this or another process is still staging them.
+ */
+- (void)removeStaleImportFiles
+{
+    [self lock];
+        NSURL *cacheURL = _cacheURL;
+    [self unlock];
+
+    NSArray<NSURL *> *files = [[NSFileManager defaultManager] contentsOfDirectoryAtURL:cacheURL
+                                                            includingPropertiesForKeys:nil
+                                                                               options:0
+                                                                                 error:NULL];
+    time_t now = time(NULL);
+    for (NSURL *fileURL in files) {
+        if (![fileURL.lastPathComponent hasPrefix:PINDiskCacheImportFilePrefix])
+            continue;
+
+        // Restoring a snapshot's dates changes the modification time, but not the status change time.
+        struct stat fileStat;
+        const char *path = PINDiskCacheFileSystemRepresentation(fileURL);
+        if (lstat(path, &fileStat) == 0 && now - fileStat.st_ctime >= PINDiskCacheStaleImportFileAge)
+            unlink(path);
+    }
+}
+
+- (void)initializeDiskProperties
+{
+    NSUInteger byteCount = 0;
+
+    NSError *error = nil;
+    
+    [self removeStaleImportFiles];
+
+    [self lock];
+        NSArray *files = [[NSFileManager defaultManager] contentsOfDirectoryAtURL:_cacheURL
+                                                       includingPropertiesForKeys:[PINDiskCache resourceKeys]
+                                                                          options:NSDirectoryEnumerationSkipsHiddenFiles
+                                                                            error:&error];
+    [self unlock];
+    
+    PINDiskCacheError(error);
+    
+    for (NSURL *fileURL in files) {
+        NSString *fileKey = [self keyForEncodedFileURL:fileURL];
+        // Continually grab and release lock while processing files to avoid contention
+        [self lock];
+        if (_metadata[fileKey] == nil) {
+            byteCount += [self _locked_initializeDiskPropertiesForFile:fileURL fileKey:fileKey];
+        }
+        [self unlock];
+    }
+    
+    [self lock];
+        if (_sharedIndexHeader != NULL) {
+            // Other processes may have written while we were scanning, the shared index has the real totals.
+            [self _locked_synchronizeSharedIndex];
+        } else if (byteCount > 0) {
+            _byteCount = byteCount;
+        }
+    
+        if (!_keyFilterCoversDisk) {
+            _keyFilterCoversDisk = YES;
+            [self _locked_keyFilterWillChange];
+        }
+    
+        if (self->_byteLimit > 0 && self->_byteCount > self->_byteLimit)
+            [self trimToSizeByEvictionStrategyAsync:self->_byteLimit completion:nil];
+
+        if (self->_ttlCache)
+            [self removeExpiredObjectsAsync:nil];
+    
+        _diskStateKnown = YES;
+        pthread_cond_broadcast(&_diskStateKnownCondition);
+    [self unlock];
+}
+
+- (void)asynchronouslySetFileModificationDate:(NSDate *)date forURL:(NSURL *)fileURL
+{
+    [self.maintenanceQueue scheduleOperation:^{
+        [self lockForWriting];
+            [self _locked_setFileModificationDate:date forURL:fileURL];
+        [self unlock];
+    } withPriority:PINOperationQueuePriorityLow];
+}
+
+- (BOOL)_locked_setFileModificationDate:(NSDate *)date forURL:(NSURL *)fileURL
+{
+    if (!date || !fileURL) {
+        return NO;
+    }
+    
+    NSError *error = nil;
+    BOOL success = [[NSFileManager defaultManager] setAttributes:@{ NSFileModificationDate: date }
+                                                    ofItemAtPath:[fileURL path]
+                                                           error:&error];
+    PINDiskCacheError(error);
+    
+    return success;
+}
+
+- (void)asynchronouslySetAgeLimit:(NSTimeInterval)ageLimit forURL:(NSURL *)fileURL
+{
+    [self.maintenanceQueue scheduleOperation:^{
+        [self lockForWriting];
+            [self _locked_setAgeLimit:ageLimit forURL:fileURL];
         [self unlock];
     } withPriority:PINOperationQueuePriorityLow];
 }
@@ -697,23 +1817,128 @@ static NSURL *_sharedTrashURL;
         }
     }
 
-    if (!error) {
-        NSString *key = [self keyForEncodedFileURL:fileURL];
-        if (key) {
-            _metadata[key].ageLimit = ageLimit;
-        }
+    if (!error) {
+        NSString *key = [self keyForEncodedFileURL:fileURL];
+        if (key) {
+            _metadata[key].ageLimit = ageLimit;
+        }
+    }
+
+    return !error;
+}
+
+- (void)asynchronouslySetAccessCount:(NSInteger)accessCount forURL:(NSURL *)fileURL
+{
+    [self.maintenanceQueue scheduleOperation:^{
+        [self lockForWriting];
+            [self _locked_setAcessCount:accessCount forURL:fileURL];
+        [self unlock];
+    } withPriority:PINOperationQueuePriorityLow];
+}
+
+- (void)asynchronouslySetAccessCounts:(NSDictionary<NSURL *, NSNumber *> *)accessCounts fileModificationDate:(nullable NSDate *)date
+{
+    if (accessCounts.count == 0)
+        return;
+
+    [self.maintenanceQueue scheduleOperation:^{
+        [self lockForWriting];
+            [accessCounts enumerateKeysAndObjectsUsingBlock:^(NSURL * _Nonnull fileURL, NSNumber * _Nonnull accessCount, BOOL * _Nonnull stop) {
+                if (date)
+                    [self _locked_setFileModificationDate:date forURL:fileURL];
+                [self _locked_setAcessCount:[accessCount integerValue] forURL:fileURL];
+            }];
+        [self unlock];
+    } withPriority:PINOperationQueuePriorityLow];
+}
+
+- (void)recordAccessToObjectForKeyAsync:(NSString *)key
+{
+    if (!key || self->_ttlCache)
+        return;
+
+    pthread_mutex_lock(&_pendingAccessMutex);
+        [_pendingAccessKeys addObject:key];
+        BOOL scheduleFlush = !_pendingAccessFlushScheduled;
+        _pendingAccessFlushScheduled = YES;
+    pthread_mutex_unlock(&_pendingAccessMutex);
+
+    if (scheduleFlush) {
+        [self.maintenanceQueue scheduleOperation:^{
+            [self flushPendingAccesses];
+        } withPriority:PINOperationQueuePriorityLow];
     }
+}
 
-    return !error;
+- (nullable NSDate *)createdDateForKey:(NSString *)key
+{
+    if (!key)
+        return nil;
+
+    [self lock];
+        NSDate *createdDate = _metadata[key].createdDate;
+    [self unlock];
+    return createdDate;
 }
 
-- (void)asynchronouslySetAccessCount:(NSInteger)accessCount forURL:(NSURL *)fileURL
+- (void)flushPendingAccesses
 {
-    [self.operationQueue scheduleOperation:^{
+    pthread_mutex_lock(&_pendingAccessMutex);
+        NSArray<NSString *> *keys = [_pendingAccessKeys allObjects];
+        [_pendingAccessKeys removeAllObjects];
+        _pendingAccessFlushScheduled = NO;
+    pthread_mutex_unlock(&_pendingAccessMutex);
+
+    NSDate *now = [NSDate date];
+    NSTimeInterval nowInterval = [now timeIntervalSince1970];
+    struct timeval times[2];
+    times[0].tv_sec = (time_t)nowInterval;
+    times[0].tv_usec = (suseconds_t)((nowInterval - floor(nowInterval)) * USEC_PER_SEC);
+    times[1] = times[0];
+
+    // The metadata is updated under the lock a chunk at a time, and the files are touched after letting it go, so
+    // reads don't wait behind a flush of many keys.
+    for (NSUInteger chunkStart = 0; chunkStart < keys.count; chunkStart += PINDiskCacheAccessFlushChunkSize) {
+        NSUInteger chunkEnd = MIN(chunkStart + PINDiskCacheAccessFlushChunkSize, keys.count);
+        NSMutableArray<NSURL *> *fileURLs = [[NSMutableArray alloc] initWithCapacity:chunkEnd - chunkStart];
+        NSMutableArray<NSNumber *> *accessCounts = [[NSMutableArray alloc] initWithCapacity:chunkEnd - chunkStart];
         [self lockForWriting];
-            [self _locked_setAcessCount:accessCount forURL:fileURL];
+            for (NSUInteger idx = chunkStart; idx < chunkEnd; idx++) {
+                NSString *key = keys[idx];
+                PINDiskCacheMetadata *metadata = _metadata[key];
+                // Without metadata, the file is only touched if the disk hasn't been scanned yet and it turns out to exist.
+                if (metadata == nil && _diskStateKnown)
+                    continue;
+
+                NSInteger accessCount = 0;
+                if (metadata) {
+                    metadata.lastModifiedDate = now;
+                    if (metadata.accessCount < NSIntegerMax) {
+                        metadata.accessCount += 1;
+                        accessCount = metadata.accessCount;
+                    }
+                }
+                [fileURLs addObject:[self encodedFileURLForKey:key]];
+                [accessCounts addObject:@(accessCount)];
+            }
         [self unlock];
-    } withPriority:PINOperationQueuePriorityLow];
+
+        [fileURLs enumerateObjectsUsingBlock:^(NSURL * _Nonnull fileURL, NSUInteger idx, BOOL * _Nonnull stop) {
+            const char *path = PINDiskCacheFileSystemRepresentation(fileURL);
+            NSInteger accessCount = [accessCounts[idx] integerValue];
+            int failureCode = 0;
+            if (utimes(path, times) != 0) {
+                failureCode = errno;
+            } else if (accessCount > 0 && setxattr(path, PINDiskCacheAccessCountAttributeName, &accessCount, sizeof(NSInteger), 0, 0) != 0) {
+                failureCode = errno;
+            }
+            // A file removed in the meantime has nothing left to record.
+            if (failureCode != 0 && failureCode != ENOENT) {
+                NSError *error = [NSError errorWithDomain:PINDiskCacheErrorDomain code:PINDiskCacheErrorWriteFailure userInfo:@{ PINDiskCacheErrorWriteFailureCodeKey : @(failureCode) }];
+                PINDiskCacheError(error);
+            }
+        }];
+    }
 }
 
 - (BOOL)_locked_setAcessCount:(NSInteger)accessCount forURL:(NSURL *)fileURL
@@ -771,19 +1996,26 @@ static NSURL *_sharedTrashURL;
             [self lock];
         }
         
+        [self _locked_keyFilterWillChange];
+        [self _locked_beginSharedIndexWrite];
+        NSNumber *byteSize = _sharedIndexHeader ? [self _locked_allocatedSizeOfFileAtURL:fileURL] : _metadata[key].size;
+        
+        uint64_t removeStartTime = PINDiskCacheTracePhaseBegin(&_tracing);
         BOOL trashed = [PINDiskCache moveItemAtURLToTrashOrRemove:fileURL];
+        PINCacheTracePhaseEnd(PINCacheTracePhaseIO, removeStartTime);
         if (!trashed) {
+            [self _locked_endSharedIndexWrite];
             [self unlock];
             return NO;
         }
     
         [PINDiskCache emptyTrash];
         
-        NSNumber *byteSize = _metadata[key].size;
         if (byteSize)
             self.byteCount = _byteCount - [byteSize unsignedIntegerValue]; // atomic
         
-        [_metadata removeObjectForKey:key];
+        [self _locked_removeMetadataForKey:key];
+        [self _locked_endSharedIndexWrite];
     
         PINDiskCacheObjectBlock didRemoveObjectBlock = _didRemoveObjectBlock;
         if (didRemoveObjectBlock) {
@@ -802,6 +2034,7 @@ static NSURL *_sharedTrashURL;
     NSMutableArray *keysToRemove = nil;
     
     [self lockForWriting];
+        [self _locked_synchronizeSharedIndexIfStale];
         if (_byteCount > trimByteCount) {
             keysToRemove = [[NSMutableArray alloc] init];
             
@@ -826,6 +2059,7 @@ static NSURL *_sharedTrashURL;
     for (NSString *key in keysToRemove) {
         [self removeFileAndExecuteBlocksForKey:key];
     }
+    [_statisticsRecorder addCount:keysToRemove.count toCounter:PINCacheStatisticsCounterCostEviction];
 }
 
 // This is the default trimming method which happens automatically
@@ -838,6 +2072,7 @@ static NSURL *_sharedTrashURL;
     NSMutableArray *keysToRemove = nil;
   
     [self lockForWriting];
+        [self _locked_synchronizeSharedIndexIfStale];
         if (_byteCount > trimByteCount) {
             PINCacheEvictionStrategy strategy = self->_evictionStrategy;
             keysToRemove = [[NSMutableArray alloc] init];
@@ -882,11 +2117,13 @@ static NSURL *_sharedTrashURL;
     for (NSString *key in keysToRemove) {
         [self removeFileAndExecuteBlocksForKey:key];
     }
+    [_statisticsRecorder addCount:keysToRemove.count toCounter:PINCacheStatisticsCounterCostEviction];
 }
 
 - (void)trimDiskToDate:(NSDate *)trimDate
 {
     [self lockForWriting];
+        [self _locked_synchronizeSharedIndexIfStale];
         NSArray *keysSortedByCreatedDate = [_metadata keysSortedByValueUsingComparator:^NSComparisonResult(PINDiskCacheMetadata * _Nonnull obj1, PINDiskCacheMetadata * _Nonnull obj2) {
             return [obj1.createdDate compare:obj2.createdDate];
         }];
@@ -909,6 +2146,7 @@ static NSURL *_sharedTrashURL;
     for (NSString *key in keysToRemove) {
         [self removeFileAndExecuteBlocksForKey:key];
     }
+    [_statisticsRecorder addCount:keysToRemove.count toCounter:PINCacheStatisticsCounterAgeEviction];
 }
 
 - (void)trimToAgeLimitRecursively
@@ -934,7 +2172,7 @@ static NSURL *_sharedTrashURL;
         [self unlock];
         
         if (shouldReschedule) {
-            [self.operationQueue scheduleOperation:^{
+            [self.maintenanceQueue scheduleOperation:^{
                 [self trimToAgeLimitRecursively];
             } withPriority:PINOperationQueuePriorityLow];
         }
@@ -968,11 +2206,32 @@ static NSURL *_sharedTrashURL;
 
 - (void)objectForKeyAsync:(NSString *)key completion:(PINDiskCacheObjectBlock)block
 {
+    [self objectForKeyAsync:key cancellationToken:nil completion:block];
+}
+
+- (PINCacheCancellationToken *)objectForKeyAsync:(NSString *)key deadline:(NSDate *)deadline completion:(PINDiskCacheObjectBlock)block
+{
+    PINCacheCancellationToken *token = [[PINCacheCancellationToken alloc] initWithDeadline:deadline];
+    [self objectForKeyAsync:key cancellationToken:token completion:block];
+    return token;
+}
+
+- (void)objectForKeyAsync:(NSString *)key cancellationToken:(nullable PINCacheCancellationToken *)token completion:(PINDiskCacheObjectBlock)block
+{
+    uint64_t enqueueTime = [self traceEnqueueTime];
     [self.operationQueue scheduleOperation:^{
-        NSURL *fileURL = nil;
-        id <NSCoding> object = [self objectForKey:key fileURL:&fileURL];
+        id <NSCoding> object = nil;
+        if (![token shouldDropOperationForRecorder:self->_statisticsRecorder]) {
+            NSURL *fileURL = nil;
+            PINCacheTraceWillRunQueuedOperation(enqueueTime);
+            PINCacheCurrentCancellationToken = token;
+            object = [self objectForKey:key fileURL:&fileURL];
+            PINCacheCurrentCancellationToken = nil;
+            PINCacheTraceDidRunQueuedOperation(enqueueTime);
+        }
         
-        block(self, key, object);
+        if (block && !token.cancelled)
+            block(self, key, object);
     } withPriority:PINOperationQueuePriorityLow];
 }
 
@@ -998,11 +2257,28 @@ static NSURL *_sharedTrashURL;
 
 - (void)setObjectAsync:(id <NSCoding>)object forKey:(NSString *)key withAgeLimit:(NSTimeInterval)ageLimit completion:(nullable PINDiskCacheObjectBlock)block
 {
+    [self setObjectAsync:object forKey:key withAgeLimit:ageLimit cancellationToken:nil completion:block];
+}
+
+- (PINCacheCancellationToken *)setObjectAsync:(id <NSCoding>)object forKey:(NSString *)key withAgeLimit:(NSTimeInterval)ageLimit deadline:(NSDate *)deadline completion:(PINDiskCacheObjectBlock)block
+{
+    PINCacheCancellationToken *token = [[PINCacheCancellationToken alloc] initWithDeadline:deadline];
+    [self setObjectAsync:object forKey:key withAgeLimit:ageLimit cancellationToken:token completion:block];
+    return token;
+}
+
+- (void)setObjectAsync:(id <NSCoding>)object forKey:(NSString *)key withAgeLimit:(NSTimeInterval)ageLimit cancellationToken:(nullable PINCacheCancellationToken *)token completion:(nullable PINDiskCacheObjectBlock)block
+{
+    uint64_t enqueueTime = [self traceEnqueueTime];
     [self.operationQueue scheduleOperation:^{
-        NSURL *fileURL = nil;
-        [self setObject:object forKey:key withAgeLimit:ageLimit fileURL:&fileURL];
+        if (![token shouldDropOperationForRecorder:self->_statisticsRecorder]) {
+            NSURL *fileURL = nil;
+            PINCacheTraceWillRunQueuedOperation(enqueueTime);
+            [self setObject:object forKey:key withAgeLimit:ageLimit fileURL:&fileURL];
+            PINCacheTraceDidRunQueuedOperation(enqueueTime);
+        }
         
-        if (block) {
+        if (block && !token.cancelled) {
             block(self, key, object);
         }
     } withPriority:PINOperationQueuePriorityLow];
@@ -1020,9 +2296,12 @@ static NSURL *_sharedTrashURL;
 
 - (void)removeObjectForKeyAsync:(NSString *)key completion:(PINDiskCacheObjectBlock)block
 {
+    uint64_t enqueueTime = [self traceEnqueueTime];
     [self.operationQueue scheduleOperation:^{
         NSURL *fileURL = nil;
+        PINCacheTraceWillRunQueuedOperation(enqueueTime);
         [self removeObjectForKey:key fileURL:&fileURL];
+        PINCacheTraceDidRunQueuedOperation(enqueueTime);
         
         if (block) {
             block(self, key, nil);
@@ -1043,7 +2322,7 @@ static NSURL *_sharedTrashURL;
         };
     }
     
-    [self.operationQueue scheduleOperation:operation
+    [self.maintenanceQueue scheduleOperation:operation
                               withPriority:PINOperationQueuePriorityLow
                                 identifier:PINDiskCacheOperationIdentifierTrimToSize
                             coalescingData:[NSNumber numberWithUnsignedInteger:trimByteCount]
@@ -1053,43 +2332,74 @@ static NSURL *_sharedTrashURL;
 
 - (void)trimToDateAsync:(NSDate *)trimDate completion:(PINCacheBlock)block
 {
-    PINOperationBlock operation = ^(id data){
-        [self trimToDate:(NSDate *)data];
+    [self trimToDateAsync:trimDate cancellationToken:nil completion:block];
+}
+
+- (PINCacheCancellationToken *)trimToDateAsync:(NSDate *)trimDate deadline:(NSDate *)deadline completion:(PINCacheBlock)block
+{
+    PINCacheCancellationToken *token = [[PINCacheCancellationToken alloc] initWithDeadline:deadline];
+    [self trimToDateAsync:trimDate cancellationToken:token completion:block];
+    return token;
+}
+
+- (void)trimToDateAsync:(NSDate *)trimDate cancellationToken:(nullable PINCacheCancellationToken *)token completion:(PINCacheBlock)block
+{
+    PINOperationBlock operation = ^(PINCacheCancellableOperationData *data){
+        NSDate *remainingTrimDate = [data dataOfRemainingRequestsForRecorder:self->_statisticsRecorder];
+        if (remainingTrimDate)
+            [self trimToDate:remainingTrimDate];
     };
     
     dispatch_block_t completion = nil;
     if (block) {
         completion = ^{
-            block(self);
+            if (!token.cancelled)
+                block(self);
         };
     }
     
-    [self.operationQueue scheduleOperation:operation
+    // Wrapped with the token, including when there's none, so that every trim to a date coalesces with the others.
+    [self.maintenanceQueue scheduleOperation:operation
                               withPriority:PINOperationQueuePriorityLow
                                 identifier:PINDiskCacheOperationIdentifierTrimToDate
-                            coalescingData:trimDate
-                       dataCoalescingBlock:PINDiskTrimmingDateCoalescingBlock
+                            coalescingData:[[PINCacheCancellableOperationData alloc] initWithData:trimDate cancellationToken:token dataCoalescingBlock:PINDiskTrimmingDateCoalescingBlock]
+                       dataCoalescingBlock:[PINCacheCancellableOperationData coalescingBlock]
                                 completion:completion];
 }
 
 - (void)trimToSizeByEvictionStrategyAsync:(NSUInteger)trimByteCount completion:(PINCacheBlock)block
 {
-    PINOperationBlock operation = ^(id data){
-        [self trimToSizeByEvictionStrategy:((NSNumber *)data).unsignedIntegerValue];
+    [self trimToSizeByEvictionStrategyAsync:trimByteCount cancellationToken:nil completion:block];
+}
+
+- (PINCacheCancellationToken *)trimToSizeByEvictionStrategyAsync:(NSUInteger)trimByteCount deadline:(NSDate *)deadline completion:(PINCacheBlock)block
+{
+    PINCacheCancellationToken *token = [[PINCacheCancellationToken alloc] initWithDeadline:deadline];
+    [self trimToSizeByEvictionStrategyAsync:trimByteCount cancellationToken:token completion:block];
+    return token;
+}
+
+- (void)trimToSizeByEvictionStrategyAsync:(NSUInteger)trimByteCount cancellationToken:(nullable PINCacheCancellationToken *)token completion:(PINCacheBlock)block
+{
+    PINOperationBlock operation = ^(PINCacheCancellableOperationData *data){
+        NSNumber *remainingTrimByteCount = [data dataOfRemainingRequestsForRecorder:self->_statisticsRecorder];
+        if (remainingTrimByteCount)
+            [self trimToSizeByEvictionStrategy:remainingTrimByteCount.unsignedIntegerValue];
     };
     
     dispatch_block_t completion = nil;
     if (block) {
         completion = ^{
-            block(self);
+            if (!token.cancelled)
+                block(self);
         };
     }
     
-    [self.operationQueue scheduleOperation:operation
+    [self.maintenanceQueue scheduleOperation:operation
                               withPriority:PINOperationQueuePriorityLow
                                 identifier:PINDiskCacheOperationIdentifierTrimToSizeByDate
-                            coalescingData:[NSNumber numberWithUnsignedInteger:trimByteCount]
-                       dataCoalescingBlock:PINDiskTrimmingSizeCoalescingBlock
+                            coalescingData:[[PINCacheCancellableOperationData alloc] initWithData:[NSNumber numberWithUnsignedInteger:trimByteCount] cancellationToken:token dataCoalescingBlock:PINDiskTrimmingSizeCoalescingBlock]
+                       dataCoalescingBlock:[PINCacheCancellableOperationData coalescingBlock]
                                 completion:completion];
 }
 
@@ -1126,6 +2436,62 @@ static NSURL *_sharedTrashURL;
     } withPriority:PINOperationQueuePriorityLow];
 }
 
+- (void)objectsForKeysAsync:(NSArray<NSString *> *)keys completion:(PINCacheObjectsBlock)block
+{
+    if (block == nil)
+        return;
+
+    [self.operationQueue scheduleOperation:^{
+        NSDictionary<NSString *, id <NSCoding>> *objects = [self objectsForKeys:keys];
+
+        block(self, objects);
+    } withPriority:PINOperationQueuePriorityLow];
+}
+
+- (void)setObjectsAsync:(NSArray<id <NSCoding>> *)objects forKeys:(NSArray<NSString *> *)keys completion:(PINCacheBlock)block
+{
+    [self.operationQueue scheduleOperation:^{
+        [self setObjects:objects forKeys:keys];
+
+        if (block)
+            block(self);
+    } withPriority:PINOperationQueuePriorityLow];
+}
+
+- (void)setObjectAsync:(id <NSCoding>)object forKey:(NSString *)key withTags:(NSSet<NSString *> *)tags completion:(PINDiskCacheObjectBlock)block
+{
+    uint64_t enqueueTime = [self traceEnqueueTime];
+    [self.operationQueue scheduleOperation:^{
+        PINCacheTraceWillRunQueuedOperation(enqueueTime);
+        [self setObject:object forKey:key withTags:tags];
+        PINCacheTraceDidRunQueuedOperation(enqueueTime);
+
+        if (block) {
+            block(self, key, object);
+        }
+    } withPriority:PINOperationQueuePriorityLow];
+}
+
+- (void)removeObjectsWithTagAsync:(NSString *)tag completion:(PINCacheBlock)block
+{
+    [self.operationQueue scheduleOperation:^{
+        [self removeObjectsWithTag:tag];
+
+        if (block)
+            block(self);
+    } withPriority:PINOperationQueuePriorityLow];
+}
+
+- (void)removeObjectsWithKeyPrefixAsync:(NSString *)prefix completion:(PINCacheBlock)block
+{
+    [self.operationQueue scheduleOperation:^{
+        [self removeObjectsWithKeyPrefix:prefix];
+
+        if (block)
+            block(self);
+    } withPriority:PINOperationQueuePriorityLow];
+}
+
 #pragma mark - Public Synchronous Methods -
 
 - (void)synchronouslyLockFileAccessWhileExecutingBlock:(PIN_NOESCAPE PINCacheBlock)block
@@ -1140,7 +2506,7 @@ static NSURL *_sharedTrashURL;
 - (BOOL)containsObjectForKey:(NSString *)key
 {
     [self lock];
-        if (_metadata[key] != nil || _diskStateKnown == NO) {
+        if (_metadata[key] != nil || [self _locked_sharedIndexIsStale] || (_diskStateKnown == NO && [self _locked_keyFilterMightContainKey:key])) {
             BOOL objectExpired = NO;
             if (self->_ttlCache && _metadata[key].createdDate != nil) {
                 NSTimeInterval ageLimit = _metadata[key].ageLimit > 0.0 ? _metadata[key].ageLimit : self->_ageLimit;
@@ -1165,14 +2531,23 @@ static NSURL *_sharedTrashURL;
 
 - (nullable id <NSCoding>)objectForKey:(NSString *)key fileURL:(NSURL **)outFileURL
 {
+    uint64_t startTime = [_statisticsRecorder startOperation];
+    PINCacheTrace trace;
+    BOOL traced = [self beginTrace:&trace forKey:key];
     [self lock];
-        BOOL containsKey = _metadata[key] != nil || _diskStateKnown == NO;
+        BOOL containsKey = _metadata[key] != nil || [self _locked_sharedIndexIsStale] || (_diskStateKnown == NO && [self _locked_keyFilterMightContainKey:key]);
     [self unlock];
 
-    if (!key || !containsKey)
+    if (!key || !containsKey) {
+        if (traced)
+            [self finishTrace:&trace operation:@"read"];
+        [self recordReadOfObject:nil byteCount:0 startTime:startTime];
         return nil;
+    }
     
     id <NSCoding> object = nil;
+    NSUInteger bytesRead = 0;
+    BOOL dropped = NO;
     NSURL *fileURL = [self encodedFileURLForKey:key];
     
     NSDate *now = [NSDate date];
@@ -1185,27 +2560,44 @@ static NSURL *_sharedTrashURL;
                 }
             }
         }
+        if (_metadata[key] == nil && [self _locked_sharedIndexIsStale] && [[NSFileManager defaultManager] fileExistsAtPath:[fileURL path]]) {
+            // Written by another process, pick up its age limit and access count before using them below.
+            [self _locked_initializeDiskPropertiesForFile:fileURL fileKey:key];
+        }
 
         NSTimeInterval ageLimit = _metadata[key].ageLimit > 0.0 ? _metadata[key].ageLimit : self->_ageLimit;
         if (!self->_ttlCache || ageLimit <= 0 || fabs([_metadata[key].createdDate timeIntervalSinceDate:now]) < ageLimit) {
             // If the cache should behave like a TTL cache, then only fetch the object if there's a valid ageLimit and  the object is still alive
             
-            NSData *objectData = [[NSData alloc] initWithContentsOfFile:[fileURL path]];
+            BOOL corrupt = NO;
+            uint64_t readStartTime = PINDiskCacheTracePhaseBegin(&_tracing);
+            NSData *objectData = PINDiskCacheReadChecksummedFile(fileURL, YES, NULL, &corrupt);
+            PINCacheTracePhaseEnd(PINCacheTracePhaseIO, readStartTime);
+            if (corrupt) {
+                [self _locked_quarantineFileAtURL:fileURL key:key];
+            }
+            bytesRead = objectData.length;
+          
+            // An asynchronous read that was called off while reading has no use for the object.
+            if (objectData && [PINCacheCurrentCancellationToken shouldDropOperationForRecorder:_statisticsRecorder]) {
+                objectData = nil;
+                dropped = YES;
+            }
           
             if (objectData) {
               //Be careful with locking below. We unlock here so that we're not locked while deserializing, we re-lock after.
               [self unlock];
+              uint64_t deserializeStartTime = PINDiskCacheTracePhaseBegin(&_tracing);
               @try {
                   object = _deserializer(objectData, key);
               }
               @catch (NSException *exception) {
-                  NSError *error = nil;
                   [self lock];
-                      [[NSFileManager defaultManager] removeItemAtPath:[fileURL path] error:&error];
+                      [self _locked_removeUnreadableFileAtURL:fileURL key:key];
                   [self unlock];
-                  PINDiskCacheError(error)
                   PINDiskCacheException(exception);
               }
+              PINCacheTracePhaseEnd(PINCacheTracePhaseDeserialization, deserializeStartTime);
               [self lock];
             }
             if (object) {
@@ -1225,9 +2617,45 @@ static NSURL *_sharedTrashURL;
         *outFileURL = fileURL;
     }
     
+    if (traced)
+        [self finishTrace:&trace operation:@"read"];
+    // Counted as dropped rather than as a miss.
+    if (!dropped)
+        [self recordReadOfObject:object byteCount:bytesRead startTime:startTime];
     return object;
 }
 
+// Opens a trace for an operation on this thread if the cache is traced. Pair with finishTrace:operation:.
+- (BOOL)beginTrace:(PINCacheTrace *)trace forKey:(nullable NSString *)key
+{
+    return atomic_load_explicit(&_tracing, memory_order_relaxed) && PINCacheTraceBegin(trace, key);
+}
+
+- (void)finishTrace:(PINCacheTrace *)trace operation:(NSString *)operation
+{
+    // Closed before taking the lock, which would otherwise be counted as part of the operation.
+    PINCacheTraceSpan *span = PINCacheTraceEnd(trace, _name, operation);
+    [self lock];
+        id <PINCacheTraceSink> traceSink = _traceSink;
+    [self unlock];
+    [traceSink recordSpan:span];
+}
+
+// When an operation about to be scheduled was queued, for its trace, or `0` if the cache isn't traced.
+- (uint64_t)traceEnqueueTime
+{
+    return atomic_load_explicit(&_tracing, memory_order_relaxed) ? PINCacheTraceCurrentTime() : 0;
+}
+
+- (void)recordReadOfObject:(nullable id)object byteCount:(NSUInteger)byteCount startTime:(uint64_t)startTime
+{
+    if (startTime == 0)
+        return;
+    [_statisticsRecorder addCount:1 toCounter:object ? PINCacheStatisticsCounterHit : PINCacheStatisticsCounterMiss];
+    [_statisticsRecorder addCount:byteCount toCounter:PINCacheStatisticsCounterBytesRead];
+    [_statisticsRecorder endOperation:PINCacheStatisticsOperationRead startTime:startTime];
+}
+
 /// Helper function to call fileURLForKey:updateFileModificationDate:
 - (NSURL *)fileURLForKey:(NSString *)key
 {
@@ -1293,13 +2721,26 @@ static NSURL *_sharedTrashURL;
     }
 }
 
+- (void)setObject:(id <NSCoding>)object forKey:(NSString *)key withTags:(NSSet<NSString *> *)tags
+{
+    [self setObject:object forKey:key withAgeLimit:0.0 tags:tags fileURL:nil];
+}
+
 - (void)setObject:(id <NSCoding>)object forKey:(NSString *)key withAgeLimit:(NSTimeInterval)ageLimit fileURL:(NSURL **)outFileURL
+{
+    [self setObject:object forKey:key withAgeLimit:ageLimit tags:nil fileURL:outFileURL];
+}
+
+- (void)setObject:(id <NSCoding>)object forKey:(NSString *)key withAgeLimit:(NSTimeInterval)ageLimit tags:(NSSet<NSString *> *)tags fileURL:(NSURL **)outFileURL
 {
     NSAssert(ageLimit <= 0.0 || (ageLimit > 0.0 && _ttlCache), @"ttlCache must be set to YES if setting an object-level age limit.");
 
     if (!key || !object)
         return;
     
+    uint64_t startTime = [_statisticsRecorder startOperation];
+    PINCacheTrace trace;
+    BOOL traced = [self beginTrace:&trace forKey:key];
     NSDataWritingOptions writeOptions = NSDataWritingAtomic;
     #if TARGET_OS_IPHONE
     if (self.writingProtectionOptionSet) {
@@ -1308,7 +2749,13 @@ static NSURL *_sharedTrashURL;
     #endif
   
     // Remain unlocked here so that we're not locked while serializing.
+    BOOL checksumsEnabled = self.checksumsEnabled;
+    uint64_t serializeStartTime = PINDiskCacheTracePhaseBegin(&_tracing);
     NSData *data = _serializer(object, key);
+    if (checksumsEnabled) {
+        data = PINDiskCacheChecksummedData(data);
+    }
+    PINCacheTracePhaseEnd(PINCacheTracePhaseSerialization, serializeStartTime);
     NSURL *fileURL = nil;
 
     NSUInteger byteLimit = self.byteLimit;
@@ -1321,6 +2768,8 @@ static NSURL *_sharedTrashURL;
         if (outFileURL) {
             *outFileURL = nil;
         }
+        if (traced)
+            [self finishTrace:&trace operation:@"write"];
         return;
     }
 
@@ -1332,14 +2781,29 @@ static NSURL *_sharedTrashURL;
             [self lock];
         }
     
+        [self _locked_keyFilterWillChange];
+        BOOL keyIsNew = self->_metadata[key] == nil;
+        if (keyIsNew && self->_keyFilterCoversDisk && !self->_diskStateKnown) {
+            // The disk hasn't been scanned yet, the file may already be there and counted by the filter.
+            keyIsNew = ![[NSFileManager defaultManager] fileExistsAtPath:[fileURL path]];
+        }
+    
+        [self _locked_beginSharedIndexWrite];
+        NSNumber *prevDiskFileSize = self->_sharedIndexHeader ? [self _locked_allocatedSizeOfFileAtURL:fileURL] : nil;
+    
         NSError *writeError = nil;
+        uint64_t writeStartTime = PINDiskCacheTracePhaseBegin(&_tracing);
         BOOL written = [data writeToURL:fileURL options:writeOptions error:&writeError];
+        PINCacheTracePhaseEnd(PINCacheTracePhaseIO, writeStartTime);
         PINDiskCacheError(writeError);
         
         if (written) {
             if (_metadata[key] == nil) {
                 _metadata[key] = [[PINDiskCacheMetadata alloc] init];
             }
+            if (keyIsNew) {
+                [self->_keyFilter addKey:key];
+            }
             
             NSError *error = nil;
             NSDictionary *values = [fileURL resourceValuesForKeys:@[ NSURLCreationDateKey, NSURLContentModificationDateKey, NSURLTotalFileAllocatedSizeKey ] error:&error];
@@ -1347,7 +2811,9 @@ static NSURL *_sharedTrashURL;
             
             NSNumber *diskFileSize = [values objectForKey:NSURLTotalFileAllocatedSizeKey];
             if (diskFileSize) {
-                NSNumber *prevDiskFileSize = self->_metadata[key].size;
+                if (self->_sharedIndexHeader == NULL) {
+                    prevDiskFileSize = self->_metadata[key].size;
+                }
                 if (prevDiskFileSize) {
                     self.byteCount = self->_byteCount - [prevDiskFileSize unsignedIntegerValue];
                 }
@@ -1363,6 +2829,12 @@ static NSURL *_sharedTrashURL;
                 self->_metadata[key].lastModifiedDate = lastModifiedDate;
             }
             [self asynchronouslySetAgeLimit:ageLimit forURL:fileURL];
+            if (tags.count > 0 && ![self _locked_setTagsAttribute:tags forURL:fileURL]) {
+                tags = nil;
+            }
+            // The file was replaced, so any tags it had are gone even if this object has none.
+            [self _locked_setTags:tags forKey:key];
+            [self _locked_noteSharedIndexChangeForKey:key];
             NSInteger accessCount = self->_metadata[key].accessCount;
             if (accessCount < NSIntegerMax) {
                 accessCount += 1;
@@ -1375,6 +2847,7 @@ static NSURL *_sharedTrashURL;
         } else {
             fileURL = nil;
         }
+        [self _locked_endSharedIndexWrite];
     
         PINDiskCacheObjectBlock didAddObjectBlock = self->_didAddObjectBlock;
         if (didAddObjectBlock) {
@@ -1387,6 +2860,253 @@ static NSURL *_sharedTrashURL;
     if (outFileURL) {
         *outFileURL = fileURL;
     }
+
+    if (traced)
+        [self finishTrace:&trace operation:@"write"];
+    if (startTime && written) {
+        [_statisticsRecorder addCount:1 toCounter:PINCacheStatisticsCounterSet];
+        [_statisticsRecorder addCount:data.length toCounter:PINCacheStatisticsCounterBytesWritten];
+        [_statisticsRecorder endOperation:PINCacheStatisticsOperationWrite startTime:startTime];
+    }
+}
+
+- (NSDictionary<NSString *, id <NSCoding>> *)objectsForKeys:(NSArray<NSString *> *)keys
+{
+    if (keys.count == 0)
+        return @{};
+
+    NSDate *now = [NSDate date];
+    NSMutableArray<NSString *> *candidateKeys = [[NSMutableArray alloc] initWithCapacity:keys.count];
+    NSMutableSet<NSString *> *seenKeys = [[NSMutableSet alloc] initWithCapacity:keys.count];
+    [self lock];
+        BOOL needsPerKeyLookup = (self->_ttlCache && !_diskStateKnown) || [self _locked_sharedIndexIsStale];
+        if (!needsPerKeyLookup) {
+            for (NSString *key in keys) {
+                if ([seenKeys containsObject:key])
+                    continue;
+                [seenKeys addObject:key];
+
+                PINDiskCacheMetadata *metadata = _metadata[key];
+                if (metadata == nil && (_diskStateKnown || ![self _locked_keyFilterMightContainKey:key]))
+                    continue;
+                // If the cache should behave like a TTL cache, then only fetch the object if there's a valid ageLimit and  the object is still alive
+                NSTimeInterval ageLimit = metadata.ageLimit > 0.0 ? metadata.ageLimit : self->_ageLimit;
+                if (!self->_ttlCache || ageLimit <= 0 || fabs([metadata.createdDate timeIntervalSinceDate:now]) < ageLimit) {
+                    [candidateKeys addObject:key];
+                }
+            }
+        }
+    [self unlock];
+
+    if (needsPerKeyLookup) {
+        // The metadata has to be filled in from disk key by key first, which the single key path already does.
+        NSMutableDictionary<NSString *, id <NSCoding>> *objects = [[NSMutableDictionary alloc] initWithCapacity:keys.count];
+        for (NSString *key in keys) {
+            if (objects[key] == nil) {
+                objects[key] = [self objectForKey:key];
+            }
+        }
+        return objects;
+    }
+
+    // Read and deserialize in parallel without holding the lock. Each stride fills its own dictionaries so that no
+    // locking is needed between them.
+    NSUInteger candidateCount = candidateKeys.count;
+    NSUInteger strideLength = 8;
+    NSUInteger strideCount = (candidateCount + strideLength - 1) / strideLength;
+    NSMutableArray<NSMutableDictionary<NSString *, id <NSCoding>> *> *stridedObjects = [[NSMutableArray alloc] initWithCapacity:strideCount];
+    NSMutableArray<NSMutableSet<NSString *> *> *stridedCorruptKeys = [[NSMutableArray alloc] initWithCapacity:strideCount];
+    NSMutableArray<NSMutableSet<NSString *> *> *stridedUnreadableKeys = [[NSMutableArray alloc] initWithCapacity:strideCount];
+    for (NSUInteger stride = 0; stride < strideCount; stride++) {
+        [stridedObjects addObject:[[NSMutableDictionary alloc] init]];
+        [stridedCorruptKeys addObject:[[NSMutableSet alloc] init]];
+        [stridedUnreadableKeys addObject:[[NSMutableSet alloc] init]];
+    }
+
+    PINDiskCacheDeserializerBlock deserializer = _deserializer;
+    dispatch_apply(strideCount, DISPATCH_APPLY_AUTO, ^(size_t stride) {
+        NSMutableDictionary<NSString *, id <NSCoding>> *objects = stridedObjects[stride];
+        NSUInteger end = MIN((stride + 1) * strideLength, candidateCount);
+        for (NSUInteger idx = stride * strideLength; idx < end; idx++) {
+            @autoreleasepool {
+                NSString *key = candidateKeys[idx];
+                BOOL corrupt = NO;
+                NSData *objectData = PINDiskCacheReadChecksummedFile([self encodedFileURLForKey:key], YES, NULL, &corrupt);
+                if (corrupt) {
+                    [stridedCorruptKeys[stride] addObject:key];
+                }
+                if (objectData == nil)
+                    continue;
+                [self->_statisticsRecorder addCount:objectData.length toCounter:PINCacheStatisticsCounterBytesRead];
+
+                @try {
+                    id <NSCoding> object = deserializer(objectData, key);
+                    if (object)
+                        objects[key] = object;
+                }
+                @catch (NSException *exception) {
+                    [stridedUnreadableKeys[stride] addObject:key];
+                    PINDiskCacheException(exception);
+                }
+            }
+        }
+    });
+
+    NSMutableDictionary<NSString *, id <NSCoding>> *objects = [[NSMutableDictionary alloc] initWithCapacity:candidateCount];
+    for (NSDictionary<NSString *, id <NSCoding>> *strideObjects in stridedObjects) {
+        [objects addEntriesFromDictionary:strideObjects];
+    }
+
+    NSMutableDictionary<NSURL *, NSNumber *> *accessCounts = [[NSMutableDictionary alloc] initWithCapacity:objects.count];
+    [self lockForWriting];
+        for (NSSet<NSString *> *corruptKeys in stridedCorruptKeys) {
+            for (NSString *key in corruptKeys) {
+                // The file may have been replaced while it was read outside the lock, check again before moving it aside.
+                NSURL *fileURL = [self encodedFileURLForKey:key];
+                BOOL corrupt = NO;
+                PINDiskCacheReadChecksummedFile(fileURL, NO, NULL, &corrupt);
+                if (corrupt) {
+                    [self _locked_quarantineFileAtURL:fileURL key:key];
+                }
+            }
+        }
+        for (NSSet<NSString *> *unreadableKeys in stridedUnreadableKeys) {
+            for (NSString *key in unreadableKeys) {
+                [self _locked_removeUnreadableFileAtURL:[self encodedFileURLForKey:key] key:key];
+            }
+        }
+        for (NSString *key in objects) {
+            PINDiskCacheMetadata *metadata = _metadata[key];
+            if (metadata == nil)
+                continue;
+            metadata.lastModifiedDate = now;
+            if (metadata.accessCount < NSIntegerMax) {
+                metadata.accessCount += 1;
+            }
+            accessCounts[[self encodedFileURLForKey:key]] = @(metadata.accessCount);
+        }
+    [self unlock];
+
+    // Recorded on disk by one operation for the whole batch.
+    [self asynchronouslySetAccessCounts:accessCounts fileModificationDate:now];
+
+    [_statisticsRecorder addCount:objects.count toCounter:PINCacheStatisticsCounterHit];
+    [_statisticsRecorder addCount:seenKeys.count - MIN(objects.count, seenKeys.count) toCounter:PINCacheStatisticsCounterMiss];
+    return objects;
+}
+
+- (void)setObjects:(NSArray<id <NSCoding>> *)objects forKeys:(NSArray<NSString *> *)keys
+{
+    NSAssert(objects.count == keys.count, @"Must pass the same number of objects and keys.");
+
+    NSUInteger count = MIN(objects.count, keys.count);
+    if (count == 0)
+        return;
+
+    // Only the last object for a key is stored, as if the objects had been set one at a time.
+    NSMutableIndexSet *uniqueIndexes = [[NSMutableIndexSet alloc] init];
+    NSMutableSet<NSString *> *seenKeys = [[NSMutableSet alloc] initWithCapacity:count];
+    for (NSUInteger idx = count; idx > 0; idx--) {
+        NSString *key = keys[idx - 1];
+        if (![seenKeys containsObject:key]) {
+            [seenKeys addObject:key];
+            [uniqueIndexes addIndex:idx - 1];
+        }
+    }
+    NSMutableArray<NSNumber *> *indexes = [[NSMutableArray alloc] initWithCapacity:uniqueIndexes.count];
+    [uniqueIndexes enumerateIndexesUsingBlock:^(NSUInteger idx, BOOL * _Nonnull stop) {
+        [indexes addObject:@(idx)];
+    }];
+
+    NSDataWritingOptions writeOptions = 0;
+    #if TARGET_OS_IPHONE
+    if (self.writingProtectionOptionSet) {
+        writeOptions |= self.writingProtectionOption;
+    }
+    #endif
+
+    [self lock];
+        PINDiskCacheObjectBlock willAddObjectBlock = self->_willAddObjectBlock;
+        NSURL *cacheURL = _cacheURL;
+        NSUInteger byteLimit = _byteLimit;
+        BOOL checksumsEnabled = _checksumsEnabled;
+    [self unlock];
+
+    if (willAddObjectBlock) {
+        for (NSNumber *idx in indexes) {
+            willAddObjectBlock(self, keys[[idx unsignedIntegerValue]], objects[[idx unsignedIntegerValue]]);
+        }
+    }
+
+    // Serialize and write in parallel without holding the lock. Files are staged inside the cache directory so that
+    // moving them into place below is a rename.
+    NSUInteger uniqueCount = indexes.count;
+    NSMutableArray<NSURL *> *stagedFileURLs = [[NSMutableArray alloc] initWithCapacity:uniqueCount];
+    for (NSUInteger i = 0; i < uniqueCount; i++) {
+        [stagedFileURLs addObject:[cacheURL URLByAppendingPathComponent:[PINDiskCacheImportFilePrefix stringByAppendingString:[[NSUUID UUID] UUIDString]] isDirectory:NO]];
+    }
+    BOOL *written = calloc(uniqueCount, sizeof(BOOL));
+    PINDiskCacheSerializerBlock serializer = _serializer;
+    dispatch_apply(uniqueCount, DISPATCH_APPLY_AUTO, ^(size_t i) {
+        @autoreleasepool {
+            NSUInteger idx = [indexes[i] unsignedIntegerValue];
+            NSData *data = serializer(objects[idx], keys[idx]);
+            if (checksumsEnabled) {
+                data = PINDiskCacheChecksummedData(data);
+            }
+            // Objects the cache isn't large enough to hold would be deleted immediately after.
+            if (data == nil || (byteLimit > 0 && data.length > byteLimit))
+                return;
+
+            NSError *writeError = nil;
+            written[i] = [data writeToURL:stagedFileURLs[i] options:writeOptions error:&writeError];
+            if (written[i]) {
+                [self->_statisticsRecorder addCount:data.length toCounter:PINCacheStatisticsCounterBytesWritten];
+            } else {
+                PINDiskCacheError(writeError);
+                unlink(PINDiskCacheFileSystemRepresentation(stagedFileURLs[i]));
+            }
+        }
+    });
+
+    NSDate *now = [NSDate date];
+    NSMutableIndexSet *storedIndexes = [[NSMutableIndexSet alloc] init];
+    NSMutableDictionary<NSURL *, NSNumber *> *accessCounts = [[NSMutableDictionary alloc] initWithCapacity:uniqueCount];
+    [self lockForWriting];
+        [self _locked_keyFilterWillChange];
+        [self _locked_beginSharedIndexWrite];
+        for (NSUInteger i = 0; i < uniqueCount; i++) {
+            if (!written[i])
+                continue;
+
+            NSUInteger idx = [indexes[i] unsignedIntegerValue];
+            NSString *key = keys[idx];
+            NSInteger accessCount = _metadata[key].accessCount;
+            if (accessCount < NSIntegerMax) {
+                accessCount += 1;
+            }
+            if ([self _locked_moveFileAtURL:stagedFileURLs[i] intoPlaceForKey:key createdDate:now lastModifiedDate:now ageLimit:0.0 accessCount:accessCount]) {
+                accessCounts[[self encodedFileURLForKey:key]] = @(accessCount);
+                [storedIndexes addIndex:idx];
+            }
+        }
+        [self _locked_endSharedIndexWrite];
+
+        if (self->_byteLimit > 0 && self->_byteCount > self->_byteLimit)
+            [self trimToSizeByEvictionStrategyAsync:self->_byteLimit completion:nil];
+
+        PINDiskCacheObjectBlock didAddObjectBlock = self->_didAddObjectBlock;
+    [self unlock];
+    free(written);
+
+    [self asynchronouslySetAccessCounts:accessCounts fileModificationDate:nil];
+    [_statisticsRecorder addCount:storedIndexes.count toCounter:PINCacheStatisticsCounterSet];
+
+    if (didAddObjectBlock) {
+        [storedIndexes enumerateIndexesUsingBlock:^(NSUInteger idx, BOOL * _Nonnull stop) {
+            didAddObjectBlock(self, keys[idx], objects[idx]);
+        }];
+    }
 }
 
 - (void)removeObjectForKey:(NSString *)key
@@ -1394,20 +3114,72 @@ static NSURL *_sharedTrashURL;
     [self removeObjectForKey:key fileURL:nil];
 }
 
-- (void)removeObjectForKey:(NSString *)key fileURL:(NSURL **)outFileURL
+- (void)removeObjectForKey:(NSString *)key fileURL:(NSURL **)outFileURL
+{
+    if (!key)
+        return;
+    
+    NSURL *fileURL = nil;
+    
+    fileURL = [self encodedFileURLForKey:key];
+    
+    PINCacheTrace trace;
+    BOOL traced = [self beginTrace:&trace forKey:key];
+    [self removeFileAndExecuteBlocksForKey:key];
+    if (traced)
+        [self finishTrace:&trace operation:@"remove"];
+    
+    if (outFileURL) {
+        *outFileURL = fileURL;
+    }
+}
+
+- (NSArray<NSString *> *)keysWithTag:(NSString *)tag
+{
+    if (!tag)
+        return @[];
+
+    [self lockAndWaitForKnownState];
+        [self _locked_synchronizeSharedIndexIfStale];
+        NSArray<NSString *> *keys = [_tagIndex[tag] allObjects];
+    [self unlock];
+    return keys ?: @[];
+}
+
+- (void)removeObjectsWithTag:(NSString *)tag
+{
+    if (!tag)
+        return;
+
+    [self lockAndWaitForKnownState];
+        [self _locked_synchronizeSharedIndexIfStale];
+        NSArray<NSString *> *keys = [_tagIndex[tag] allObjects];
+    [self unlock];
+
+    [self removeFilesAndExecuteBlocksForKeys:keys passingTest:^BOOL(NSString *key) {
+        return [self->_metadata[key].tags containsObject:tag];
+    }];
+}
+
+- (void)removeObjectsWithKeyPrefix:(NSString *)prefix
 {
-    if (!key)
+    if (!prefix)
         return;
-    
-    NSURL *fileURL = nil;
-    
-    fileURL = [self encodedFileURLForKey:key];
-    
-    [self removeFileAndExecuteBlocksForKey:key];
-    
-    if (outFileURL) {
-        *outFileURL = fileURL;
-    }
+
+    NSMutableArray<NSString *> *keys = [[NSMutableArray alloc] init];
+    [self lockAndWaitForKnownState];
+        [self _locked_synchronizeSharedIndexIfStale];
+        for (NSString *key in _metadata) {
+            if ([key hasPrefix:prefix]) {
+                [keys addObject:key];
+            }
+        }
+    [self unlock];
+
+    // A matching key always has the prefix, but it may have been removed in between.
+    [self removeFilesAndExecuteBlocksForKeys:keys passingTest:^BOOL(NSString *key) {
+        return self->_metadata[key] != nil;
+    }];
 }
 
 - (void)trimToSize:(NSUInteger)trimByteCount
@@ -1446,6 +3218,7 @@ static NSURL *_sharedTrashURL;
 - (void)removeExpiredObjects
 {
     [self lockForWriting];
+        [self _locked_synchronizeSharedIndexIfStale];
         NSDate *now = [NSDate date];
         NSMutableArray<NSString *> *expiredObjectKeys = [NSMutableArray array];
         [_metadata enumerateKeysAndObjectsUsingBlock:^(NSString * _Nonnull key, PINDiskCacheMetadata * _Nonnull obj, BOOL * _Nonnull stop) {
@@ -1461,6 +3234,7 @@ static NSURL *_sharedTrashURL;
         //unlock, removeFileAndExecuteBlocksForKey handles locking itself
         [self removeFileAndExecuteBlocksForKey:key];
     }
+    [_statisticsRecorder addCount:expiredObjectKeys.count toCounter:PINCacheStatisticsCounterAgeEviction];
 }
 
 - (void)removeAllObjects
@@ -1474,13 +3248,20 @@ static NSURL *_sharedTrashURL;
             [self lock];
         }
     
+        [self _locked_keyFilterWillChange];
+        [self _locked_beginSharedIndexWrite];
         [PINDiskCache moveItemAtURLToTrashOrRemove:self->_cacheURL];
         [PINDiskCache emptyTrash];
         
         [self _locked_createCacheDirectory];
         
         [self->_metadata removeAllObjects];
+        [self->_tagIndex removeAllObjects];
+        [self->_keyFilter removeAllKeys];
+        self->_keyFilterCoversDisk = YES;
         self.byteCount = 0; // atomic
+        [self _locked_noteSharedIndexChangeOfAllKeys];
+        [self _locked_endSharedIndexWrite];
     
         PINCacheBlock didRemoveAllObjectsBlock = self->_didRemoveAllObjectsBlock;
         if (didRemoveAllObjectsBlock) {
@@ -1498,6 +3279,7 @@ static NSURL *_sharedTrashURL;
         return;
     
     [self lockAndWaitForKnownState];
+        [self _locked_synchronizeSharedIndexIfStale];
         NSDate *now = [NSDate date];
     
         for (NSString *key in _metadata) {
@@ -1515,6 +3297,430 @@ static NSURL *_sharedTrashURL;
     [self unlock];
 }
 
+#pragma mark - Public Snapshot Methods -
+
+- (BOOL)exportSnapshotToURL:(NSURL *)archiveURL error:(NSError **)outError
+{
+    NSFileManager *fileManager = [NSFileManager defaultManager];
+    NSString *snapshotName = [NSString stringWithFormat:@"%@.snapshot-%@", [_cacheURL lastPathComponent], [[NSUUID UUID] UUIDString]];
+    NSURL *snapshotURL = [[_cacheURL URLByDeletingLastPathComponent] URLByAppendingPathComponent:snapshotName isDirectory:YES];
+    NSMutableArray<PINDiskCacheSnapshotEntry *> *entries = [[NSMutableArray alloc] init];
+    NSError *error = nil;
+
+    // Only what's needed to find the files is taken under the lock, the files are frozen after it's released.
+    [self lockAndWaitForKnownState];
+        [self _locked_synchronizeSharedIndexIfStale];
+        for (NSString *key in _metadata) {
+            PINDiskCacheMetadata *metadata = _metadata[key];
+            PINDiskCacheSnapshotEntry *entry = [[PINDiskCacheSnapshotEntry alloc] init];
+            entry.key = key;
+            entry.fileURL = [self encodedFileURLForKey:key];
+            entry.indexEntry = (PINDiskCacheSnapshotIndexEntry){
+                .createdDate = [metadata.createdDate timeIntervalSinceReferenceDate],
+                .lastModifiedDate = [metadata.lastModifiedDate timeIntervalSinceReferenceDate],
+                .ageLimit = metadata.ageLimit,
+                .accessCount = metadata.accessCount,
+            };
+            [entries addObject:entry];
+        }
+    [self unlock];
+
+    // Writes replace files rather than modify them, so a hard link (or copy, where links aren't possible) freezes each
+    // file as it is now and the archive is written from the frozen files. Objects removed since the lock was released
+    // are left out, and one replaced since is archived as it is now, with the attributes it had.
+    if ([fileManager createDirectoryAtURL:snapshotURL withIntermediateDirectories:YES attributes:nil error:&error]) {
+        NSMutableIndexSet *removedIndexes = [[NSMutableIndexSet alloc] init];
+        for (NSUInteger idx = 0; idx < entries.count && error == nil; idx++) {
+            PINDiskCacheSnapshotEntry *entry = entries[idx];
+            NSURL *frozenFileURL = [snapshotURL URLByAppendingPathComponent:[entry.fileURL lastPathComponent] isDirectory:NO];
+            if (link(PINDiskCacheFileSystemRepresentation(entry.fileURL), PINDiskCacheFileSystemRepresentation(frozenFileURL)) != 0) {
+                if (errno == ENOENT) {
+                    [removedIndexes addIndex:idx];
+                    continue;
+                }
+                NSError *copyError = nil;
+                if (![fileManager copyItemAtURL:entry.fileURL toURL:frozenFileURL error:&copyError]) {
+                    if ([copyError.domain isEqualToString:NSCocoaErrorDomain] && copyError.code == NSFileReadNoSuchFileError) {
+                        [removedIndexes addIndex:idx];
+                    } else {
+                        error = copyError;
+                    }
+                    continue;
+                }
+            }
+            entry.fileURL = frozenFileURL;
+        }
+        [entries removeObjectsAtIndexes:removedIndexes];
+    }
+
+    if (error) {
+        [fileManager removeItemAtURL:snapshotURL error:nil];
+        if (outError) {
+            *outError = error;
+        }
+        return NO;
+    }
+
+    [entries sortUsingComparator:^NSComparisonResult(PINDiskCacheSnapshotEntry *entry1, PINDiskCacheSnapshotEntry *entry2) {
+        double lastModifiedDate1 = entry1.indexEntry.lastModifiedDate;
+        double lastModifiedDate2 = entry2.indexEntry.lastModifiedDate;
+        if (lastModifiedDate1 > lastModifiedDate2) {
+            return NSOrderedAscending;
+        } else if (lastModifiedDate1 < lastModifiedDate2) {
+            return NSOrderedDescending;
+        }
+        return NSOrderedSame;
+    }];
+
+    BOOL written = [self writeSnapshotEntries:entries toURL:archiveURL error:&error];
+    [fileManager removeItemAtURL:snapshotURL error:nil];
+
+    if (!written && outError) {
+        *outError = error;
+    }
+    return written;
+}
+
+- (BOOL)writeSnapshotEntries:(NSArray<PINDiskCacheSnapshotEntry *> *)entries toURL:(NSURL *)archiveURL error:(NSError **)outError
+{
+    NSURL *temporaryURL = [archiveURL URLByAppendingPathExtension:[[NSUUID UUID] UUIDString]];
+    int archive = open(PINDiskCacheFileSystemRepresentation(temporaryURL), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (archive < 0) {
+        *outError = PINDiskCacheSnapshotError(PINDiskCacheErrorWriteFailure, errno);
+        return NO;
+    }
+
+    uint8_t *buffer = malloc(PINDiskCacheSnapshotBufferSize);
+    NSMutableData *index = [[NSMutableData alloc] init];
+    PINDiskCacheSnapshotHeader header = { .magic = PINDiskCacheSnapshotMagic, .version = PINDiskCacheSnapshotVersion };
+    // The header is rewritten once the index offset is known.
+    BOOL written = buffer != NULL && PINDiskCacheWriteFully(archive, &header, sizeof(header));
+    uint64_t offset = sizeof(header);
+
+    for (PINDiskCacheSnapshotEntry *entry in entries) {
+        if (!written)
+            break;
+
+        int file = open(PINDiskCacheFileSystemRepresentation(entry.fileURL), O_RDONLY | O_CLOEXEC);
+        if (file < 0) {
+            continue;
+        }
+
+        PINDiskCacheSnapshotIndexEntry indexEntry = entry.indexEntry;
+        uint32_t checksum = 0;
+        uint64_t length = 0;
+        ssize_t result;
+        while ((result = read(file, buffer, PINDiskCacheSnapshotBufferSize)) != 0) {
+            if (result < 0 && errno == EINTR) {
+                continue;
+            }
+            if (result < 0 || !PINDiskCacheWriteFully(archive, buffer, (size_t)result)) {
+                written = NO;
+                break;
+            }
+            checksum = PINCacheCRC32C(checksum, buffer, (size_t)result);
+            length += (uint64_t)result;
+        }
+        close(file);
+
+        NSData *keyData = [entry.key dataUsingEncoding:NSUTF8StringEncoding];
+        indexEntry.length = length;
+        indexEntry.checksum = checksum;
+        indexEntry.keyLength = (uint32_t)keyData.length;
+        [index appendBytes:&indexEntry length:sizeof(indexEntry)];
+        [index appendData:keyData];
+        offset += length;
+        header.entryCount++;
+    }
+
+    header.indexOffset = offset;
+    header.indexLength = index.length;
+    written = written
+        && PINDiskCacheWriteFully(archive, index.bytes, index.length)
+        && pwrite(archive, &header, sizeof(header), 0) == (ssize_t)sizeof(header);
+    if (!written) {
+        *outError = PINDiskCacheSnapshotError(PINDiskCacheErrorWriteFailure, errno);
+    }
+
+    free(buffer);
+    close(archive);
+
+    if (written && rename(PINDiskCacheFileSystemRepresentation(temporaryURL), PINDiskCacheFileSystemRepresentation(archiveURL)) != 0) {
+        *outError = PINDiskCacheSnapshotError(PINDiskCacheErrorWriteFailure, errno);
+        written = NO;
+    }
+    if (!written) {
+        unlink(PINDiskCacheFileSystemRepresentation(temporaryURL));
+    }
+    return written;
+}
+
+- (BOOL)importSnapshotFromURL:(NSURL *)archiveURL error:(NSError **)error
+{
+    return [self importSnapshotFromURL:archiveURL hottestObjectCount:0 hottestObjectBlock:nil error:error];
+}
+
+- (BOOL)importSnapshotFromURL:(NSURL *)archiveURL
+           hottestObjectCount:(NSUInteger)hottestObjectCount
+           hottestObjectBlock:(PINDiskCacheObjectBlock)hottestObjectBlock
+                        error:(NSError **)outError
+{
+    NSError *error = nil;
+    int archive = open(PINDiskCacheFileSystemRepresentation(archiveURL), O_RDONLY | O_CLOEXEC);
+    if (archive < 0) {
+        if (outError) {
+            *outError = PINDiskCacheSnapshotError(PINDiskCacheErrorReadFailure, errno);
+        }
+        return NO;
+    }
+#ifdef F_RDAHEAD
+    fcntl(archive, F_RDAHEAD, 1);
+#endif
+
+    NSArray<PINDiskCacheSnapshotEntry *> *entries = [self readSnapshotIndexFromArchive:archive error:&error];
+    if (entries == nil) {
+        close(archive);
+        if (outError) {
+            *outError = error;
+        }
+        return NO;
+    }
+
+    // Imported files are staged inside the cache directory so that moving them into place is a rename.
+    [self lockForWriting];
+        NSURL *cacheURL = _cacheURL;
+    [self unlock];
+
+    NSDataWritingOptions writeOptions = 0;
+#if TARGET_OS_IPHONE
+    if (self.writingProtectionOptionSet) {
+        writeOptions |= self.writingProtectionOption;
+    }
+#endif
+
+    NSFileManager *fileManager = [NSFileManager defaultManager];
+    off_t offset = sizeof(PINDiskCacheSnapshotHeader);
+    NSUInteger entryIndex = 0;
+    for (PINDiskCacheSnapshotEntry *entry in entries) {
+        @autoreleasepool {
+            PINDiskCacheSnapshotIndexEntry indexEntry = entry.indexEntry;
+            NSMutableData *data = [[NSMutableData alloc] initWithLength:(NSUInteger)indexEntry.length];
+            if (data == nil || !PINDiskCacheReadFully(archive, data.mutableBytes, data.length, offset)) {
+                error = PINDiskCacheSnapshotError(PINDiskCacheErrorReadFailure, errno);
+                break;
+            }
+            offset += (off_t)indexEntry.length;
+            if (PINCacheCRC32C(0, data.bytes, data.length) != indexEntry.checksum) {
+                error = PINDiskCacheSnapshotError(PINDiskCacheErrorInvalidSnapshot, 0);
+                break;
+            }
+
+            NSURL *stagedFileURL = [cacheURL URLByAppendingPathComponent:[PINDiskCacheImportFilePrefix stringByAppendingString:[[NSUUID UUID] UUIDString]] isDirectory:NO];
+            if (![data writeToURL:stagedFileURL options:writeOptions error:&error]) {
+                break;
+            }
+            [self restoreSnapshotAttributes:indexEntry toFileAtURL:stagedFileURL];
+            [self moveSnapshotFileAtURL:stagedFileURL intoPlaceForKey:entry.key indexEntry:indexEntry];
+
+            if (entryIndex < hottestObjectCount && hottestObjectBlock) {
+                BOOL corrupt = NO;
+                NSData *payload = PINDiskCachePayloadFromData(data, &corrupt);
+                id <NSCoding> object = nil;
+                if (payload) {
+                    @try {
+                        object = _deserializer(payload, entry.key);
+                    }
+                    @catch (NSException *exception) {
+                        PINDiskCacheException(exception);
+                    }
+                }
+                if (object) {
+                    hottestObjectBlock(self, entry.key, object);
+                }
+            }
+            entryIndex++;
+        }
+    }
+    close(archive);
+
+    [self lock];
+        if (self->_byteLimit > 0 && self->_byteCount > self->_byteLimit)
+            [self trimToSizeByEvictionStrategyAsync:self->_byteLimit completion:nil];
+    [self unlock];
+
+    if (error) {
+        PINDiskCacheError(error);
+        if (outError) {
+            *outError = error;
+        }
+        return NO;
+    }
+    return YES;
+}
+
+- (NSArray<PINDiskCacheSnapshotEntry *> *)readSnapshotIndexFromArchive:(int)archive error:(NSError **)outError
+{
+    struct stat archiveStat;
+    PINDiskCacheSnapshotHeader header;
+    if (fstat(archive, &archiveStat) != 0 || !PINDiskCacheReadFully(archive, &header, sizeof(header), 0)) {
+        *outError = PINDiskCacheSnapshotError(PINDiskCacheErrorReadFailure, errno);
+        return nil;
+    }
+    uint64_t archiveLength = 0;
+    if (header.magic != PINDiskCacheSnapshotMagic
+        || header.version != PINDiskCacheSnapshotVersion
+        || header.indexOffset < sizeof(header)
+        || __builtin_add_overflow(header.indexOffset, header.indexLength, &archiveLength)
+        || archiveLength != (uint64_t)archiveStat.st_size) {
+        *outError = PINDiskCacheSnapshotError(PINDiskCacheErrorInvalidSnapshot, 0);
+        return nil;
+    }
+
+    NSMutableData *index = [[NSMutableData alloc] initWithLength:(NSUInteger)header.indexLength];
+    if (index == nil || !PINDiskCacheReadFully(archive, index.mutableBytes, index.length, (off_t)header.indexOffset)) {
+        *outError = PINDiskCacheSnapshotError(PINDiskCacheErrorReadFailure, errno);
+        return nil;
+    }
+
+    // The count is only checked against the index once it's read, so it can't size the array on its own.
+    uint64_t capacity = MIN(header.entryCount, header.indexLength / sizeof(PINDiskCacheSnapshotIndexEntry));
+    NSMutableArray<PINDiskCacheSnapshotEntry *> *entries = [[NSMutableArray alloc] initWithCapacity:(NSUInteger)capacity];
+    const uint8_t *cursor = index.bytes;
+    const uint8_t *end = cursor + index.length;
+    // Starts at the header, so that it ends at the index offset.
+    uint64_t dataEnd = sizeof(header);
+    BOOL overflowed = NO;
+    while (cursor < end) {
+        PINDiskCacheSnapshotIndexEntry indexEntry;
+        if ((size_t)(end - cursor) < sizeof(indexEntry)) {
+            break;
+        }
+        memcpy(&indexEntry, cursor, sizeof(indexEntry));
+        cursor += sizeof(indexEntry);
+        if ((size_t)(end - cursor) < indexEntry.keyLength) {
+            break;
+        }
+
+        NSString *key = [[NSString alloc] initWithBytes:cursor length:indexEntry.keyLength encoding:NSUTF8StringEncoding];
+        cursor += indexEntry.keyLength;
+        if (key == nil) {
+            break;
+        }
+
+        PINDiskCacheSnapshotEntry *entry = [[PINDiskCacheSnapshotEntry alloc] init];
+        entry.key = key;
+        entry.indexEntry = indexEntry;
+        [entries addObject:entry];
+        // A crafted index could make the lengths wrap around to add up to the offset.
+        if (__builtin_add_overflow(dataEnd, indexEntry.length, &dataEnd)) {
+            overflowed = YES;
+            break;
+        }
+    }
+
+    if (overflowed || cursor != end || entries.count != header.entryCount || dataEnd != header.indexOffset) {
+        *outError = PINDiskCacheSnapshotError(PINDiskCacheErrorInvalidSnapshot, 0);
+        return nil;
+    }
+    return entries;
+}
+
+- (void)restoreSnapshotAttributes:(PINDiskCacheSnapshotIndexEntry)indexEntry toFileAtURL:(NSURL *)fileURL
+{
+    NSMutableDictionary<NSFileAttributeKey, id> *attributes = [[NSMutableDictionary alloc] init];
+    if (indexEntry.createdDate != 0) {
+        attributes[NSFileCreationDate] = [NSDate dateWithTimeIntervalSinceReferenceDate:indexEntry.createdDate];
+    }
+    if (indexEntry.lastModifiedDate != 0) {
+        attributes[NSFileModificationDate] = [NSDate dateWithTimeIntervalSinceReferenceDate:indexEntry.lastModifiedDate];
+    }
+    NSError *error = nil;
+    [[NSFileManager defaultManager] setAttributes:attributes ofItemAtPath:[fileURL path] error:&error];
+    PINDiskCacheError(error);
+
+    NSTimeInterval ageLimit = indexEntry.ageLimit;
+    if (ageLimit > 0.0) {
+        setxattr(PINDiskCacheFileSystemRepresentation(fileURL), PINDiskCacheAgeLimitAttributeName, &ageLimit, sizeof(NSTimeInterval), 0, 0);
+    }
+    NSInteger accessCount = (NSInteger)indexEntry.accessCount;
+    if (accessCount > 0) {
+        setxattr(PINDiskCacheFileSystemRepresentation(fileURL), PINDiskCacheAccessCountAttributeName, &accessCount, sizeof(NSInteger), 0, 0);
+    }
+}
+
+- (void)moveSnapshotFileAtURL:(NSURL *)stagedFileURL intoPlaceForKey:(NSString *)key indexEntry:(PINDiskCacheSnapshotIndexEntry)indexEntry
+{
+    NSDate *now = [NSDate date];
+    NSDate *createdDate = indexEntry.createdDate != 0 ? [NSDate dateWithTimeIntervalSinceReferenceDate:indexEntry.createdDate] : now;
+    NSDate *lastModifiedDate = indexEntry.lastModifiedDate != 0 ? [NSDate dateWithTimeIntervalSinceReferenceDate:indexEntry.lastModifiedDate] : now;
+
+    [self lockForWriting];
+        [self _locked_keyFilterWillChange];
+        [self _locked_beginSharedIndexWrite];
+        [self _locked_moveFileAtURL:stagedFileURL
+                    intoPlaceForKey:key
+                        createdDate:createdDate
+                   lastModifiedDate:lastModifiedDate
+                           ageLimit:indexEntry.ageLimit
+                        accessCount:(NSInteger)indexEntry.accessCount];
+        [self _locked_endSharedIndexWrite];
+    [self unlock];
+}
+
+/**
+ * Renames a file staged inside the cache directory over the file for key and updates the metadata to match. The caller
+ * must have called _locked_keyFilterWillChange and _locked_beginSharedIndexWrite. The staged file is removed on failure.
+ */
+- (BOOL)_locked_moveFileAtURL:(NSURL *)stagedFileURL
+              intoPlaceForKey:(NSString *)key
+                  createdDate:(NSDate *)createdDate
+             lastModifiedDate:(NSDate *)lastModifiedDate
+                     ageLimit:(NSTimeInterval)ageLimit
+                  accessCount:(NSInteger)accessCount
+{
+    NSURL *fileURL = [self encodedFileURLForKey:key];
+
+    BOOL keyIsNew = _metadata[key] == nil;
+    if (keyIsNew && _keyFilterCoversDisk && !_diskStateKnown) {
+        keyIsNew = ![[NSFileManager defaultManager] fileExistsAtPath:[fileURL path]];
+    }
+
+    NSNumber *prevDiskFileSize = _sharedIndexHeader ? [self _locked_allocatedSizeOfFileAtURL:fileURL] : _metadata[key].size;
+
+    if (rename(PINDiskCacheFileSystemRepresentation(stagedFileURL), PINDiskCacheFileSystemRepresentation(fileURL)) != 0) {
+        NSDictionary<NSErrorUserInfoKey, id> *userInfo = @{ PINDiskCacheErrorWriteFailureCodeKey : @(errno)};
+        NSError *error = [NSError errorWithDomain:PINDiskCacheErrorDomain code:PINDiskCacheErrorWriteFailure userInfo:userInfo];
+        PINDiskCacheError(error);
+        unlink(PINDiskCacheFileSystemRepresentation(stagedFileURL));
+        return NO;
+    }
+
+    if (_metadata[key] == nil) {
+        _metadata[key] = [[PINDiskCacheMetadata alloc] init];
+    }
+    if (keyIsNew) {
+        [_keyFilter addKey:key];
+    }
+
+    PINDiskCacheMetadata *metadata = _metadata[key];
+    NSNumber *diskFileSize = [self _locked_allocatedSizeOfFileAtURL:fileURL];
+    if (prevDiskFileSize) {
+        self.byteCount = _byteCount - [prevDiskFileSize unsignedIntegerValue];
+    }
+    if (diskFileSize) {
+        self.byteCount = _byteCount + [diskFileSize unsignedIntegerValue]; // atomic
+    }
+    metadata.size = diskFileSize;
+    metadata.createdDate = createdDate;
+    metadata.lastModifiedDate = lastModifiedDate;
+    metadata.ageLimit = ageLimit;
+    metadata.accessCount = accessCount;
+    // The file that was there, and its tags, have been replaced.
+    [self _locked_setTags:nil forKey:key];
+    [self _locked_noteSharedIndexChangeForKey:key];
+    return YES;
+}
+
 #pragma mark - Public Thread Safe Accessors -
 
 - (PINDiskCacheObjectBlock)willAddObjectBlock
@@ -1660,6 +3866,129 @@ static NSURL *_sharedTrashURL;
     } withPriority:PINOperationQueuePriorityHigh];
 }
 
+- (NSUInteger)byteCount
+{
+    // Read without the lock, which is safe because the mapping outlives sharing being turned off.
+    PINDiskCacheSharedIndexHeader *header = _sharedIndexHeader;
+    if (header != NULL) {
+        return (NSUInteger)atomic_load_explicit(&header->byteCount, memory_order_relaxed);
+    }
+    return _byteCount;
+}
+
+- (void)setByteCount:(NSUInteger)byteCount
+{
+    // Only called with the lock held, the shared index is updated when the write ends.
+    _byteCount = byteCount;
+}
+
+- (BOOL)sharedAcrossProcesses
+{
+    BOOL sharedAcrossProcesses;
+
+    [self lock];
+        sharedAcrossProcesses = _sharedIndexHeader != NULL;
+    [self unlock];
+
+    return sharedAcrossProcesses;
+}
+
+- (void)setSharedAcrossProcesses:(BOOL)sharedAcrossProcesses
+{
+    // Applied synchronously so that no write goes out unaccounted for once this returns.
+    [self lockForWriting];
+        if (sharedAcrossProcesses) {
+            if (_sharedIndexHeader == NULL && [self _locked_openSharedIndex]) {
+                [self _locked_synchronizeSharedIndex];
+            }
+        } else {
+            [self _locked_closeSharedIndex];
+        }
+    [self unlock];
+}
+
+- (BOOL)checksumsEnabled
+{
+    BOOL checksumsEnabled;
+
+    [self lock];
+        checksumsEnabled = _checksumsEnabled;
+    [self unlock];
+
+    return checksumsEnabled;
+}
+
+- (void)setChecksumsEnabled:(BOOL)checksumsEnabled
+{
+    // Applied synchronously so that every write made after this returns is covered.
+    [self lock];
+        _checksumsEnabled = checksumsEnabled;
+    [self unlock];
+}
+
+- (BOOL)statisticsEnabled
+{
+    return _statisticsRecorder.enabled;
+}
+
+- (void)setStatisticsEnabled:(BOOL)statisticsEnabled
+{
+    _statisticsRecorder.enabled = statisticsEnabled;
+}
+
+- (PINCacheStatistics *)statistics
+{
+    return [_statisticsRecorder snapshot];
+}
+
+- (void)resetStatistics
+{
+    [_statisticsRecorder reset];
+}
+
+- (id<PINCacheTraceSink>)traceSink
+{
+    id<PINCacheTraceSink> traceSink;
+
+    [self lock];
+        traceSink = _traceSink;
+    [self unlock];
+
+    return traceSink;
+}
+
+- (void)setTraceSink:(id<PINCacheTraceSink>)traceSink
+{
+    [self lock];
+        _traceSink = traceSink;
+        atomic_store_explicit(&_tracing, traceSink != nil, memory_order_relaxed);
+    [self unlock];
+}
+
+- (NSUInteger)scrubBytesPerSecond
+{
+    NSUInteger scrubBytesPerSecond;
+
+    [self lock];
+        scrubBytesPerSecond = _scrubBytesPerSecond;
+    [self unlock];
+
+    return scrubBytesPerSecond;
+}
+
+- (void)setScrubBytesPerSecond:(NSUInteger)scrubBytesPerSecond
+{
+    [self.operationQueue scheduleOperation:^{
+        [self lock];
+            self->_scrubBytesPerSecond = scrubBytesPerSecond;
+        [self unlock];
+
+        [self.maintenanceQueue scheduleOperation:^{
+            [self scrubRecursively];
+        } withPriority:PINOperationQueuePriorityLow];
+    } withPriority:PINOperationQueuePriorityHigh];
+}
+
 - (NSTimeInterval)ageLimit
 {
     NSTimeInterval ageLimit;
@@ -1678,12 +4007,23 @@ static NSURL *_sharedTrashURL;
             self->_ageLimit = ageLimit;
         [self unlock];
         
-        [self.operationQueue scheduleOperation:^{
+        [self.maintenanceQueue scheduleOperation:^{
             [self trimToAgeLimitRecursively];
         } withPriority:PINOperationQueuePriorityLow];
     } withPriority:PINOperationQueuePriorityHigh];
 }
 
+- (PINDiskCacheSerializerBlock)serializer
+{
+    // Set once in init.
+    return _serializer;
+}
+
+- (PINDiskCacheDeserializerBlock)deserializer
+{
+    return _deserializer;
+}
+
 - (BOOL)isTTLCache
 {
     BOOL isTTLCache;
@@ -1726,7 +4066,9 @@ static NSURL *_sharedTrashURL;
     
     // Lock if the disk isn't writable.
     if (_diskWritable == NO) {
+        uint64_t waitStartTime = PINDiskCacheTracePhaseBegin(&_tracing);
         pthread_cond_wait(&_diskWritableCondition, &_mutex);
+        PINCacheTracePhaseEnd(PINCacheTracePhaseDiskWritableWait, waitStartTime);
     }
 }
 
@@ -1742,8 +4084,10 @@ static NSURL *_sharedTrashURL;
 
 - (void)lock
 {
+    uint64_t waitStartTime = PINDiskCacheTracePhaseBegin(&_tracing);
     __unused int result = pthread_mutex_lock(&_mutex);
     NSAssert(result == 0, @"Failed to lock PINDiskCache %@. Code: %d", self, result);
+    PINCacheTracePhaseEnd(PINCacheTracePhaseLockWait, waitStartTime);
 }
 
 - (void)unlock
@@ -1856,3 +4200,6 @@ static NSURL *_sharedTrashURL;
 
 @implementation PINDiskCacheMetadata
 @end
+
+@implementation PINDiskCacheSnapshotEntry
+@end
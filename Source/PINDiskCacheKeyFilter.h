@@ -0,0 +1,53 @@
+//
+//  PINDiskCacheKeyFilter.h
+//  PINCache
+//
+//  Copyright © 2017 Pinterest. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ A counting Bloom filter of the keys stored by a <PINDiskCache>, used to answer definite misses without touching the
+ file system. Every key bumps a handful of 4-bit counters so keys can be removed again. A counter that saturates is
+ never decremented, which can only ever cost a false positive, never a false negative.
+ 
+ Not thread safe, <PINDiskCache> only uses it with its lock held.
+ */
+@interface PINDiskCacheKeyFilter : NSObject
+
+- (instancetype)init NS_UNAVAILABLE;
+
+/**
+ @param capacity The number of keys the filter is sized for. It keeps working past that, with more false positives.
+ */
+- (instancetype)initWithCapacity:(NSUInteger)capacity;
+
+/**
+ Loads a filter written by <writeToURL:error:>.
+ 
+ @result The filter, or nil if the file is missing, unreadable or was marked dirty by <markDirtyAtURL:>.
+ */
++ (nullable instancetype)filterWithContentsOfURL:(NSURL *)url;
+
+/**
+ Marks the filter at `url` as no longer matching the cache, so it won't be loaded if the process dies before it's
+ written again. Succeeds if there's no file.
+ */
++ (BOOL)markDirtyAtURL:(NSURL *)url;
+
+@property (readonly) NSUInteger capacity;
+@property (readonly) NSUInteger count;
+
+- (void)addKey:(NSString *)key;
+- (void)removeKey:(NSString *)key;
+- (BOOL)mightContainKey:(NSString *)key;
+- (void)removeAllKeys;
+
+- (BOOL)writeToURL:(NSURL *)url error:(NSError **)error;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,216 @@
+//
+//  PINDiskCacheKeyFilter.m
+//  PINCache
+//
+//  Copyright © 2017 Pinterest. All rights reserved.
+//
+
+#import "PINDiskCacheKeyFilter.h"
+
+#import <fcntl.h>
+#import <stddef.h>
+#import <string.h>
+#import <unistd.h>
+
+static const uint32_t PINDiskCacheKeyFilterMagic = 0x4B4E4950; // 'PINK'
+static const uint8_t PINDiskCacheKeyFilterVersion = 1;
+#define PINDiskCacheKeyFilterHashCount 6
+// Counters per key at capacity, about a 2% false positive rate with six hashes.
+static const NSUInteger PINDiskCacheKeyFilterCountersPerKey = 8;
+static const uint8_t PINDiskCacheKeyFilterCounterMax = 0xF;
+
+typedef struct {
+    uint32_t magic;
+    uint8_t version;
+    uint8_t clean;
+    uint8_t hashCount;
+    uint8_t reserved;
+    uint64_t counterCount;
+    uint64_t count;
+} PINDiskCacheKeyFilterHeader;
+
+// FNV-1a over the UTF-8 bytes, stable across launches unlike -[NSString hash].
+static uint64_t PINDiskCacheKeyFilterHash(NSString *key)
+{
+    const char *bytes = key.UTF8String;
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    for (; bytes != NULL && *bytes != '\0'; bytes++) {
+        hash ^= (uint8_t)*bytes;
+        hash *= 0x100000001B3ULL;
+    }
+    return hash;
+}
+
+// Double hashing, derives every probe from the two halves of one 64-bit hash.
+static void PINDiskCacheKeyFilterIndexes(NSString *key, uint64_t counterCount, uint64_t indexes[PINDiskCacheKeyFilterHashCount])
+{
+    uint64_t hash = PINDiskCacheKeyFilterHash(key);
+    uint64_t first = (uint32_t)hash;
+    uint64_t second = (uint32_t)(hash >> 32) | 1;
+    for (uint64_t probe = 0; probe < PINDiskCacheKeyFilterHashCount; probe++) {
+        indexes[probe] = (first + probe * second) & (counterCount - 1);
+    }
+}
+
+static inline uint8_t PINDiskCacheKeyFilterCounter(const uint8_t *counters, uint64_t index)
+{
+    uint8_t byte = counters[index / 2];
+    return (index & 1) ? byte >> 4 : byte & 0xF;
+}
+
+static inline void PINDiskCacheKeyFilterSetCounter(uint8_t *counters, uint64_t index, uint8_t counter)
+{
+    uint8_t *byte = &counters[index / 2];
+    *byte = (index & 1) ? (uint8_t)((*byte & 0x0F) | (counter << 4)) : (uint8_t)((*byte & 0xF0) | counter);
+}
+
+@interface PINDiskCacheKeyFilter ()
+- (instancetype)initWithCounterCount:(uint64_t)counterCount counters:(nullable const uint8_t *)counters count:(NSUInteger)count NS_DESIGNATED_INITIALIZER;
+@end
+
+@implementation PINDiskCacheKeyFilter {
+    uint8_t *_counters;
+    uint64_t _counterCount;
+    NSUInteger _count;
+}
+
+- (instancetype)initWithCapacity:(NSUInteger)capacity
+{
+    return [self initWithCounterCount:PINDiskCacheKeyFilterCountersPerKey * MAX(capacity, (NSUInteger)1) counters:NULL count:0];
+}
+
+- (instancetype)initWithCounterCount:(uint64_t)counterCount counters:(const uint8_t *)counters count:(NSUInteger)count
+{
+    if (self = [super init]) {
+        // A power of two, so probes can mask instead of divide.
+        _counterCount = 16;
+        while (_counterCount < counterCount) {
+            _counterCount <<= 1;
+        }
+        _counters = calloc((size_t)(_counterCount / 2), 1);
+        if (_counters == NULL) {
+            return nil;
+        }
+        if (counters) {
+            memcpy(_counters, counters, (size_t)(_counterCount / 2));
+        }
+        _count = count;
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    free(_counters);
+}
+
++ (instancetype)filterWithContentsOfURL:(NSURL *)url
+{
+    NSData *data = [NSData dataWithContentsOfURL:url options:NSDataReadingUncached error:NULL];
+    if (data.length < sizeof(PINDiskCacheKeyFilterHeader)) {
+        return nil;
+    }
+
+    PINDiskCacheKeyFilterHeader header;
+    memcpy(&header, data.bytes, sizeof(header));
+    if (header.magic != PINDiskCacheKeyFilterMagic
+        || header.version != PINDiskCacheKeyFilterVersion
+        || header.clean == 0
+        || header.hashCount != PINDiskCacheKeyFilterHashCount
+        || header.counterCount < 16
+        || (header.counterCount & (header.counterCount - 1)) != 0
+        || data.length != sizeof(header) + header.counterCount / 2) {
+        return nil;
+    }
+
+    const uint8_t *counters = (const uint8_t *)data.bytes + sizeof(header);
+    return [[self alloc] initWithCounterCount:header.counterCount counters:counters count:(NSUInteger)header.count];
+}
+
++ (BOOL)markDirtyAtURL:(NSURL *)url
+{
+    int fileDescriptor = open(url.fileSystemRepresentation, O_WRONLY | O_CLOEXEC);
+    if (fileDescriptor < 0) {
+        return errno == ENOENT;
+    }
+    uint8_t clean = 0;
+    BOOL marked = pwrite(fileDescriptor, &clean, sizeof(clean), offsetof(PINDiskCacheKeyFilterHeader, clean)) == sizeof(clean);
+    close(fileDescriptor);
+    return marked;
+}
+
+- (NSUInteger)capacity
+{
+    return (NSUInteger)(_counterCount / PINDiskCacheKeyFilterCountersPerKey);
+}
+
+- (NSUInteger)count
+{
+    return _count;
+}
+
+- (void)addKey:(NSString *)key
+{
+    uint64_t indexes[PINDiskCacheKeyFilterHashCount];
+    PINDiskCacheKeyFilterIndexes(key, _counterCount, indexes);
+    for (NSUInteger probe = 0; probe < PINDiskCacheKeyFilterHashCount; probe++) {
+        uint8_t counter = PINDiskCacheKeyFilterCounter(_counters, indexes[probe]);
+        if (counter < PINDiskCacheKeyFilterCounterMax) {
+            PINDiskCacheKeyFilterSetCounter(_counters, indexes[probe], counter + 1);
+        }
+    }
+    _count++;
+}
+
+- (void)removeKey:(NSString *)key
+{
+    uint64_t indexes[PINDiskCacheKeyFilterHashCount];
+    PINDiskCacheKeyFilterIndexes(key, _counterCount, indexes);
+    for (NSUInteger probe = 0; probe < PINDiskCacheKeyFilterHashCount; probe++) {
+        uint8_t counter = PINDiskCacheKeyFilterCounter(_counters, indexes[probe]);
+        // Saturated counters have lost track of how many keys they hold and must stay put.
+        if (counter > 0 && counter < PINDiskCacheKeyFilterCounterMax) {
+            PINDiskCacheKeyFilterSetCounter(_counters, indexes[probe], counter - 1);
+        }
+    }
+    if (_count > 0) {
+        _count--;
+    }
+}
+
+- (BOOL)mightContainKey:(NSString *)key
+{
+    uint64_t indexes[PINDiskCacheKeyFilterHashCount];
+    PINDiskCacheKeyFilterIndexes(key, _counterCount, indexes);
+    for (NSUInteger probe = 0; probe < PINDiskCacheKeyFilterHashCount; probe++) {
+        if (PINDiskCacheKeyFilterCounter(_counters, indexes[probe]) == 0) {
+            return NO;
+        }
+    }
+    return YES;
+}
+
+- (void)removeAllKeys
+{
+    memset(_counters, 0, (size_t)(_counterCount / 2));
+    _count = 0;
+}
+
+- (BOOL)writeToURL:(NSURL *)url error:(NSError **)error
+{
+    PINDiskCacheKeyFilterHeader header = {
+        .magic = PINDiskCacheKeyFilterMagic,
+        .version = PINDiskCacheKeyFilterVersion,
+        .clean = 1,
+        .hashCount = PINDiskCacheKeyFilterHashCount,
+        .reserved = 0,
+        .counterCount = _counterCount,
+        .count = _count,
+    };
+    NSMutableData *data = [[NSMutableData alloc] initWithCapacity:sizeof(header) + (NSUInteger)(_counterCount / 2)];
+    [data appendBytes:&header length:sizeof(header)];
+    [data appendBytes:_counters length:(NSUInteger)(_counterCount / 2)];
+    return [data writeToURL:url options:NSDataWritingAtomic error:error];
+}
+
+@end
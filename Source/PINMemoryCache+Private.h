@@ -0,0 +1,51 @@
+//
+//  PINMemoryCache+Private.h
+//  PINCache
+//
+//  Copyright © 2017 Pinterest. All rights reserved.
+//
+
+#import "PINMemoryCache.h"
+#import "PINCacheWorkStealingQueue.h"
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ A callback block for objects a <PINMemoryCache> evicted to stay within a cost, called after each one is removed.
+
+ @param cache The cache that evicted the object.
+ @param key The key of the evicted object.
+ @param object The evicted object.
+ @param createdTime When the object was added to the cache, in seconds since the reference date.
+ */
+typedef void (^PINMemoryCacheEvictionBlock)(PINMemoryCache *cache, NSString *key, id object, CFAbsoluteTime createdTime);
+
+@interface PINMemoryCache ()
+
+/**
+ Where the asynchronous methods run. The operation queue the cache was created with, unless replaced before the cache
+ is first used, as <PINCache> does with a <PINCacheWorkStealingQueue>.
+ */
+@property (strong, nonatomic) id <PINCacheOperationScheduling> operationQueue;
+
+/**
+ Adds a block to call for every object removed by <trimToCost:> or <trimToCostByEvictionStrategy:>, including the trims
+ that keep the cache under its <costLimit>, but not for explicit removals or expiry. Kept apart from the public remove
+ blocks so that <PINCache> and <PINTieredCache> can follow evictions while users still own those. Blocks are called in
+ the order they were added.
+
+ @param observer The block to call.
+ @result An object to pass to <removeEvictionObserver:> to stop calling the block.
+ */
+- (id)addEvictionObserver:(PINMemoryCacheEvictionBlock)observer;
+
+/**
+ Stops calling a block added with <addEvictionObserver:>.
+
+ @param observer What <addEvictionObserver:> returned for the block.
+ */
+- (void)removeEvictionObserver:(id)observer;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -5,14 +5,29 @@
 #import <Foundation/Foundation.h>
 
 #import <PINCache/PINCacheMacros.h>
+#import <PINCache/PINCacheCancellationToken.h>
 #import <PINCache/PINCaching.h>
 #import <PINCache/PINCacheObjectSubscripting.h>
+#import <PINCache/PINCacheStatistics.h>
 
 NS_ASSUME_NONNULL_BEGIN
 
 @class PINMemoryCache;
 @class PINOperationQueue;
 
+/**
+ Objects can adopt this protocol to tell a <PINMemoryCache> with <automaticallyEstimatesCost> enabled how much memory
+ they take up, instead of having it guessed.
+ */
+@protocol PINMemoryCacheCostReporting <NSObject>
+
+/**
+ The approximate number of bytes this object keeps alive, including anything it exclusively owns.
+ */
+- (NSUInteger)memoryCacheCost;
+
+@end
+
 
 /**
  `PINMemoryCache` is a fast, thread safe key/value store similar to `NSCache`. On iOS it will clear itself
@@ -47,6 +62,14 @@ PIN_SUBCLASSING_RESTRICTED
  */
 @property (assign) NSUInteger costLimit;
 
+/**
+ When `YES`, objects added with a cost of `0` (including through the methods that don't take a cost) are given an
+ estimate of the bytes they use instead, so that <costLimit> works as a memory budget. Objects adopting
+ <PINMemoryCacheCostReporting> report their own cost; `NSData`, `NSString` and arrays, dictionaries and sets of them are
+ estimated from their contents; anything else counts as its instance size. Defaults to `NO`.
+ */
+@property (assign) BOOL automaticallyEstimatesCost;
+
 /**
  The maximum number of seconds an object is allowed to exist in the cache. Setting this to a value
  greater than `0.0` will start a recurring GCD timer with the same period that calls <trimToDate:>.
@@ -67,6 +90,12 @@ PIN_SUBCLASSING_RESTRICTED
  */
 @property (nonatomic, readonly, getter=isTTLCache) BOOL ttlCache;
 
+/**
+ The number of independently locked shards the cache's keys are spread across. See
+ <initWithName:operationQueue:ttlCache:evictionStrategy:shardCount:>.
+ */
+@property (readonly) NSUInteger shardCount;
+
 /**
  The eviction strategy when trimming the cache.
  */
@@ -157,7 +186,23 @@ PIN_SUBCLASSING_RESTRICTED
 
 - (instancetype)initWithName:(NSString *)name operationQueue:(PINOperationQueue *)operationQueue ttlCache:(BOOL)ttlCache;
 
-- (instancetype)initWithName:(NSString *)name operationQueue:(PINOperationQueue *)operationQueue ttlCache:(BOOL)ttlCache evictionStrategy:(PINCacheEvictionStrategy)evictionStrategy NS_DESIGNATED_INITIALIZER;
+- (instancetype)initWithName:(NSString *)name operationQueue:(PINOperationQueue *)operationQueue ttlCache:(BOOL)ttlCache evictionStrategy:(PINCacheEvictionStrategy)evictionStrategy;
+
+/**
+ Creates a cache whose keys are partitioned across several shards, each with its own lock, so that reads and writes
+ of keys in different shards don't contend with each other. This helps when many threads hit the cache at once.
+ 
+ The <costLimit> is enforced approximately: when the <totalCost> goes over the limit, each shard is trimmed to its
+ even share of it, so eviction order is only exact within a shard. Enumeration and <removeAllObjects> cover every shard.
+ 
+ @param name The name of the cache.
+ @param operationQueue The queue to run asynchronous operations on.
+ @param ttlCache Whether or not the cache should behave as a TTL cache.
+ @param evictionStrategy How the cache decides to evict objects when over cost.
+ @param shardCount The number of shards, rounded up to a power of two and capped at 64. `1` gives an unsharded cache.
+ @result A new cache with the specified name.
+ */
+- (instancetype)initWithName:(NSString *)name operationQueue:(PINOperationQueue *)operationQueue ttlCache:(BOOL)ttlCache evictionStrategy:(PINCacheEvictionStrategy)evictionStrategy shardCount:(NSUInteger)shardCount NS_DESIGNATED_INITIALIZER;
 
 #pragma mark - Asynchronous Methods
 /// @name Asynchronous Methods
@@ -191,6 +236,111 @@ PIN_SUBCLASSING_RESTRICTED
  */
 - (void)enumerateObjectsWithBlockAsync:(PINCacheObjectEnumerationBlock)block completionBlock:(nullable PINCacheBlock)completionBlock;
 
+/**
+ Retrieves several objects at once. This method returns immediately and executes the passed block once, with every
+ object found, potentially in parallel with other blocks on the <concurrentQueue>.
+ 
+ @see objectsForKeys:
+ @param keys The keys of the objects to retrieve.
+ @param block A block to be executed concurrently when the objects are available.
+ */
+- (void)objectsForKeysAsync:(NSArray<NSString *> *)keys completion:(PINCacheObjectsBlock)block;
+
+/**
+ Stores several objects at once. This method returns immediately and executes the passed block once every object
+ has been stored, potentially in parallel with other blocks on the <concurrentQueue>.
+ 
+ @see setObjects:forKeys:
+ @param objects The objects to store.
+ @param keys The keys to associate with the objects, in the same order. Must have the same count as objects.
+ @param block A block to be executed concurrently after the objects have been stored, or nil.
+ */
+- (void)setObjectsAsync:(NSArray *)objects forKeys:(NSArray<NSString *> *)keys completion:(nullable PINCacheBlock)block;
+
+/**
+ Stores an object with tags. This method returns immediately and executes the passed block after the object has been
+ stored, potentially in parallel with other blocks on the <concurrentQueue>.
+
+ @see setObject:forKey:withTags:
+ @param object An object to store in the cache.
+ @param key A key to associate with the object. This string will be copied.
+ @param tags The tags to give the object.
+ @param block A block to be executed concurrently after the object has been stored, or nil.
+ */
+- (void)setObjectAsync:(id)object forKey:(NSString *)key withTags:(NSSet<NSString *> *)tags completion:(nullable PINCacheObjectBlock)block;
+
+/**
+ Removes every object with a tag. This method returns immediately and executes the passed block after the objects
+ have been removed, potentially in parallel with other blocks on the <concurrentQueue>.
+
+ @see removeObjectsWithTag:
+ @param tag The tag of the objects to remove.
+ @param block A block to be executed concurrently after the objects have been removed, or nil.
+ */
+- (void)removeObjectsWithTagAsync:(NSString *)tag completion:(nullable PINCacheBlock)block;
+
+/**
+ Removes every object whose key starts with a prefix. This method returns immediately and executes the passed block
+ after the objects have been removed, potentially in parallel with other blocks on the <concurrentQueue>.
+
+ @see removeObjectsWithKeyPrefix:
+ @param prefix The prefix of the keys of the objects to remove.
+ @param block A block to be executed concurrently after the objects have been removed, or nil.
+ */
+- (void)removeObjectsWithKeyPrefixAsync:(NSString *)prefix completion:(nullable PINCacheBlock)block;
+
+/**
+ Retrieves the object for the specified key, unless called off first. This method returns immediately and executes
+ the passed block after the object is available, potentially in parallel with other blocks on the <concurrentQueue>.
+
+ @see PINCacheCancellationToken
+ @param key The key associated with the requested object.
+ @param deadline When the object stops being wanted, or nil.
+ @param block A block to be executed concurrently when the object is available.
+ @result A token to call the lookup off with.
+ */
+- (PINCacheCancellationToken *)objectForKeyAsync:(NSString *)key deadline:(nullable NSDate *)deadline completion:(PINCacheObjectBlock)block;
+
+/**
+ Stores an object, unless called off first. This method returns immediately and executes the passed block after the
+ object has been stored, potentially in parallel with other blocks on the <concurrentQueue>.
+
+ @see PINCacheCancellationToken
+ @param object An object to store in the cache.
+ @param key A key to associate with the object. This string will be copied.
+ @param cost An amount to add to the <totalCost>.
+ @param ageLimit The age limit (in seconds) to associate with the object, or 0 for the cache's own.
+ @param deadline When the set stops being wanted, or nil.
+ @param block A block to be executed concurrently after the object has been stored, or nil.
+ @result A token to call the set off with.
+ */
+- (PINCacheCancellationToken *)setObjectAsync:(id)object forKey:(NSString *)key withCost:(NSUInteger)cost ageLimit:(NSTimeInterval)ageLimit deadline:(nullable NSDate *)deadline completion:(nullable PINCacheObjectBlock)block;
+
+/**
+ Removes objects older than a date, unless called off first. This method returns immediately and executes the passed
+ block after the cache has been trimmed, potentially in parallel with other blocks on the <concurrentQueue>.
+
+ @see PINCacheCancellationToken
+ @param date Objects that haven't been accessed since this date are removed from the cache.
+ @param deadline When the trim stops being wanted, or nil.
+ @param block A block to be executed concurrently after the cache has been trimmed, or nil.
+ @result A token to call the trim off with.
+ */
+- (PINCacheCancellationToken *)trimToDateAsync:(NSDate *)date deadline:(nullable NSDate *)deadline completion:(nullable PINCacheBlock)block;
+
+/**
+ Removes objects by the <evictionStrategy> until the <totalCost> is below a value, unless called off first. This
+ method returns immediately and executes the passed block after the cache has been trimmed, potentially in parallel
+ with other blocks on the <concurrentQueue>.
+
+ @see PINCacheCancellationToken
+ @param cost The total accumulation allowed to remain after the cache has been trimmed.
+ @param deadline When the trim stops being wanted, or nil.
+ @param block A block to be executed concurrently after the cache has been trimmed, or nil.
+ @result A token to call the trim off with.
+ */
+- (PINCacheCancellationToken *)trimToCostByEvictionStrategyAsync:(NSUInteger)cost deadline:(nullable NSDate *)deadline completion:(nullable PINCacheBlock)block;
+
 #pragma mark - Synchronous Methods
 /// @name Synchronous Methods
 
@@ -212,6 +362,57 @@ PIN_SUBCLASSING_RESTRICTED
  */
 - (void)trimToCostByEvictionStrategy:(NSUInteger)cost;
 
+/**
+ Stores several objects in the cache at once, taking the lock once for the whole batch and trimming to the
+ <costLimit> once at the end. Objects are added with a cost of 0, or an estimate if <automaticallyEstimatesCost> is
+ enabled, and no object-level age limit. The event blocks are still executed once per object. This method blocks
+ the calling thread until the objects have been stored.
+ 
+ @param objects The objects to store.
+ @param keys The keys to associate with the objects, in the same order. Must have the same count as objects.
+ */
+- (void)setObjects:(NSArray *)objects forKeys:(NSArray<NSString *> *)keys;
+
+/**
+ Retrieves several objects at once, taking each shard's lock once for the whole batch. This method blocks the calling
+ thread until the objects are available.
+ 
+ @see objectsForKeysAsync:completion:
+ @param keys The keys of the objects to retrieve. Duplicates are looked up once.
+ @result The objects found, keyed by their keys. Keys that were not found are absent.
+ */
+- (NSDictionary<NSString *, id> *)objectsForKeys:(NSArray<NSString *> *)keys;
+
+/**
+ Stores an object with tags, which <removeObjectsWithTag:> can later remove it by. Setting the key again replaces its
+ tags along with its object. The object is added with a cost of 0, or an estimate if <automaticallyEstimatesCost> is
+ enabled. This method blocks the calling thread until the object has been stored.
+
+ @param object An object to store in the cache.
+ @param key A key to associate with the object. This string will be copied.
+ @param tags The tags to give the object.
+ */
+- (void)setObject:(id)object forKey:(NSString *)key withTags:(NSSet<NSString *> *)tags;
+
+/**
+ Removes every object with a tag. Matches are found through an index of the tags, and each shard's lock is taken
+ once for all of its matches. The event blocks are still executed once per object. This method blocks the calling
+ thread until the objects have been removed.
+
+ @param tag The tag of the objects to remove.
+ */
+- (void)removeObjectsWithTag:(NSString *)tag;
+
+/**
+ Removes every object whose key starts with a prefix, e.g. everything cached for one user. Matches are found by
+ going through the keys without touching the objects, and each shard's lock is taken once for all of its matches.
+ The event blocks are still executed once per object. This method blocks the calling thread until the objects have
+ been removed.
+
+ @param prefix The prefix of the keys of the objects to remove.
+ */
+- (void)removeObjectsWithKeyPrefix:(NSString *)prefix;
+
 /**
  Loops through all objects in the cache within a memory lock (reads and writes are suspended during the enumeration).
  This method blocks the calling thread until all objects have been enumerated.
@@ -226,6 +427,25 @@ PIN_SUBCLASSING_RESTRICTED
  */
 - (void)enumerateObjectsWithBlock:(PIN_NOESCAPE PINCacheObjectEnumerationBlock)block;
 
+#pragma mark - Statistics
+/// @name Statistics
+
+/**
+ Whether the cache counts what it does and measures how long it takes, see <statistics>. Recording is cheap but not
+ free, so it's off by default.
+ */
+@property (assign) BOOL statisticsEnabled;
+
+/**
+ A snapshot of what the memory cache has done since <statisticsEnabled> was turned on or <resetStatistics> was called.
+ */
+@property (readonly) PINCacheStatistics *statistics;
+
+/**
+ Zeroes <statistics>.
+ */
+- (void)resetStatistics;
+
 @end
 
 
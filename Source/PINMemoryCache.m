@@ -3,8 +3,13 @@
 //  Copyright (c) 2015 Pinterest. All rights reserved.
 
 #import "PINMemoryCache.h"
+#import "PINMemoryCache+Private.h"
+#import "PINCacheCancellationToken+Private.h"
+#import "PINCacheStatistics+Private.h"
 
+#import <objc/runtime.h>
 #import <pthread.h>
+#import <stdatomic.h>
 
 #import <PINOperation/PINOperation.h>
 
@@ -14,26 +19,148 @@
 
 static NSString * const PINMemoryCachePrefix = @"com.pinterest.PINMemoryCache";
 static NSString * const PINMemoryCacheSharedName = @"PINMemoryCacheSharedName";
+static const NSUInteger PINMemoryCacheMaxShardCount = 64;
+static const NSUInteger PINMemoryCacheReadBufferStripeCount = 8; // Must be a power of two.
+static const NSUInteger PINMemoryCacheReadBufferSize = 16; // Must be a power of two.
+
+// A lossy ring of entries that were read and still need their access bookkeeping done. Readers claim a slot with a
+// single compare-and-swap and give up if the ring is full or another reader won the race; the ring is drained under the
+// shard's write lock. Aligned so that stripes written by different threads don't share cache lines.
+typedef struct {
+    _Atomic(uint64_t) readCounter;
+    _Atomic(uint64_t) writeCounter;
+    _Atomic(void *) slots[PINMemoryCacheReadBufferSize];
+} __attribute__((aligned(64))) PINMemoryCacheReadBuffer;
+
+// The orders in which a shard can hand out entries to evict.
+typedef NS_ENUM(NSInteger, PINMemoryCacheEvictionOrder) {
+    PINMemoryCacheEvictionOrderLeastRecentlyUsed,
+    PINMemoryCacheEvictionOrderLeastFrequentlyUsed,
+    PINMemoryCacheEvictionOrderCostliest,
+};
+
+@class PINMemoryCacheFrequencyBucket;
+
+// Everything the cache knows about one object. Timestamps are plain numbers so that touching an entry on a hit
+// never allocates.
+@interface PINMemoryCacheEntry : NSObject
+@property (nonatomic, strong) id object;
+@property (nonatomic, strong) NSString *key;
+@property (nonatomic) NSUInteger cost;
+// When the object was added, in seconds since the reference date. Compared against age limits and trim dates.
+@property (nonatomic) CFAbsoluteTime createdTime;
+// Age limit is used in conjuction with ttl
+@property (nonatomic) NSTimeInterval ageLimit;
+// Access count is how many times this object has been fetched. Used with the LFU
+@property (nonatomic) NSInteger accessCount;
+// Tags the object was set with, or nil. Must only be changed through the shard, which indexes them.
+@property (nonatomic, copy) NSSet<NSString *> *tags;
+// Neighbours in the shard's LRU list, least recently used first. Entries are owned by the shard's dictionary.
+@property (nonatomic, unsafe_unretained) PINMemoryCacheEntry *lruPrev;
+@property (nonatomic, unsafe_unretained) PINMemoryCacheEntry *lruNext;
+// Neighbours in the frequency bucket for accessCount, least recently used first.
+@property (nonatomic, unsafe_unretained) PINMemoryCacheEntry *lfuPrev;
+@property (nonatomic, unsafe_unretained) PINMemoryCacheEntry *lfuNext;
+@property (nonatomic, unsafe_unretained) PINMemoryCacheFrequencyBucket *bucket;
+@end
+
+// The entries of a shard that have been accessed the same number of times. Buckets are linked in order of increasing
+// access count and only exist while they hold entries, so the least frequently used entry is always at hand.
+@interface PINMemoryCacheFrequencyBucket : NSObject
+@property (nonatomic) NSInteger accessCount;
+@property (nonatomic, unsafe_unretained) PINMemoryCacheEntry *head;
+@property (nonatomic, unsafe_unretained) PINMemoryCacheEntry *tail;
+@property (nonatomic, unsafe_unretained) PINMemoryCacheFrequencyBucket *prev;
+@property (nonatomic, unsafe_unretained) PINMemoryCacheFrequencyBucket *next;
+@end
+
+// A slice of the cache's entries behind its own lock, so that accesses to keys in different shards don't contend.
+// An unsharded cache has a single shard holding every entry.
+@interface PINMemoryCacheShard : NSObject
+// Must only be mutated through the _locked_ methods below, which keep the eviction lists in step.
+@property (nonatomic, strong, readonly) NSMutableDictionary<NSString *, PINMemoryCacheEntry *> *entries;
+@property (nonatomic) NSUInteger totalCost;
+// The keys of the entries with each tag. Must only be mutated through _locked_setTags:forEntry:.
+@property (nonatomic, strong, readonly) NSMutableDictionary<NSString *, NSMutableSet<NSString *> *> *tagIndex;
+// Takes the lock exclusively. Accesses recorded by readers are applied first, so the LRU/LFU state is current while held.
+- (void)lock;
+// Takes the lock shared with other readers. Entries must not be mutated while it is held.
+- (void)lockForReading;
+- (void)unlock;
+// Notes that an entry was read, to be applied the next time the lock is taken exclusively. May drop the record.
+- (void)recordAccessToEntry:(PINMemoryCacheEntry *)entry;
+// Adds a new entry as the most recently used, with an access count of one.
+- (void)_locked_addEntry:(PINMemoryCacheEntry *)entry forKey:(NSString *)key;
+// Makes an entry the most recently used and counts the access.
+- (void)_locked_touchEntry:(PINMemoryCacheEntry *)entry;
+// Removes an entry from the dictionary and the eviction lists. Its object is cleared so pending reads skip it.
+- (void)_locked_removeEntry:(PINMemoryCacheEntry *)entry;
+- (void)_locked_removeAllEntries;
+// Replaces an entry's tags, keeping the tag index in step.
+- (void)_locked_setTags:(NSSet<NSString *> *)tags forEntry:(PINMemoryCacheEntry *)entry;
+// Visits entries starting with the next one to evict. LRU and LFU orders cost nothing up front.
+- (void)_locked_enumerateEntriesInEvictionOrder:(PINMemoryCacheEvictionOrder)order usingBlock:(PIN_NOESCAPE void (^)(PINMemoryCacheEntry *entry, BOOL *stop))block;
+@end
+
+// How deep to look into nested collections when estimating cost. Anything deeper counts as a pointer.
+static const NSUInteger PINMemoryCacheMaxCostEstimationDepth = 8;
 
-@interface PINMemoryCache ()
+static NSUInteger PINMemoryCacheEstimatedCost(id object, NSUInteger depth)
+{
+    if ([object conformsToProtocol:@protocol(PINMemoryCacheCostReporting)]) {
+        return [(id<PINMemoryCacheCostReporting>)object memoryCacheCost];
+    }
+
+    NSUInteger cost = class_getInstanceSize([object class]);
+    if (depth >= PINMemoryCacheMaxCostEstimationDepth) {
+        return cost;
+    }
+
+    if ([object isKindOfClass:[NSData class]]) {
+        cost += [(NSData *)object length];
+    } else if ([object isKindOfClass:[NSString class]]) {
+        // Strings that fit in a byte per character are usually stored that way, the rest as UTF-16.
+        CFStringRef string = (__bridge CFStringRef)object;
+        CFIndex length = CFStringGetLength(string);
+        BOOL isNarrow = CFStringGetCStringPtr(string, kCFStringEncodingASCII) != NULL || CFStringGetCStringPtr(string, kCFStringEncodingMacRoman) != NULL;
+        cost += (NSUInteger)length * (isNarrow ? sizeof(char) : sizeof(unichar));
+    } else if ([object isKindOfClass:[NSDictionary class]]) {
+        for (id key in (NSDictionary *)object) {
+            cost += 2 * sizeof(id) + PINMemoryCacheEstimatedCost(key, depth + 1) + PINMemoryCacheEstimatedCost(((NSDictionary *)object)[key], depth + 1);
+        }
+    } else if ([object isKindOfClass:[NSArray class]] || [object isKindOfClass:[NSSet class]] || [object isKindOfClass:[NSOrderedSet class]]) {
+        for (id element in (id<NSFastEnumeration>)object) {
+            cost += sizeof(id) + PINMemoryCacheEstimatedCost(element, depth + 1);
+        }
+    }
+    return cost;
+}
+
+// Goes through +[NSDate date] rather than CFAbsoluteTimeGetCurrent() so that the tests can move time forward.
+static inline CFAbsoluteTime PINMemoryCacheCurrentTime(void)
+{
+    return [[NSDate date] timeIntervalSinceReferenceDate];
+}
+
+@interface PINMemoryCache () {
+    // Read on every hit without taking the lock, so these are atomic. Writes still happen under the lock.
+    _Atomic(NSTimeInterval) _ageLimit;
+    _Atomic(BOOL) _ttlCache;
+    _Atomic(NSUInteger) _totalCost;
+    NSUInteger _shardMask;
+    // Replaced rather than changed, under the lock, so trims can call a snapshot without holding it.
+    NSArray<PINMemoryCacheEvictionBlock> *_evictionObservers;
+}
 @property (copy, nonatomic) NSString *name;
-@property (strong, nonatomic) PINOperationQueue *operationQueue;
 @property (assign, nonatomic) pthread_mutex_t mutex;
-@property (strong, nonatomic) NSMutableDictionary *dictionary;
-@property (strong, nonatomic) NSMutableDictionary *createdDates;
-@property (strong, nonatomic) NSMutableDictionary *accessDates;
-@property (strong, nonatomic) NSMutableDictionary *costs;
-@property (strong, nonatomic) NSMutableDictionary *ageLimits;
-@property (strong, nonatomic) NSMutableDictionary *accessCounts;
+@property (strong, nonatomic) NSArray<PINMemoryCacheShard *> *shards;
+@property (strong, nonatomic) PINCacheStatisticsRecorder *statisticsRecorder;
 @end
 
 @implementation PINMemoryCache
 
 @synthesize name = _name;
-@synthesize ageLimit = _ageLimit;
 @synthesize costLimit = _costLimit;
-@synthesize totalCost = _totalCost;
-@synthesize ttlCache = _ttlCache;
 @synthesize willAddObjectBlock = _willAddObjectBlock;
 @synthesize willRemoveObjectBlock = _willRemoveObjectBlock;
 @synthesize willRemoveAllObjectsBlock = _willRemoveAllObjectsBlock;
@@ -74,6 +201,11 @@ static NSString * const PINMemoryCacheSharedName = @"PINMemoryCacheSharedName";
 }
 
 - (instancetype)initWithName:(NSString *)name operationQueue:(PINOperationQueue *)operationQueue ttlCache:(BOOL)ttlCache evictionStrategy:(PINCacheEvictionStrategy)evictionStrategy
+{
+    return [self initWithName:name operationQueue:operationQueue ttlCache:ttlCache evictionStrategy:evictionStrategy shardCount:1];
+}
+
+- (instancetype)initWithName:(NSString *)name operationQueue:(PINOperationQueue *)operationQueue ttlCache:(BOOL)ttlCache evictionStrategy:(PINCacheEvictionStrategy)evictionStrategy shardCount:(NSUInteger)shardCount
 {
     if (self = [super init]) {
         __unused int result = pthread_mutex_init(&_mutex, NULL);
@@ -83,12 +215,18 @@ static NSString * const PINMemoryCacheSharedName = @"PINMemoryCacheSharedName";
         _operationQueue = operationQueue;
         _ttlCache = ttlCache;
         
-        _dictionary = [[NSMutableDictionary alloc] init];
-        _createdDates = [[NSMutableDictionary alloc] init];
-        _accessDates = [[NSMutableDictionary alloc] init];
-        _costs = [[NSMutableDictionary alloc] init];
-        _ageLimits = [[NSMutableDictionary alloc] init];
-        _accessCounts = [[NSMutableDictionary alloc] init];
+        // Round up to a power of two so a shard can be picked with a mask.
+        NSUInteger roundedShardCount = 1;
+        while (roundedShardCount < MIN(shardCount, PINMemoryCacheMaxShardCount)) {
+            roundedShardCount <<= 1;
+        }
+        NSMutableArray<PINMemoryCacheShard *> *shards = [[NSMutableArray alloc] initWithCapacity:roundedShardCount];
+        for (NSUInteger idx = 0; idx < roundedShardCount; idx++) {
+            [shards addObject:[[PINMemoryCacheShard alloc] init]];
+        }
+        _shards = [shards copy];
+        _shardMask = roundedShardCount - 1;
+        _statisticsRecorder = [[PINCacheStatisticsRecorder alloc] init];
         
         _willAddObjectBlock = nil;
         _willRemoveObjectBlock = nil;
@@ -140,6 +278,8 @@ static NSString * const PINMemoryCacheSharedName = @"PINMemoryCacheSharedName";
 
 - (void)didReceiveMemoryWarningNotification:(NSNotification *)notification {
     if (self.removeAllObjectsOnMemoryWarning) {
+        if (_statisticsRecorder.enabled)
+            [_statisticsRecorder addCount:[self objectCount] toCounter:PINCacheStatisticsCounterMemoryWarningEviction];
         [self removeAllObjectsAsync:nil];
     } else {
         [self removeExpiredObjects];
@@ -170,159 +310,264 @@ static NSString * const PINMemoryCacheSharedName = @"PINMemoryCacheSharedName";
     } withPriority:PINOperationQueuePriorityHigh];
 }
 
+- (PINMemoryCacheShard *)shardForKey:(NSString *)key
+{
+    if (_shardMask == 0)
+        return _shards[0];
+
+    // NSString's hash isn't well mixed in its low bits, so spread it with a Fibonacci multiply first.
+    uint64_t hash = (uint64_t)[key hash] * 11400714819323198485ULL;
+    return _shards[(NSUInteger)(hash >> 32) & _shardMask];
+}
+
+- (NSUInteger)totalCostOfShard:(PINMemoryCacheShard *)shard
+{
+    [shard lockForReading];
+        NSUInteger totalCost = shard.totalCost;
+    [shard unlock];
+
+    return totalCost;
+}
+
 - (void)removeObjectAndExecuteBlocksForKey:(NSString *)key
 {
-    [self lock];
-        id object = _dictionary[key];
-        NSNumber *cost = _costs[key];
-        PINCacheObjectBlock willRemoveObjectBlock = _willRemoveObjectBlock;
-        PINCacheObjectBlock didRemoveObjectBlock = _didRemoveObjectBlock;
-    [self unlock];
+    PINMemoryCacheShard *shard = [self shardForKey:key];
+
+    [shard lockForReading];
+        id object = shard.entries[key].object;
+    [shard unlock];
 
     if (object == nil) {
         return;
     }
 
+    [self lock];
+        PINCacheObjectBlock willRemoveObjectBlock = _willRemoveObjectBlock;
+        PINCacheObjectBlock didRemoveObjectBlock = _didRemoveObjectBlock;
+    [self unlock];
+
     if (willRemoveObjectBlock)
         willRemoveObjectBlock(self, key, object);
 
-    [self lock];
-        if (cost)
-            _totalCost -= [cost unsignedIntegerValue];
-
-        [_dictionary removeObjectForKey:key];
-        [_createdDates removeObjectForKey:key];
-        [_accessDates removeObjectForKey:key];
-        [_costs removeObjectForKey:key];
-        [_ageLimits removeObjectForKey:key];
-        [_accessCounts removeObjectForKey:key];
-    [self unlock];
+    [shard lock];
+        [self _locked_removeEntryForKey:key fromShard:shard];
+    [shard unlock];
     
     if (didRemoveObjectBlock)
         didRemoveObjectBlock(self, key, nil);
 }
 
-- (void)trimMemoryToDate:(NSDate *)trimDate
+// The bulk counterpart of removeObjectAndExecuteBlocksForKey:. The block picks the keys to remove from a shard, with
+// its lock held for reading, and each shard's lock is then taken once to remove them all.
+- (void)removeObjectsAndExecuteBlocksForKeysInShards:(PIN_NOESCAPE NSArray<NSString *> * (^)(PINMemoryCacheShard *shard))keysInShard
 {
     [self lock];
-        NSDictionary *createdDates = [_createdDates copy];
-        NSDictionary *ageLimits = [_ageLimits copy];
+        PINCacheObjectBlock willRemoveObjectBlock = _willRemoveObjectBlock;
+        PINCacheObjectBlock didRemoveObjectBlock = _didRemoveObjectBlock;
     [self unlock];
-    
-    [createdDates enumerateKeysAndObjectsUsingBlock:^(NSString * _Nonnull key, NSDate * _Nonnull createdDate, BOOL * _Nonnull stop) {
-        NSTimeInterval ageLimit = [ageLimits[key] doubleValue];
-        if (!createdDate || ageLimit > 0.0) {
-            return;
-        }
-        if ([createdDate compare:trimDate] == NSOrderedAscending) { // older than trim date
-            [self removeObjectAndExecuteBlocksForKey:key];
-        }
-    }];
-}
 
-- (void)removeExpiredObjects
-{
-    [self lock];
-        NSDictionary<NSString *, NSDate *> *createdDates = [_createdDates copy];
-        NSDictionary<NSString *, NSNumber *> *ageLimits = [_ageLimits copy];
-        NSTimeInterval globalAgeLimit = self->_ageLimit;
-    [self unlock];
+    for (PINMemoryCacheShard *shard in _shards) {
+        NSArray<NSString *> *keys = nil;
+        NSMutableArray *objects = nil;
+        [shard lockForReading];
+            keys = keysInShard(shard);
+            if (willRemoveObjectBlock && keys.count > 0) {
+                objects = [[NSMutableArray alloc] initWithCapacity:keys.count];
+                for (NSString *key in keys) {
+                    [objects addObject:shard.entries[key].object ?: [NSNull null]];
+                }
+            }
+        [shard unlock];
 
-    NSDate *now = [NSDate date];
-    for (NSString *key in ageLimits) {
-        NSDate *createdDate = createdDates[key];
-        NSTimeInterval ageLimit = [ageLimits[key] doubleValue] ?: globalAgeLimit;
-        if (!createdDate)
+        if (keys.count == 0)
             continue;
 
-        NSDate *expirationDate = [createdDate dateByAddingTimeInterval:ageLimit];
-        if ([expirationDate compare:now] == NSOrderedAscending) { // Expiration date has passed
-            [self removeObjectAndExecuteBlocksForKey:key];
+        if (willRemoveObjectBlock) {
+            [keys enumerateObjectsUsingBlock:^(NSString *key, NSUInteger idx, BOOL *stop) {
+                id object = objects[idx];
+                willRemoveObjectBlock(self, key, object == [NSNull null] ? nil : object);
+            }];
+        }
+
+        [shard lock];
+            for (NSString *key in keys) {
+                [self _locked_removeEntryForKey:key fromShard:shard];
+            }
+        [shard unlock];
+
+        if (didRemoveObjectBlock) {
+            for (NSString *key in keys) {
+                didRemoveObjectBlock(self, key, nil);
+            }
         }
     }
 }
 
-- (void)trimToCostLimit:(NSUInteger)limit
+- (void)_locked_removeEntryForKey:(NSString *)key fromShard:(PINMemoryCacheShard *)shard
 {
-    NSUInteger totalCost = 0;
-    
-    [self lock];
-        totalCost = _totalCost;
-    [self unlock];
-    
-    if (totalCost <= limit) {
+    PINMemoryCacheEntry *entry = shard.entries[key];
+    if (entry == nil) {
         return;
     }
 
-    [self lock];
-        NSDictionary *costs = [_costs copy];
-    [self unlock];
+    shard.totalCost -= entry.cost;
+    atomic_fetch_sub_explicit(&_totalCost, entry.cost, memory_order_relaxed);
+    [shard _locked_removeEntry:entry];
+}
 
-    NSArray *keysSortedByCost = [costs keysSortedByValueUsingSelector:@selector(compare:)];
+- (NSUInteger)objectCount
+{
+    NSUInteger objectCount = 0;
+    for (PINMemoryCacheShard *shard in _shards) {
+        [shard lockForReading];
+            objectCount += shard.entries.count;
+        [shard unlock];
+    }
+    return objectCount;
+}
 
-    for (NSString *key in [keysSortedByCost reverseObjectEnumerator]) { // costliest objects first
+- (void)trimMemoryToDate:(NSDate *)trimDate
+{
+    CFAbsoluteTime trimTime = [trimDate timeIntervalSinceReferenceDate];
+    NSMutableArray<NSString *> *keysToRemove = [[NSMutableArray alloc] init];
+    
+    for (PINMemoryCacheShard *shard in _shards) {
+        [shard lockForReading];
+            [shard.entries enumerateKeysAndObjectsUsingBlock:^(NSString * _Nonnull key, PINMemoryCacheEntry * _Nonnull entry, BOOL * _Nonnull stop) {
+                if (entry.ageLimit > 0.0) {
+                    return;
+                }
+                if (entry.createdTime < trimTime) { // older than trim date
+                    [keysToRemove addObject:key];
+                }
+            }];
+        [shard unlock];
+    }
+    
+    for (NSString *key in keysToRemove) {
         [self removeObjectAndExecuteBlocksForKey:key];
-
-        [self lock];
-            totalCost = _totalCost;
-        [self unlock];
-        
-        if (totalCost <= limit)
-            break;
     }
+    [_statisticsRecorder addCount:keysToRemove.count toCounter:PINCacheStatisticsCounterAgeEviction];
 }
 
-- (void)trimToCostLimitByEvictionStrategy:(NSUInteger)limit
+- (void)removeExpiredObjects
 {
-    if (self.isTTLCache) {
-        [self removeExpiredObjects];
+    CFAbsoluteTime now = PINMemoryCacheCurrentTime();
+    NSMutableArray<NSString *> *keysToRemove = [[NSMutableArray alloc] init];
+    
+    for (PINMemoryCacheShard *shard in _shards) {
+        [shard lockForReading];
+            [shard.entries enumerateKeysAndObjectsUsingBlock:^(NSString * _Nonnull key, PINMemoryCacheEntry * _Nonnull entry, BOOL * _Nonnull stop) {
+                NSTimeInterval ageLimit = entry.ageLimit;
+                if (ageLimit <= 0.0) {
+                    return;
+                }
+                if (entry.createdTime + ageLimit < now) { // Expiration date has passed
+                    [keysToRemove addObject:key];
+                }
+            }];
+        [shard unlock];
     }
-
-    [self lock];
-        NSUInteger totalCost = _totalCost;
-    [self unlock];
     
-    if (totalCost <= limit)
+    for (NSString *key in keysToRemove) {
+        [self removeObjectAndExecuteBlocksForKey:key];
+    }
+    [_statisticsRecorder addCount:keysToRemove.count toCounter:PINCacheStatisticsCounterAgeEviction];
+}
+
+/**
+ Evicts entries in the given order until the total cost is at most the limit. Each shard is only trimmed down to its
+ even share of the limit, so a sharded cache stays within the limit overall without every shard having to agree on a
+ single global order. Victims are picked and removed in one pass under the shard's lock, so the work done is
+ proportional to the number of entries evicted; the remove blocks, if any, are called for the whole batch at once.
+ */
+- (void)trimToCostLimit:(NSUInteger)limit evictingInOrder:(PINMemoryCacheEvictionOrder)order
+{
+    if (self.totalCost <= limit)
         return;
-    
+
     [self lock];
-        NSDictionary *accessDates = [_accessDates copy];
-        NSDictionary *accessCounts = [_accessCounts copy];
-        PINCacheEvictionStrategy strategy = _evictionStrategy;
+        PINCacheObjectBlock willRemoveObjectBlock = _willRemoveObjectBlock;
+        PINCacheObjectBlock didRemoveObjectBlock = _didRemoveObjectBlock;
+        NSArray<PINMemoryCacheEvictionBlock> *evictionObservers = _evictionObservers;
     [self unlock];
 
-    NSArray *keysSortedByEvictionStrategy = nil;
-    switch (strategy) {
-        case PINCacheEvictionStrategyLeastRecentlyUsed:
-            keysSortedByEvictionStrategy = [accessDates keysSortedByValueUsingSelector:@selector(compare:)];
+    NSUInteger shardLimit = limit / _shards.count;
+    for (PINMemoryCacheShard *shard in _shards) {
+        if (self.totalCost <= limit)
             break;
-            
-        case PINCacheEvictionStrategyLeastFrequentlyUsed:
-            keysSortedByEvictionStrategy = [[accessCounts allKeys] sortedArrayUsingComparator:^NSComparisonResult(NSString * _Nonnull key1, NSString * _Nonnull key2) {
-                NSInteger count1 = [accessCounts[key1] integerValue];
-                NSInteger count2 = [accessCounts[key2] integerValue];
-                if (count1 < count2) {
-                    return NSOrderedAscending;
-                } else if (count1 > count2) {
-                    return NSOrderedDescending;
-                } else {
-                    NSDate *date1 = accessDates[key1];
-                    NSDate *date2 = accessDates[key2];
-                    return [date1 compare:date2];
+
+        NSMutableArray<PINMemoryCacheEntry *> *victims = [[NSMutableArray alloc] init];
+        // Entries lose their object when removed, so the objects are kept aside for the blocks.
+        NSMutableArray *victimObjects = [[NSMutableArray alloc] init];
+        [shard lock];
+            __block NSUInteger shardCost = shard.totalCost;
+            __block NSUInteger totalCost = self.totalCost;
+            if (shardCost > shardLimit && totalCost > limit) {
+                [shard _locked_enumerateEntriesInEvictionOrder:order usingBlock:^(PINMemoryCacheEntry *entry, BOOL *stop) {
+                    [victims addObject:entry];
+                    [victimObjects addObject:entry.object];
+                    shardCost -= entry.cost;
+                    totalCost -= MIN(entry.cost, totalCost);
+                    if (shardCost <= shardLimit || totalCost <= limit)
+                        *stop = YES;
+                }];
+            }
+
+            // Without a will remove block there's nothing to tell anyone before the victims go, so they go now.
+            if (willRemoveObjectBlock == nil) {
+                for (PINMemoryCacheEntry *entry in victims) {
+                    [self _locked_removeEntryForKey:entry.key fromShard:shard];
                 }
+            }
+        [shard unlock];
+
+        if (victims.count == 0)
+            continue;
+
+        NSMutableIndexSet *evictedIndexes = [NSMutableIndexSet indexSetWithIndexesInRange:NSMakeRange(0, victims.count)];
+        if (willRemoveObjectBlock) {
+            [victims enumerateObjectsUsingBlock:^(PINMemoryCacheEntry *entry, NSUInteger idx, BOOL *stop) {
+                willRemoveObjectBlock(self, entry.key, victimObjects[idx]);
             }];
-            break;
+
+            [shard lock];
+                [victims enumerateObjectsUsingBlock:^(PINMemoryCacheEntry *entry, NSUInteger idx, BOOL *stop) {
+                    // Skip victims that were removed by someone else in the meantime.
+                    if (shard.entries[entry.key] == entry) {
+                        [self _locked_removeEntryForKey:entry.key fromShard:shard];
+                    } else {
+                        [evictedIndexes removeIndex:idx];
+                    }
+                }];
+            [shard unlock];
+        }
+
+        [_statisticsRecorder addCount:evictedIndexes.count toCounter:PINCacheStatisticsCounterCostEviction];
+        [evictedIndexes enumerateIndexesUsingBlock:^(NSUInteger idx, BOOL *stop) {
+            PINMemoryCacheEntry *entry = victims[idx];
+            for (PINMemoryCacheEvictionBlock evictionObserver in evictionObservers) {
+                evictionObserver(self, entry.key, victimObjects[idx], entry.createdTime);
+            }
+            if (didRemoveObjectBlock)
+                didRemoveObjectBlock(self, entry.key, nil);
+        }];
     }
+}
 
-    for (NSString *key in keysSortedByEvictionStrategy) { // oldest objects first
-        [self removeObjectAndExecuteBlocksForKey:key];
+- (void)trimToCostLimit:(NSUInteger)limit
+{
+    [self trimToCostLimit:limit evictingInOrder:PINMemoryCacheEvictionOrderCostliest];
+}
 
-        [self lock];
-            totalCost = _totalCost;
-        [self unlock];
-        if (totalCost <= limit)
-            break;
+- (void)trimToCostLimitByEvictionStrategy:(NSUInteger)limit
+{
+    if (self.isTTLCache) {
+        [self removeExpiredObjects];
     }
+
+    PINCacheEvictionStrategy strategy = self.evictionStrategy;
+    [self trimToCostLimit:limit evictingInOrder:strategy == PINCacheEvictionStrategyLeastFrequentlyUsed ? PINMemoryCacheEvictionOrderLeastFrequentlyUsed : PINMemoryCacheEvictionOrderLeastRecentlyUsed];
 }
 
 - (void)trimToAgeLimitRecursively
@@ -357,6 +602,27 @@ static NSString * const PINMemoryCacheSharedName = @"PINMemoryCacheSharedName";
     });
 }
 
+- (id)addEvictionObserver:(PINMemoryCacheEvictionBlock)observer
+{
+    PINMemoryCacheEvictionBlock copiedObserver = [observer copy];
+    [self lock];
+        _evictionObservers = _evictionObservers ? [_evictionObservers arrayByAddingObject:copiedObserver] : @[ copiedObserver ];
+    [self unlock];
+    return copiedObserver;
+}
+
+- (void)removeEvictionObserver:(id)observer
+{
+    [self lock];
+        NSUInteger index = [_evictionObservers indexOfObjectIdenticalTo:observer];
+        if (index != NSNotFound) {
+            NSMutableArray<PINMemoryCacheEvictionBlock> *evictionObservers = [_evictionObservers mutableCopy];
+            [evictionObservers removeObjectAtIndex:index];
+            _evictionObservers = [evictionObservers copy];
+        }
+    [self unlock];
+}
+
 #pragma mark - Public Asynchronous Methods -
 
 - (void)containsObjectForKeyAsync:(NSString *)key completion:(PINCacheObjectContainmentBlock)block
@@ -372,15 +638,30 @@ static NSString * const PINMemoryCacheSharedName = @"PINMemoryCacheSharedName";
 }
 
 - (void)objectForKeyAsync:(NSString *)key completion:(PINCacheObjectBlock)block
+{
+    [self objectForKeyAsync:key cancellationToken:nil completion:block];
+}
+
+- (PINCacheCancellationToken *)objectForKeyAsync:(NSString *)key deadline:(NSDate *)deadline completion:(PINCacheObjectBlock)block
+{
+    PINCacheCancellationToken *token = [[PINCacheCancellationToken alloc] initWithDeadline:deadline];
+    [self objectForKeyAsync:key cancellationToken:token completion:block];
+    return token;
+}
+
+- (void)objectForKeyAsync:(NSString *)key cancellationToken:(nullable PINCacheCancellationToken *)token completion:(PINCacheObjectBlock)block
 {
     if (block == nil) {
       return;
     }
     
     [self.operationQueue scheduleOperation:^{
-        id object = [self objectForKey:key];
+        id object = nil;
+        if (![token shouldDropOperationForRecorder:self->_statisticsRecorder])
+            object = [self objectForKey:key];
         
-        block(self, key, object);
+        if (!token.cancelled)
+            block(self, key, object);
     } withPriority:PINOperationQueuePriorityHigh];
 }
 
@@ -400,11 +681,24 @@ static NSString * const PINMemoryCacheSharedName = @"PINMemoryCacheSharedName";
 }
 
 - (void)setObjectAsync:(id)object forKey:(NSString *)key withCost:(NSUInteger)cost ageLimit:(NSTimeInterval)ageLimit completion:(PINCacheObjectBlock)block
+{
+    [self setObjectAsync:object forKey:key withCost:cost ageLimit:ageLimit cancellationToken:nil completion:block];
+}
+
+- (PINCacheCancellationToken *)setObjectAsync:(id)object forKey:(NSString *)key withCost:(NSUInteger)cost ageLimit:(NSTimeInterval)ageLimit deadline:(NSDate *)deadline completion:(PINCacheObjectBlock)block
+{
+    PINCacheCancellationToken *token = [[PINCacheCancellationToken alloc] initWithDeadline:deadline];
+    [self setObjectAsync:object forKey:key withCost:cost ageLimit:ageLimit cancellationToken:token completion:block];
+    return token;
+}
+
+- (void)setObjectAsync:(id)object forKey:(NSString *)key withCost:(NSUInteger)cost ageLimit:(NSTimeInterval)ageLimit cancellationToken:(nullable PINCacheCancellationToken *)token completion:(PINCacheObjectBlock)block
 {
     [self.operationQueue scheduleOperation:^{
-        [self setObject:object forKey:key withCost:cost ageLimit:ageLimit];
+        if (![token shouldDropOperationForRecorder:self->_statisticsRecorder])
+            [self setObject:object forKey:key withCost:cost ageLimit:ageLimit];
         
-        if (block)
+        if (block && !token.cancelled)
             block(self, key, object);
     } withPriority:PINOperationQueuePriorityHigh];
 }
@@ -420,11 +714,24 @@ static NSString * const PINMemoryCacheSharedName = @"PINMemoryCacheSharedName";
 }
 
 - (void)trimToDateAsync:(NSDate *)trimDate completion:(PINCacheBlock)block
+{
+    [self trimToDateAsync:trimDate cancellationToken:nil completion:block];
+}
+
+- (PINCacheCancellationToken *)trimToDateAsync:(NSDate *)trimDate deadline:(NSDate *)deadline completion:(PINCacheBlock)block
+{
+    PINCacheCancellationToken *token = [[PINCacheCancellationToken alloc] initWithDeadline:deadline];
+    [self trimToDateAsync:trimDate cancellationToken:token completion:block];
+    return token;
+}
+
+- (void)trimToDateAsync:(NSDate *)trimDate cancellationToken:(nullable PINCacheCancellationToken *)token completion:(PINCacheBlock)block
 {
     [self.operationQueue scheduleOperation:^{
-        [self trimToDate:trimDate];
+        if (![token shouldDropOperationForRecorder:self->_statisticsRecorder])
+            [self trimToDate:trimDate];
         
-        if (block)
+        if (block && !token.cancelled)
             block(self);
     } withPriority:PINOperationQueuePriorityLow];
 }
@@ -440,11 +747,24 @@ static NSString * const PINMemoryCacheSharedName = @"PINMemoryCacheSharedName";
 }
 
 - (void)trimToCostByEvictionStrategyAsync:(NSUInteger)cost completion:(PINCacheBlock)block
+{
+    [self trimToCostByEvictionStrategyAsync:cost cancellationToken:nil completion:block];
+}
+
+- (PINCacheCancellationToken *)trimToCostByEvictionStrategyAsync:(NSUInteger)cost deadline:(NSDate *)deadline completion:(PINCacheBlock)block
+{
+    PINCacheCancellationToken *token = [[PINCacheCancellationToken alloc] initWithDeadline:deadline];
+    [self trimToCostByEvictionStrategyAsync:cost cancellationToken:token completion:block];
+    return token;
+}
+
+- (void)trimToCostByEvictionStrategyAsync:(NSUInteger)cost cancellationToken:(nullable PINCacheCancellationToken *)token completion:(PINCacheBlock)block
 {
     [self.operationQueue scheduleOperation:^{
-        [self trimToCostByEvictionStrategy:cost];
+        if (![token shouldDropOperationForRecorder:self->_statisticsRecorder])
+            [self trimToCostByEvictionStrategy:cost];
         
-        if (block)
+        if (block && !token.cancelled)
             block(self);
     } withPriority:PINOperationQueuePriorityLow];
 }
@@ -479,6 +799,58 @@ static NSString * const PINMemoryCacheSharedName = @"PINMemoryCacheSharedName";
     } withPriority:PINOperationQueuePriorityLow];
 }
 
+- (void)objectsForKeysAsync:(NSArray<NSString *> *)keys completion:(PINCacheObjectsBlock)block
+{
+    if (block == nil)
+        return;
+
+    [self.operationQueue scheduleOperation:^{
+        NSDictionary<NSString *, id> *objects = [self objectsForKeys:keys];
+
+        block(self, objects);
+    } withPriority:PINOperationQueuePriorityHigh];
+}
+
+- (void)setObjectsAsync:(NSArray *)objects forKeys:(NSArray<NSString *> *)keys completion:(PINCacheBlock)block
+{
+    [self.operationQueue scheduleOperation:^{
+        [self setObjects:objects forKeys:keys];
+
+        if (block)
+            block(self);
+    } withPriority:PINOperationQueuePriorityHigh];
+}
+
+- (void)setObjectAsync:(id)object forKey:(NSString *)key withTags:(NSSet<NSString *> *)tags completion:(PINCacheObjectBlock)block
+{
+    [self.operationQueue scheduleOperation:^{
+        [self setObject:object forKey:key withTags:tags];
+
+        if (block)
+            block(self, key, object);
+    } withPriority:PINOperationQueuePriorityHigh];
+}
+
+- (void)removeObjectsWithTagAsync:(NSString *)tag completion:(PINCacheBlock)block
+{
+    [self.operationQueue scheduleOperation:^{
+        [self removeObjectsWithTag:tag];
+
+        if (block)
+            block(self);
+    } withPriority:PINOperationQueuePriorityLow];
+}
+
+- (void)removeObjectsWithKeyPrefixAsync:(NSString *)prefix completion:(PINCacheBlock)block
+{
+    [self.operationQueue scheduleOperation:^{
+        [self removeObjectsWithKeyPrefix:prefix];
+
+        if (block)
+            block(self);
+    } withPriority:PINOperationQueuePriorityLow];
+}
+
 #pragma mark - Public Synchronous Methods -
 
 - (BOOL)containsObjectForKey:(NSString *)key
@@ -486,9 +858,10 @@ static NSString * const PINMemoryCacheSharedName = @"PINMemoryCacheSharedName";
     if (!key)
         return NO;
     
-    [self lock];
-        BOOL containsObject = (_dictionary[key] != nil);
-    [self unlock];
+    PINMemoryCacheShard *shard = [self shardForKey:key];
+    [shard lockForReading];
+        BOOL containsObject = (shard.entries[key] != nil);
+    [shard unlock];
     return containsObject;
 }
 
@@ -497,24 +870,29 @@ static NSString * const PINMemoryCacheSharedName = @"PINMemoryCacheSharedName";
     if (!key)
         return nil;
     
-    NSDate *now = [NSDate date];
-    [self lock];
+    uint64_t startTime = [_statisticsRecorder startOperation];
+    BOOL ttlCache = _ttlCache;
+    NSTimeInterval globalAgeLimit = _ageLimit;
+    PINMemoryCacheShard *shard = [self shardForKey:key];
+    [shard lockForReading];
         id object = nil;
-        // If the cache should behave like a TTL cache, then only fetch the object if there's a valid ageLimit and  the object is still alive
-        NSTimeInterval ageLimit = [_ageLimits[key] doubleValue] ?: self->_ageLimit;
-        if (!self->_ttlCache || ageLimit <= 0 || fabs([[_createdDates objectForKey:key] timeIntervalSinceDate:now]) < ageLimit) {
-            object = _dictionary[key];
-        }
-    [self unlock];
-        
-    if (object) {
-        [self lock];
-            _accessDates[key] = now;
-            NSInteger accessCount = [_accessCounts[key] integerValue];
-            if (accessCount < NSIntegerMax) {
-                _accessCounts[key] = @(accessCount + 1);
+        PINMemoryCacheEntry *entry = shard.entries[key];
+        if (entry) {
+            // If the cache should behave like a TTL cache, then only fetch the object if there's a valid ageLimit and  the object is still alive
+            NSTimeInterval ageLimit = entry.ageLimit > 0.0 ? entry.ageLimit : globalAgeLimit;
+            if (!ttlCache || ageLimit <= 0 || fabs(PINMemoryCacheCurrentTime() - entry.createdTime) < ageLimit) {
+                object = entry.object;
             }
-        [self unlock];
+        }
+    [shard unlock];
+
+    // The access date and count are updated later, in a batch, the next time a writer takes the shard's lock.
+    if (object)
+        [shard recordAccessToEntry:entry];
+
+    if (startTime) {
+        [_statisticsRecorder addCount:1 toCounter:object ? PINCacheStatisticsCounterHit : PINCacheStatisticsCounterMiss];
+        [_statisticsRecorder endOperation:PINCacheStatisticsOperationRead startTime:startTime];
     }
 
     return object;
@@ -550,12 +928,26 @@ static NSString * const PINMemoryCacheSharedName = @"PINMemoryCacheSharedName";
 }
 
 - (void)setObject:(id)object forKey:(NSString *)key withCost:(NSUInteger)cost ageLimit:(NSTimeInterval)ageLimit
+{
+    [self setObject:object forKey:key withCost:cost ageLimit:ageLimit tags:nil];
+}
+
+- (void)setObject:(id)object forKey:(NSString *)key withTags:(NSSet<NSString *> *)tags
+{
+    [self setObject:object forKey:key withCost:0 ageLimit:0.0 tags:tags];
+}
+
+- (void)setObject:(id)object forKey:(NSString *)key withCost:(NSUInteger)cost ageLimit:(NSTimeInterval)ageLimit tags:(NSSet<NSString *> *)tags
 {
     NSAssert(ageLimit <= 0.0 || (ageLimit > 0.0 && _ttlCache), @"ttlCache must be set to YES if setting an object-level age limit.");
 
     if (!key || !object)
         return;
     
+    uint64_t startTime = [_statisticsRecorder startOperation];
+    if (cost == 0 && self.automaticallyEstimatesCost)
+        cost = PINMemoryCacheEstimatedCost(object, 0);
+    
     [self lock];
         PINCacheObjectBlock willAddObjectBlock = _willAddObjectBlock;
         PINCacheObjectBlock didAddObjectBlock = _didAddObjectBlock;
@@ -565,36 +957,149 @@ static NSString * const PINMemoryCacheSharedName = @"PINMemoryCacheSharedName";
     if (willAddObjectBlock)
         willAddObjectBlock(self, key, object);
     
-    [self lock];
-        NSNumber* oldCost = _costs[key];
-        if (oldCost)
-            _totalCost -= [oldCost unsignedIntegerValue];
+    PINMemoryCacheShard *shard = [self shardForKey:key];
+    [shard lock];
+        [self _locked_setObject:object forKey:key inShard:shard withCost:cost ageLimit:ageLimit tags:tags time:PINMemoryCacheCurrentTime()];
+    [shard unlock];
+    
+    if (didAddObjectBlock)
+        didAddObjectBlock(self, key, object);
+    
+    if (costLimit > 0)
+        [self trimToCostByEvictionStrategy:costLimit];
 
-        NSDate *now = [NSDate date];
-        _dictionary[key] = object;
-        _createdDates[key] = now;
-        _accessDates[key] = now;
-        NSInteger accessCount = [_accessCounts[key] integerValue];
-        if (accessCount < NSIntegerMax) {
-            _accessCounts[key] = @(accessCount + 1);
-        }
+    if (startTime) {
+        [_statisticsRecorder addCount:1 toCounter:PINCacheStatisticsCounterSet];
+        [_statisticsRecorder endOperation:PINCacheStatisticsOperationWrite startTime:startTime];
+    }
+}
 
-        _costs[key] = @(cost);
+- (void)setObjects:(NSArray *)objects forKeys:(NSArray<NSString *> *)keys
+{
+    NSAssert(objects.count == keys.count, @"Must pass the same number of objects and keys.");
 
-        if (ageLimit > 0.0) {
-            _ageLimits[key] = @(ageLimit);
-        } else {
-            [_ageLimits removeObjectForKey:key];
+    NSUInteger count = MIN(objects.count, keys.count);
+    if (count == 0)
+        return;
+    
+    [self lock];
+        PINCacheObjectBlock willAddObjectBlock = _willAddObjectBlock;
+        PINCacheObjectBlock didAddObjectBlock = _didAddObjectBlock;
+        NSUInteger costLimit = _costLimit;
+    [self unlock];
+    
+    if (willAddObjectBlock) {
+        for (NSUInteger idx = 0; idx < count; idx++) {
+            willAddObjectBlock(self, keys[idx], objects[idx]);
         }
+    }
+    
+    NSMapTable<PINMemoryCacheShard *, NSMutableIndexSet *> *indexesByShard = [self indexesByShardForKeys:keys count:count];
+
+    // Estimated up front so that no shard is locked while large collections are walked.
+    NSMutableData *costs = [[NSMutableData alloc] initWithLength:count * sizeof(NSUInteger)];
+    NSUInteger *costValues = costs.mutableBytes;
+    if (self.automaticallyEstimatesCost) {
+        for (NSUInteger idx = 0; idx < count; idx++) {
+            costValues[idx] = PINMemoryCacheEstimatedCost(objects[idx], 0);
+        }
+    }
 
-        _totalCost += cost;
-    [self unlock];
+    CFAbsoluteTime now = PINMemoryCacheCurrentTime();
+    for (PINMemoryCacheShard *shard in indexesByShard) {
+        [shard lock];
+            [[indexesByShard objectForKey:shard] enumerateIndexesUsingBlock:^(NSUInteger idx, BOOL * _Nonnull stop) {
+                [self _locked_setObject:objects[idx] forKey:keys[idx] inShard:shard withCost:costValues[idx] ageLimit:0.0 tags:nil time:now];
+            }];
+        [shard unlock];
+    }
     
-    if (didAddObjectBlock)
-        didAddObjectBlock(self, key, object);
+    if (didAddObjectBlock) {
+        for (NSUInteger idx = 0; idx < count; idx++) {
+            didAddObjectBlock(self, keys[idx], objects[idx]);
+        }
+    }
     
     if (costLimit > 0)
         [self trimToCostByEvictionStrategy:costLimit];
+
+    [_statisticsRecorder addCount:count toCounter:PINCacheStatisticsCounterSet];
+}
+
+- (NSDictionary<NSString *, id> *)objectsForKeys:(NSArray<NSString *> *)keys
+{
+    NSUInteger count = keys.count;
+    if (count == 0)
+        return @{};
+
+    BOOL ttlCache = _ttlCache;
+    NSTimeInterval globalAgeLimit = _ageLimit;
+    CFAbsoluteTime now = PINMemoryCacheCurrentTime();
+    NSMutableDictionary<NSString *, id> *objects = [[NSMutableDictionary alloc] initWithCapacity:count];
+    NSMapTable<PINMemoryCacheShard *, NSMutableIndexSet *> *indexesByShard = [self indexesByShardForKeys:keys count:count];
+    for (PINMemoryCacheShard *shard in indexesByShard) {
+        NSMutableArray<PINMemoryCacheEntry *> *hits = [[NSMutableArray alloc] init];
+        [shard lockForReading];
+            [[indexesByShard objectForKey:shard] enumerateIndexesUsingBlock:^(NSUInteger idx, BOOL * _Nonnull stop) {
+                NSString *key = keys[idx];
+                PINMemoryCacheEntry *entry = shard.entries[key];
+                if (entry == nil || objects[key] != nil)
+                    return;
+                // If the cache should behave like a TTL cache, then only fetch the object if there's a valid ageLimit and  the object is still alive
+                NSTimeInterval ageLimit = entry.ageLimit > 0.0 ? entry.ageLimit : globalAgeLimit;
+                if (!ttlCache || ageLimit <= 0 || fabs(now - entry.createdTime) < ageLimit) {
+                    objects[key] = entry.object;
+                    [hits addObject:entry];
+                }
+            }];
+        [shard unlock];
+
+        for (PINMemoryCacheEntry *entry in hits) {
+            [shard recordAccessToEntry:entry];
+        }
+    }
+
+    [_statisticsRecorder addCount:objects.count toCounter:PINCacheStatisticsCounterHit];
+    [_statisticsRecorder addCount:count - MIN(objects.count, count) toCounter:PINCacheStatisticsCounterMiss];
+    return objects;
+}
+
+// Groups a batch of keys by shard so that each shard's lock is only taken once.
+- (NSMapTable<PINMemoryCacheShard *, NSMutableIndexSet *> *)indexesByShardForKeys:(NSArray<NSString *> *)keys count:(NSUInteger)count
+{
+    NSMapTable<PINMemoryCacheShard *, NSMutableIndexSet *> *indexesByShard = [NSMapTable strongToStrongObjectsMapTable];
+    for (NSUInteger idx = 0; idx < count; idx++) {
+        PINMemoryCacheShard *shard = [self shardForKey:keys[idx]];
+        NSMutableIndexSet *indexes = [indexesByShard objectForKey:shard];
+        if (indexes == nil) {
+            indexes = [[NSMutableIndexSet alloc] init];
+            [indexesByShard setObject:indexes forKey:shard];
+        }
+        [indexes addIndex:idx];
+    }
+    return indexesByShard;
+}
+
+- (void)_locked_setObject:(id)object forKey:(NSString *)key inShard:(PINMemoryCacheShard *)shard withCost:(NSUInteger)cost ageLimit:(NSTimeInterval)ageLimit tags:(NSSet<NSString *> *)tags time:(CFAbsoluteTime)now
+{
+    PINMemoryCacheEntry *entry = shard.entries[key];
+    if (entry) {
+        shard.totalCost -= entry.cost;
+        atomic_fetch_sub_explicit(&_totalCost, entry.cost, memory_order_relaxed);
+        [shard _locked_touchEntry:entry];
+    } else {
+        entry = [[PINMemoryCacheEntry alloc] init];
+        [shard _locked_addEntry:entry forKey:key];
+    }
+
+    entry.object = object;
+    entry.createdTime = now;
+    entry.cost = cost;
+    entry.ageLimit = ageLimit > 0.0 ? ageLimit : 0.0;
+    [shard _locked_setTags:tags forEntry:entry];
+
+    shard.totalCost += cost;
+    atomic_fetch_add_explicit(&_totalCost, cost, memory_order_relaxed);
 }
 
 - (void)removeObjectForKey:(NSString *)key
@@ -605,6 +1110,32 @@ static NSString * const PINMemoryCacheSharedName = @"PINMemoryCacheSharedName";
     [self removeObjectAndExecuteBlocksForKey:key];
 }
 
+- (void)removeObjectsWithTag:(NSString *)tag
+{
+    if (!tag)
+        return;
+
+    [self removeObjectsAndExecuteBlocksForKeysInShards:^NSArray<NSString *> *(PINMemoryCacheShard *shard) {
+        return [shard.tagIndex[tag] allObjects];
+    }];
+}
+
+- (void)removeObjectsWithKeyPrefix:(NSString *)prefix
+{
+    if (!prefix)
+        return;
+
+    [self removeObjectsAndExecuteBlocksForKeysInShards:^NSArray<NSString *> *(PINMemoryCacheShard *shard) {
+        NSMutableArray<NSString *> *keys = [[NSMutableArray alloc] init];
+        for (NSString *key in shard.entries) {
+            if ([key hasPrefix:prefix]) {
+                [keys addObject:key];
+            }
+        }
+        return keys;
+    }];
+}
+
 - (void)trimToDate:(NSDate *)trimDate
 {
     if (!trimDate)
@@ -638,16 +1169,13 @@ static NSString * const PINMemoryCacheSharedName = @"PINMemoryCacheSharedName";
     if (willRemoveAllObjectsBlock)
         willRemoveAllObjectsBlock(self);
     
-    [self lock];
-        [_dictionary removeAllObjects];
-        [_createdDates removeAllObjects];
-        [_accessDates removeAllObjects];
-        [_accessCounts removeAllObjects];
-        [_costs removeAllObjects];
-        [_ageLimits removeAllObjects];
-    
-        _totalCost = 0;
-    [self unlock];
+    for (PINMemoryCacheShard *shard in _shards) {
+        [shard lock];
+            [shard _locked_removeAllEntries];
+            atomic_fetch_sub_explicit(&_totalCost, shard.totalCost, memory_order_relaxed);
+            shard.totalCost = 0;
+        [shard unlock];
+    }
     
     if (didRemoveAllObjectsBlock)
         didRemoveAllObjectsBlock(self);
@@ -659,21 +1187,37 @@ static NSString * const PINMemoryCacheSharedName = @"PINMemoryCacheSharedName";
     if (!block)
         return;
     
-    [self lock];
-        NSDate *now = [NSDate date];
-        NSArray *keysSortedByCreatedDate = [_createdDates keysSortedByValueUsingSelector:@selector(compare:)];
+    // Shards are always locked in the same order, so concurrent enumerations can't deadlock.
+    for (PINMemoryCacheShard *shard in _shards) {
+        [shard lockForReading];
+    }
+        BOOL ttlCache = _ttlCache;
+        NSTimeInterval globalAgeLimit = _ageLimit;
+        CFAbsoluteTime now = PINMemoryCacheCurrentTime();
+        NSMutableDictionary<NSString *, PINMemoryCacheEntry *> *entries = [[NSMutableDictionary alloc] init];
+        for (PINMemoryCacheShard *shard in _shards) {
+            [entries addEntriesFromDictionary:shard.entries];
+        }
+        NSArray *keysSortedByCreatedDate = [entries keysSortedByValueUsingComparator:^NSComparisonResult(PINMemoryCacheEntry * _Nonnull entry1, PINMemoryCacheEntry * _Nonnull entry2) {
+            CFAbsoluteTime time1 = entry1.createdTime;
+            CFAbsoluteTime time2 = entry2.createdTime;
+            return time1 < time2 ? NSOrderedAscending : (time1 > time2 ? NSOrderedDescending : NSOrderedSame);
+        }];
         
         for (NSString *key in keysSortedByCreatedDate) {
+            PINMemoryCacheEntry *entry = entries[key];
             // If the cache should behave like a TTL cache, then only fetch the object if there's a valid ageLimit and  the object is still alive
-            NSTimeInterval ageLimit = [_ageLimits[key] doubleValue] ?: self->_ageLimit;
-            if (!self->_ttlCache || ageLimit <= 0 || fabs([[_createdDates objectForKey:key] timeIntervalSinceDate:now]) < ageLimit) {
+            NSTimeInterval ageLimit = entry.ageLimit > 0.0 ? entry.ageLimit : globalAgeLimit;
+            if (!ttlCache || ageLimit <= 0 || fabs(now - entry.createdTime) < ageLimit) {
                 BOOL stop = NO;
-                block(self, key, _dictionary[key], &stop);
+                block(self, key, entry.object, &stop);
                 if (stop)
                     break;
             }
         }
-    [self unlock];
+    for (PINMemoryCacheShard *shard in [_shards reverseObjectEnumerator]) {
+        [shard unlock];
+    }
 }
 
 #pragma mark - Public Thread Safe Accessors -
@@ -845,11 +1389,32 @@ static NSString * const PINMemoryCacheSharedName = @"PINMemoryCacheSharedName";
 
 - (NSUInteger)totalCost
 {
-    [self lock];
-        NSUInteger cost = _totalCost;
-    [self unlock];
+    return atomic_load_explicit(&_totalCost, memory_order_relaxed);
+}
     
-    return cost;
+- (NSUInteger)shardCount
+{
+    return _shards.count;
+}
+
+- (BOOL)statisticsEnabled
+{
+    return _statisticsRecorder.enabled;
+}
+
+- (void)setStatisticsEnabled:(BOOL)statisticsEnabled
+{
+    _statisticsRecorder.enabled = statisticsEnabled;
+}
+
+- (PINCacheStatistics *)statistics
+{
+    return [_statisticsRecorder snapshot];
+}
+
+- (void)resetStatistics
+{
+    [_statisticsRecorder reset];
 }
 
 - (BOOL)isTTLCache {
@@ -876,6 +1441,343 @@ static NSString * const PINMemoryCacheSharedName = @"PINMemoryCacheSharedName";
 
 @end
 
+@implementation PINMemoryCacheEntry
+@end
+
+@implementation PINMemoryCacheFrequencyBucket
+@end
+
+@implementation PINMemoryCacheShard
+{
+    pthread_rwlock_t _rwlock;
+    PINMemoryCacheReadBuffer *_readBuffers;
+    // Ends of the LRU list. The head is the least recently used entry.
+    __unsafe_unretained PINMemoryCacheEntry *_lruHead;
+    __unsafe_unretained PINMemoryCacheEntry *_lruTail;
+    // The bucket with the lowest access count. Buckets are owned by _buckets.
+    __unsafe_unretained PINMemoryCacheFrequencyBucket *_lowestBucket;
+    NSMutableSet<PINMemoryCacheFrequencyBucket *> *_buckets;
+}
+
+- (instancetype)init
+{
+    if (self = [super init]) {
+        __unused int result = pthread_rwlock_init(&_rwlock, NULL);
+        NSAssert(result == 0, @"Failed to init lock in PINMemoryCacheShard %@. Code: %d", self, result);
+
+        _entries = [[NSMutableDictionary alloc] init];
+        _tagIndex = [[NSMutableDictionary alloc] init];
+        _buckets = [[NSMutableSet alloc] init];
+
+        void *readBuffers = NULL;
+        result = posix_memalign(&readBuffers, 64, sizeof(PINMemoryCacheReadBuffer) * PINMemoryCacheReadBufferStripeCount);
+        NSAssert(result == 0, @"Failed to allocate read buffers in PINMemoryCacheShard %@. Code: %d", self, result);
+        memset(readBuffers, 0, sizeof(PINMemoryCacheReadBuffer) * PINMemoryCacheReadBufferStripeCount);
+        _readBuffers = readBuffers;
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    // Releases the entries still waiting in the read buffers.
+    [self _locked_drainReadBuffers];
+    free(_readBuffers);
+
+    __unused int result = pthread_rwlock_destroy(&_rwlock);
+    NSCAssert(result == 0, @"Failed to destroy lock in PINMemoryCacheShard %p. Code: %d", (void *)self, result);
+}
+
+- (void)recordAccessToEntry:(PINMemoryCacheEntry *)entry
+{
+    // Threads stick to a stripe, so the accesses of a single thread are applied in the order they happened.
+    uint64_t threadHash = (uint64_t)(uintptr_t)pthread_self() * 11400714819323198485ULL;
+    PINMemoryCacheReadBuffer *buffer = &_readBuffers[(NSUInteger)(threadHash >> 32) & (PINMemoryCacheReadBufferStripeCount - 1)];
+
+    for (NSUInteger attempt = 0; attempt < 2; attempt++) {
+        uint64_t head = atomic_load_explicit(&buffer->readCounter, memory_order_acquire);
+        uint64_t tail = atomic_load_explicit(&buffer->writeCounter, memory_order_relaxed);
+        if (tail - head < PINMemoryCacheReadBufferSize) {
+            if (atomic_compare_exchange_strong_explicit(&buffer->writeCounter, &tail, tail + 1, memory_order_acq_rel, memory_order_relaxed)) {
+                atomic_store_explicit(&buffer->slots[tail & (PINMemoryCacheReadBufferSize - 1)], (void *)CFBridgingRetain(entry), memory_order_release);
+            }
+            // Losing the race to another reader just drops this record.
+            return;
+        }
+
+        // Full. Drain it if nobody else holds the lock, then try once more; otherwise drop the record.
+        if (pthread_rwlock_trywrlock(&_rwlock) != 0)
+            return;
+        [self _locked_drainReadBuffers];
+        [self unlock];
+    }
+}
+
+- (void)_locked_drainReadBuffers
+{
+    for (NSUInteger stripe = 0; stripe < PINMemoryCacheReadBufferStripeCount; stripe++) {
+        PINMemoryCacheReadBuffer *buffer = &_readBuffers[stripe];
+        uint64_t head = atomic_load_explicit(&buffer->readCounter, memory_order_relaxed);
+        uint64_t tail = atomic_load_explicit(&buffer->writeCounter, memory_order_acquire);
+        for (; head != tail; head++) {
+            _Atomic(void *) *slot = &buffer->slots[head & (PINMemoryCacheReadBufferSize - 1)];
+            void *record = atomic_load_explicit(slot, memory_order_acquire);
+            if (record == NULL) {
+                // Claimed by a reader that hasn't stored it yet. It'll be picked up by the next drain.
+                break;
+            }
+            atomic_store_explicit(slot, NULL, memory_order_relaxed);
+
+            PINMemoryCacheEntry *entry = CFBridgingRelease(record);
+            if (entry.object == nil) {
+                // Removed from the cache since it was read.
+                continue;
+            }
+            [self _locked_touchEntry:entry];
+        }
+        atomic_store_explicit(&buffer->readCounter, head, memory_order_release);
+    }
+}
+
+- (void)_locked_addEntry:(PINMemoryCacheEntry *)entry forKey:(NSString *)key
+{
+    entry.key = key;
+    _entries[key] = entry;
+
+    entry.lruPrev = _lruTail;
+    entry.lruNext = nil;
+    if (_lruTail) {
+        _lruTail.lruNext = entry;
+    } else {
+        _lruHead = entry;
+    }
+    _lruTail = entry;
+
+    entry.accessCount = 1;
+    PINMemoryCacheFrequencyBucket *bucket = _lowestBucket;
+    if (bucket == nil || bucket.accessCount != 1) {
+        bucket = [self _locked_insertBucketWithAccessCount:1 after:nil];
+    }
+    [self _locked_appendEntry:entry toBucket:bucket];
+}
+
+- (void)_locked_touchEntry:(PINMemoryCacheEntry *)entry
+{
+    if (entry != _lruTail) {
+        [self _locked_unlinkEntryFromLRU:entry];
+        entry.lruPrev = _lruTail;
+        entry.lruNext = nil;
+        _lruTail.lruNext = entry;
+        _lruTail = entry;
+    }
+
+    PINMemoryCacheFrequencyBucket *bucket = entry.bucket;
+    NSInteger accessCount = entry.accessCount;
+    if (accessCount == NSIntegerMax) {
+        // The count saturates, so the entry just becomes the most recent in its bucket, which it can't leave empty.
+        if (entry != bucket.tail) {
+            [self _locked_unlinkEntryFromBucket:entry];
+            [self _locked_appendEntry:entry toBucket:bucket];
+        }
+        return;
+    }
+
+    accessCount += 1;
+    entry.accessCount = accessCount;
+    PINMemoryCacheFrequencyBucket *nextBucket = bucket.next;
+    if (nextBucket == nil || nextBucket.accessCount != accessCount) {
+        nextBucket = [self _locked_insertBucketWithAccessCount:accessCount after:bucket];
+    }
+    // The next bucket is in place before the entry leaves its old one, which may then go away.
+    [self _locked_unlinkEntryFromBucket:entry];
+    [self _locked_appendEntry:entry toBucket:nextBucket];
+}
+
+- (void)_locked_removeEntry:(PINMemoryCacheEntry *)entry
+{
+    [self _locked_setTags:nil forEntry:entry];
+    [self _locked_unlinkEntryFromLRU:entry];
+    [self _locked_unlinkEntryFromBucket:entry];
+    // The entry may still be waiting in a read buffer; without an object it is skipped when drained.
+    entry.object = nil;
+    [_entries removeObjectForKey:entry.key];
+}
+
+- (void)_locked_removeAllEntries
+{
+    for (PINMemoryCacheEntry *entry in [_entries objectEnumerator]) {
+        entry.object = nil;
+    }
+    [_entries removeAllObjects];
+    [_tagIndex removeAllObjects];
+    [_buckets removeAllObjects];
+    _lruHead = nil;
+    _lruTail = nil;
+    _lowestBucket = nil;
+}
+
+- (void)_locked_setTags:(NSSet<NSString *> *)tags forEntry:(PINMemoryCacheEntry *)entry
+{
+    NSSet<NSString *> *oldTags = entry.tags;
+    if (oldTags == nil && tags.count == 0) {
+        return;
+    }
+
+    NSString *key = entry.key;
+    for (NSString *tag in oldTags) {
+        NSMutableSet<NSString *> *keys = _tagIndex[tag];
+        [keys removeObject:key];
+        if (keys.count == 0) {
+            [_tagIndex removeObjectForKey:tag];
+        }
+    }
+    for (NSString *tag in tags) {
+        NSMutableSet<NSString *> *keys = _tagIndex[tag];
+        if (keys == nil) {
+            keys = [[NSMutableSet alloc] init];
+            _tagIndex[tag] = keys;
+        }
+        [keys addObject:key];
+    }
+    entry.tags = tags.count > 0 ? tags : nil;
+}
+
+- (void)_locked_enumerateEntriesInEvictionOrder:(PINMemoryCacheEvictionOrder)order usingBlock:(PIN_NOESCAPE void (^)(PINMemoryCacheEntry *entry, BOOL *stop))block
+{
+    BOOL stop = NO;
+    switch (order) {
+        case PINMemoryCacheEvictionOrderLeastRecentlyUsed:
+            for (PINMemoryCacheEntry *entry = _lruHead; entry && !stop; entry = entry.lruNext) {
+                block(entry, &stop);
+            }
+            break;
+        case PINMemoryCacheEvictionOrderLeastFrequentlyUsed:
+            for (PINMemoryCacheFrequencyBucket *bucket = _lowestBucket; bucket && !stop; bucket = bucket.next) {
+                for (PINMemoryCacheEntry *entry = bucket.head; entry && !stop; entry = entry.lfuNext) {
+                    block(entry, &stop);
+                }
+            }
+            break;
+        case PINMemoryCacheEvictionOrderCostliest: {
+            // There's no standing order by cost, so this one sorts.
+            NSArray<PINMemoryCacheEntry *> *entries = [[_entries allValues] sortedArrayUsingComparator:^NSComparisonResult(PINMemoryCacheEntry * _Nonnull entry1, PINMemoryCacheEntry * _Nonnull entry2) {
+                NSUInteger cost1 = entry1.cost;
+                NSUInteger cost2 = entry2.cost;
+                return cost1 > cost2 ? NSOrderedAscending : (cost1 < cost2 ? NSOrderedDescending : NSOrderedSame);
+            }];
+            for (PINMemoryCacheEntry *entry in entries) {
+                block(entry, &stop);
+                if (stop)
+                    break;
+            }
+            break;
+        }
+    }
+}
+
+- (void)_locked_unlinkEntryFromLRU:(PINMemoryCacheEntry *)entry
+{
+    PINMemoryCacheEntry *prev = entry.lruPrev;
+    PINMemoryCacheEntry *next = entry.lruNext;
+    if (prev) {
+        prev.lruNext = next;
+    } else {
+        _lruHead = next;
+    }
+    if (next) {
+        next.lruPrev = prev;
+    } else {
+        _lruTail = prev;
+    }
+    entry.lruPrev = nil;
+    entry.lruNext = nil;
+}
+
+- (PINMemoryCacheFrequencyBucket *)_locked_insertBucketWithAccessCount:(NSInteger)accessCount after:(PINMemoryCacheFrequencyBucket *)prev
+{
+    PINMemoryCacheFrequencyBucket *bucket = [[PINMemoryCacheFrequencyBucket alloc] init];
+    bucket.accessCount = accessCount;
+    [_buckets addObject:bucket];
+
+    PINMemoryCacheFrequencyBucket *next = prev ? prev.next : _lowestBucket;
+    bucket.prev = prev;
+    bucket.next = next;
+    if (prev) {
+        prev.next = bucket;
+    } else {
+        _lowestBucket = bucket;
+    }
+    next.prev = bucket;
+    return bucket;
+}
+
+- (void)_locked_appendEntry:(PINMemoryCacheEntry *)entry toBucket:(PINMemoryCacheFrequencyBucket *)bucket
+{
+    entry.bucket = bucket;
+    entry.lfuPrev = bucket.tail;
+    entry.lfuNext = nil;
+    if (bucket.tail) {
+        bucket.tail.lfuNext = entry;
+    } else {
+        bucket.head = entry;
+    }
+    bucket.tail = entry;
+}
+
+- (void)_locked_unlinkEntryFromBucket:(PINMemoryCacheEntry *)entry
+{
+    PINMemoryCacheFrequencyBucket *bucket = entry.bucket;
+    PINMemoryCacheEntry *prev = entry.lfuPrev;
+    PINMemoryCacheEntry *next = entry.lfuNext;
+    if (prev) {
+        prev.lfuNext = next;
+    } else {
+        bucket.head = next;
+    }
+    if (next) {
+        next.lfuPrev = prev;
+    } else {
+        bucket.tail = prev;
+    }
+    entry.lfuPrev = nil;
+    entry.lfuNext = nil;
+    entry.bucket = nil;
+
+    if (bucket.head == nil) {
+        PINMemoryCacheFrequencyBucket *prevBucket = bucket.prev;
+        PINMemoryCacheFrequencyBucket *nextBucket = bucket.next;
+        if (prevBucket) {
+            prevBucket.next = nextBucket;
+        } else {
+            _lowestBucket = nextBucket;
+        }
+        nextBucket.prev = prevBucket;
+        [_buckets removeObject:bucket];
+    }
+}
+
+- (void)lock
+{
+    __unused int result = pthread_rwlock_wrlock(&_rwlock);
+    NSAssert(result == 0, @"Failed to lock PINMemoryCacheShard %@. Code: %d", self, result);
+
+    [self _locked_drainReadBuffers];
+}
+
+- (void)lockForReading
+{
+    __unused int result = pthread_rwlock_rdlock(&_rwlock);
+    NSAssert(result == 0, @"Failed to lock PINMemoryCacheShard %@ for reading. Code: %d", self, result);
+}
+
+- (void)unlock
+{
+    __unused int result = pthread_rwlock_unlock(&_rwlock);
+    NSAssert(result == 0, @"Failed to unlock PINMemoryCacheShard %@. Code: %d", self, result);
+}
+
+@end
+
 
 #pragma mark - Deprecated
 
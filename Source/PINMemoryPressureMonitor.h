@@ -0,0 +1,141 @@
+//
+//  PINMemoryPressureMonitor.h
+//  PINCache
+//
+//  Copyright © 2017 Pinterest. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+#import <PINCache/PINCacheMacros.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+@class PINMemoryCache;
+
+/**
+ How much memory pressure the process is under, as seen by a <PINMemoryPressureMonitor>.
+ */
+typedef NS_ENUM(NSInteger, PINMemoryPressureLevel) {
+    /// No pressure worth responding to.
+    PINMemoryPressureLevelNormal = 0,
+    /// Tasks are stalling on memory some of the time, or usage is close to the limit.
+    PINMemoryPressureLevelWarning,
+    /// All tasks are stalling on memory a meaningful fraction of the time, or usage is at the limit.
+    PINMemoryPressureLevelCritical,
+};
+
+/**
+ `PINMemoryPressureMonitor` shrinks memory caches gradually as memory pressure builds, instead of emptying them all at
+ once the way a memory warning does. It is meant for platforms without memory warnings, such as Linux servers running
+ in containers.
+
+ Pressure is read from the kernel's pressure stall information (`/proc/pressure/memory`) and from the usage and limit
+ of the process's own memory cgroup, as found in `/proc/self/cgroup`. Inputs that are missing are ignored, so a
+ monitor with no readable inputs always reports <PINMemoryPressureLevelNormal>.
+
+ At <PINMemoryPressureLevelWarning> every registered cache is trimmed to 75% of the total cost it had when the
+ pressure started, and at <PINMemoryPressureLevelCritical> to 50%, using
+ <[PINMemoryCache trimToCostByEvictionStrategy:]>. Caches are trimmed as soon as the level rises, and again every
+ <responseInterval> while it stays raised, which takes back what they grew since without shrinking them further.
+ */
+PIN_SUBCLASSING_RESTRICTED
+@interface PINMemoryPressureMonitor : NSObject
+
+/**
+ A shared monitor reading the system's pressure and cgroup files. It must be started with <start>.
+ */
+@property (class, strong, readonly) PINMemoryPressureMonitor *sharedMonitor;
+
+/**
+ The level seen by the most recent check.
+ */
+@property (readonly) PINMemoryPressureLevel currentLevel;
+
+/**
+ How often <start> checks for pressure, in seconds. Changes apply to a running monitor too. Defaults to `1.0`.
+ */
+@property (assign) NSTimeInterval pollInterval;
+
+/**
+ How long a level has to last before caches are trimmed again, in seconds. Defaults to `10.0`.
+ */
+@property (assign) NSTimeInterval responseInterval;
+
+/**
+ The `avg10` share of time, as a percentage, that some tasks spent stalled on memory at which the level becomes
+ <PINMemoryPressureLevelWarning>. Defaults to `10.0`.
+ */
+@property (assign) double warningStallPercentage;
+
+/**
+ The `avg10` share of time, as a percentage, that all tasks spent stalled on memory at which the level becomes
+ <PINMemoryPressureLevelCritical>. Defaults to `10.0`.
+ */
+@property (assign) double criticalStallPercentage;
+
+/**
+ The fraction of the cgroup's memory limit in use at which the level becomes <PINMemoryPressureLevelWarning>.
+ Defaults to `0.8`.
+ */
+@property (assign) double warningUsageFraction;
+
+/**
+ The fraction of the cgroup's memory limit in use at which the level becomes <PINMemoryPressureLevelCritical>.
+ Defaults to `0.9`.
+ */
+@property (assign) double criticalUsageFraction;
+
+/**
+ Creates a monitor reading `/proc/pressure/memory` and the cgroup v2 `memory.current` and `memory.max` files, falling
+ back to the cgroup v1 `memory.usage_in_bytes` and `memory.limit_in_bytes` files.
+ */
+- (instancetype)init;
+
+/**
+ Creates a monitor reading the given files. Any of them may be `nil` or missing.
+
+ @param pressureFileURL A file in the format of `/proc/pressure/memory`.
+ @param cgroupUsageFileURL A file containing the bytes in use.
+ @param cgroupLimitFileURL A file containing the byte limit, or `max` for none.
+ @result A new, stopped monitor.
+ */
+- (instancetype)initWithPressureFileURL:(nullable NSURL *)pressureFileURL
+                     cgroupUsageFileURL:(nullable NSURL *)cgroupUsageFileURL
+                     cgroupLimitFileURL:(nullable NSURL *)cgroupLimitFileURL NS_DESIGNATED_INITIALIZER;
+
+/**
+ Adds a cache to trim under pressure. Caches are held weakly.
+
+ @param cache The cache to trim.
+ */
+- (void)registerMemoryCache:(PINMemoryCache *)cache;
+
+/**
+ Stops trimming a cache.
+
+ @param cache The cache to stop trimming.
+ */
+- (void)unregisterMemoryCache:(PINMemoryCache *)cache;
+
+/**
+ Starts checking for pressure every <pollInterval> seconds.
+ */
+- (void)start;
+
+/**
+ Stops checking for pressure.
+ */
+- (void)stop;
+
+/**
+ Reads the inputs once, trims the registered caches if needed and updates <currentLevel>. This method blocks the
+ calling thread until the caches have been trimmed.
+
+ @result The level seen.
+ */
+- (PINMemoryPressureLevel)checkMemoryPressure;
+
+@end
+
+NS_ASSUME_NONNULL_END
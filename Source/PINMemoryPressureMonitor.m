@@ -0,0 +1,433 @@
+//
+//  PINMemoryPressureMonitor.m
+//  PINCache
+//
+//  Copyright © 2017 Pinterest. All rights reserved.
+//
+
+#import "PINMemoryPressureMonitor.h"
+
+#import <errno.h>
+#import <fcntl.h>
+#import <pthread.h>
+#import <stdlib.h>
+#import <string.h>
+#import <unistd.h>
+
+#import "PINMemoryCache.h"
+
+static NSString * const PINMemoryPressureMonitorPressurePath = @"/proc/pressure/memory";
+static NSString * const PINMemoryPressureMonitorProcessCgroupPath = @"/proc/self/cgroup";
+static NSString * const PINMemoryPressureMonitorCgroupRootPath = @"/sys/fs/cgroup";
+static NSString * const PINMemoryPressureMonitorCgroupUsageFileName = @"memory.current";
+static NSString * const PINMemoryPressureMonitorCgroupLimitFileName = @"memory.max";
+static NSString * const PINMemoryPressureMonitorLegacyCgroupRootPath = @"/sys/fs/cgroup/memory";
+static NSString * const PINMemoryPressureMonitorLegacyCgroupUsageFileName = @"memory.usage_in_bytes";
+static NSString * const PINMemoryPressureMonitorLegacyCgroupLimitFileName = @"memory.limit_in_bytes";
+// cgroup v1 reports "no limit" as a huge page aligned number rather than "max".
+static const unsigned long long PINMemoryPressureMonitorUnlimited = 1ULL << 60;
+
+// Reads a small pseudo-file into buffer as a C string. Files under /proc and /sys report a size of zero, so they are
+// read until EOF rather than by their size.
+static BOOL PINMemoryPressureMonitorReadFile(NSURL *fileURL, char *buffer, size_t capacity)
+{
+    if (fileURL == nil || capacity == 0)
+        return NO;
+
+    int fd = open(fileURL.fileSystemRepresentation, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return NO;
+
+    size_t length = 0;
+    while (length < capacity - 1) {
+        ssize_t bytesRead = read(fd, buffer + length, capacity - 1 - length);
+        if (bytesRead < 0 && errno == EINTR)
+            continue;
+        if (bytesRead <= 0)
+            break;
+        length += (size_t)bytesRead;
+    }
+    close(fd);
+    buffer[length] = '\0';
+    return length > 0;
+}
+
+// Finds the avg10 value on the line starting with prefix ("some" or "full"), or returns -1.
+static double PINMemoryPressureMonitorStallPercentage(const char *contents, const char *prefix)
+{
+    size_t prefixLength = strlen(prefix);
+    const char *line = contents;
+    while (line && *line) {
+        if (strncmp(line, prefix, prefixLength) == 0 && line[prefixLength] == ' ') {
+            const char *value = strstr(line, "avg10=");
+            const char *end = strchr(line, '\n');
+            if (value && (end == NULL || value < end))
+                return strtod(value + strlen("avg10="), NULL);
+            return -1;
+        }
+        line = strchr(line, '\n');
+        if (line)
+            line++;
+    }
+    return -1;
+}
+
+// Finds the directory of the process's own memory cgroup from /proc/self/cgroup: the "0::" line under cgroup v2, or
+// the line of the memory controller under v1. Falls back to the root of the hierarchy, which is what a container
+// without its own cgroup namespace can't see past anyway, when the process's directory isn't there.
+static NSString *PINMemoryPressureMonitorCgroupDirectory(NSString *cgroupFileContents, BOOL legacy)
+{
+    NSString *rootPath = legacy ? PINMemoryPressureMonitorLegacyCgroupRootPath : PINMemoryPressureMonitorCgroupRootPath;
+    for (NSString *line in [cgroupFileContents componentsSeparatedByString:@"\n"]) {
+        // hierarchy-ID:controller-list:cgroup-path, the path may itself contain colons.
+        NSArray<NSString *> *fields = [line componentsSeparatedByString:@":"];
+        if (fields.count < 3)
+            continue;
+
+        BOOL matches = legacy ? [[fields[1] componentsSeparatedByString:@","] containsObject:@"memory"]
+                              : ([fields[0] isEqualToString:@"0"] && fields[1].length == 0);
+        if (!matches)
+            continue;
+
+        NSString *cgroupPath = [[fields subarrayWithRange:NSMakeRange(2, fields.count - 2)] componentsJoinedByString:@":"];
+        NSString *directory = [rootPath stringByAppendingPathComponent:cgroupPath];
+        BOOL isDirectory = NO;
+        if ([[NSFileManager defaultManager] fileExistsAtPath:directory isDirectory:&isDirectory] && isDirectory)
+            return directory;
+        break;
+    }
+    return rootPath;
+}
+
+@interface PINMemoryPressureMonitor ()
+@property (copy, nonatomic) NSURL *pressureFileURL;
+@property (copy, nonatomic) NSURL *cgroupUsageFileURL;
+@property (copy, nonatomic) NSURL *cgroupLimitFileURL;
+@property (strong, nonatomic) NSHashTable<PINMemoryCache *> *caches;
+@property (strong, nonatomic) dispatch_queue_t queue;
+@property (strong, nonatomic) dispatch_source_t timer;
+@property (assign, nonatomic) pthread_mutex_t mutex;
+@end
+
+@implementation PINMemoryPressureMonitor {
+    PINMemoryPressureLevel _currentLevel;
+    NSTimeInterval _pollInterval;
+    NSTimeInterval _responseInterval;
+    double _warningStallPercentage;
+    double _criticalStallPercentage;
+    double _warningUsageFraction;
+    double _criticalUsageFraction;
+    // When the caches were last trimmed, as a reference date time interval.
+    NSTimeInterval _lastResponseTime;
+    PINMemoryPressureLevel _lastResponseLevel;
+    // Each cache's total cost when the pressure started, which the trims are a fraction of. Trimming to a fraction of
+    // the current cost instead would shrink the caches further every response for as long as the pressure lasts.
+    NSMapTable<PINMemoryCache *, NSNumber *> *_pressureStartCosts;
+}
+
+- (void)dealloc
+{
+    if (_timer)
+        dispatch_source_cancel(_timer);
+
+    __unused int result = pthread_mutex_destroy(&_mutex);
+    NSCAssert(result == 0, @"Failed to destroy lock in PINMemoryPressureMonitor %p. Code: %d", (void *)self, result);
+}
+
+- (instancetype)init
+{
+    NSString *cgroupFileContents = [NSString stringWithContentsOfFile:PINMemoryPressureMonitorProcessCgroupPath encoding:NSUTF8StringEncoding error:NULL] ?: @"";
+    NSString *directory = PINMemoryPressureMonitorCgroupDirectory(cgroupFileContents, NO);
+    NSString *usagePath = [directory stringByAppendingPathComponent:PINMemoryPressureMonitorCgroupUsageFileName];
+    NSString *limitPath = [directory stringByAppendingPathComponent:PINMemoryPressureMonitorCgroupLimitFileName];
+    if (![[NSFileManager defaultManager] fileExistsAtPath:usagePath]) {
+        directory = PINMemoryPressureMonitorCgroupDirectory(cgroupFileContents, YES);
+        usagePath = [directory stringByAppendingPathComponent:PINMemoryPressureMonitorLegacyCgroupUsageFileName];
+        limitPath = [directory stringByAppendingPathComponent:PINMemoryPressureMonitorLegacyCgroupLimitFileName];
+    }
+
+    return [self initWithPressureFileURL:[NSURL fileURLWithPath:PINMemoryPressureMonitorPressurePath]
+                      cgroupUsageFileURL:[NSURL fileURLWithPath:usagePath]
+                      cgroupLimitFileURL:[NSURL fileURLWithPath:limitPath]];
+}
+
+- (instancetype)initWithPressureFileURL:(NSURL *)pressureFileURL
+                     cgroupUsageFileURL:(NSURL *)cgroupUsageFileURL
+                     cgroupLimitFileURL:(NSURL *)cgroupLimitFileURL
+{
+    if (self = [super init]) {
+        __unused int result = pthread_mutex_init(&_mutex, NULL);
+        NSAssert(result == 0, @"Failed to init lock in PINMemoryPressureMonitor %@. Code: %d", self, result);
+
+        _pressureFileURL = [pressureFileURL copy];
+        _cgroupUsageFileURL = [cgroupUsageFileURL copy];
+        _cgroupLimitFileURL = [cgroupLimitFileURL copy];
+        _caches = [NSHashTable weakObjectsHashTable];
+        _pressureStartCosts = [NSMapTable weakToStrongObjectsMapTable];
+        _queue = dispatch_queue_create("com.pinterest.PINMemoryPressureMonitor", DISPATCH_QUEUE_SERIAL);
+
+        _currentLevel = PINMemoryPressureLevelNormal;
+        _lastResponseLevel = PINMemoryPressureLevelNormal;
+        _pollInterval = 1.0;
+        _responseInterval = 10.0;
+        _warningStallPercentage = 10.0;
+        _criticalStallPercentage = 10.0;
+        _warningUsageFraction = 0.8;
+        _criticalUsageFraction = 0.9;
+    }
+    return self;
+}
+
++ (PINMemoryPressureMonitor *)sharedMonitor
+{
+    static PINMemoryPressureMonitor *monitor;
+    static dispatch_once_t predicate;
+
+    dispatch_once(&predicate, ^{
+        monitor = [[PINMemoryPressureMonitor alloc] init];
+    });
+
+    return monitor;
+}
+
+#pragma mark - Public Methods -
+
+- (void)registerMemoryCache:(PINMemoryCache *)cache
+{
+    if (!cache)
+        return;
+
+    [self lock];
+        [_caches addObject:cache];
+    [self unlock];
+}
+
+- (void)unregisterMemoryCache:(PINMemoryCache *)cache
+{
+    if (!cache)
+        return;
+
+    [self lock];
+        [_caches removeObject:cache];
+    [self unlock];
+}
+
+- (void)start
+{
+    __weak PINMemoryPressureMonitor *weakSelf = self;
+    [self lock];
+        // Armed under the lock, so that it can't miss a change of the poll interval made meanwhile.
+        if (_timer == nil) {
+            _timer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, _queue);
+            dispatch_source_set_event_handler(_timer, ^{
+                [weakSelf checkMemoryPressure];
+            });
+            uint64_t interval = (uint64_t)(_pollInterval * NSEC_PER_SEC);
+            dispatch_source_set_timer(_timer, dispatch_time(DISPATCH_TIME_NOW, (int64_t)interval), interval, interval / 10);
+            dispatch_resume(_timer);
+        }
+    [self unlock];
+}
+
+- (void)stop
+{
+    [self lock];
+        dispatch_source_t timer = _timer;
+        _timer = nil;
+    [self unlock];
+
+    if (timer)
+        dispatch_source_cancel(timer);
+}
+
+- (PINMemoryPressureLevel)checkMemoryPressure
+{
+    [self lock];
+        double warningStallPercentage = _warningStallPercentage;
+        double criticalStallPercentage = _criticalStallPercentage;
+        double warningUsageFraction = _warningUsageFraction;
+        double criticalUsageFraction = _criticalUsageFraction;
+    [self unlock];
+
+    PINMemoryPressureLevel level = PINMemoryPressureLevelNormal;
+
+    char contents[1024];
+    if (PINMemoryPressureMonitorReadFile(_pressureFileURL, contents, sizeof(contents))) {
+        double someStall = PINMemoryPressureMonitorStallPercentage(contents, "some");
+        double fullStall = PINMemoryPressureMonitorStallPercentage(contents, "full");
+        if (fullStall >= criticalStallPercentage) {
+            level = PINMemoryPressureLevelCritical;
+        } else if (someStall >= warningStallPercentage) {
+            level = PINMemoryPressureLevelWarning;
+        }
+    }
+
+    if (level < PINMemoryPressureLevelCritical
+        && PINMemoryPressureMonitorReadFile(_cgroupLimitFileURL, contents, sizeof(contents))
+        && strncmp(contents, "max", 3) != 0) {
+        unsigned long long limit = strtoull(contents, NULL, 10);
+        if (limit > 0 && limit < PINMemoryPressureMonitorUnlimited
+            && PINMemoryPressureMonitorReadFile(_cgroupUsageFileURL, contents, sizeof(contents))) {
+            double usage = (double)strtoull(contents, NULL, 10) / (double)limit;
+            if (usage >= criticalUsageFraction) {
+                level = PINMemoryPressureLevelCritical;
+            } else if (usage >= warningUsageFraction && level < PINMemoryPressureLevelWarning) {
+                level = PINMemoryPressureLevelWarning;
+            }
+        }
+    }
+
+    NSTimeInterval now = [[NSDate date] timeIntervalSinceReferenceDate];
+    NSArray<PINMemoryCache *> *caches = nil;
+    [self lock];
+        _currentLevel = level;
+        BOOL shouldRespond = NO;
+        if (level == PINMemoryPressureLevelNormal) {
+            _lastResponseLevel = PINMemoryPressureLevelNormal;
+            [_pressureStartCosts removeAllObjects];
+        } else if (level > _lastResponseLevel || now - _lastResponseTime >= _responseInterval) {
+            shouldRespond = YES;
+            _lastResponseLevel = level;
+            _lastResponseTime = now;
+            caches = [_caches allObjects];
+        }
+    [self unlock];
+
+    if (shouldRespond) {
+        for (PINMemoryCache *cache in caches) {
+            NSUInteger totalCost = cache.totalCost;
+            [self lock];
+                NSNumber *startCost = [_pressureStartCosts objectForKey:cache];
+                if (startCost == nil) {
+                    startCost = @(totalCost);
+                    [_pressureStartCosts setObject:startCost forKey:cache];
+                }
+            [self unlock];
+
+            NSUInteger baseCost = [startCost unsignedIntegerValue];
+            NSUInteger targetCost = level == PINMemoryPressureLevelCritical ? baseCost / 2 : baseCost - baseCost / 4;
+            [cache trimToCostByEvictionStrategy:targetCost];
+        }
+    }
+
+    return level;
+}
+
+#pragma mark - Public Thread Safe Accessors -
+
+- (PINMemoryPressureLevel)currentLevel
+{
+    [self lock];
+        PINMemoryPressureLevel level = _currentLevel;
+    [self unlock];
+    return level;
+}
+
+- (NSTimeInterval)pollInterval
+{
+    [self lock];
+        NSTimeInterval pollInterval = _pollInterval;
+    [self unlock];
+    return pollInterval;
+}
+
+- (void)setPollInterval:(NSTimeInterval)pollInterval
+{
+    [self lock];
+        _pollInterval = pollInterval;
+        // A running timer is re-armed so the new interval applies from now on.
+        if (_timer) {
+            uint64_t interval = (uint64_t)(pollInterval * NSEC_PER_SEC);
+            dispatch_source_set_timer(_timer, dispatch_time(DISPATCH_TIME_NOW, (int64_t)interval), interval, interval / 10);
+        }
+    [self unlock];
+}
+
+- (NSTimeInterval)responseInterval
+{
+    [self lock];
+        NSTimeInterval responseInterval = _responseInterval;
+    [self unlock];
+    return responseInterval;
+}
+
+- (void)setResponseInterval:(NSTimeInterval)responseInterval
+{
+    [self lock];
+        _responseInterval = responseInterval;
+    [self unlock];
+}
+
+- (double)warningStallPercentage
+{
+    [self lock];
+        double percentage = _warningStallPercentage;
+    [self unlock];
+    return percentage;
+}
+
+- (void)setWarningStallPercentage:(double)warningStallPercentage
+{
+    [self lock];
+        _warningStallPercentage = warningStallPercentage;
+    [self unlock];
+}
+
+- (double)criticalStallPercentage
+{
+    [self lock];
+        double percentage = _criticalStallPercentage;
+    [self unlock];
+    return percentage;
+}
+
+- (void)setCriticalStallPercentage:(double)criticalStallPercentage
+{
+    [self lock];
+        _criticalStallPercentage = criticalStallPercentage;
+    [self unlock];
+}
+
+- (double)warningUsageFraction
+{
+    [self lock];
+        double fraction = _warningUsageFraction;
+    [self unlock];
+    return fraction;
+}
+
+- (void)setWarningUsageFraction:(double)warningUsageFraction
+{
+    [self lock];
+        _warningUsageFraction = warningUsageFraction;
+    [self unlock];
+}
+
+- (double)criticalUsageFraction
+{
+    [self lock];
+        double fraction = _criticalUsageFraction;
+    [self unlock];
+    return fraction;
+}
+
+- (void)setCriticalUsageFraction:(double)criticalUsageFraction
+{
+    [self lock];
+        _criticalUsageFraction = criticalUsageFraction;
+    [self unlock];
+}
+
+- (void)lock
+{
+    __unused int result = pthread_mutex_lock(&_mutex);
+    NSAssert(result == 0, @"Failed to lock PINMemoryPressureMonitor %@. Code: %d", self, result);
+}
+
+- (void)unlock
+{
+    __unused int result = pthread_mutex_unlock(&_mutex);
+    NSAssert(result == 0, @"Failed to unlock PINMemoryPressureMonitor %@. Code: %d", self, result);
+}
+
+@end
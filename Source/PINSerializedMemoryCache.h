@@ -0,0 +1,86 @@
+//
+//  PINSerializedMemoryCache.h
+//  PINCache
+//
+//  Copyright © 2017 Pinterest. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ A thread safe, byte budgeted, least recently used store of serialized objects, used by <PINCache> as a tier between its
+ memory and disk caches. Serialized objects are usually much smaller than the live objects they come from, and can be
+ compressed further, so the same memory holds many more of them.
+ */
+@interface PINSerializedMemoryCache : NSObject
+
+/**
+ The maximum number of bytes to hold. The least recently used data is evicted to stay within it. Data bigger than the
+ limit is not stored. Setting it to `0` empties the cache.
+ */
+@property (assign) NSUInteger byteLimit;
+
+/**
+ Whether data is stored LZ4 compressed. Data that doesn't shrink by at least an eighth is stored as is. Compression
+ needs iOS 13, macOS 10.15, tvOS 13 or watchOS 6; on older systems data is always stored as is. Defaults to `YES`.
+ */
+@property (assign) BOOL compressesData;
+
+/**
+ The number of bytes held, after compression.
+ */
+@property (readonly) NSUInteger byteCount;
+
+- (instancetype)initWithByteLimit:(NSUInteger)byteLimit NS_DESIGNATED_INITIALIZER;
+- (instancetype)init NS_UNAVAILABLE;
+
+/**
+ Stores data, replacing any data already stored for the key, and evicts as needed to stay within <byteLimit>.
+
+ @param data The serialized object.
+ @param key The key of the object.
+ @param createdTime When the object was first cached, in seconds since the reference date.
+ */
+- (void)setData:(NSData *)data forKey:(NSString *)key createdTime:(CFAbsoluteTime)createdTime;
+
+/**
+ Removes the data for a key and returns it, decompressed.
+
+ @param key The key of the object.
+ @param createdTime Set to when the object was first cached, if data is returned.
+ @result The data, or `nil` if there was none.
+ */
+- (nullable NSData *)removeDataForKey:(NSString *)key createdTime:(nullable CFAbsoluteTime *)createdTime;
+
+/**
+ Whether there is data for a key. Doesn't count as a use.
+ */
+- (BOOL)containsDataForKey:(NSString *)key;
+
+/**
+ Removes the data for a key, if any.
+ */
+- (void)discardDataForKey:(NSString *)key;
+
+/**
+ Removes data for objects first cached before the given time.
+
+ @param time A time in seconds since the reference date.
+ */
+- (void)discardDataCreatedBefore:(CFAbsoluteTime)time;
+
+/**
+ Removes the data for keys that start with a prefix.
+ */
+- (void)discardDataForKeysWithPrefix:(NSString *)prefix;
+
+/**
+ Removes all data.
+ */
+- (void)discardAllData;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,260 @@
+//
+//  PINSerializedMemoryCache.m
+//  PINCache
+//
+//  Copyright © 2017 Pinterest. All rights reserved.
+//
+
+#import "PINSerializedMemoryCache.h"
+
+#import <pthread.h>
+
+#import "PINCacheLinkedList.h"
+
+// Small payloads rarely compress well enough to pay for the framing.
+static const NSUInteger PINSerializedMemoryCacheMinimumCompressedLength = 64;
+
+// Linked into the LRU list, least recently used first. Entries are owned by the dictionary.
+@interface PINSerializedMemoryCacheEntry : PINCacheLinkedListNode
+@property (nonatomic, copy) NSString *key;
+@property (nonatomic, strong) NSData *data;
+@property (nonatomic) BOOL compressed;
+// When the object was first cached, in seconds since the reference date.
+@property (nonatomic) CFAbsoluteTime createdTime;
+@end
+
+@interface PINSerializedMemoryCache ()
+@property (strong, nonatomic) NSMutableDictionary<NSString *, PINSerializedMemoryCacheEntry *> *entries;
+@property (assign, nonatomic) pthread_mutex_t mutex;
+@end
+
+@implementation PINSerializedMemoryCache {
+    NSUInteger _byteLimit;
+    NSUInteger _byteCount;
+    BOOL _compressesData;
+    PINCacheLinkedList<PINSerializedMemoryCacheEntry *> *_lruList;
+}
+
+- (void)dealloc
+{
+    __unused int result = pthread_mutex_destroy(&_mutex);
+    NSCAssert(result == 0, @"Failed to destroy lock in PINSerializedMemoryCache %p. Code: %d", (void *)self, result);
+}
+
+- (instancetype)initWithByteLimit:(NSUInteger)byteLimit
+{
+    if (self = [super init]) {
+        __unused int result = pthread_mutex_init(&_mutex, NULL);
+        NSAssert(result == 0, @"Failed to init lock in PINSerializedMemoryCache %@. Code: %d", self, result);
+
+        _entries = [[NSMutableDictionary alloc] init];
+        _lruList = [[PINCacheLinkedList alloc] init];
+        _byteLimit = byteLimit;
+        _compressesData = YES;
+    }
+    return self;
+}
+
+#pragma mark - Public Methods -
+
+- (void)setData:(NSData *)data forKey:(NSString *)key createdTime:(CFAbsoluteTime)createdTime
+{
+    if (!data || !key)
+        return;
+
+    [self lock];
+        NSUInteger byteLimit = _byteLimit;
+        BOOL compressesData = _compressesData;
+    [self unlock];
+
+    // Compress before taking the lock; it's the expensive part.
+    NSData *storedData = data;
+    BOOL compressed = NO;
+    if (compressesData && data.length >= PINSerializedMemoryCacheMinimumCompressedLength) {
+        if (@available(iOS 13.0, macOS 10.15, tvOS 13.0, watchOS 6.0, *)) {
+            NSData *compressedData = [data compressedDataUsingAlgorithm:NSDataCompressionAlgorithmLZ4 error:NULL];
+            if (compressedData && compressedData.length <= data.length - data.length / 8) {
+                storedData = compressedData;
+                compressed = YES;
+            }
+        }
+    }
+
+    [self lock];
+        [self _locked_removeEntry:_entries[key]];
+
+        if (storedData.length <= byteLimit) {
+            PINSerializedMemoryCacheEntry *entry = [[PINSerializedMemoryCacheEntry alloc] init];
+            entry.key = key;
+            entry.data = storedData;
+            entry.compressed = compressed;
+            entry.createdTime = createdTime;
+            _entries[entry.key] = entry;
+            [_lruList appendNode:entry];
+            _byteCount += storedData.length;
+
+            [self _locked_trimToByteLimit:_byteLimit];
+        }
+    [self unlock];
+}
+
+- (NSData *)removeDataForKey:(NSString *)key createdTime:(CFAbsoluteTime *)createdTime
+{
+    if (!key)
+        return nil;
+
+    [self lock];
+        PINSerializedMemoryCacheEntry *entry = _entries[key];
+        [self _locked_removeEntry:entry];
+    [self unlock];
+
+    if (entry == nil)
+        return nil;
+
+    if (createdTime)
+        *createdTime = entry.createdTime;
+
+    if (entry.compressed) {
+        if (@available(iOS 13.0, macOS 10.15, tvOS 13.0, watchOS 6.0, *)) {
+            return [entry.data decompressedDataUsingAlgorithm:NSDataCompressionAlgorithmLZ4 error:NULL];
+        }
+        return nil;
+    }
+    return entry.data;
+}
+
+- (BOOL)containsDataForKey:(NSString *)key
+{
+    if (!key)
+        return NO;
+
+    [self lock];
+        BOOL containsData = _entries[key] != nil;
+    [self unlock];
+    return containsData;
+}
+
+- (void)discardDataForKey:(NSString *)key
+{
+    if (!key)
+        return;
+
+    [self lock];
+        [self _locked_removeEntry:_entries[key]];
+    [self unlock];
+}
+
+- (void)discardDataCreatedBefore:(CFAbsoluteTime)time
+{
+    [self lock];
+        PINSerializedMemoryCacheEntry *entry = _lruList.head;
+        while (entry) {
+            PINSerializedMemoryCacheEntry *next = entry.next;
+            if (entry.createdTime < time)
+                [self _locked_removeEntry:entry];
+            entry = next;
+        }
+    [self unlock];
+}
+
+- (void)discardDataForKeysWithPrefix:(NSString *)prefix
+{
+    if (!prefix)
+        return;
+
+    [self lock];
+        PINSerializedMemoryCacheEntry *entry = _lruList.head;
+        while (entry) {
+            PINSerializedMemoryCacheEntry *next = entry.next;
+            if ([entry.key hasPrefix:prefix])
+                [self _locked_removeEntry:entry];
+            entry = next;
+        }
+    [self unlock];
+}
+
+- (void)discardAllData
+{
+    [self lock];
+        [_entries removeAllObjects];
+        [_lruList removeAllNodes];
+        _byteCount = 0;
+    [self unlock];
+}
+
+#pragma mark - Private Methods -
+
+- (void)_locked_removeEntry:(PINSerializedMemoryCacheEntry *)entry
+{
+    if (entry == nil)
+        return;
+
+    [_lruList removeNode:entry];
+    _byteCount -= entry.data.length;
+    [_entries removeObjectForKey:entry.key];
+}
+
+- (void)_locked_trimToByteLimit:(NSUInteger)byteLimit
+{
+    while (_byteCount > byteLimit && _lruList.head) {
+        [self _locked_removeEntry:_lruList.head];
+    }
+}
+
+#pragma mark - Public Thread Safe Accessors -
+
+- (NSUInteger)byteLimit
+{
+    [self lock];
+        NSUInteger byteLimit = _byteLimit;
+    [self unlock];
+    return byteLimit;
+}
+
+- (void)setByteLimit:(NSUInteger)byteLimit
+{
+    [self lock];
+        _byteLimit = byteLimit;
+        [self _locked_trimToByteLimit:byteLimit];
+    [self unlock];
+}
+
+- (BOOL)compressesData
+{
+    [self lock];
+        BOOL compressesData = _compressesData;
+    [self unlock];
+    return compressesData;
+}
+
+- (void)setCompressesData:(BOOL)compressesData
+{
+    [self lock];
+        _compressesData = compressesData;
+    [self unlock];
+}
+
+- (NSUInteger)byteCount
+{
+    [self lock];
+        NSUInteger byteCount = _byteCount;
+    [self unlock];
+    return byteCount;
+}
+
+- (void)lock
+{
+    __unused int result = pthread_mutex_lock(&_mutex);
+    NSAssert(result == 0, @"Failed to lock PINSerializedMemoryCache %@. Code: %d", self, result);
+}
+
+- (void)unlock
+{
+    __unused int result = pthread_mutex_unlock(&_mutex);
+    NSAssert(result == 0, @"Failed to unlock PINSerializedMemoryCache %@. Code: %d", self, result);
+}
+
+@end
+
+@implementation PINSerializedMemoryCacheEntry
+@end
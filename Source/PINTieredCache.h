@@ -0,0 +1,121 @@
+//
+//  PINTieredCache.h
+//  PINCache
+//
+//  Copyright © 2017 Pinterest. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+#import <PINCache/PINCacheMacros.h>
+#import <PINCache/PINCaching.h>
+#import <PINCache/PINCacheObjectSubscripting.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ Where an object found below the first tier is copied on its way back to the caller.
+ */
+typedef NS_ENUM(NSInteger, PINTieredCachePromotionPolicy) {
+    /// Into every tier above the one it was found in, so the next lookup is answered by the first tier.
+    PINTieredCachePromotionPolicyAllTiers = 0,
+    /// Into the tier right above the one it was found in, so objects climb one tier per hit and only hot objects reach
+    /// the top.
+    PINTieredCachePromotionPolicyNextTier,
+    /// Nowhere, tiers only get what is set.
+    PINTieredCachePromotionPolicyNone,
+};
+
+/**
+ Where an object a tier evicts to stay within its limits is copied.
+ */
+typedef NS_ENUM(NSInteger, PINTieredCacheDemotionPolicy) {
+    /// Nowhere, objects evicted from a tier are only in the tiers below if they were written or promoted there.
+    PINTieredCacheDemotionPolicyNone = 0,
+    /// Into the tier right below the one that evicted it, unless that tier already has it. Only evictions of
+    /// <PINMemoryCache> tiers to stay within their cost limit are seen; other tiers don't report theirs.
+    PINTieredCacheDemotionPolicyNextTier,
+};
+
+/**
+ Which tiers an object that is set goes to, and when.
+ */
+typedef NS_ENUM(NSInteger, PINTieredCacheWritePolicy) {
+    /// Every tier, before the set returns or calls its completion block.
+    PINTieredCacheWritePolicyWriteThrough = 0,
+    /// The first tier before the set returns or calls its completion block. Lower tiers are filled asynchronously
+    /// afterwards, so an object set just before the app exits may only be in the first tier.
+    PINTieredCacheWritePolicyWriteBehind,
+    /// The last tier only, after removing the key from the tiers above. Objects reach upper tiers when they're read,
+    /// so objects written once and never read don't take up room in them.
+    PINTieredCacheWritePolicyWriteAround,
+};
+
+/**
+ `PINTieredCache` stacks any number of caches, fastest first, behind one <PINCaching> interface. A lookup asks each
+ tier in turn and copies what it finds into the tiers above according to <promotionPolicy>; a set writes the tiers
+ chosen by <writePolicy>; evictions copy objects into the tier below according to <demotionPolicy>; removals and trims
+ apply to every tier. Tiers can be any <PINCaching> implementation, including a <PINCache>, so e.g. a memory cache, a
+ disk cache on fast storage and a cache in front of a remote store can be composed without any of them knowing about
+ the others.
+
+ Sets pass their cost and age limit to every tier they write, and the cache remembers them for promotions and
+ demotions, which pass on the cost and what is left of the age limit, so copying an object between tiers never extends
+ its life. Only those of the last 10,000 objects set with a cost or an age limit are remembered, and those of an object
+ evicted by the last tier are forgotten. Objects put in a tier some other way, or whose attributes were forgotten, get
+ the defaults of the tiers they're copied into. Tiers are expected to be thread safe, and are called from whatever
+ thread the caller or the previous tier's completion block is on.
+ */
+PIN_SUBCLASSING_RESTRICTED
+@interface PINTieredCache : NSObject <PINCaching, PINCacheObjectSubscripting>
+
+#pragma mark - Properties
+/// @name Properties
+
+/**
+ The tiers, fastest first.
+ */
+@property (readonly, copy) NSArray<id <PINCaching>> *tiers;
+
+/**
+ Where objects found below the first tier are copied. Promotions are asynchronous, lookups don't wait for them.
+ Defaults to `PINTieredCachePromotionPolicyAllTiers`.
+ */
+@property (assign) PINTieredCachePromotionPolicy promotionPolicy;
+
+/**
+ Where objects evicted from a tier are copied. Demotions are asynchronous. Defaults to
+ `PINTieredCacheDemotionPolicyNone`.
+ */
+@property (assign) PINTieredCacheDemotionPolicy demotionPolicy;
+
+/**
+ Which tiers objects that are set go to. Defaults to `PINTieredCacheWritePolicyWriteThrough`.
+ */
+@property (assign) PINTieredCacheWritePolicy writePolicy;
+
+/**
+ Whether an asynchronous lookup that misses the first tier asks all the other tiers at once, rather than one after the
+ other. The object from the highest tier that has one is still the one returned, but a slow tier no longer delays
+ asking the tiers below it. This costs a request to every tier on every miss of the first tier, which slow tiers
+ may charge for. Synchronous lookups always go one tier at a time. Defaults to `NO`.
+ */
+@property (assign) BOOL probesLowerTiersInParallel;
+
+#pragma mark - Lifecycle
+/// @name Initialization
+
+/**
+ Creates a tiered cache.
+
+ @param name The name of the cache.
+ @param tiers The caches to stack, fastest first. There must be at least one.
+ @result A new cache.
+ */
+- (instancetype)initWithName:(NSString *)name tiers:(NSArray<id <PINCaching>> *)tiers NS_DESIGNATED_INITIALIZER;
+
+- (instancetype)init NS_UNAVAILABLE;
+
+@end
+
+NS_ASSUME_NONNULL_END
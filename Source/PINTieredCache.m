@@ -0,0 +1,758 @@
+//
+//  PINTieredCache.m
+//  PINCache
+//
+//  Copyright © 2017 Pinterest. All rights reserved.
+//
+
+#import "PINTieredCache.h"
+
+#import "PINMemoryCache+Private.h"
+
+#import <pthread.h>
+#import <stdatomic.h>
+
+// Beyond this many, the attributes of the objects set longest ago are dropped, since tiers that don't report their
+// evictions would otherwise leave them behind for good.
+static const NSUInteger PINTieredCacheMaxObjectAttributesCount = 10000;
+
+typedef void (^PINTieredCacheProbeReportBlock)(id _Nullable object);
+typedef void (^PINTieredCacheProbeLookupBlock)(id <PINCaching> tier, PINTieredCacheProbeReportBlock report);
+typedef void (^PINTieredCacheProbeCompletionBlock)(id _Nullable object, NSUInteger tierIndex);
+
+/**
+ One asynchronous lookup across the tiers. Tiers report back in any order, and the lookup finishes as soon as the
+ highest tier with an object has reported and every tier above it has reported a miss.
+ */
+@interface PINTieredCacheProbe : NSObject
+- (instancetype)initWithTiers:(NSArray<id <PINCaching>> *)tiers
+                     parallel:(BOOL)parallel
+                       lookup:(PINTieredCacheProbeLookupBlock)lookup
+                   completion:(PINTieredCacheProbeCompletionBlock)completion NS_DESIGNATED_INITIALIZER;
+- (instancetype)init NS_UNAVAILABLE;
+- (void)start;
+@end
+
+/**
+ The cost and age limit an object was set with, so that copies made by promotions and demotions can be set with them.
+ */
+@interface PINTieredCacheObjectAttributes : NSObject
+@property (assign, nonatomic) NSUInteger cost;
+@property (assign, nonatomic) NSTimeInterval ageLimit;
+@property (assign, nonatomic) CFAbsoluteTime createdTime;
+@end
+
+@implementation PINTieredCacheObjectAttributes
+@end
+
+@interface PINTieredCache ()
+@property (copy, nonatomic) NSString *name;
+@property (assign, nonatomic) pthread_mutex_t mutex;
+@end
+
+@implementation PINTieredCache {
+    _Atomic(PINTieredCachePromotionPolicy) _promotionPolicy;
+    _Atomic(PINTieredCacheDemotionPolicy) _demotionPolicy;
+    _Atomic(PINTieredCacheWritePolicy) _writePolicy;
+    atomic_bool _probesLowerTiersInParallel;
+    // Only objects set with a cost or an age limit have attributes, guarded by the lock. They go when the key is
+    // removed, trimmed, expires, is evicted by the last tier or is missed by every tier.
+    NSMutableDictionary<NSString *, PINTieredCacheObjectAttributes *> *_objectAttributes;
+    // What each memory cache tier returned for the eviction observer added to it, by tier index.
+    NSDictionary<NSNumber *, id> *_evictionObservers;
+}
+
+#pragma mark - Initialization -
+
+- (void)dealloc
+{
+    [_evictionObservers enumerateKeysAndObjectsUsingBlock:^(NSNumber *tierIndex, id observer, BOOL *stop) {
+        [(PINMemoryCache *)self->_tiers[tierIndex.unsignedIntegerValue] removeEvictionObserver:observer];
+    }];
+
+    __unused int result = pthread_mutex_destroy(&_mutex);
+    NSCAssert(result == 0, @"Failed to destroy lock in PINTieredCache %p. Code: %d", (void *)self, result);
+}
+
+- (instancetype)init
+{
+    @throw [NSException exceptionWithName:@"Must initialize with a name and tiers" reason:@"PINTieredCache must be initialized with a name and tiers. Call initWithName:tiers: instead." userInfo:nil];
+    return [self initWithName:@"" tiers:@[]];
+}
+
+- (instancetype)initWithName:(NSString *)name tiers:(NSArray<id <PINCaching>> *)tiers
+{
+    NSAssert(tiers.count > 0, @"PINTieredCache needs at least one tier.");
+
+    if (self = [super init]) {
+        __unused int result = pthread_mutex_init(&_mutex, NULL);
+        NSAssert(result == 0, @"Failed to init lock in PINTieredCache %@. Code: %d", self, result);
+
+        _name = [name copy];
+        _tiers = [tiers copy];
+        _objectAttributes = [[NSMutableDictionary alloc] init];
+        atomic_init(&_promotionPolicy, PINTieredCachePromotionPolicyAllTiers);
+        atomic_init(&_demotionPolicy, PINTieredCacheDemotionPolicyNone);
+        atomic_init(&_writePolicy, PINTieredCacheWritePolicyWriteThrough);
+        atomic_init(&_probesLowerTiersInParallel, NO);
+
+        // Memory caches are the only tiers that report their evictions.
+        __weak PINTieredCache *weakSelf = self;
+        NSUInteger lastTierIndex = _tiers.count - 1;
+        NSMutableDictionary<NSNumber *, id> *evictionObservers = [[NSMutableDictionary alloc] init];
+        for (NSUInteger idx = 0; idx <= lastTierIndex; idx++) {
+            if (![_tiers[idx] isKindOfClass:[PINMemoryCache class]]) {
+                continue;
+            }
+            evictionObservers[@(idx)] = [(PINMemoryCache *)_tiers[idx] addEvictionObserver:^(PINMemoryCache *cache, NSString *key, id object, CFAbsoluteTime createdTime) {
+                if (idx == lastTierIndex) {
+                    [weakSelf forgetAttributesForKey:key];
+                } else {
+                    [weakSelf demoteObject:object forKey:key fromTierAtIndex:idx];
+                }
+            }];
+        }
+        _evictionObservers = [evictionObservers copy];
+    }
+    return self;
+}
+
+- (NSString *)description
+{
+    return [[NSString alloc] initWithFormat:@"%@.%@.%p", NSStringFromClass([self class]), _name, (void *)self];
+}
+
+#pragma mark - Public Asynchronous Methods -
+
+- (void)containsObjectForKeyAsync:(NSString *)key completion:(PINCacheObjectContainmentBlock)block
+{
+    if (!key || !block) {
+        return;
+    }
+
+    PINTieredCacheProbe *probe = [[PINTieredCacheProbe alloc] initWithTiers:_tiers parallel:self.probesLowerTiersInParallel lookup:^(id <PINCaching> tier, PINTieredCacheProbeReportBlock report) {
+        [tier containsObjectForKeyAsync:key completion:^(BOOL containsObject) {
+            report(containsObject ? @YES : nil);
+        }];
+    } completion:^(id object, NSUInteger tierIndex) {
+        block(object != nil);
+    }];
+    [probe start];
+}
+
+- (void)objectForKeyAsync:(NSString *)key completion:(PINCacheObjectBlock)block
+{
+    if (!key || !block) {
+        return;
+    }
+
+    PINTieredCacheProbe *probe = [[PINTieredCacheProbe alloc] initWithTiers:_tiers parallel:self.probesLowerTiersInParallel lookup:^(id <PINCaching> tier, PINTieredCacheProbeReportBlock report) {
+        [tier objectForKeyAsync:key completion:^(id <PINCaching> cache, NSString *tierKey, id tierObject) {
+            report(tierObject);
+        }];
+    } completion:^(id object, NSUInteger tierIndex) {
+        if (object) {
+            [self promoteObject:object forKey:key fromTierAtIndex:tierIndex];
+        } else {
+            [self forgetAttributesForKey:key];
+        }
+        block(self, key, object);
+    }];
+    [probe start];
+}
+
+- (void)setObjectAsync:(id)object forKey:(NSString *)key completion:(PINCacheObjectBlock)block
+{
+    [self setObjectAsync:object forKey:key withCost:0 ageLimit:0.0 completion:block];
+}
+
+- (void)setObjectAsync:(id)object forKey:(NSString *)key withAgeLimit:(NSTimeInterval)ageLimit completion:(PINCacheObjectBlock)block
+{
+    [self setObjectAsync:object forKey:key withCost:0 ageLimit:ageLimit completion:block];
+}
+
+- (void)setObjectAsync:(id)object forKey:(NSString *)key withCost:(NSUInteger)cost completion:(PINCacheObjectBlock)block
+{
+    [self setObjectAsync:object forKey:key withCost:cost ageLimit:0.0 completion:block];
+}
+
+- (void)setObjectAsync:(id)object forKey:(NSString *)key withCost:(NSUInteger)cost ageLimit:(NSTimeInterval)ageLimit completion:(PINCacheObjectBlock)block
+{
+    if (!key || !object) {
+        return;
+    }
+
+    [self rememberCost:cost ageLimit:ageLimit forKey:key];
+    dispatch_group_t group = dispatch_group_create();
+    NSUInteger lastTierIndex = _tiers.count - 1;
+    switch (self.writePolicy) {
+        case PINTieredCacheWritePolicyWriteThrough:
+            for (id <PINCaching> tier in _tiers) {
+                dispatch_group_enter(group);
+                [tier setObjectAsync:object forKey:key withCost:cost ageLimit:ageLimit completion:^(id <PINCaching> cache, NSString *tierKey, id tierObject) {
+                    dispatch_group_leave(group);
+                }];
+            }
+            break;
+        case PINTieredCacheWritePolicyWriteBehind:
+            dispatch_group_enter(group);
+            [_tiers[0] setObjectAsync:object forKey:key withCost:cost ageLimit:ageLimit completion:^(id <PINCaching> cache, NSString *tierKey, id tierObject) {
+                dispatch_group_leave(group);
+            }];
+            [self fillLowerTiersWithObject:object forKey:key withCost:cost ageLimit:ageLimit];
+            break;
+        case PINTieredCacheWritePolicyWriteAround:
+            for (NSUInteger idx = 0; idx < lastTierIndex; idx++) {
+                dispatch_group_enter(group);
+                [_tiers[idx] removeObjectForKeyAsync:key completion:^(id <PINCaching> cache, NSString *tierKey, id tierObject) {
+                    dispatch_group_leave(group);
+                }];
+            }
+            dispatch_group_enter(group);
+            [_tiers[lastTierIndex] setObjectAsync:object forKey:key withCost:cost ageLimit:ageLimit completion:^(id <PINCaching> cache, NSString *tierKey, id tierObject) {
+                dispatch_group_leave(group);
+            }];
+            break;
+    }
+
+    if (block) {
+        dispatch_group_notify(group, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+            block(self, key, object);
+        });
+    }
+}
+
+- (void)removeObjectForKeyAsync:(NSString *)key completion:(PINCacheObjectBlock)block
+{
+    if (!key) {
+        return;
+    }
+
+    [self forgetAttributesForKey:key];
+    dispatch_group_t group = dispatch_group_create();
+    for (id <PINCaching> tier in _tiers) {
+        dispatch_group_enter(group);
+        [tier removeObjectForKeyAsync:key completion:^(id <PINCaching> cache, NSString *tierKey, id tierObject) {
+            dispatch_group_leave(group);
+        }];
+    }
+
+    if (block) {
+        dispatch_group_notify(group, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+            block(self, key, nil);
+        });
+    }
+}
+
+- (void)trimToDateAsync:(NSDate *)date completion:(PINCacheBlock)block
+{
+    if (!date) {
+        return;
+    }
+
+    [self forgetAttributesCreatedBefore:[date timeIntervalSinceReferenceDate]];
+    [self forEachTierAsync:^(id <PINCaching> tier, PINCacheBlock tierBlock) {
+        [tier trimToDateAsync:date completion:tierBlock];
+    } completion:block];
+}
+
+- (void)removeExpiredObjectsAsync:(PINCacheBlock)block
+{
+    [self forgetExpiredAttributes];
+    [self forEachTierAsync:^(id <PINCaching> tier, PINCacheBlock tierBlock) {
+        [tier removeExpiredObjectsAsync:tierBlock];
+    } completion:block];
+}
+
+- (void)removeAllObjectsAsync:(PINCacheBlock)block
+{
+    [self forgetAllAttributes];
+    [self forEachTierAsync:^(id <PINCaching> tier, PINCacheBlock tierBlock) {
+        [tier removeAllObjectsAsync:tierBlock];
+    } completion:block];
+}
+
+#pragma mark - Public Synchronous Methods -
+
+- (BOOL)containsObjectForKey:(NSString *)key
+{
+    if (!key) {
+        return NO;
+    }
+
+    for (id <PINCaching> tier in _tiers) {
+        if ([tier containsObjectForKey:key]) {
+            return YES;
+        }
+    }
+    return NO;
+}
+
+- (id)objectForKey:(NSString *)key
+{
+    if (!key) {
+        return nil;
+    }
+
+    NSUInteger tierCount = _tiers.count;
+    for (NSUInteger idx = 0; idx < tierCount; idx++) {
+        id object = [_tiers[idx] objectForKey:key];
+        if (object) {
+            [self promoteObject:object forKey:key fromTierAtIndex:idx];
+            return object;
+        }
+    }
+    [self forgetAttributesForKey:key];
+    return nil;
+}
+
+- (void)setObject:(id)object forKey:(NSString *)key
+{
+    [self setObject:object forKey:key withCost:0 ageLimit:0.0];
+}
+
+- (void)setObject:(id)object forKey:(NSString *)key withAgeLimit:(NSTimeInterval)ageLimit
+{
+    [self setObject:object forKey:key withCost:0 ageLimit:ageLimit];
+}
+
+- (void)setObject:(id)object forKey:(NSString *)key withCost:(NSUInteger)cost
+{
+    [self setObject:object forKey:key withCost:cost ageLimit:0.0];
+}
+
+- (void)setObject:(id)object forKey:(NSString *)key withCost:(NSUInteger)cost ageLimit:(NSTimeInterval)ageLimit
+{
+    if (!key || !object) {
+        return;
+    }
+
+    [self rememberCost:cost ageLimit:ageLimit forKey:key];
+    NSUInteger lastTierIndex = _tiers.count - 1;
+    switch (self.writePolicy) {
+        case PINTieredCacheWritePolicyWriteThrough:
+            for (id <PINCaching> tier in _tiers) {
+                [tier setObject:object forKey:key withCost:cost ageLimit:ageLimit];
+            }
+            break;
+        case PINTieredCacheWritePolicyWriteBehind:
+            [_tiers[0] setObject:object forKey:key withCost:cost ageLimit:ageLimit];
+            [self fillLowerTiersWithObject:object forKey:key withCost:cost ageLimit:ageLimit];
+            break;
+        case PINTieredCacheWritePolicyWriteAround:
+            for (NSUInteger idx = 0; idx < lastTierIndex; idx++) {
+                [_tiers[idx] removeObjectForKey:key];
+            }
+            [_tiers[lastTierIndex] setObject:object forKey:key withCost:cost ageLimit:ageLimit];
+            break;
+    }
+}
+
+- (nullable id)objectForKeyedSubscript:(NSString *)key
+{
+    return [self objectForKey:key];
+}
+
+- (void)setObject:(nullable id)obj forKeyedSubscript:(NSString *)key
+{
+    if (obj == nil) {
+        [self removeObjectForKey:key];
+    } else {
+        [self setObject:obj forKey:key];
+    }
+}
+
+- (void)removeObjectForKey:(NSString *)key
+{
+    if (!key) {
+        return;
+    }
+
+    [self forgetAttributesForKey:key];
+    for (id <PINCaching> tier in _tiers) {
+        [tier removeObjectForKey:key];
+    }
+}
+
+- (void)trimToDate:(NSDate *)date
+{
+    if (!date) {
+        return;
+    }
+
+    [self forgetAttributesCreatedBefore:[date timeIntervalSinceReferenceDate]];
+    for (id <PINCaching> tier in _tiers) {
+        [tier trimToDate:date];
+    }
+}
+
+- (void)removeExpiredObjects
+{
+    [self forgetExpiredAttributes];
+    for (id <PINCaching> tier in _tiers) {
+        [tier removeExpiredObjects];
+    }
+}
+
+- (void)removeAllObjects
+{
+    [self forgetAllAttributes];
+    for (id <PINCaching> tier in _tiers) {
+        [tier removeAllObjects];
+    }
+}
+
+#pragma mark - Private Methods -
+
+- (void)promoteObject:(id)object forKey:(NSString *)key fromTierAtIndex:(NSUInteger)tierIndex
+{
+    if (tierIndex == 0) {
+        return;
+    }
+
+    NSUInteger firstTierIndex = tierIndex;
+    switch (self.promotionPolicy) {
+        case PINTieredCachePromotionPolicyAllTiers:
+            firstTierIndex = 0;
+            break;
+        case PINTieredCachePromotionPolicyNextTier:
+            firstTierIndex = tierIndex - 1;
+            break;
+        case PINTieredCachePromotionPolicyNone:
+            return;
+    }
+
+    NSUInteger cost;
+    NSTimeInterval ageLimit;
+    if (![self getCost:&cost ageLimit:&ageLimit forKey:key]) {
+        return;
+    }
+    for (NSUInteger idx = firstTierIndex; idx < tierIndex; idx++) {
+        [_tiers[idx] setObjectAsync:object forKey:key withCost:cost ageLimit:ageLimit completion:nil];
+    }
+}
+
+- (void)demoteObject:(id)object forKey:(NSString *)key fromTierAtIndex:(NSUInteger)tierIndex
+{
+    if (self.demotionPolicy == PINTieredCacheDemotionPolicyNone) {
+        return;
+    }
+
+    NSUInteger cost;
+    NSTimeInterval ageLimit;
+    if (![self getCost:&cost ageLimit:&ageLimit forKey:key]) {
+        return;
+    }
+
+    // Called from inside the evicting tier's trim, which mustn't wait on the tier below.
+    id <PINCaching> lowerTier = _tiers[tierIndex + 1];
+    [lowerTier containsObjectForKeyAsync:key completion:^(BOOL containsObject) {
+        if (!containsObject) {
+            [lowerTier setObjectAsync:object forKey:key withCost:cost ageLimit:ageLimit completion:nil];
+        }
+    }];
+}
+
+- (void)rememberCost:(NSUInteger)cost ageLimit:(NSTimeInterval)ageLimit forKey:(NSString *)key
+{
+    PINTieredCacheObjectAttributes *attributes = nil;
+    if (cost > 0 || ageLimit > 0.0) {
+        attributes = [[PINTieredCacheObjectAttributes alloc] init];
+        attributes.cost = cost;
+        attributes.ageLimit = ageLimit;
+        attributes.createdTime = CFAbsoluteTimeGetCurrent();
+    }
+
+    [self lock];
+        _objectAttributes[key] = attributes;
+        if (_objectAttributes.count > PINTieredCacheMaxObjectAttributesCount) {
+            [self _locked_trimObjectAttributes];
+        }
+    [self unlock];
+}
+
+/**
+ Drops expired attributes and, if that isn't enough, the oldest down to three quarters of the maximum, so that the
+ sort is paid for once per many objects set rather than on each.
+ */
+- (void)_locked_trimObjectAttributes
+{
+    [self _locked_forgetAttributesExpiredAt:CFAbsoluteTimeGetCurrent()];
+
+    NSUInteger targetCount = PINTieredCacheMaxObjectAttributesCount / 4 * 3;
+    if (_objectAttributes.count <= targetCount) {
+        return;
+    }
+    NSArray<NSString *> *keysByAge = [_objectAttributes keysSortedByValueUsingComparator:^NSComparisonResult(PINTieredCacheObjectAttributes *attributes1, PINTieredCacheObjectAttributes *attributes2) {
+        if (attributes1.createdTime < attributes2.createdTime) {
+            return NSOrderedAscending;
+        }
+        return attributes1.createdTime > attributes2.createdTime ? NSOrderedDescending : NSOrderedSame;
+    }];
+    [_objectAttributes removeObjectsForKeys:[keysByAge subarrayWithRange:NSMakeRange(0, keysByAge.count - targetCount)]];
+}
+
+/**
+ What to set a copy of an object with: the cost it was set with, and what is left of its age limit, so that a copy
+ doesn't outlive the original. Returns `NO` if the object has outlived its age limit and shouldn't be copied at all.
+ */
+- (BOOL)getCost:(NSUInteger *)cost ageLimit:(NSTimeInterval *)ageLimit forKey:(NSString *)key
+{
+    [self lock];
+        PINTieredCacheObjectAttributes *attributes = _objectAttributes[key];
+    [self unlock];
+
+    *cost = attributes.cost;
+    *ageLimit = 0.0;
+    if (attributes.ageLimit > 0.0) {
+        *ageLimit = attributes.ageLimit - (CFAbsoluteTimeGetCurrent() - attributes.createdTime);
+        if (*ageLimit <= 0.0) {
+            return NO;
+        }
+    }
+    return YES;
+}
+
+- (void)forgetAttributesForKey:(NSString *)key
+{
+    [self lock];
+        [_objectAttributes removeObjectForKey:key];
+    [self unlock];
+}
+
+- (void)forgetAttributesCreatedBefore:(CFAbsoluteTime)time
+{
+    [self lock];
+        NSSet<NSString *> *keys = [_objectAttributes keysOfEntriesPassingTest:^BOOL(NSString *key, PINTieredCacheObjectAttributes *attributes, BOOL *stop) {
+            return attributes.createdTime < time;
+        }];
+        [_objectAttributes removeObjectsForKeys:keys.allObjects];
+    [self unlock];
+}
+
+- (void)forgetExpiredAttributes
+{
+    CFAbsoluteTime now = CFAbsoluteTimeGetCurrent();
+    [self lock];
+        [self _locked_forgetAttributesExpiredAt:now];
+    [self unlock];
+}
+
+- (void)_locked_forgetAttributesExpiredAt:(CFAbsoluteTime)time
+{
+    NSSet<NSString *> *keys = [_objectAttributes keysOfEntriesPassingTest:^BOOL(NSString *key, PINTieredCacheObjectAttributes *attributes, BOOL *stop) {
+        return attributes.ageLimit > 0.0 && time - attributes.createdTime >= attributes.ageLimit;
+    }];
+    [_objectAttributes removeObjectsForKeys:keys.allObjects];
+}
+
+- (void)forgetAllAttributes
+{
+    [self lock];
+        [_objectAttributes removeAllObjects];
+    [self unlock];
+}
+
+- (void)fillLowerTiersWithObject:(id)object forKey:(NSString *)key withCost:(NSUInteger)cost ageLimit:(NSTimeInterval)ageLimit
+{
+    NSUInteger tierCount = _tiers.count;
+    for (NSUInteger idx = 1; idx < tierCount; idx++) {
+        [_tiers[idx] setObjectAsync:object forKey:key withCost:cost ageLimit:ageLimit completion:nil];
+    }
+}
+
+- (void)forEachTierAsync:(void (^)(id <PINCaching> tier, PINCacheBlock tierBlock))operation completion:(nullable PINCacheBlock)block
+{
+    dispatch_group_t group = dispatch_group_create();
+    for (id <PINCaching> tier in _tiers) {
+        dispatch_group_enter(group);
+        operation(tier, ^(id <PINCaching> cache) {
+            dispatch_group_leave(group);
+        });
+    }
+
+    if (block) {
+        dispatch_group_notify(group, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+            block(self);
+        });
+    }
+}
+
+#pragma mark - Public Thread Safe Accessors -
+
+- (PINTieredCachePromotionPolicy)promotionPolicy
+{
+    return atomic_load(&_promotionPolicy);
+}
+
+- (void)setPromotionPolicy:(PINTieredCachePromotionPolicy)promotionPolicy
+{
+    atomic_store(&_promotionPolicy, promotionPolicy);
+}
+
+- (PINTieredCacheDemotionPolicy)demotionPolicy
+{
+    return atomic_load(&_demotionPolicy);
+}
+
+- (void)setDemotionPolicy:(PINTieredCacheDemotionPolicy)demotionPolicy
+{
+    atomic_store(&_demotionPolicy, demotionPolicy);
+}
+
+- (PINTieredCacheWritePolicy)writePolicy
+{
+    return atomic_load(&_writePolicy);
+}
+
+- (void)setWritePolicy:(PINTieredCacheWritePolicy)writePolicy
+{
+    atomic_store(&_writePolicy, writePolicy);
+}
+
+- (BOOL)probesLowerTiersInParallel
+{
+    return atomic_load(&_probesLowerTiersInParallel);
+}
+
+- (void)setProbesLowerTiersInParallel:(BOOL)probesLowerTiersInParallel
+{
+    atomic_store(&_probesLowerTiersInParallel, probesLowerTiersInParallel);
+}
+
+- (void)lock
+{
+    __unused int result = pthread_mutex_lock(&_mutex);
+    NSAssert(result == 0, @"Failed to lock PINTieredCache %@. Code: %d", self, result);
+}
+
+- (void)unlock
+{
+    __unused int result = pthread_mutex_unlock(&_mutex);
+    NSAssert(result == 0, @"Failed to unlock PINTieredCache %@. Code: %d", self, result);
+}
+
+@end
+
+@interface PINTieredCacheProbe ()
+@property (assign, nonatomic) pthread_mutex_t mutex;
+@end
+
+@implementation PINTieredCacheProbe {
+    NSArray<id <PINCaching>> *_tiers;
+    BOOL _parallel;
+    PINTieredCacheProbeLookupBlock _lookup;
+    PINTieredCacheProbeCompletionBlock _completion;
+    // What each tier reported, NSNull for misses, guarded by the lock.
+    NSMutableArray *_results;
+    NSMutableIndexSet *_reportedTiers;
+    BOOL _finished;
+}
+
+- (void)dealloc
+{
+    __unused int result = pthread_mutex_destroy(&_mutex);
+    NSCAssert(result == 0, @"Failed to destroy lock in PINTieredCacheProbe %p. Code: %d", (void *)self, result);
+}
+
+- (instancetype)initWithTiers:(NSArray<id <PINCaching>> *)tiers
+                     parallel:(BOOL)parallel
+                       lookup:(PINTieredCacheProbeLookupBlock)lookup
+                   completion:(PINTieredCacheProbeCompletionBlock)completion
+{
+    if (self = [super init]) {
+        __unused int result = pthread_mutex_init(&_mutex, NULL);
+        NSAssert(result == 0, @"Failed to init lock in PINTieredCacheProbe %@. Code: %d", self, result);
+
+        _tiers = tiers;
+        _parallel = parallel;
+        _lookup = [lookup copy];
+        _completion = [completion copy];
+        _results = [[NSMutableArray alloc] initWithCapacity:tiers.count];
+        for (NSUInteger idx = 0; idx < tiers.count; idx++) {
+            [_results addObject:[NSNull null]];
+        }
+        _reportedTiers = [[NSMutableIndexSet alloc] init];
+    }
+    return self;
+}
+
+- (void)start
+{
+    [self askTierAtIndex:0];
+}
+
+- (void)askTierAtIndex:(NSUInteger)tierIndex
+{
+    _lookup(_tiers[tierIndex], ^(id object) {
+        [self tierAtIndex:tierIndex didReportObject:object];
+    });
+}
+
+- (void)tierAtIndex:(NSUInteger)tierIndex didReportObject:(nullable id)object
+{
+    NSUInteger tierCount = _tiers.count;
+    id foundObject = nil;
+    NSUInteger foundTierIndex = NSNotFound;
+    BOOL finishedBefore;
+    BOOL finishes = NO;
+
+    [self lock];
+        finishedBefore = _finished;
+        if (!finishedBefore) {
+            if (object) {
+                _results[tierIndex] = object;
+            }
+            [_reportedTiers addIndex:tierIndex];
+
+            // The answer is the first tier with an object, once every tier above it has missed.
+            NSUInteger idx = 0;
+            for (; idx < tierCount && [_reportedTiers containsIndex:idx]; idx++) {
+                if (_results[idx] != [NSNull null]) {
+                    foundObject = _results[idx];
+                    foundTierIndex = idx;
+                    break;
+                }
+            }
+            finishes = foundObject != nil || idx == tierCount;
+            _finished = finishes;
+        }
+    [self unlock];
+
+    if (finishedBefore) {
+        // A lower tier answering after a tier above it already did.
+        return;
+    }
+    if (finishes) {
+        _completion(foundObject, foundTierIndex);
+        return;
+    }
+    if (object) {
+        // Waiting on a tier above this one.
+        return;
+    }
+
+    if (_parallel) {
+        if (tierIndex == 0) {
+            for (NSUInteger lowerTierIndex = 1; lowerTierIndex < tierCount; lowerTierIndex++) {
+                [self askTierAtIndex:lowerTierIndex];
+            }
+        }
+    } else if (tierIndex + 1 < tierCount) {
+        [self askTierAtIndex:tierIndex + 1];
+    }
+}
+
+- (void)lock
+{
+    __unused int result = pthread_mutex_lock(&_mutex);
+    NSAssert(result == 0, @"Failed to lock PINTieredCacheProbe %@. Code: %d", self, result);
+}
+
+- (void)unlock
+{
+    __unused int result = pthread_mutex_unlock(&_mutex);
+    NSAssert(result == 0, @"Failed to unlock PINTieredCacheProbe %@. Code: %d", self, result);
+}
+
+@end
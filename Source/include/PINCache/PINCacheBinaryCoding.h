@@ -0,0 +1 @@
+../../PINCacheBinaryCoding.h
\ No newline at end of file
@@ -0,0 +1 @@
+../../PINCacheCancellationToken.h
\ No newline at end of file
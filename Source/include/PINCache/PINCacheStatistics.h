@@ -0,0 +1 @@
+../../PINCacheStatistics.h
\ No newline at end of file
@@ -0,0 +1 @@
+../../PINCacheTracing.h
\ No newline at end of file
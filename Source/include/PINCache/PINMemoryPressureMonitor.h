@@ -0,0 +1 @@
+../../PINMemoryPressureMonitor.h
\ No newline at end of file
@@ -0,0 +1 @@
+../../PINTieredCache.h
\ No newline at end of file
@@ -0,0 +1,30 @@
+#import <PINCache/PINCache.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ A cache tier standing in for a slow store, such as one across the network. Objects are kept in memory, every
+ operation first sleeps for <latency>, and asynchronous operations run concurrently on a queue of their own.
+ */
+@interface PINCacheTestSlowTier : NSObject <PINCaching>
+
+- (instancetype)initWithName:(NSString *)name latency:(NSTimeInterval)latency;
+
+/** How long every operation sleeps before touching the objects. */
+@property (assign) NSTimeInterval latency;
+
+/** How many lookups, including containment checks, have been made. */
+@property (readonly) NSUInteger readCount;
+
+/** How many sets have been made. */
+@property (readonly) NSUInteger writeCount;
+
+/** The cost the object for a key was last set with. */
+- (NSUInteger)costForKey:(NSString *)key;
+
+/** The age limit the object for a key was last set with. */
+- (NSTimeInterval)ageLimitForKey:(NSString *)key;
+
+@end
+
+NS_ASSUME_NONNULL_END
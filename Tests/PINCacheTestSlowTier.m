@@ -0,0 +1,215 @@
+#import "PINCacheTestSlowTier.h"
+
+@implementation PINCacheTestSlowTier {
+    NSMutableDictionary<NSString *, id> *_objects;
+    NSMutableDictionary<NSString *, NSNumber *> *_costs;
+    NSMutableDictionary<NSString *, NSNumber *> *_ageLimits;
+    dispatch_queue_t _queue;
+    NSUInteger _readCount;
+    NSUInteger _writeCount;
+}
+
+@synthesize name = _name;
+
+- (instancetype)initWithName:(NSString *)name latency:(NSTimeInterval)latency
+{
+    if (self = [super init]) {
+        _name = [name copy];
+        _latency = latency;
+        _objects = [[NSMutableDictionary alloc] init];
+        _costs = [[NSMutableDictionary alloc] init];
+        _ageLimits = [[NSMutableDictionary alloc] init];
+        _queue = dispatch_queue_create("com.pinterest.PINCacheTestSlowTier", DISPATCH_QUEUE_CONCURRENT);
+    }
+    return self;
+}
+
+- (NSUInteger)readCount
+{
+    @synchronized (self) {
+        return _readCount;
+    }
+}
+
+- (NSUInteger)writeCount
+{
+    @synchronized (self) {
+        return _writeCount;
+    }
+}
+
+- (NSUInteger)costForKey:(NSString *)key
+{
+    @synchronized (self) {
+        return _costs[key].unsignedIntegerValue;
+    }
+}
+
+- (NSTimeInterval)ageLimitForKey:(NSString *)key
+{
+    @synchronized (self) {
+        return _ageLimits[key].doubleValue;
+    }
+}
+
+- (void)wait
+{
+    NSTimeInterval latency = self.latency;
+    if (latency > 0.0) {
+        [NSThread sleepForTimeInterval:latency];
+    }
+}
+
+#pragma mark - Asynchronous Methods
+
+- (void)containsObjectForKeyAsync:(NSString *)key completion:(PINCacheObjectContainmentBlock)block
+{
+    dispatch_async(_queue, ^{
+        block([self containsObjectForKey:key]);
+    });
+}
+
+- (void)objectForKeyAsync:(NSString *)key completion:(PINCacheObjectBlock)block
+{
+    dispatch_async(_queue, ^{
+        block(self, key, [self objectForKey:key]);
+    });
+}
+
+- (void)setObjectAsync:(id)object forKey:(NSString *)key completion:(PINCacheObjectBlock)block
+{
+    [self setObjectAsync:object forKey:key withCost:0 ageLimit:0.0 completion:block];
+}
+
+- (void)setObjectAsync:(id)object forKey:(NSString *)key withAgeLimit:(NSTimeInterval)ageLimit completion:(PINCacheObjectBlock)block
+{
+    [self setObjectAsync:object forKey:key withCost:0 ageLimit:ageLimit completion:block];
+}
+
+- (void)setObjectAsync:(id)object forKey:(NSString *)key withCost:(NSUInteger)cost completion:(PINCacheObjectBlock)block
+{
+    [self setObjectAsync:object forKey:key withCost:cost ageLimit:0.0 completion:block];
+}
+
+- (void)setObjectAsync:(id)object forKey:(NSString *)key withCost:(NSUInteger)cost ageLimit:(NSTimeInterval)ageLimit completion:(PINCacheObjectBlock)block
+{
+    dispatch_async(_queue, ^{
+        [self setObject:object forKey:key withCost:cost ageLimit:ageLimit];
+        if (block) {
+            block(self, key, object);
+        }
+    });
+}
+
+- (void)removeObjectForKeyAsync:(NSString *)key completion:(PINCacheObjectBlock)block
+{
+    dispatch_async(_queue, ^{
+        [self removeObjectForKey:key];
+        if (block) {
+            block(self, key, nil);
+        }
+    });
+}
+
+- (void)trimToDateAsync:(NSDate *)date completion:(PINCacheBlock)block
+{
+    dispatch_async(_queue, ^{
+        if (block) {
+            block(self);
+        }
+    });
+}
+
+- (void)removeExpiredObjectsAsync:(PINCacheBlock)block
+{
+    dispatch_async(_queue, ^{
+        if (block) {
+            block(self);
+        }
+    });
+}
+
+- (void)removeAllObjectsAsync:(PINCacheBlock)block
+{
+    dispatch_async(_queue, ^{
+        [self removeAllObjects];
+        if (block) {
+            block(self);
+        }
+    });
+}
+
+#pragma mark - Synchronous Methods
+
+- (BOOL)containsObjectForKey:(NSString *)key
+{
+    [self wait];
+    @synchronized (self) {
+        _readCount++;
+        return _objects[key] != nil;
+    }
+}
+
+- (id)objectForKey:(NSString *)key
+{
+    [self wait];
+    @synchronized (self) {
+        _readCount++;
+        return _objects[key];
+    }
+}
+
+- (void)setObject:(id)object forKey:(NSString *)key
+{
+    [self setObject:object forKey:key withCost:0 ageLimit:0.0];
+}
+
+- (void)setObject:(id)object forKey:(NSString *)key withAgeLimit:(NSTimeInterval)ageLimit
+{
+    [self setObject:object forKey:key withCost:0 ageLimit:ageLimit];
+}
+
+- (void)setObject:(id)object forKey:(NSString *)key withCost:(NSUInteger)cost
+{
+    [self setObject:object forKey:key withCost:cost ageLimit:0.0];
+}
+
+- (void)setObject:(id)object forKey:(NSString *)key withCost:(NSUInteger)cost ageLimit:(NSTimeInterval)ageLimit
+{
+    [self wait];
+    @synchronized (self) {
+        _writeCount++;
+        _objects[key] = object;
+        _costs[key] = @(cost);
+        _ageLimits[key] = @(ageLimit);
+    }
+}
+
+- (void)removeObjectForKey:(NSString *)key
+{
+    [self wait];
+    @synchronized (self) {
+        [_objects removeObjectForKey:key];
+        [_costs removeObjectForKey:key];
+        [_ageLimits removeObjectForKey:key];
+    }
+}
+
+- (void)trimToDate:(NSDate *)date
+{
+}
+
+- (void)removeExpiredObjects
+{
+}
+
+- (void)removeAllObjects
+{
+    @synchronized (self) {
+        [_objects removeAllObjects];
+        [_costs removeAllObjects];
+        [_ageLimits removeAllObjects];
+    }
+}
+
+@end
@@ -5,9 +5,14 @@
 #import <PINCache/PINCache.h>
 #import <PINOperation/PINOperation.h>
 
+#import <malloc/malloc.h>
+#import <objc/runtime.h>
+#import <stdatomic.h>
+
 #import "PINCacheTests.h"
 #import "NSDate+PINCacheTests.h"
 #import "PINDiskCache+PINCacheTests.h"
+#import "PINCacheTestSlowTier.h"
 
 
 #if TARGET_OS_IPHONE
@@ -29,6 +34,17 @@ const NSTimeInterval PINCacheTestBlockTimeout = 20.0;
 + (NSLock *)sharedLock;
 + (NSURL *)sharedTrashURL;
 - (NSString *)encodedString:(NSString *)string;
+- (BOOL)keyFilterMightContainKey:(NSString *)key;
+- (void)persistKeyFilter;
+
+@end
+
+@interface PINCacheWorkStealingQueue : NSObject
+
+- (instancetype)initWithMaxConcurrentOperations:(NSUInteger)maxConcurrentOperations;
+- (id <PINOperationReference>)scheduleOperation:(dispatch_block_t)operation;
+- (id <PINOperationReference>)scheduleOperation:(dispatch_block_t)operation withPriority:(PINOperationQueuePriority)priority;
+- (void)waitUntilAllOperationsAreFinished;
 
 @end
 
@@ -39,6 +55,41 @@ const NSTimeInterval PINCacheTestBlockTimeout = 20.0;
 
 @end
 
+@interface PINCacheTestSizedObject : NSObject <PINMemoryCacheCostReporting>
+@end
+
+@implementation PINCacheTestSizedObject
+
+- (NSUInteger)memoryCacheCost
+{
+    return 1234;
+}
+
+@end
+
+@interface PINCacheTestTraceSink : NSObject <PINCacheTraceSink>
+@property (strong, nonatomic) NSMutableArray<PINCacheTraceSpan *> *spans;
+@end
+
+@implementation PINCacheTestTraceSink
+
+- (instancetype)init
+{
+    if (self = [super init]) {
+        _spans = [[NSMutableArray alloc] init];
+    }
+    return self;
+}
+
+- (void)recordSpan:(PINCacheTraceSpan *)span
+{
+    @synchronized (self) {
+        [_spans addObject:span];
+    }
+}
+
+@end
+
 @interface PINCacheTests ()
 @property (strong, nonatomic) PINCache *cache;
 @end
@@ -1398,6 +1449,295 @@ const NSTimeInterval PINCacheTestBlockTimeout = 20.0;
     XCTAssertTrue([[NSFileManager defaultManager] fileExistsAtPath:[testCacheURL path]]);
 }
 
+- (void)testMemoryCacheSet
+{
+  PINMemoryCache *testCache = [[PINMemoryCache alloc] initWithName:@"testMemoryCacheSet" operationQueue:[PINOperationQueue sharedOperationQueue]];
+  const NSUInteger objectCount = 10000;
+  NSMutableArray<NSString *> *keys = [[NSMutableArray alloc] initWithCapacity:objectCount];
+  for (NSUInteger idx = 0; idx < objectCount; idx++) {
+    [keys addObject:[@(idx) stringValue]];
+  }
+  [self measureBlock:^{
+    for (NSString *key in keys) {
+      [testCache setObject:key forKey:key];
+    }
+  }];
+}
+
+- (void)testMemoryCacheHit
+{
+  PINMemoryCache *testCache = [[PINMemoryCache alloc] initWithName:@"testMemoryCacheHit" operationQueue:[PINOperationQueue sharedOperationQueue]];
+  const NSUInteger objectCount = 10000;
+  NSMutableArray<NSString *> *keys = [[NSMutableArray alloc] initWithCapacity:objectCount];
+  for (NSUInteger idx = 0; idx < objectCount; idx++) {
+    NSString *key = [@(idx) stringValue];
+    [testCache setObject:key forKey:key];
+    [keys addObject:key];
+  }
+  [self measureBlock:^{
+    for (NSString *key in keys) {
+      [testCache objectForKey:key];
+    }
+  }];
+}
+
+- (void)testMemoryCacheEntryOverhead
+{
+  // Each object costs one entry record on top of its slot in the cache's dictionary. The record includes the links
+  // for the LRU list and the LFU buckets.
+  Class entryClass = NSClassFromString(@"PINMemoryCacheEntry");
+  XCTAssertNotNil(entryClass);
+  id entry = [[entryClass alloc] init];
+  size_t entrySize = malloc_size((__bridge const void *)entry);
+  XCTAssertLessThanOrEqual(class_getInstanceSize(entryClass), entrySize);
+  XCTAssertLessThanOrEqual(entrySize, (size_t)96, @"an entry record should fit in one 96 byte allocation");
+}
+
+- (void)testMemoryCacheEvictionOrder
+{
+  PINMemoryCache *testCache = [[PINMemoryCache alloc] initWithName:@"testMemoryCacheEvictionOrder" operationQueue:[PINOperationQueue sharedOperationQueue]];
+  for (NSUInteger idx = 0; idx < 6; idx++) {
+    [testCache setObject:@(idx) forKey:[@(idx) stringValue] withCost:1];
+  }
+  // Access counts: 0 -> 3, 1 -> 1, 2 -> 3, 3 -> 3, 4 -> 1, 5 -> 2. Least recently used first: 1, 4, 0, 5, 2, 3.
+  for (NSString *key in @[@"0", @"2", @"0", @"5", @"2", @"3", @"3"]) {
+    (void)[testCache objectForKey:key];
+  }
+
+  NSMutableArray<NSString *> *evictedKeys = [[NSMutableArray alloc] init];
+  testCache.didRemoveObjectBlock = ^(id<PINCaching> cache, NSString *key, id object) {
+    [evictedKeys addObject:key];
+  };
+
+  [testCache trimToCostByEvictionStrategy:4];
+  XCTAssertEqualObjects(evictedKeys, (@[@"1", @"4"]));
+
+  // Ties in access count go to the least recently used.
+  testCache.evictionStrategy = PINCacheEvictionStrategyLeastFrequentlyUsed;
+  [evictedKeys removeAllObjects];
+  [testCache trimToCostByEvictionStrategy:1];
+  XCTAssertEqualObjects(evictedKeys, (@[@"5", @"0", @"2"]));
+  XCTAssertNotNil([testCache objectForKey:@"3"]);
+  XCTAssertEqual(testCache.totalCost, 1);
+}
+
+- (void)testMemoryCacheEvictionAtCostLimit
+{
+  // Every set evicts one object from a full cache, which should take the same time however big the cache is.
+  PINMemoryCache *testCache = [[PINMemoryCache alloc] initWithName:@"testMemoryCacheEvictionAtCostLimit" operationQueue:[PINOperationQueue sharedOperationQueue]];
+  const NSUInteger objectCount = 50000;
+  for (NSUInteger idx = 0; idx < objectCount; idx++) {
+    [testCache setObject:@(idx) forKey:[@(idx) stringValue] withCost:1];
+  }
+  testCache.costLimit = objectCount;
+
+  __block NSUInteger nextKey = objectCount;
+  [self measureBlock:^{
+    for (NSUInteger idx = 0; idx < 1000; idx++, nextKey++) {
+      [testCache setObject:@(nextKey) forKey:[@(nextKey) stringValue] withCost:1];
+    }
+  }];
+  XCTAssertEqual(testCache.totalCost, objectCount);
+}
+
+- (void)testMemoryCacheShardedCostLimit
+{
+  PINMemoryCache *testCache = [[PINMemoryCache alloc] initWithName:@"testMemoryCacheShardedCostLimit"
+                                                    operationQueue:[PINOperationQueue sharedOperationQueue]
+                                                          ttlCache:NO
+                                                  evictionStrategy:PINCacheEvictionStrategyLeastRecentlyUsed
+                                                        shardCount:6];
+  XCTAssertEqual(testCache.shardCount, 8, @"shard count should be rounded up to a power of two");
+
+  testCache.costLimit = 100;
+  for (NSUInteger idx = 0; idx < 200; idx++) {
+    [testCache setObject:[@(idx) stringValue] forKey:[@(idx) stringValue] withCost:1];
+  }
+  XCTAssertLessThanOrEqual(testCache.totalCost, 100);
+  XCTAssertGreaterThan(testCache.totalCost, 0);
+  XCTAssertNotNil([testCache objectForKey:@"199"], @"the most recently added object should survive");
+
+  __block NSUInteger enumeratedCount = 0;
+  [testCache enumerateObjectsWithBlock:^(id<PINCaching> cache, NSString *key, id object, BOOL *stop) {
+    enumeratedCount++;
+  }];
+  XCTAssertEqual(enumeratedCount, testCache.totalCost, @"enumeration should cover every shard");
+
+  [testCache removeAllObjects];
+  XCTAssertEqual(testCache.totalCost, 0);
+  XCTAssertFalse([testCache containsObjectForKey:@"199"]);
+}
+
+- (void)testMemoryCacheBufferedAccessOrder
+{
+  PINMemoryCache *testCache = [[PINMemoryCache alloc] initWithName:@"testMemoryCacheBufferedAccessOrder" operationQueue:[PINOperationQueue sharedOperationQueue]];
+  [testCache setObject:@"a" forKey:@"a" withCost:1];
+  [testCache setObject:@"b" forKey:@"b" withCost:1];
+
+  // More reads than a read buffer holds, so some of them are applied by draining on the read path.
+  for (NSUInteger idx = 0; idx < 100; idx++) {
+    XCTAssertEqualObjects([testCache objectForKey:@"a"], @"a");
+  }
+
+  // Reads from many threads at once may drop some access records, but never lose or corrupt entries.
+  dispatch_apply(16, dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0), ^(size_t thread) {
+    for (NSUInteger idx = 0; idx < 1000; idx++) {
+      [testCache objectForKey:@"a"];
+      [testCache setObject:@"c" forKey:[NSString stringWithFormat:@"c%zu", thread] withCost:0];
+    }
+  });
+
+  // The buffered reads of "a" are applied before eviction, so "b" is now the least recently used.
+  [testCache trimToCostByEvictionStrategy:1];
+  XCTAssertNotNil([testCache objectForKey:@"a"]);
+  XCTAssertNil([testCache objectForKey:@"b"]);
+}
+
+- (void)testMemoryCacheAutomaticCostEstimation
+{
+  PINMemoryCache *testCache = [[PINMemoryCache alloc] initWithName:@"testMemoryCacheAutomaticCostEstimation" operationQueue:[PINOperationQueue sharedOperationQueue]];
+  NSData *data = [[NSMutableData alloc] initWithLength:1000];
+
+  [testCache setObject:data forKey:@"data"];
+  XCTAssertEqual(testCache.totalCost, 0, @"cost should not be estimated unless enabled");
+
+  testCache.automaticallyEstimatesCost = YES;
+  NSUInteger totalCost = testCache.totalCost;
+  [testCache setObject:data forKey:@"data"];
+  XCTAssertGreaterThanOrEqual(testCache.totalCost - totalCost, 1000);
+
+  totalCost = testCache.totalCost;
+  [testCache setObject:[@"" stringByPaddingToLength:500 withString:@"x" startingAtIndex:0] forKey:@"string"];
+  XCTAssertGreaterThanOrEqual(testCache.totalCost - totalCost, 500);
+
+  totalCost = testCache.totalCost;
+  [testCache setObject:@{ @"nested" : @[data, data] } forKey:@"collection"];
+  XCTAssertGreaterThanOrEqual(testCache.totalCost - totalCost, 2000);
+
+  totalCost = testCache.totalCost;
+  [testCache setObject:[[PINCacheTestSizedObject alloc] init] forKey:@"reporting"];
+  XCTAssertEqual(testCache.totalCost - totalCost, 1234);
+
+  totalCost = testCache.totalCost;
+  [testCache setObject:data forKey:@"explicit" withCost:7];
+  XCTAssertEqual(testCache.totalCost - totalCost, 7, @"an explicit cost should be used as is");
+
+  // With a byte budget, the cache keeps roughly that many bytes.
+  testCache.costLimit = 5000;
+  for (NSUInteger idx = 0; idx < 20; idx++) {
+    [testCache setObject:[[NSMutableData alloc] initWithLength:1000] forKey:[@(idx) stringValue]];
+  }
+  XCTAssertLessThanOrEqual(testCache.totalCost, 5000);
+}
+
+- (void)testMemoryPressureMonitorShrinksCaches
+{
+  NSURL *directoryURL = [[NSURL fileURLWithPath:NSTemporaryDirectory()] URLByAppendingPathComponent:[[NSUUID UUID] UUIDString]];
+  [[NSFileManager defaultManager] createDirectoryAtURL:directoryURL withIntermediateDirectories:YES attributes:nil error:NULL];
+  NSURL *pressureURL = [directoryURL URLByAppendingPathComponent:@"memory"];
+  NSURL *usageURL = [directoryURL URLByAppendingPathComponent:@"memory.current"];
+  NSURL *limitURL = [directoryURL URLByAppendingPathComponent:@"memory.max"];
+  void (^writeInputs)(double, double, NSString *) = ^(double some, double full, NSString *usage) {
+    NSString *pressure = [NSString stringWithFormat:@"some avg10=%.2f avg60=0.00 avg300=0.00 total=0\nfull avg10=%.2f avg60=0.00 avg300=0.00 total=0\n", some, full];
+    [pressure writeToURL:pressureURL atomically:YES encoding:NSUTF8StringEncoding error:NULL];
+    [usage writeToURL:usageURL atomically:YES encoding:NSUTF8StringEncoding error:NULL];
+  };
+  [@"100\n" writeToURL:limitURL atomically:YES encoding:NSUTF8StringEncoding error:NULL];
+
+  PINMemoryCache *testCache = [[PINMemoryCache alloc] initWithName:@"testMemoryPressureMonitorShrinksCaches" operationQueue:[PINOperationQueue sharedOperationQueue]];
+  for (NSUInteger idx = 0; idx < 100; idx++) {
+    [testCache setObject:@(idx) forKey:[@(idx) stringValue] withCost:1];
+  }
+
+  PINMemoryPressureMonitor *monitor = [[PINMemoryPressureMonitor alloc] initWithPressureFileURL:pressureURL cgroupUsageFileURL:usageURL cgroupLimitFileURL:limitURL];
+  [monitor registerMemoryCache:testCache];
+
+  writeInputs(1.0, 0.0, @"50\n");
+  XCTAssertEqual([monitor checkMemoryPressure], PINMemoryPressureLevelNormal);
+  XCTAssertEqual(testCache.totalCost, 100);
+
+  writeInputs(15.0, 0.0, @"50\n");
+  XCTAssertEqual([monitor checkMemoryPressure], PINMemoryPressureLevelWarning);
+  XCTAssertEqual(monitor.currentLevel, PINMemoryPressureLevelWarning);
+  XCTAssertEqual(testCache.totalCost, 75);
+  XCTAssertNotNil([testCache objectForKey:@"99"], @"the most recently used objects should be kept");
+
+  // The same level doesn't trim again until the response interval has passed.
+  XCTAssertEqual([monitor checkMemoryPressure], PINMemoryPressureLevelWarning);
+  XCTAssertEqual(testCache.totalCost, 75);
+
+  // Usage close to the cgroup limit is critical even without stalls.
+  writeInputs(0.0, 0.0, @"95\n");
+  XCTAssertEqual([monitor checkMemoryPressure], PINMemoryPressureLevelCritical);
+  XCTAssertEqual(testCache.totalCost, 50, @"trims should be a fraction of the cost when the pressure started");
+
+  // Lasting pressure takes back what the cache grew since, without shrinking it further.
+  monitor.responseInterval = 0.0;
+  XCTAssertEqual([monitor checkMemoryPressure], PINMemoryPressureLevelCritical);
+  XCTAssertEqual(testCache.totalCost, 50);
+  for (NSUInteger idx = 100; idx < 110; idx++) {
+    [testCache setObject:@(idx) forKey:[@(idx) stringValue] withCost:1];
+  }
+  XCTAssertEqual([monitor checkMemoryPressure], PINMemoryPressureLevelCritical);
+  XCTAssertEqual(testCache.totalCost, 50);
+
+  // No limit means usage is ignored.
+  [@"max\n" writeToURL:limitURL atomically:YES encoding:NSUTF8StringEncoding error:NULL];
+  XCTAssertEqual([monitor checkMemoryPressure], PINMemoryPressureLevelNormal);
+  XCTAssertEqual(testCache.totalCost, 50);
+
+  [[NSFileManager defaultManager] removeItemAtURL:directoryURL error:NULL];
+}
+
+- (void)measureConcurrentMemoryCacheReadsWithShardCount:(NSUInteger)shardCount
+{
+  const NSUInteger objectCount = 10000;
+  const NSUInteger readsPerThread = 20000;
+  // Enough threads to keep every core reading at once.
+  const NSUInteger threadCount = [[NSProcessInfo processInfo] activeProcessorCount] * 2;
+  NSMutableArray<NSString *> *keys = [[NSMutableArray alloc] initWithCapacity:objectCount];
+  for (NSUInteger idx = 0; idx < objectCount; idx++) {
+    [keys addObject:[@(idx) stringValue]];
+  }
+
+  PINMemoryCache *testCache = [[PINMemoryCache alloc] initWithName:@"testMemoryCacheReadScaling"
+                                                    operationQueue:[PINOperationQueue sharedOperationQueue]
+                                                          ttlCache:NO
+                                                  evictionStrategy:PINCacheEvictionStrategyLeastRecentlyUsed
+                                                        shardCount:shardCount];
+  for (NSString *key in keys) {
+    [testCache setObject:key forKey:key];
+  }
+
+  [self measureBlock:^{
+    NSUInteger *missesPerThread = calloc(threadCount, sizeof(NSUInteger));
+    dispatch_apply(threadCount, dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0), ^(size_t thread) {
+      for (NSUInteger idx = 0; idx < readsPerThread; idx++) {
+        if ([testCache objectForKey:keys[(idx * 7919 + thread) % objectCount]] == nil) {
+          missesPerThread[thread]++;
+        }
+      }
+    });
+    NSUInteger misses = 0;
+    for (NSUInteger thread = 0; thread < threadCount; thread++) {
+      misses += missesPerThread[thread];
+    }
+    free(missesPerThread);
+    XCTAssertEqual(misses, 0);
+  }];
+}
+
+- (void)testMemoryCacheReadScaling
+{
+  [self measureConcurrentMemoryCacheReadsWithShardCount:32];
+}
+
+- (void)testMemoryCacheReadScalingUnsharded
+{
+  // The baseline the sharded cache is compared against.
+  [self measureConcurrentMemoryCacheReadsWithShardCount:1];
+}
+
 - (void)testDiskCacheSet
 {
   PINDiskCache *testCache = [[PINDiskCache alloc] initWithName:@"testDiskCacheSet"];
@@ -1525,6 +1865,1422 @@ const NSTimeInterval PINCacheTestBlockTimeout = 20.0;
     }
 }
 
+- (void)testDiskCacheSharedAcrossProcesses
+{
+    // Two caches on the same directory each open their own descriptor for the shared index, just like two processes would.
+    NSString *cacheName = [[NSUUID UUID] UUIDString];
+    NSString *rootPath = NSTemporaryDirectory();
+    PINDiskCache *firstCache = [[PINDiskCache alloc] initWithName:cacheName rootPath:rootPath];
+    PINDiskCache *secondCache = [[PINDiskCache alloc] initWithName:cacheName rootPath:rootPath];
+    firstCache.sharedAcrossProcesses = YES;
+    secondCache.sharedAcrossProcesses = YES;
+    XCTAssertTrue(firstCache.sharedAcrossProcesses);
+    [firstCache waitForKnownState];
+    [secondCache waitForKnownState];
+
+    [firstCache setObject:@"first" forKey:@"first"];
+    XCTAssertEqualObjects([secondCache objectForKey:@"first"], @"first", @"object written by the other cache should be readable");
+
+    [secondCache setObject:@"second" forKey:@"second"];
+    XCTAssertGreaterThan(firstCache.byteCount, (NSUInteger)0);
+    XCTAssertEqual(firstCache.byteCount, secondCache.byteCount, @"byte count should be shared");
+
+    // The first cache never saw "second" being written, trimming must still account for it.
+    [firstCache trimToSizeByEvictionStrategy:1];
+    XCTAssertNil([secondCache objectForKey:@"second"], @"trim should evict objects written by the other cache");
+    XCTAssertEqual(secondCache.byteCount, (NSUInteger)0);
+
+    // A few changes are applied from the shared journal, a batch too large for it falls back to a rescan.
+    [secondCache setObject:@"third" forKey:@"third"];
+    [secondCache setObject:@"fourth" forKey:@"fourth"];
+    [secondCache removeObjectForKey:@"third"];
+    NSMutableSet<NSString *> *enumeratedKeys = [[NSMutableSet alloc] init];
+    [firstCache enumerateObjectsWithBlock:^(NSString * _Nonnull key, NSURL * _Nullable fileURL, BOOL * _Nonnull stop) {
+        [enumeratedKeys addObject:key];
+    }];
+    XCTAssertEqualObjects(enumeratedKeys, [NSSet setWithObject:@"fourth"], @"changes made by the other cache should be applied");
+    XCTAssertEqual(firstCache.byteCount, secondCache.byteCount);
+
+    NSMutableArray<NSString *> *batchKeys = [[NSMutableArray alloc] init];
+    NSMutableArray<NSString *> *batchObjects = [[NSMutableArray alloc] init];
+    for (NSUInteger idx = 0; idx < 200; idx++) {
+        [batchKeys addObject:[[NSString alloc] initWithFormat:@"batch%lu", (unsigned long)idx]];
+        [batchObjects addObject:@"value"];
+    }
+    [secondCache setObjects:batchObjects forKeys:batchKeys];
+    [enumeratedKeys removeAllObjects];
+    [firstCache enumerateObjectsWithBlock:^(NSString * _Nonnull key, NSURL * _Nullable fileURL, BOOL * _Nonnull stop) {
+        [enumeratedKeys addObject:key];
+    }];
+    XCTAssertEqual(enumeratedKeys.count, batchKeys.count + 1, @"changes the journal can't hold should be picked up by a rescan");
+    XCTAssertEqual(firstCache.byteCount, secondCache.byteCount);
+
+    [firstCache removeAllObjects];
+    XCTAssertFalse([secondCache containsObjectForKey:@"third"]);
+    XCTAssertEqual(secondCache.byteCount, (NSUInteger)0);
+}
+
+- (void)corruptFileAtURL:(NSURL *)fileURL
+{
+    NSMutableData *data = [NSMutableData dataWithContentsOfURL:fileURL];
+    uint8_t *bytes = data.mutableBytes;
+    bytes[data.length - 1] ^= 0xFF;
+    [data writeToURL:fileURL atomically:YES];
+}
+
+- (void)testDiskCacheChecksumQuarantinesCorruptObjects
+{
+    PINDiskCache *diskCache = self.cache.diskCache;
+    diskCache.checksumsEnabled = YES;
+
+    NSString *key = @"key";
+    [diskCache setObject:@"value" forKey:key];
+    NSURL *fileURL = [diskCache fileURLForKey:key];
+    XCTAssertEqualObjects([diskCache objectForKey:key], @"value", @"checksummed object should read back");
+    XCTAssertGreaterThan(diskCache.byteCount, (NSUInteger)0);
+
+    [self corruptFileAtURL:fileURL];
+    XCTAssertNil([diskCache objectForKey:key], @"corrupt object should be a miss");
+    XCTAssertFalse([[NSFileManager defaultManager] fileExistsAtPath:[fileURL path]]);
+    NSURL *quarantinedFileURL = [diskCache.quarantineURL URLByAppendingPathComponent:[fileURL lastPathComponent]];
+    XCTAssertTrue([[NSFileManager defaultManager] fileExistsAtPath:[quarantinedFileURL path]], @"corrupt object should be quarantined");
+    XCTAssertEqual(diskCache.byteCount, (NSUInteger)0);
+
+    // Only the most recently quarantined objects are kept.
+    for (NSUInteger idx = 0; idx < 20; idx++) {
+        NSString *corruptKey = [[NSString alloc] initWithFormat:@"corrupt%lu", (unsigned long)idx];
+        [diskCache setObject:@"value" forKey:corruptKey];
+        [self corruptFileAtURL:[diskCache fileURLForKey:corruptKey]];
+        XCTAssertNil([diskCache objectForKey:corruptKey]);
+    }
+    NSArray *quarantinedFiles = [[NSFileManager defaultManager] contentsOfDirectoryAtPath:[diskCache.quarantineURL path] error:nil];
+    XCTAssertEqual(quarantinedFiles.count, (NSUInteger)16, @"the quarantine should be capped");
+    XCTAssertTrue([quarantinedFiles containsObject:@"corrupt19"], @"the newest quarantined object should be kept");
+
+    // Objects written before checksums were enabled are still readable.
+    diskCache.checksumsEnabled = NO;
+    [diskCache setObject:@"unchecked" forKey:key];
+    diskCache.checksumsEnabled = YES;
+    XCTAssertEqualObjects([diskCache objectForKey:key], @"unchecked");
+}
+
+- (void)testDiskCacheChecksumScrubber
+{
+    PINDiskCache *diskCache = self.cache.diskCache;
+    diskCache.checksumsEnabled = YES;
+
+    NSString *key = @"key";
+    [diskCache setObject:@"value" forKey:key];
+    [self corruptFileAtURL:[diskCache fileURLForKey:key]];
+
+    diskCache.scrubBytesPerSecond = 1024 * 1024;
+    NSDate *deadline = [NSDate dateWithTimeIntervalSinceNow:PINCacheTestBlockTimeout];
+    while ([diskCache containsObjectForKey:key] && [deadline timeIntervalSinceNow] > 0) {
+        [NSThread sleepForTimeInterval:0.1];
+    }
+    diskCache.scrubBytesPerSecond = 0;
+
+    XCTAssertFalse([diskCache containsObjectForKey:key], @"scrubber should quarantine the corrupt object");
+}
+
+- (void)testDiskCacheKeyFilterPersistsAcrossLaunches
+{
+    NSString *cacheName = [[NSUUID UUID] UUIDString];
+    PINDiskCache *diskCache = [[PINDiskCache alloc] initWithName:cacheName];
+    [diskCache waitForKnownState];
+    [diskCache setObject:@"present" forKey:@"present"];
+    [diskCache setObject:@"removed" forKey:@"removed"];
+    [diskCache removeObjectForKey:@"removed"];
+    XCTAssertTrue([diskCache keyFilterMightContainKey:@"present"]);
+    XCTAssertFalse([diskCache keyFilterMightContainKey:@"removed"], @"removed keys should be deleted from the filter");
+    [diskCache persistKeyFilter];
+
+    // A new instance picks up the filter before it has scanned the disk.
+    PINDiskCache *relaunchedCache = [[PINDiskCache alloc] initWithName:cacheName];
+    XCTAssertTrue([relaunchedCache keyFilterMightContainKey:@"present"]);
+    XCTAssertFalse([relaunchedCache keyFilterMightContainKey:@"removed"]);
+    XCTAssertFalse([relaunchedCache keyFilterMightContainKey:@"missing"]);
+    XCTAssertEqualObjects([relaunchedCache objectForKey:@"present"], @"present");
+    XCTAssertNil([relaunchedCache objectForKey:@"missing"]);
+
+    [relaunchedCache removeAllObjects];
+    XCTAssertFalse([relaunchedCache keyFilterMightContainKey:@"present"]);
+}
+
+- (void)testSnapshotExportImport
+{
+    PINCache *sourceCache = self.cache;
+    [sourceCache setObject:@"cold" forKey:@"cold"];
+    [sourceCache setObject:@"hot" forKey:@"hot"];
+    [sourceCache.diskCache objectForKey:@"hot"];
+
+    NSURL *archiveURL = [[NSURL fileURLWithPath:NSTemporaryDirectory()] URLByAppendingPathComponent:[[NSUUID UUID] UUIDString]];
+    NSError *error = nil;
+    XCTAssertTrue([sourceCache exportSnapshotToURL:archiveURL error:&error], @"export failed: %@", error);
+
+    PINCache *destinationCache = [[PINCache alloc] initWithName:[[NSUUID UUID] UUIDString]];
+    XCTAssertTrue([destinationCache importSnapshotFromURL:archiveURL memoryObjectCount:1 error:&error], @"import failed: %@", error);
+    XCTAssertEqualObjects([destinationCache.diskCache objectForKey:@"cold"], @"cold");
+    XCTAssertEqualObjects([destinationCache.diskCache objectForKey:@"hot"], @"hot");
+    XCTAssertEqual(destinationCache.diskCache.byteCount, sourceCache.diskCache.byteCount);
+    XCTAssertEqualObjects([destinationCache.memoryCache objectForKey:@"hot"], @"hot", @"hottest object should be in memory");
+    XCTAssertNil([destinationCache.memoryCache objectForKey:@"cold"]);
+
+    // A truncated archive is rejected.
+    NSData *archive = [NSData dataWithContentsOfURL:archiveURL];
+    [[archive subdataWithRange:NSMakeRange(0, archive.length - 1)] writeToURL:archiveURL atomically:YES];
+    XCTAssertFalse([destinationCache importSnapshotFromURL:archiveURL memoryObjectCount:0 error:&error]);
+    XCTAssertEqual(error.code, PINDiskCacheErrorInvalidSnapshot);
+
+    // So is an index whose lengths wrap around to add up to the right total. The index offset is at byte 16 of the
+    // header; each index entry starts with its length and ends with its key length, 48 bytes in.
+    NSMutableData *wrappedArchive = [archive mutableCopy];
+    uint64_t indexOffset = 0;
+    uint32_t keyLength = 0;
+    [wrappedArchive getBytes:&indexOffset range:NSMakeRange(16, sizeof(indexOffset))];
+    [wrappedArchive getBytes:&keyLength range:NSMakeRange((NSUInteger)indexOffset + 44, sizeof(keyLength))];
+    for (NSNumber *lengthOffset in @[ @(indexOffset), @(indexOffset + 48 + keyLength) ]) {
+        NSRange lengthRange = NSMakeRange(lengthOffset.unsignedIntegerValue, sizeof(uint64_t));
+        uint64_t length = 0;
+        [wrappedArchive getBytes:&length range:lengthRange];
+        length += 1ULL << 63;
+        [wrappedArchive replaceBytesInRange:lengthRange withBytes:&length];
+    }
+    [wrappedArchive writeToURL:archiveURL atomically:YES];
+    XCTAssertFalse([destinationCache importSnapshotFromURL:archiveURL memoryObjectCount:0 error:&error]);
+    XCTAssertEqual(error.code, PINDiskCacheErrorInvalidSnapshot);
+
+    [destinationCache removeAllObjects];
+    [[NSFileManager defaultManager] removeItemAtURL:archiveURL error:nil];
+}
+
+- (void)testSnapshotExportWithPendingWriteBacks
+{
+    self.cache.writesBack = YES;
+    self.cache.maxWriteBackDelay = 60.0;
+    [self.cache setObject:@"pending" forKey:@"pending"];
+    XCTAssertEqual(self.cache.pendingWriteBackCount, 1);
+
+    NSURL *archiveURL = [[NSURL fileURLWithPath:NSTemporaryDirectory()] URLByAppendingPathComponent:[[NSUUID UUID] UUIDString]];
+    NSError *error = nil;
+    XCTAssertTrue([self.cache exportSnapshotToURL:archiveURL error:&error], @"export failed: %@", error);
+
+    PINCache *destinationCache = [[PINCache alloc] initWithName:[[NSUUID UUID] UUIDString]];
+    XCTAssertTrue([destinationCache importSnapshotFromURL:archiveURL memoryObjectCount:0 error:&error], @"import failed: %@", error);
+    XCTAssertEqualObjects([destinationCache.diskCache objectForKey:@"pending"], @"pending", @"objects waiting to be written back should be in the snapshot");
+
+    [destinationCache removeAllObjects];
+    [[NSFileManager defaultManager] removeItemAtURL:archiveURL error:nil];
+}
+
+- (void)testSnapshotImportWithPendingWriteBacks
+{
+    PINCache *sourceCache = [[PINCache alloc] initWithName:[[NSUUID UUID] UUIDString]];
+    [sourceCache setObject:@"imported" forKey:@"key"];
+    NSURL *archiveURL = [[NSURL fileURLWithPath:NSTemporaryDirectory()] URLByAppendingPathComponent:[[NSUUID UUID] UUIDString]];
+    NSError *error = nil;
+    XCTAssertTrue([sourceCache exportSnapshotToURL:archiveURL error:&error], @"export failed: %@", error);
+
+    self.cache.writesBack = YES;
+    self.cache.maxWriteBackDelay = 60.0;
+    [self.cache setObject:@"pending" forKey:@"key"];
+    XCTAssertTrue([self.cache importSnapshotFromURL:archiveURL memoryObjectCount:0 error:&error], @"import failed: %@", error);
+    XCTAssertEqual(self.cache.pendingWriteBackCount, 0);
+
+    [self.cache flush];
+    XCTAssertEqualObjects([self.cache.diskCache objectForKey:@"key"], @"imported", @"a pending write-back shouldn't overwrite an imported object");
+
+    [sourceCache removeAllObjects];
+    [[NSFileManager defaultManager] removeItemAtURL:archiveURL error:nil];
+}
+
+- (void)testSerializedMemoryTier
+{
+    self.cache.memoryCache.costLimit = 2;
+    self.cache.serializedMemoryByteLimit = 1024 * 1024;
+    NSString *largeObject = [@"" stringByPaddingToLength:100000 withString:@"pinterest" startingAtIndex:0];
+
+    [self.cache setObject:largeObject forKey:@"a" withCost:1];
+    [self.cache setObject:@"b" forKey:@"b" withCost:1];
+    [self.cache setObject:@"c" forKey:@"c" withCost:1];
+    XCTAssertNil([self.cache.memoryCache objectForKey:@"a"], @"least recently used object should have been evicted");
+    NSDate *deadline = [NSDate dateWithTimeIntervalSinceNow:PINCacheTestBlockTimeout];
+    while (self.cache.serializedMemoryByteCount == 0 && [deadline timeIntervalSinceNow] > 0) {
+        usleep(1000);
+    }
+    XCTAssertGreaterThan(self.cache.serializedMemoryByteCount, 0, @"evicted object should have been demoted");
+    XCTAssertLessThan(self.cache.serializedMemoryByteCount, 100000, @"demoted object should be compressed");
+
+    // Served without the disk.
+    [self.cache.diskCache removeObjectForKey:@"a"];
+    XCTAssertTrue([self.cache containsObjectForKey:@"a"]);
+    XCTAssertEqualObjects([self.cache objectForKey:@"a"], largeObject);
+    XCTAssertEqual(self.cache.serializedMemoryByteCount, 0, @"hit should move the object back to memory");
+    XCTAssertEqualObjects([self.cache.memoryCache objectForKey:@"a"], largeObject);
+
+    // Removing an object removes it from every tier.
+    [self.cache setObject:@"d" forKey:@"d" withCost:1];
+    XCTAssertNil([self.cache.memoryCache objectForKey:@"b"]);
+    XCTAssertTrue([self.cache containsObjectForKey:@"b"], @"object should be found while its demotion is pending");
+    deadline = [NSDate dateWithTimeIntervalSinceNow:PINCacheTestBlockTimeout];
+    while (self.cache.serializedMemoryByteCount == 0 && [deadline timeIntervalSinceNow] > 0) {
+        usleep(1000);
+    }
+    XCTAssertGreaterThan(self.cache.serializedMemoryByteCount, 0);
+    [self.cache removeObjectForKey:@"b"];
+    XCTAssertEqual(self.cache.serializedMemoryByteCount, 0);
+    XCTAssertNil([self.cache objectForKey:@"b"]);
+
+    // A pending demotion doesn't bring back an object removed before it's serialized.
+    [self.cache setObject:@"f" forKey:@"f" withCost:1];
+    [self.cache setObject:@"g" forKey:@"g" withCost:1];
+    [self.cache removeObjectForKey:@"d"];
+    usleep(100000);
+    XCTAssertNil([self.cache objectForKey:@"d"]);
+
+    // Disabled, nothing is demoted.
+    self.cache.serializedMemoryByteLimit = 0;
+    [self.cache setObject:@"e" forKey:@"e" withCost:2];
+    XCTAssertEqual(self.cache.serializedMemoryByteCount, 0);
+}
+
+- (void)testPrefetchObjectsForKeys
+{
+    const NSUInteger objectCount = 50;
+    NSMutableArray<NSString *> *keys = [[NSMutableArray alloc] init];
+    for (NSUInteger idx = 0; idx < objectCount; idx++) {
+        NSString *key = [@(idx) stringValue];
+        [self.cache setObject:key forKey:key];
+        [keys addObject:key];
+    }
+    [self.cache.memoryCache removeAllObjects];
+    [self.cache.memoryCache setObject:@"0" forKey:@"0"];
+    [keys addObject:@"0"];
+    [keys addObject:@"missing"];
+
+    dispatch_semaphore_t semaphore = dispatch_semaphore_create(0);
+    __block NSDictionary *prefetchedObjects = nil;
+    NSProgress *progress = [self.cache prefetchObjectsForKeys:keys priority:PINOperationQueuePriorityHigh completion:^(PINCache *cache, NSDictionary<NSString *, id> *objects) {
+        prefetchedObjects = objects;
+        dispatch_semaphore_signal(semaphore);
+    }];
+    dispatch_semaphore_wait(semaphore, [self timeout]);
+
+    XCTAssertEqual(progress.totalUnitCount, (int64_t)objectCount + 1, @"duplicate keys should be ignored");
+    XCTAssertEqual(prefetchedObjects.count, objectCount);
+    XCTAssertNil(prefetchedObjects[@"missing"]);
+    for (NSUInteger idx = 0; idx < objectCount; idx++) {
+        NSString *key = [@(idx) stringValue];
+        XCTAssertEqualObjects(prefetchedObjects[key], key);
+        XCTAssertTrue([self.cache.memoryCache containsObjectForKey:key], @"prefetched object should be in memory");
+    }
+
+    // A cancelled prefetch still completes, but stops reading and doesn't promote anything to memory.
+    [self.cache.memoryCache removeAllObjects];
+    [self.cache.diskCache synchronouslyLockFileAccessWhileExecutingBlock:^(id<PINCaching> diskCache) {
+        NSProgress *cancelledProgress = [self.cache prefetchObjectsForKeys:keys priority:PINOperationQueuePriorityLow completion:^(PINCache *cache, NSDictionary<NSString *, id> *objects) {
+            prefetchedObjects = objects;
+            dispatch_semaphore_signal(semaphore);
+        }];
+        [cancelledProgress cancel];
+    }];
+    dispatch_semaphore_wait(semaphore, [self timeout]);
+
+    XCTAssertLessThan(prefetchedObjects.count, objectCount);
+    XCTAssertFalse([self.cache.memoryCache containsObjectForKey:@"1"]);
+}
+
+- (void)testBatchObjectsForKeys
+{
+    const NSUInteger objectCount = 20;
+    NSMutableArray<NSString *> *keys = [[NSMutableArray alloc] init];
+    for (NSUInteger idx = 0; idx < objectCount; idx++) {
+        [keys addObject:[@(idx) stringValue]];
+    }
+
+    __block NSUInteger willAddCount = 0;
+    __block NSUInteger didAddCount = 0;
+    self.cache.diskCache.willAddObjectBlock = ^(PINDiskCache *cache, NSString *key, id<NSCoding> object) {
+        willAddCount++;
+    };
+    self.cache.diskCache.didAddObjectBlock = ^(PINDiskCache *cache, NSString *key, id<NSCoding> object) {
+        didAddCount++;
+    };
+
+    // The last object for a duplicated key wins.
+    [self.cache setObjects:[keys arrayByAddingObject:@"last"] forKeys:[keys arrayByAddingObject:@"0"]];
+    XCTAssertEqual(willAddCount, objectCount, @"duplicate keys should only be stored once");
+    XCTAssertEqual(didAddCount, objectCount);
+    XCTAssertEqualObjects([self.cache.memoryCache objectForKey:@"0"], @"last");
+    XCTAssertEqualObjects([self.cache.diskCache objectForKey:@"0"], @"last");
+    XCTAssertEqualObjects([self.cache.diskCache objectForKey:@"1"], @"1");
+
+    // Half the keys are only on disk.
+    for (NSUInteger idx = 0; idx < objectCount; idx += 2) {
+        [self.cache.memoryCache removeObjectForKey:keys[idx]];
+    }
+
+    NSDictionary<NSString *, id> *objects = [self.cache objectsForKeys:[keys arrayByAddingObject:@"missing"]];
+    XCTAssertEqual(objects.count, objectCount);
+    XCTAssertNil(objects[@"missing"]);
+    XCTAssertEqualObjects(objects[@"0"], @"last");
+    for (NSUInteger idx = 1; idx < objectCount; idx++) {
+        XCTAssertEqualObjects(objects[keys[idx]], keys[idx]);
+        XCTAssertTrue([self.cache.memoryCache containsObjectForKey:keys[idx]], @"objects read from disk should be in memory");
+    }
+
+    dispatch_semaphore_t semaphore = dispatch_semaphore_create(0);
+    __block NSDictionary<NSString *, id> *asyncObjects = nil;
+    [self.cache setObjectsAsync:@[ @"a", @"b" ] forKeys:@[ @"a", @"b" ] completion:^(PINCache *cache) {
+        dispatch_semaphore_signal(semaphore);
+    }];
+    dispatch_semaphore_wait(semaphore, [self timeout]);
+    [self.cache.memoryCache removeAllObjects];
+    [self.cache objectsForKeysAsync:@[ @"a", @"b", @"c" ] completion:^(PINCache *cache, NSDictionary<NSString *, id> *objects) {
+        asyncObjects = objects;
+        dispatch_semaphore_signal(semaphore);
+    }];
+    dispatch_semaphore_wait(semaphore, [self timeout]);
+    XCTAssertEqualObjects(asyncObjects, (@{ @"a" : @"a", @"b" : @"b" }));
+}
+
+- (void)testWriteBack
+{
+    self.cache.writesBack = YES;
+    // Long enough that nothing is written on its own during the test.
+    self.cache.maxWriteBackDelay = 60.0;
+
+    [self.cache setObject:@"a" forKey:@"a"];
+    XCTAssertEqual(self.cache.pendingWriteBackCount, 1);
+    XCTAssertNil([self.cache.diskCache objectForKey:@"a"], @"set should complete before the object is on disk");
+    [self.cache.memoryCache removeAllObjects];
+    XCTAssertTrue([self.cache containsObjectForKey:@"a"]);
+    XCTAssertEqualObjects([self.cache objectForKey:@"a"], @"a", @"pending objects should still be found");
+
+    [self.cache flush];
+    XCTAssertEqual(self.cache.pendingWriteBackCount, 0);
+    XCTAssertEqualObjects([self.cache.diskCache objectForKey:@"a"], @"a");
+
+    // Removed before it was written, never written.
+    [self.cache setObject:@"b" forKey:@"b"];
+    [self.cache removeObjectForKey:@"b"];
+    [self.cache flush];
+    XCTAssertNil([self.cache.diskCache objectForKey:@"b"]);
+
+    // Reaching the bound writes everything pending.
+    self.cache.maxPendingWriteBackObjects = 3;
+    [self.cache setObject:@"c" forKey:@"c"];
+    [self.cache setObject:@"d" forKey:@"d"];
+    XCTAssertEqual(self.cache.pendingWriteBackCount, 2);
+    [self.cache setObject:@"e" forKey:@"e"];
+    XCTAssertEqual(self.cache.pendingWriteBackCount, 0);
+    XCTAssertEqualObjects([self.cache.diskCache objectForKey:@"c"], @"c");
+    XCTAssertEqualObjects([self.cache.diskCache objectForKey:@"e"], @"e");
+
+    // An object evicted from memory is written straight away.
+    self.cache.memoryCache.costLimit = 2;
+    [self.cache setObject:@"f" forKey:@"f" withCost:1];
+    [self.cache setObject:@"g" forKey:@"g" withCost:2];
+    NSDate *deadline = [NSDate dateWithTimeIntervalSinceNow:PINCacheTestBlockTimeout];
+    while (self.cache.pendingWriteBackCount > 0 && [deadline timeIntervalSinceNow] > 0) {
+        usleep(1000);
+    }
+    XCTAssertEqual(self.cache.pendingWriteBackCount, 0);
+    XCTAssertEqualObjects([self.cache.diskCache objectForKey:@"f"], @"f");
+
+    // Turning write-back off writes everything pending.
+    [self.cache setObject:@"h" forKey:@"h" withCost:1];
+    self.cache.writesBack = NO;
+    XCTAssertEqual(self.cache.pendingWriteBackCount, 0);
+    XCTAssertEqualObjects([self.cache.diskCache objectForKey:@"h"], @"h");
+}
+
+- (void)testWriteBackKeepsCostAndAgeLimit
+{
+    PINCache *cache = [[PINCache alloc] initWithName:[[NSUUID UUID] UUIDString] rootPath:NSTemporaryDirectory() serializer:nil deserializer:nil keyEncoder:nil keyDecoder:nil ttlCache:YES evictionStrategy:PINCacheEvictionStrategyLeastRecentlyUsed];
+    cache.writesBack = YES;
+    cache.maxWriteBackDelay = 60.0;
+
+    // Promoted from the write-back queue with the cost it was set with.
+    [cache setObject:@"a" forKey:@"a" withCost:5];
+    [cache.memoryCache removeAllObjects];
+    XCTAssertEqualObjects([cache objectForKey:@"a"], @"a");
+    XCTAssertEqual(cache.memoryCache.totalCost, (NSUInteger)5, @"a promoted object should keep its cost");
+
+    // Once its age limit has passed, a pending object is neither returned nor written.
+    [cache setObject:@"b" forKey:@"b" withCost:0 ageLimit:10.0];
+    [cache.memoryCache removeAllObjects];
+    [NSDate startMockingDateWithDate:[NSDate dateWithTimeIntervalSinceNow:15]];
+    XCTAssertFalse([cache containsObjectForKey:@"b"]);
+    XCTAssertNil([cache objectForKey:@"b"], @"an expired pending object shouldn't be promoted");
+    [cache flush];
+    [NSDate stopMockingDate];
+    XCTAssertNil([cache.diskCache objectForKey:@"b"], @"an expired pending object shouldn't be written");
+
+    [cache removeAllObjects];
+}
+
+- (void)testNegativeCache
+{
+    XCTAssertEqual(self.cache.negativeCacheAgeLimit, 0.0, @"negative caching should be off by default");
+    [self.cache objectForKey:@"a"];
+    [self.cache.diskCache setObject:@"a" forKey:@"a"];
+    XCTAssertEqualObjects([self.cache objectForKey:@"a"], @"a", @"misses shouldn't be remembered when disabled");
+
+    self.cache.negativeCacheAgeLimit = 10.0;
+    XCTAssertNil([self.cache objectForKey:@"b"]);
+    // Written behind the cache's back, so only a search of the tiers would find it.
+    [self.cache.diskCache setObject:@"b" forKey:@"b"];
+    XCTAssertNil([self.cache objectForKey:@"b"], @"the miss should be remembered");
+    XCTAssertFalse([self.cache containsObjectForKey:@"b"]);
+
+    // A set through the cache forgets the miss.
+    [self.cache setObject:@"b" forKey:@"b"];
+    XCTAssertEqualObjects([self.cache objectForKey:@"b"], @"b");
+
+    // Misses expire.
+    XCTAssertNil([self.cache objectForKey:@"c"]);
+    [self.cache.diskCache setObject:@"c" forKey:@"c"];
+    [NSDate startMockingDateWithDate:[NSDate dateWithTimeIntervalSinceNow:15]];
+    XCTAssertEqualObjects([self.cache objectForKey:@"c"], @"c", @"expired misses should be searched for again");
+    [NSDate stopMockingDate];
+
+    // The oldest misses are forgotten first.
+    self.cache.negativeCacheCountLimit = 2;
+    for (NSString *key in @[ @"d", @"e", @"f" ]) {
+        XCTAssertNil([self.cache objectForKey:key]);
+        [self.cache.diskCache setObject:key forKey:key];
+    }
+    XCTAssertEqualObjects([self.cache objectForKey:@"d"], @"d");
+    XCTAssertNil([self.cache objectForKey:@"f"]);
+
+    // Removing everything forgets every miss too.
+    [self.cache removeAllObjects];
+    [self.cache.diskCache setObject:@"f" forKey:@"f"];
+    XCTAssertEqualObjects([self.cache objectForKey:@"f"], @"f");
+}
+
+- (void)testObjectForKeyLoader
+{
+    // Concurrent misses share a single load.
+    NSLock *countsLock = [[NSLock alloc] init];
+    __block NSUInteger loaderCalls = 0;
+    PINCacheLoaderBlock slowLoader = ^(NSString *key, PINCacheLoaderCompletionBlock completion) {
+        [countsLock lock];
+        loaderCalls++;
+        [countsLock unlock];
+        dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(0.1 * NSEC_PER_SEC)), dispatch_get_global_queue(QOS_CLASS_DEFAULT, 0), ^{
+            completion(@"loaded");
+        });
+    };
+
+    dispatch_group_t group = dispatch_group_create();
+    NSUInteger callerCount = 20;
+    NSMutableArray *results = [[NSMutableArray alloc] init];
+    NSLock *resultsLock = [[NSLock alloc] init];
+    for (NSUInteger idx = 0; idx < callerCount; idx++) {
+        dispatch_group_enter(group);
+        [self.cache objectForKeyAsync:@"a" loader:slowLoader completion:^(PINCache *cache, NSString *key, id object) {
+            [resultsLock lock];
+            [results addObject:object ?: [NSNull null]];
+            [resultsLock unlock];
+            dispatch_group_leave(group);
+        }];
+    }
+    XCTAssertEqual(dispatch_group_wait(group, [self timeout]), 0);
+    XCTAssertEqual(loaderCalls, 1, @"the loader should run once for concurrent misses");
+    XCTAssertEqual(results.count, callerCount);
+    for (id result in results) {
+        XCTAssertEqualObjects(result, @"loaded");
+    }
+    XCTAssertEqualObjects([self.cache.memoryCache objectForKey:@"a"], @"loaded");
+    XCTAssertEqualObjects([self.cache.diskCache objectForKey:@"a"], @"loaded");
+
+    // Stale objects are served, then refreshed once in the background.
+    self.cache.softAgeLimit = 10.0;
+    [NSDate startMockingDateWithDate:[NSDate dateWithTimeIntervalSinceNow:15]];
+    dispatch_semaphore_t semaphore = dispatch_semaphore_create(0);
+    __block id staleObject = nil;
+    [self.cache objectForKeyAsync:@"a" loader:^(NSString *key, PINCacheLoaderCompletionBlock completion) {
+        completion(@"refreshed");
+    } completion:^(PINCache *cache, NSString *key, id object) {
+        staleObject = object;
+        dispatch_semaphore_signal(semaphore);
+    }];
+    dispatch_semaphore_wait(semaphore, [self timeout]);
+    [NSDate stopMockingDate];
+    XCTAssertEqualObjects(staleObject, @"loaded", @"a stale object should be returned straight away");
+    NSDate *deadline = [NSDate dateWithTimeIntervalSinceNow:PINCacheTestBlockTimeout];
+    while (![[self.cache.diskCache objectForKey:@"a"] isEqual:@"refreshed"] && [deadline timeIntervalSinceNow] > 0) {
+        usleep(1000);
+    }
+    XCTAssertEqualObjects([self.cache objectForKey:@"a"], @"refreshed");
+
+    // Loads of different keys respect the concurrency limit.
+    self.cache.maxConcurrentLoads = 1;
+    __block NSUInteger runningLoads = 0;
+    __block NSUInteger peakLoads = 0;
+    PINCacheLoaderBlock countingLoader = ^(NSString *key, PINCacheLoaderCompletionBlock completion) {
+        [countsLock lock];
+        runningLoads++;
+        peakLoads = MAX(peakLoads, runningLoads);
+        [countsLock unlock];
+        dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(0.02 * NSEC_PER_SEC)), dispatch_get_global_queue(QOS_CLASS_DEFAULT, 0), ^{
+            [countsLock lock];
+            runningLoads--;
+            [countsLock unlock];
+            completion(key);
+        });
+    };
+    for (NSString *objectKey in @[ @"b", @"c", @"d", @"e" ]) {
+        dispatch_group_enter(group);
+        [self.cache objectForKeyAsync:objectKey loader:countingLoader completion:^(PINCache *cache, NSString *key, id object) {
+            XCTAssertEqualObjects(object, key);
+            dispatch_group_leave(group);
+        }];
+    }
+    XCTAssertEqual(dispatch_group_wait(group, [self timeout]), 0);
+    XCTAssertEqual(peakLoads, 1);
+
+    // Loaders that block don't take the slots of disk reads and writes.
+    self.cache.maxConcurrentLoads = 0;
+    NSUInteger blockedLoadCount = self.cache.maxConcurrentOperations;
+    dispatch_semaphore_t loadersStarted = dispatch_semaphore_create(0);
+    dispatch_semaphore_t loaderGate = dispatch_semaphore_create(0);
+    PINCacheLoaderBlock blockingLoader = ^(NSString *key, PINCacheLoaderCompletionBlock completion) {
+        dispatch_semaphore_signal(loadersStarted);
+        dispatch_semaphore_wait(loaderGate, DISPATCH_TIME_FOREVER);
+        completion(key);
+    };
+    for (NSUInteger idx = 0; idx < blockedLoadCount; idx++) {
+        dispatch_group_enter(group);
+        NSString *blockedKey = [[NSString alloc] initWithFormat:@"blocked%lu", (unsigned long)idx];
+        [self.cache objectForKeyAsync:blockedKey loader:blockingLoader completion:^(PINCache *cache, NSString *key, id object) {
+            dispatch_group_leave(group);
+        }];
+    }
+    for (NSUInteger idx = 0; idx < blockedLoadCount; idx++) {
+        XCTAssertEqual(dispatch_semaphore_wait(loadersStarted, [self timeout]), 0);
+    }
+    XCTestExpectation *setExpectation = [self expectationWithDescription:@"set while loaders are blocked"];
+    [self.cache setObjectAsync:@"value" forKey:@"f" completion:^(PINCache *cache, NSString *key, id object) {
+        [setExpectation fulfill];
+    }];
+    [self waitForExpectationsWithTimeout:PINCacheTestBlockTimeout handler:nil];
+    for (NSUInteger idx = 0; idx < blockedLoadCount; idx++) {
+        dispatch_semaphore_signal(loaderGate);
+    }
+    XCTAssertEqual(dispatch_group_wait(group, [self timeout]), 0);
+}
+
+- (void)testExecutionLanes
+{
+    XCTAssertEqual(self.cache.maxConcurrentOperations, 10);
+    XCTAssertTrue(self.cache.adaptsConcurrencyToDiskLatency);
+    XCTAssertEqual(self.cache.maxConcurrentMaintenanceOperations, 2);
+    XCTAssertEqual(self.cache.maxConcurrentMemoryOperations, [[NSProcessInfo processInfo] activeProcessorCount]);
+
+    // Lowering the bound applies straight away, whatever latency says.
+    self.cache.maxConcurrentOperations = 4;
+    XCTAssertLessThanOrEqual(self.cache.concurrentOperations, 4);
+
+    // Memory hits are answered while every I/O slot is stuck behind the disk.
+    self.cache.adaptsConcurrencyToDiskLatency = NO;
+    self.cache.maxConcurrentOperations = 2;
+    for (NSUInteger idx = 0; idx < 4; idx++) {
+        NSString *key = [NSString stringWithFormat:@"%lu", (unsigned long)idx];
+        [self.cache setObject:key forKey:key];
+        [self.cache.memoryCache removeObjectForKey:key];
+    }
+    [self.cache setObject:@"hit" forKey:@"hit"];
+
+    dispatch_semaphore_t diskHeld = dispatch_semaphore_create(0);
+    dispatch_semaphore_t releaseDisk = dispatch_semaphore_create(0);
+    [self.cache.diskCache lockFileAccessWhileExecutingBlockAsync:^(id<PINCaching> diskCache) {
+        dispatch_semaphore_signal(diskHeld);
+        dispatch_semaphore_wait(releaseDisk, [self timeout]);
+    }];
+    XCTAssertEqual(dispatch_semaphore_wait(diskHeld, [self timeout]), 0);
+
+    dispatch_group_t diskReads = dispatch_group_create();
+    for (NSUInteger idx = 0; idx < 4; idx++) {
+        dispatch_group_enter(diskReads);
+        [self.cache objectForKeyAsync:[NSString stringWithFormat:@"%lu", (unsigned long)idx] completion:^(PINCache *cache, NSString *key, id object) {
+            dispatch_group_leave(diskReads);
+        }];
+    }
+
+    dispatch_semaphore_t hit = dispatch_semaphore_create(0);
+    [self.cache objectForKeyAsync:@"hit" completion:^(PINCache *cache, NSString *key, id object) {
+        XCTAssertEqualObjects(object, @"hit");
+        dispatch_semaphore_signal(hit);
+    }];
+    XCTAssertEqual(dispatch_semaphore_wait(hit, dispatch_time(DISPATCH_TIME_NOW, (int64_t)(NSEC_PER_SEC))), 0, @"a memory hit shouldn't wait for the I/O lane");
+    XCTAssertNotEqual(dispatch_group_wait(diskReads, DISPATCH_TIME_NOW), 0, @"the I/O lane should still be held");
+
+    dispatch_semaphore_signal(releaseDisk);
+    XCTAssertEqual(dispatch_group_wait(diskReads, [self timeout]), 0);
+
+    // Without adapting, the lane runs at its bound.
+    XCTAssertEqual(self.cache.concurrentOperations, 2);
+}
+
+- (void)testStatistics
+{
+    XCTAssertFalse(self.cache.statisticsEnabled);
+    [self.cache setObject:@"untracked" forKey:@"untracked"];
+    XCTAssertEqual(self.cache.statistics.setCount, 0);
+
+    self.cache.statisticsEnabled = YES;
+    XCTAssertTrue(self.cache.memoryCache.statisticsEnabled);
+    XCTAssertTrue(self.cache.diskCache.statisticsEnabled);
+
+    [self.cache setObject:@"value" forKey:@"key"];
+    XCTAssertEqualObjects([self.cache objectForKey:@"key"], @"value");
+    [self.cache.memoryCache removeObjectForKey:@"key"];
+    XCTAssertEqualObjects([self.cache objectForKey:@"key"], @"value");
+    XCTAssertNil([self.cache objectForKey:@"missing"]);
+
+    PINCacheStatistics *statistics = self.cache.statistics;
+    XCTAssertEqual(statistics.setCount, 1);
+    XCTAssertEqual(statistics.hitCount, 2);
+    XCTAssertEqual(statistics.missCount, 1);
+    XCTAssertEqualWithAccuracy(statistics.hitRate, 2.0 / 3.0, 0.001);
+    XCTAssertEqual(statistics.promotionCount, 1);
+    XCTAssertEqual(statistics.readLatency.count, 3);
+    XCTAssertEqual(statistics.writeLatency.count, 1);
+    XCTAssertGreaterThan(statistics.readLatency.maximum, 0.0);
+    XCTAssertLessThanOrEqual(statistics.readLatency.minimum, statistics.readLatency.p50);
+    XCTAssertLessThanOrEqual(statistics.readLatency.p50, statistics.readLatency.p99);
+    XCTAssertLessThanOrEqual(statistics.readLatency.p99, statistics.readLatency.p999);
+    XCTAssertLessThanOrEqual(statistics.readLatency.p999, statistics.readLatency.maximum);
+
+    // Each tier only counts what reached it.
+    PINCacheStatistics *memoryStatistics = self.cache.memoryCache.statistics;
+    XCTAssertEqual(memoryStatistics.hitCount, 1);
+    XCTAssertEqual(memoryStatistics.missCount, 2);
+    XCTAssertEqual(memoryStatistics.setCount, 2);
+    PINCacheStatistics *diskStatistics = self.cache.diskCache.statistics;
+    XCTAssertEqual(diskStatistics.hitCount, 1);
+    XCTAssertEqual(diskStatistics.setCount, 1);
+    XCTAssertGreaterThan(diskStatistics.bytesWritten, 0);
+    XCTAssertGreaterThan(diskStatistics.bytesRead, 0);
+
+    [self.cache.memoryCache setObject:@"costly" forKey:@"costly" withCost:10];
+    [self.cache.memoryCache trimToCost:0];
+    XCTAssertGreaterThanOrEqual([self.cache.memoryCache.statistics evictionCountForReason:PINCacheEvictionReasonCost], 1);
+    XCTAssertEqual([self.cache.memoryCache.statistics evictionCountForReason:PINCacheEvictionReasonAge], 0);
+
+    [self.cache resetStatistics];
+    XCTAssertEqual(self.cache.statistics.hitCount, 0);
+    XCTAssertEqual(self.cache.statistics.readLatency.count, 0);
+    XCTAssertEqual(self.cache.memoryCache.statistics.evictionCount, 0);
+    XCTAssertEqual(self.cache.diskCache.statistics.bytesRead, 0);
+}
+
+- (void)testTracing
+{
+    PINDiskCache *diskCache = self.cache.diskCache;
+    PINCacheTestTraceSink *sink = [[PINCacheTestTraceSink alloc] init];
+    [diskCache setObject:@"untraced" forKey:@"untraced"];
+    diskCache.traceSink = sink;
+
+    [diskCache setObject:@"value" forKey:@"key"];
+    XCTAssertEqualObjects([diskCache objectForKey:@"key"], @"value");
+    dispatch_semaphore_t semaphore = dispatch_semaphore_create(0);
+    [diskCache removeObjectForKeyAsync:@"key" completion:^(PINDiskCache *cache, NSString *key, id<NSCoding> object) {
+        dispatch_semaphore_signal(semaphore);
+    }];
+    XCTAssertEqual(dispatch_semaphore_wait(semaphore, [self timeout]), 0);
+    diskCache.traceSink = nil;
+    [diskCache objectForKey:@"untraced"];
+
+    NSArray<PINCacheTraceSpan *> *spans = nil;
+    @synchronized (sink) {
+        spans = [sink.spans copy];
+    }
+    XCTAssertEqualObjects([spans valueForKey:@"operation"], (@[ @"write", @"read", @"remove" ]));
+    for (PINCacheTraceSpan *span in spans) {
+        XCTAssertEqual(span.keyHash, [@"key" hash]);
+        XCTAssertGreaterThan(span.duration, 0.0);
+        XCTAssertGreaterThan([span durationOfPhase:PINCacheTracePhaseIO], 0.0);
+        XCTAssertLessThanOrEqual([span durationOfPhase:PINCacheTracePhaseIO], span.duration);
+        __block NSTimeInterval lastStartTime = span.startTime;
+        [span enumeratePhasesUsingBlock:^(PINCacheTracePhase phase, NSTimeInterval startTime, NSTimeInterval duration) {
+            XCTAssertGreaterThanOrEqual(startTime, lastStartTime);
+            XCTAssertLessThanOrEqual(startTime + duration, span.startTime + span.duration + 0.000001);
+            lastStartTime = startTime;
+        }];
+    }
+    XCTAssertGreaterThan([spans[0] durationOfPhase:PINCacheTracePhaseSerialization], 0.0);
+    XCTAssertGreaterThan([spans[1] durationOfPhase:PINCacheTracePhaseDeserialization], 0.0);
+    XCTAssertGreaterThan([spans[2] durationOfPhase:PINCacheTracePhaseQueue], 0.0);
+
+    // The Chrome sink writes an array of complete events, one for each span and one for each phase.
+    NSURL *traceURL = [[NSURL fileURLWithPath:NSTemporaryDirectory()] URLByAppendingPathComponent:[[NSUUID UUID] UUIDString]];
+    NSError *error = nil;
+    PINCacheChromeTraceSink *chromeSink = [[PINCacheChromeTraceSink alloc] initWithFileURL:traceURL error:&error];
+    XCTAssertNotNil(chromeSink, @"%@", error);
+    __block NSUInteger phaseCount = 0;
+    for (PINCacheTraceSpan *span in spans) {
+        [chromeSink recordSpan:span];
+        [span enumeratePhasesUsingBlock:^(PINCacheTracePhase phase, NSTimeInterval startTime, NSTimeInterval duration) {
+            phaseCount++;
+        }];
+    }
+    [chromeSink close];
+    [chromeSink recordSpan:spans[0]];
+
+    NSArray<NSDictionary *> *events = [NSJSONSerialization JSONObjectWithData:[NSData dataWithContentsOfURL:traceURL] options:0 error:&error];
+    XCTAssertNotNil(events, @"%@", error);
+    XCTAssertEqual(events.count, spans.count + phaseCount);
+    XCTAssertEqualObjects(events[0][@"name"], @"write");
+    XCTAssertEqualObjects(events[0][@"ph"], @"X");
+    XCTAssertEqualObjects(events[0][@"args"][@"key"], ([NSString stringWithFormat:@"%lx", (unsigned long)[@"key" hash]]));
+    [[NSFileManager defaultManager] removeItemAtURL:traceURL error:NULL];
+}
+
+- (void)testObjectForKeyAsyncCallbackQueue
+{
+    static void *callbackQueueKey = &callbackQueueKey;
+    dispatch_queue_t callbackQueue = dispatch_queue_create("com.pinterest.PINCacheTests.callbackQueue", DISPATCH_QUEUE_SERIAL);
+    dispatch_queue_set_specific(callbackQueue, callbackQueueKey, callbackQueueKey, NULL);
+
+    [self.cache setObject:@"memory" forKey:@"memory"];
+    [self.cache setObject:@"disk" forKey:@"disk"];
+    [self.cache.memoryCache removeObjectForKey:@"disk"];
+
+    dispatch_semaphore_t semaphore = dispatch_semaphore_create(0);
+    NSMutableDictionary<NSString *, id> *objects = [[NSMutableDictionary alloc] init];
+    __block NSUInteger callbacksOnQueue = 0;
+    for (NSString *key in @[ @"memory", @"disk", @"missing" ]) {
+        [self.cache objectForKeyAsync:key callbackQueue:callbackQueue completion:^(PINCache *cache, NSString *objectKey, id object) {
+            if (dispatch_get_specific(callbackQueueKey) == callbackQueueKey) {
+                callbacksOnQueue++;
+            }
+            objects[objectKey] = object;
+            dispatch_semaphore_signal(semaphore);
+        }];
+        dispatch_semaphore_wait(semaphore, [self timeout]);
+    }
+
+    XCTAssertEqual(callbacksOnQueue, 3);
+    XCTAssertEqualObjects(objects, (@{ @"memory" : @"memory", @"disk" : @"disk" }));
+    XCTAssertTrue([self.cache.memoryCache containsObjectForKey:@"disk"], @"disk hit should be promoted to memory");
+}
+
+- (void)testObjectForKeyAsyncMemoryHitLatency
+{
+    // Measures the time from the first request to the last callback for a burst of memory hits.
+    const NSUInteger requestCount = 10000;
+    [self.cache setObject:@"object" forKey:@"key"];
+
+    [self measureBlock:^{
+        dispatch_group_t group = dispatch_group_create();
+        NSLock *lock = [[NSLock alloc] init];
+        __block NSUInteger hitCount = 0;
+        for (NSUInteger idx = 0; idx < requestCount; idx++) {
+            dispatch_group_enter(group);
+            [self.cache objectForKeyAsync:@"key" completion:^(PINCache *cache, NSString *key, id object) {
+                if (object) {
+                    [lock lock];
+                    hitCount++;
+                    [lock unlock];
+                }
+                dispatch_group_leave(group);
+            }];
+        }
+        XCTAssertEqual(dispatch_group_wait(group, [self timeout]), 0);
+        XCTAssertEqual(hitCount, requestCount);
+    }];
+}
+
+- (void)testRemoveObjectsWithTag
+{
+    PINMemoryCache *memoryCache = self.cache.memoryCache;
+    __block NSUInteger removedCount = 0;
+    memoryCache.didRemoveObjectBlock = ^(PINMemoryCache *cache, NSString *key, id object) {
+        removedCount++;
+    };
+    [memoryCache setObject:@"a" forKey:@"a" withTags:[NSSet setWithObjects:@"user:1", @"feed", nil]];
+    [memoryCache setObject:@"b" forKey:@"b" withTags:[NSSet setWithObject:@"user:1"]];
+    [memoryCache setObject:@"c" forKey:@"c" withTags:[NSSet setWithObject:@"feed"]];
+    // Setting a key again replaces its tags.
+    [memoryCache setObject:@"b" forKey:@"b"];
+    [memoryCache removeObjectsWithTag:@"user:1"];
+    XCTAssertNil([memoryCache objectForKey:@"a"]);
+    XCTAssertNotNil([memoryCache objectForKey:@"b"]);
+    XCTAssertNotNil([memoryCache objectForKey:@"c"]);
+    XCTAssertEqual(removedCount, 1);
+    [memoryCache removeObjectsWithTag:@"feed"];
+    XCTAssertNil([memoryCache objectForKey:@"c"]);
+
+    NSString *cacheName = @"testRemoveObjectsWithTag";
+    PINDiskCache *diskCache = [[PINDiskCache alloc] initWithName:cacheName];
+    [diskCache removeAllObjects];
+    [diskCache setObject:@"a" forKey:@"a" withTags:[NSSet setWithObjects:@"user:1", @"feed", nil]];
+    [diskCache setObject:@"b" forKey:@"b" withTags:[NSSet setWithObject:@"user:1"]];
+    [diskCache setObject:@"c" forKey:@"c" withTags:[NSSet setWithObject:@"feed"]];
+    [diskCache setObjects:@[ @"b" ] forKeys:@[ @"b" ]];
+    NSUInteger byteCount = diskCache.byteCount;
+
+    // Tags are read back from disk by a new instance.
+    diskCache = nil;
+    diskCache = [[PINDiskCache alloc] initWithName:cacheName];
+    dispatch_semaphore_t semaphore = dispatch_semaphore_create(0);
+    [diskCache removeObjectsWithTagAsync:@"user:1" completion:^(PINDiskCache *cache) {
+        dispatch_semaphore_signal(semaphore);
+    }];
+    XCTAssertEqual(dispatch_semaphore_wait(semaphore, [self timeout]), 0);
+    XCTAssertFalse([diskCache containsObjectForKey:@"a"]);
+    XCTAssertTrue([diskCache containsObjectForKey:@"b"]);
+    XCTAssertTrue([diskCache containsObjectForKey:@"c"]);
+    XCTAssertLessThan(diskCache.byteCount, byteCount);
+    [diskCache removeObjectsWithTag:@"feed"];
+    XCTAssertFalse([diskCache containsObjectForKey:@"c"]);
+
+    // An object set again without the tag after the tagged keys were collected is kept. The will remove block runs in
+    // between the two.
+    [diskCache setObject:@"d" forKey:@"d" withTags:[NSSet setWithObject:@"feed"]];
+    __weak PINDiskCache *weakDiskCache = diskCache;
+    diskCache.willRemoveObjectBlock = ^(PINDiskCache *cache, NSString *key, id object) {
+        weakDiskCache.willRemoveObjectBlock = nil;
+        [weakDiskCache setObject:@"untagged" forKey:key];
+    };
+    [diskCache removeObjectsWithTag:@"feed"];
+    XCTAssertEqualObjects([diskCache objectForKey:@"d"], @"untagged");
+    [diskCache removeAllObjects];
+}
+
+- (void)testRemoveObjectsWithKeyPrefix
+{
+    NSArray<NSString *> *keys = @[ @"user:1:feed", @"user:1:profile", @"user:10:feed", @"user:2:feed" ];
+    for (NSString *key in keys) {
+        [self.cache setObject:key forKey:key];
+    }
+
+    __block NSUInteger memoryRemovedCount = 0;
+    self.cache.memoryCache.willRemoveObjectBlock = ^(PINMemoryCache *cache, NSString *key, id object) {
+        XCTAssertEqualObjects(object, key);
+        memoryRemovedCount++;
+    };
+    __block NSUInteger diskRemovedCount = 0;
+    self.cache.diskCache.didRemoveObjectBlock = ^(PINDiskCache *cache, NSString *key, id<NSCoding> object) {
+        diskRemovedCount++;
+    };
+    [self.cache.memoryCache removeObjectsWithKeyPrefix:@"user:1:"];
+    [self.cache.diskCache removeObjectsWithKeyPrefix:@"user:1:"];
+
+    XCTAssertEqual(memoryRemovedCount, 2);
+    XCTAssertEqual(diskRemovedCount, 2);
+    for (NSString *key in keys) {
+        BOOL removed = [key hasPrefix:@"user:1:"];
+        XCTAssertEqual([self.cache.memoryCache containsObjectForKey:key], !removed, @"%@", key);
+        XCTAssertEqual([self.cache.diskCache containsObjectForKey:key], !removed, @"%@", key);
+    }
+}
+
+- (void)testCacheRemoveObjectsWithTagOrPrefix
+{
+    NSSet<NSString *> *tags = [NSSet setWithObject:@"user:1"];
+
+    // An object read back from disk comes into memory without its tags, and still goes.
+    [self.cache setObject:@"a" forKey:@"a" withTags:tags];
+    [self.cache.memoryCache removeObjectForKey:@"a"];
+    XCTAssertEqualObjects([self.cache objectForKey:@"a"], @"a");
+    XCTAssertNil([self.cache objectForKey:@"missing"]);
+    [self.cache removeObjectsWithTag:@"user:1"];
+    XCTAssertNil([self.cache objectForKey:@"a"]);
+    XCTAssertFalse([self.cache.diskCache containsObjectForKey:@"a"]);
+
+    // Objects waiting to be written back stay removed once the queue is flushed.
+    self.cache.writesBack = YES;
+    self.cache.maxWriteBackDelay = 60.0;
+    [self.cache setObject:@"b" forKey:@"b" withTags:tags];
+    [self.cache setObject:@"user:1:c" forKey:@"user:1:c"];
+    [self.cache setObject:@"d" forKey:@"d"];
+    XCTAssertEqual(self.cache.pendingWriteBackCount, 3);
+    [self.cache.memoryCache removeAllObjects];
+
+    [self.cache removeObjectsWithTag:@"user:1"];
+    [self.cache removeObjectsWithKeyPrefix:@"user:1:"];
+    XCTAssertEqual(self.cache.pendingWriteBackCount, 1);
+    [self.cache flush];
+    XCTAssertNil([self.cache objectForKey:@"b"]);
+    XCTAssertNil([self.cache objectForKey:@"user:1:c"]);
+    XCTAssertFalse([self.cache.diskCache containsObjectForKey:@"b"]);
+    XCTAssertFalse([self.cache.diskCache containsObjectForKey:@"user:1:c"]);
+    XCTAssertEqualObjects([self.cache.diskCache objectForKey:@"d"], @"d");
+
+    // Tags set in write-back mode reach the disk with the object.
+    [self.cache setObject:@"e" forKey:@"e" withTags:tags];
+    [self.cache flush];
+    [self.cache.diskCache removeObjectsWithTag:@"user:1"];
+    XCTAssertFalse([self.cache.diskCache containsObjectForKey:@"e"]);
+}
+
+- (void)testTieredCachePromotion
+{
+    PINCacheTestSlowTier *top = [[PINCacheTestSlowTier alloc] initWithName:@"top" latency:0.0];
+    PINCacheTestSlowTier *middle = [[PINCacheTestSlowTier alloc] initWithName:@"middle" latency:0.0];
+    PINCacheTestSlowTier *bottom = [[PINCacheTestSlowTier alloc] initWithName:@"bottom" latency:0.0];
+    PINTieredCache *tieredCache = [[PINTieredCache alloc] initWithName:PINCacheTestName tiers:@[ top, middle, bottom ]];
+
+    [bottom setObject:@"all" forKey:@"all"];
+    XCTAssertEqualObjects([tieredCache objectForKey:@"all"], @"all");
+    XCTAssertNil([tieredCache objectForKey:@"missing"]);
+    XCTAssertTrue([tieredCache containsObjectForKey:@"all"]);
+    [self waitForPromotionsToTier:top key:@"all"];
+    XCTAssertTrue([middle containsObjectForKey:@"all"]);
+
+    tieredCache.promotionPolicy = PINTieredCachePromotionPolicyNextTier;
+    [bottom setObject:@"next" forKey:@"next"];
+    dispatch_semaphore_t semaphore = dispatch_semaphore_create(0);
+    [tieredCache objectForKeyAsync:@"next" completion:^(PINTieredCache *cache, NSString *key, id object) {
+        XCTAssertEqualObjects(object, @"next");
+        dispatch_semaphore_signal(semaphore);
+    }];
+    XCTAssertEqual(dispatch_semaphore_wait(semaphore, [self timeout]), 0);
+    [self waitForPromotionsToTier:middle key:@"next"];
+    XCTAssertFalse([top containsObjectForKey:@"next"]);
+
+    tieredCache.promotionPolicy = PINTieredCachePromotionPolicyNone;
+    [bottom setObject:@"none" forKey:@"none"];
+    XCTAssertEqualObjects(tieredCache[@"none"], @"none");
+    tieredCache[@"none"] = nil;
+    XCTAssertFalse([bottom containsObjectForKey:@"none"]);
+    XCTAssertFalse([middle containsObjectForKey:@"none"]);
+}
+
+- (void)testTieredCachePromotionKeepsCostAndAgeLimit
+{
+    PINCacheTestSlowTier *top = [[PINCacheTestSlowTier alloc] initWithName:@"top" latency:0.0];
+    PINCacheTestSlowTier *bottom = [[PINCacheTestSlowTier alloc] initWithName:@"bottom" latency:0.0];
+    PINTieredCache *tieredCache = [[PINTieredCache alloc] initWithName:PINCacheTestName tiers:@[ top, bottom ]];
+    tieredCache.writePolicy = PINTieredCacheWritePolicyWriteAround;
+
+    [tieredCache setObject:@"limited" forKey:@"limited" withCost:3 ageLimit:100.0];
+    XCTAssertEqualObjects([tieredCache objectForKey:@"limited"], @"limited");
+    [self waitForPromotionsToTier:top key:@"limited"];
+    XCTAssertEqual([top costForKey:@"limited"], 3);
+    XCTAssertGreaterThan([top ageLimitForKey:@"limited"], 0.0);
+    XCTAssertLessThanOrEqual([top ageLimitForKey:@"limited"], 100.0, @"a promoted copy shouldn't outlive the original");
+
+    // An object past its age limit that a tier still returns isn't copied.
+    [tieredCache setObject:@"expired" forKey:@"expired" withCost:1 ageLimit:0.05];
+    usleep(100000);
+    XCTAssertEqualObjects([tieredCache objectForKey:@"expired"], @"expired");
+    usleep(100000);
+    XCTAssertFalse([top containsObjectForKey:@"expired"]);
+}
+
+- (void)testTieredCacheDemotion
+{
+    PINMemoryCache *top = [[PINMemoryCache alloc] initWithName:PINCacheTestName operationQueue:[PINOperationQueue sharedOperationQueue]];
+    top.costLimit = 1;
+    PINCacheTestSlowTier *bottom = [[PINCacheTestSlowTier alloc] initWithName:@"bottom" latency:0.0];
+    PINTieredCache *tieredCache = [[PINTieredCache alloc] initWithName:PINCacheTestName tiers:@[ top, bottom ]];
+
+    // Not demoted by default.
+    [top setObject:@"a" forKey:@"a" withCost:1];
+    [top setObject:@"b" forKey:@"b" withCost:1];
+    XCTAssertFalse([top containsObjectForKey:@"a"]);
+    usleep(100000);
+    XCTAssertFalse([bottom containsObjectForKey:@"a"]);
+
+    tieredCache.demotionPolicy = PINTieredCacheDemotionPolicyNextTier;
+    [top setObject:@"c" forKey:@"c" withCost:1];
+    XCTAssertFalse([top containsObjectForKey:@"b"]);
+    [self waitForPromotionsToTier:bottom key:@"b"];
+    XCTAssertEqualObjects([tieredCache objectForKey:@"b"], @"b");
+
+    // Demotions keep the cost and age limit the object was set with.
+    [tieredCache setObject:@"d" forKey:@"d" withCost:1 ageLimit:100.0];
+    [bottom removeObjectForKey:@"d"];
+    [top setObject:@"e" forKey:@"e" withCost:1];
+    [self waitForPromotionsToTier:bottom key:@"d"];
+    XCTAssertEqual([bottom costForKey:@"d"], 1);
+    XCTAssertGreaterThan([bottom ageLimitForKey:@"d"], 0.0);
+    XCTAssertLessThanOrEqual([bottom ageLimitForKey:@"d"], 100.0);
+
+    // A tiered cache sharing the memory cache sees its evictions too, without taking them from the first.
+    PINCacheTestSlowTier *otherBottom = [[PINCacheTestSlowTier alloc] initWithName:@"other bottom" latency:0.0];
+    PINTieredCache *otherTieredCache = [[PINTieredCache alloc] initWithName:PINCacheTestName tiers:@[ top, otherBottom ]];
+    otherTieredCache.demotionPolicy = PINTieredCacheDemotionPolicyNextTier;
+    [top setObject:@"f" forKey:@"f" withCost:1];
+    [self waitForPromotionsToTier:bottom key:@"e"];
+    [self waitForPromotionsToTier:otherBottom key:@"e"];
+}
+
+- (void)waitForPromotionsToTier:(PINCacheTestSlowTier *)tier key:(NSString *)key
+{
+    NSDate *deadline = [NSDate dateWithTimeIntervalSinceNow:PINCacheTestBlockTimeout];
+    while (![tier containsObjectForKey:key] && [deadline timeIntervalSinceNow] > 0) {
+        [NSThread sleepForTimeInterval:0.001];
+    }
+    XCTAssertTrue([tier containsObjectForKey:key], @"%@ should have been promoted to %@", key, tier.name);
+}
+
+- (void)testTieredCacheWritePolicies
+{
+    PINCacheTestSlowTier *top = [[PINCacheTestSlowTier alloc] initWithName:@"top" latency:0.0];
+    PINCacheTestSlowTier *bottom = [[PINCacheTestSlowTier alloc] initWithName:@"bottom" latency:0.0];
+    PINTieredCache *tieredCache = [[PINTieredCache alloc] initWithName:PINCacheTestName tiers:@[ top, bottom ]];
+
+    [tieredCache setObject:@"through" forKey:@"through"];
+    XCTAssertEqualObjects([top objectForKey:@"through"], @"through");
+    XCTAssertEqualObjects([bottom objectForKey:@"through"], @"through");
+
+    tieredCache.writePolicy = PINTieredCacheWritePolicyWriteBehind;
+    bottom.latency = 0.1;
+    dispatch_semaphore_t semaphore = dispatch_semaphore_create(0);
+    [tieredCache setObjectAsync:@"behind" forKey:@"behind" completion:^(PINTieredCache *cache, NSString *key, id object) {
+        dispatch_semaphore_signal(semaphore);
+    }];
+    XCTAssertEqual(dispatch_semaphore_wait(semaphore, [self timeout]), 0);
+    XCTAssertEqualObjects([top objectForKey:@"behind"], @"behind");
+    XCTAssertEqual(bottom.writeCount, 1, @"the lower tier should still be being written");
+    bottom.latency = 0.0;
+    [self waitForPromotionsToTier:bottom key:@"behind"];
+
+    tieredCache.writePolicy = PINTieredCacheWritePolicyWriteAround;
+    [top setObject:@"stale" forKey:@"around"];
+    [tieredCache setObject:@"around" forKey:@"around"];
+    XCTAssertNil([top objectForKey:@"around"]);
+    XCTAssertEqualObjects([bottom objectForKey:@"around"], @"around");
+
+    [tieredCache removeAllObjectsAsync:^(PINTieredCache *cache) {
+        dispatch_semaphore_signal(semaphore);
+    }];
+    XCTAssertEqual(dispatch_semaphore_wait(semaphore, [self timeout]), 0);
+    XCTAssertFalse([tieredCache containsObjectForKey:@"through"]);
+}
+
+- (void)testTieredCacheParallelProbes
+{
+    // The middle tier is slower than the bottom one, and has the object the bottom one has an older version of.
+    PINCacheTestSlowTier *top = [[PINCacheTestSlowTier alloc] initWithName:@"top" latency:0.0];
+    PINCacheTestSlowTier *middle = [[PINCacheTestSlowTier alloc] initWithName:@"middle" latency:0.0];
+    PINCacheTestSlowTier *bottom = [[PINCacheTestSlowTier alloc] initWithName:@"bottom" latency:0.0];
+    [middle setObject:@"new" forKey:@"key"];
+    [bottom setObject:@"old" forKey:@"key"];
+    [bottom setObject:@"bottom" forKey:@"bottom"];
+    middle.latency = 0.3;
+    bottom.latency = 0.2;
+
+    PINTieredCache *tieredCache = [[PINTieredCache alloc] initWithName:PINCacheTestName tiers:@[ top, middle, bottom ]];
+    tieredCache.promotionPolicy = PINTieredCachePromotionPolicyNone;
+    tieredCache.probesLowerTiersInParallel = YES;
+
+    dispatch_semaphore_t semaphore = dispatch_semaphore_create(0);
+    __block id foundObject = nil;
+    [tieredCache objectForKeyAsync:@"key" completion:^(PINTieredCache *cache, NSString *key, id object) {
+        foundObject = object;
+        dispatch_semaphore_signal(semaphore);
+    }];
+    XCTAssertEqual(dispatch_semaphore_wait(semaphore, [self timeout]), 0);
+    XCTAssertEqualObjects(foundObject, @"new", @"a lower tier answering first shouldn't win over a higher one");
+
+    // Both lower tiers are asked at once, so the miss costs the slowest tier rather than the sum of both.
+    CFAbsoluteTime start = CFAbsoluteTimeGetCurrent();
+    __block BOOL containsObject = NO;
+    [tieredCache containsObjectForKeyAsync:@"bottom" completion:^(BOOL contains) {
+        containsObject = contains;
+        dispatch_semaphore_signal(semaphore);
+    }];
+    XCTAssertEqual(dispatch_semaphore_wait(semaphore, [self timeout]), 0);
+    XCTAssertTrue(containsObject);
+    XCTAssertLessThan(CFAbsoluteTimeGetCurrent() - start, 0.3 + 0.2);
+}
+
+- (void)measureTieredCacheLookupsProbingLowerTiersInParallel:(BOOL)probesLowerTiersInParallel
+{
+    const NSUInteger requestCount = 20;
+    PINCacheTestSlowTier *top = [[PINCacheTestSlowTier alloc] initWithName:@"top" latency:0.0];
+    PINCacheTestSlowTier *middle = [[PINCacheTestSlowTier alloc] initWithName:@"middle" latency:0.005];
+    PINCacheTestSlowTier *bottom = [[PINCacheTestSlowTier alloc] initWithName:@"bottom" latency:0.01];
+    PINTieredCache *tieredCache = [[PINTieredCache alloc] initWithName:PINCacheTestName tiers:@[ top, middle, bottom ]];
+    tieredCache.promotionPolicy = PINTieredCachePromotionPolicyNone;
+    tieredCache.probesLowerTiersInParallel = probesLowerTiersInParallel;
+    for (NSUInteger idx = 0; idx < requestCount; idx++) {
+        [bottom setObject:@(idx) forKey:[@(idx) stringValue]];
+    }
+
+    [self measureBlock:^{
+        dispatch_group_t group = dispatch_group_create();
+        NSLock *lock = [[NSLock alloc] init];
+        __block NSUInteger foundCount = 0;
+        for (NSUInteger idx = 0; idx < requestCount; idx++) {
+            dispatch_group_enter(group);
+            [tieredCache objectForKeyAsync:[@(idx) stringValue] completion:^(PINTieredCache *cache, NSString *key, id object) {
+                if (object) {
+                    [lock lock];
+                    foundCount++;
+                    [lock unlock];
+                }
+                dispatch_group_leave(group);
+            }];
+        }
+        XCTAssertEqual(dispatch_group_wait(group, [self timeout]), 0);
+        XCTAssertEqual(foundCount, requestCount);
+    }];
+}
+
+- (void)testTieredCacheLookupLatency
+{
+    // Lookups that miss the first tier, with the lower tiers probed all at once.
+    [self measureTieredCacheLookupsProbingLowerTiersInParallel:YES];
+}
+
+- (void)testTieredCacheLookupLatencySequential
+{
+    // The baseline, with the lower tiers probed one after the other.
+    [self measureTieredCacheLookupsProbingLowerTiersInParallel:NO];
+}
+
+- (void)testCancellationTokens
+{
+    PINOperationQueue *queue = [[PINOperationQueue alloc] initWithMaxConcurrentOperations:1];
+    PINMemoryCache *memoryCache = [[PINMemoryCache alloc] initWithName:@"testCancellationTokens" operationQueue:queue];
+    memoryCache.statisticsEnabled = YES;
+    [memoryCache setObject:@"value" forKey:@"key"];
+
+    // Holds the queue, so the lookups below are still waiting when they're called off.
+    dispatch_semaphore_t blocker = dispatch_semaphore_create(0);
+    [queue scheduleOperation:^{
+        dispatch_semaphore_wait(blocker, DISPATCH_TIME_FOREVER);
+    }];
+
+    __block BOOL cancelledBlockCalled = NO;
+    __block id expiredObject = @"unset";
+    __block id wantedObject = nil;
+    PINCacheCancellationToken *cancelledToken = [memoryCache objectForKeyAsync:@"key" deadline:nil completion:^(PINMemoryCache *cache, NSString *key, id object) {
+        cancelledBlockCalled = YES;
+    }];
+    [cancelledToken cancel];
+    PINCacheCancellationToken *expiredToken = [memoryCache objectForKeyAsync:@"key" deadline:[NSDate distantPast] completion:^(PINMemoryCache *cache, NSString *key, id object) {
+        expiredObject = object;
+    }];
+    [memoryCache objectForKeyAsync:@"key" deadline:[NSDate dateWithTimeIntervalSinceNow:60.0] completion:^(PINMemoryCache *cache, NSString *key, id object) {
+        wantedObject = object;
+    }];
+    XCTAssertTrue(cancelledToken.cancelled);
+    XCTAssertTrue(expiredToken.expired);
+
+    dispatch_semaphore_signal(blocker);
+    [queue waitUntilAllOperationsAreFinished];
+
+    XCTAssertFalse(cancelledBlockCalled, @"A cancelled lookup shouldn't call its block");
+    XCTAssertNil(expiredObject, @"An expired lookup should be answered as a miss");
+    XCTAssertEqualObjects(wantedObject, @"value", @"A lookup before its deadline should find the object");
+    PINCacheStatistics *statistics = memoryCache.statistics;
+    XCTAssertEqual(statistics.cancelledCount, 1);
+    XCTAssertEqual(statistics.expiredCount, 1);
+    XCTAssertEqual(statistics.hitCount, 1, @"Dropped lookups shouldn't be counted as lookups");
+}
+
+- (void)testCancellationTokenDropsDiskRead
+{
+    self.cache.statisticsEnabled = YES;
+    [self.cache setObject:@"value" forKey:@"key"];
+    [self.cache.memoryCache removeAllObjects];
+
+    dispatch_semaphore_t semaphore = dispatch_semaphore_create(0);
+    __block id expiredObject = @"unset";
+    [self.cache objectForKeyAsync:@"key" deadline:[NSDate distantPast] completion:^(PINCache *cache, NSString *key, id object) {
+        expiredObject = object;
+        dispatch_semaphore_signal(semaphore);
+    }];
+    dispatch_semaphore_wait(semaphore, [self timeout]);
+
+    XCTAssertNil(expiredObject, @"An expired lookup should be answered as a miss");
+    XCTAssertEqual(self.cache.statistics.expiredCount, 1);
+    XCTAssertEqual(self.cache.statistics.missCount, 0, @"Dropped lookups shouldn't be counted as misses");
+    XCTAssertEqual(self.cache.diskCache.statistics.bytesRead, 0, @"A lookup dropped before it started shouldn't read the disk");
+    XCTAssertEqualObjects([self.cache objectForKey:@"key"], @"value", @"A dropped lookup shouldn't be remembered as a miss");
+}
+
+- (void)testCancelledTrimDoesNotNarrowCoalescedTrim
+{
+    PINOperationQueue *queue = [[PINOperationQueue alloc] initWithMaxConcurrentOperations:1];
+    PINDiskCache *diskCache = [[PINDiskCache alloc] initWithName:[[NSUUID UUID] UUIDString]
+                                                          prefix:PINDiskCachePrefix
+                                                        rootPath:NSTemporaryDirectory()
+                                                      serializer:nil
+                                                    deserializer:nil
+                                                      keyEncoder:nil
+                                                      keyDecoder:nil
+                                                  operationQueue:queue];
+    diskCache.statisticsEnabled = YES;
+    [diskCache setObject:@"value" forKey:@"key"];
+
+    // Holds the queue, so the trims below are coalesced into one operation before either runs.
+    dispatch_semaphore_t blocker = dispatch_semaphore_create(0);
+    [queue scheduleOperation:^{
+        dispatch_semaphore_wait(blocker, DISPATCH_TIME_FOREVER);
+    }];
+
+    PINCacheCancellationToken *cancelledToken = [diskCache trimToSizeByEvictionStrategyAsync:0 deadline:nil completion:nil];
+    [cancelledToken cancel];
+    [diskCache trimToSizeByEvictionStrategyAsync:100 * 1024 * 1024 deadline:nil completion:nil];
+
+    dispatch_semaphore_signal(blocker);
+    [queue waitUntilAllOperationsAreFinished];
+
+    XCTAssertEqualObjects([diskCache objectForKey:@"key"], @"value", @"A cancelled trim shouldn't change what the trims coalesced with it do");
+    XCTAssertEqual(diskCache.statistics.cancelledCount, 1, @"Only the cancelled request should be counted");
+    [diskCache removeAllObjects];
+}
+
+- (void)testWorkStealingQueuePriority
+{
+    PINCacheWorkStealingQueue *queue = [[PINCacheWorkStealingQueue alloc] initWithMaxConcurrentOperations:1];
+    dispatch_semaphore_t started = dispatch_semaphore_create(0);
+    dispatch_semaphore_t blocker = dispatch_semaphore_create(0);
+    [queue scheduleOperation:^{
+        dispatch_semaphore_signal(started);
+        dispatch_semaphore_wait(blocker, DISPATCH_TIME_FOREVER);
+    }];
+    dispatch_semaphore_wait(started, [self timeout]);
+
+    // Queued behind the running operation, so they run by priority, and in order within one.
+    NSMutableArray<NSString *> *order = [[NSMutableArray alloc] init];
+    for (NSString *name in @[ @"low", @"default 1", @"high", @"default 2" ]) {
+        PINOperationQueuePriority priority = [name hasPrefix:@"low"] ? PINOperationQueuePriorityLow : ([name hasPrefix:@"high"] ? PINOperationQueuePriorityHigh : PINOperationQueuePriorityDefault);
+        [queue scheduleOperation:^{
+            @synchronized (order) {
+                [order addObject:name];
+            }
+        } withPriority:priority];
+    }
+
+    dispatch_semaphore_signal(blocker);
+    [queue waitUntilAllOperationsAreFinished];
+
+    XCTAssertEqualObjects(order, (@[ @"high", @"default 1", @"default 2", @"low" ]), @"Operations should run by priority, then in the order they were scheduled");
+}
+
+- (void)testWorkStealingQueueThroughput
+{
+    // Many threads scheduling short operations at once, the way a busy memory cache uses its queue.
+    const NSUInteger operationCount = 20000;
+    const NSUInteger producerCount = 8;
+    PINCacheWorkStealingQueue *queue = [[PINCacheWorkStealingQueue alloc] initWithMaxConcurrentOperations:[[NSProcessInfo processInfo] activeProcessorCount]];
+
+    [self measureBlock:^{
+        // The operations have all finished when this returns, so they can count on its stack.
+        atomic_uint ranCount = 0;
+        atomic_uint *ranCountPointer = &ranCount;
+        dispatch_apply(producerCount, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^(size_t producer) {
+            for (NSUInteger idx = 0; idx < operationCount / producerCount; idx++) {
+                [queue scheduleOperation:^{
+                    atomic_fetch_add_explicit(ranCountPointer, 1, memory_order_relaxed);
+                }];
+            }
+        });
+        [queue waitUntilAllOperationsAreFinished];
+        XCTAssertEqual(atomic_load(&ranCount), operationCount, @"Every scheduled operation should run once");
+    }];
+}
+
+- (void)testBinaryCodingRoundTrip
+{
+    NSMutableArray *mutableArray = [@[ @"mutable" ] mutableCopy];
+    NSDictionary *payload = @{ @"string" : @"héllo wörld 👋",
+                               @"empty" : @"",
+                               @"integers" : @[ @0, @-1, @(INT64_MIN), @(INT64_MAX), @(UINT64_MAX) ],
+                               @"floats" : @[ @1.5f, @(M_PI), @(-0.0) ],
+                               @"booleans" : @[ @YES, @NO ],
+                               @"data" : [@"bytes" dataUsingEncoding:NSUTF8StringEncoding],
+                               @"date" : [NSDate dateWithTimeIntervalSinceReferenceDate:123456.789],
+                               @"null" : [NSNull null],
+                               @"nested" : @{ @"array" : mutableArray, @42 : @"number key" } };
+
+    PINDiskCacheSerializerBlock serializer = self.cache.diskCache.serializer;
+    PINDiskCacheDeserializerBlock deserializer = self.cache.diskCache.deserializer;
+    NSData *data = serializer(payload, @"key");
+    XCTAssertTrue(PINCacheIsBinaryEncodedData(data), @"Property lists should get the binary format");
+    NSDictionary *decoded = (NSDictionary *)deserializer(data, @"key");
+    XCTAssertEqualObjects(decoded, payload);
+    XCTAssertTrue([decoded[@"nested"][@"array"] isKindOfClass:[NSMutableArray class]], @"Mutable collections should stay mutable");
+    [decoded[@"nested"][@"array"] addObject:@"added"];
+    XCTAssertEqualObjects(decoded[@"booleans"][0], @YES);
+    XCTAssertEqual(strcmp([decoded[@"floats"][0] objCType], @encode(float)), 0, @"Floats should stay floats");
+
+    // Objects that aren't property lists, and property lists holding them, are archived as before.
+    NSURL *url = [NSURL URLWithString:@"https://www.pinterest.com"];
+    XCTAssertNil(PINCacheBinaryEncodedData(@[ url ]));
+    NSData *archivedData = serializer(@[ url ], @"key");
+    XCTAssertFalse(PINCacheIsBinaryEncodedData(archivedData));
+    XCTAssertEqualObjects(deserializer(archivedData, @"key"), @[ url ]);
+
+    // Objects written before the binary format existed still read.
+    NSData *legacyData = [NSKeyedArchiver archivedDataWithRootObject:payload requiringSecureCoding:NO error:NULL];
+    XCTAssertEqualObjects(deserializer(legacyData, @"key"), payload);
+
+    // Data from a newer version, truncated or with trailing garbage reads as nothing rather than as the wrong thing.
+    NSMutableData *newerData = [data mutableCopy];
+    ((uint8_t *)newerData.mutableBytes)[4] += 1;
+    XCTAssertNil(PINCacheBinaryDecodedObject(newerData));
+    XCTAssertNil(PINCacheBinaryDecodedObject([data subdataWithRange:NSMakeRange(0, data.length - 1)]));
+    NSMutableData *paddedData = [data mutableCopy];
+    [paddedData appendBytes:"x" length:1];
+    XCTAssertNil(PINCacheBinaryDecodedObject(paddedData));
+}
+
+- (void)testBinaryCodingBenchmark
+{
+    // Compares the binary format with NSKeyedArchiver for a typical payload of API responses, and measures its round trip.
+    NSMutableArray *items = [[NSMutableArray alloc] init];
+    for (NSUInteger idx = 0; idx < 100; idx++) {
+        [items addObject:@{ @"id" : [[NSString alloc] initWithFormat:@"%lu", (unsigned long)(1234567890 + idx)],
+                            @"title" : [[NSString alloc] initWithFormat:@"Pin number %lu", (unsigned long)idx],
+                            @"width" : @(736),
+                            @"height" : @(1104 + idx),
+                            @"score" : @(0.5 + idx / 100.0),
+                            @"promoted" : @(idx % 7 == 0),
+                            @"created" : [NSDate dateWithTimeIntervalSinceReferenceDate:idx * 3600.0],
+                            @"thumbnail" : [[NSMutableData alloc] initWithLength:64] }];
+    }
+    NSDictionary *payload = @{ @"items" : items, @"bookmark" : @"Y2JVSG81V2sxcmNHRmlSbndq" };
+    const NSUInteger iterations = 200;
+
+    NSData *binaryData = PINCacheBinaryEncodedData(payload);
+    NSData *archivedData = [NSKeyedArchiver archivedDataWithRootObject:payload requiringSecureCoding:NO error:NULL];
+    XCTAssertNotNil(binaryData);
+    XCTAssertLessThan(binaryData.length, archivedData.length);
+
+    // The binary format has to round trip faster than the archiver it replaces.
+    CFAbsoluteTime start = CFAbsoluteTimeGetCurrent();
+    for (NSUInteger idx = 0; idx < iterations; idx++) {
+        @autoreleasepool {
+            PINCacheBinaryDecodedObject(PINCacheBinaryEncodedData(payload));
+        }
+    }
+    CFAbsoluteTime binaryElapsed = CFAbsoluteTimeGetCurrent() - start;
+
+    start = CFAbsoluteTimeGetCurrent();
+    for (NSUInteger idx = 0; idx < iterations; idx++) {
+        @autoreleasepool {
+            NSData *data = [NSKeyedArchiver archivedDataWithRootObject:payload requiringSecureCoding:NO error:NULL];
+            NSKeyedUnarchiver *unarchiver = [[NSKeyedUnarchiver alloc] initForReadingFromData:data error:NULL];
+            unarchiver.requiresSecureCoding = NO;
+            [unarchiver decodeObjectForKey:NSKeyedArchiveRootObjectKey];
+        }
+    }
+    CFAbsoluteTime archiverElapsed = CFAbsoluteTimeGetCurrent() - start;
+    XCTAssertLessThan(binaryElapsed, archiverElapsed);
+
+    [self measureBlock:^{
+        for (NSUInteger idx = 0; idx < iterations; idx++) {
+            @autoreleasepool {
+                PINCacheBinaryDecodedObject(PINCacheBinaryEncodedData(payload));
+            }
+        }
+    }];
+}
+
+
 
 
 @end